@@ -17,7 +17,7 @@
 /* PUBLIC METHODS **********************************************/
 
 CCell::CCell(
-    _In_ HWND hParent
+    _In_opt_ HWND hParent
     ) :
     CCell(hParent, RECT{0})
 {
@@ -40,7 +40,8 @@ CCell::~CCell()
 }
 
 bool
-CCell::OnPaint(_In_ PAINTSTRUCT &PaintStruct)
+CCell::OnPaint(_In_ PAINTSTRUCT &PaintStruct,
+               _In_ CGlyphAtlas &GlyphAtlas)
 {
     // Check if this cell is in our paint region
     BOOL NeedsPaint; RECT rect;
@@ -75,14 +76,12 @@ CCell::OnPaint(_In_ PAINTSTRUCT &PaintStruct)
                   Internal.bottom);
     }
 
-    int Success;
-    Success = DrawTextW(PaintStruct.hdc,
-                        &m_Char,
-                        1,
-                        &Internal,
-                        DT_CENTER | DT_VCENTER | DT_SINGLELINE);
+    if (m_Char == 0)
+        return true;
 
-    return (Success != 0);
+    // Blit the glyph inside the borders, from the atlas when it's there
+    InflateRect(&Internal, -1, -1);
+    return GlyphAtlas.Draw(PaintStruct.hdc, m_Char, &Internal);
 }
 
 void
@@ -1,4 +1,6 @@
 #pragma once
+#include "GlyphAtlas.h"
+
 class CCell
 {
 private:
@@ -7,11 +9,11 @@ private:
 
     bool m_bHasFocus;
     bool m_bIsLarge;
-    WCHAR m_Char;
+    UINT m_Char;    // code point, 0 for none
 
 public:
     CCell(
-        _In_ HWND hParent
+        _In_opt_ HWND hParent = NULL
         );
 
     CCell(
@@ -23,11 +25,12 @@ public:
 
     LPRECT GetCellCoordinates() { return &m_CellCoordinates; }
     void SetFocus(_In_ bool HasFocus) { m_bHasFocus = HasFocus; }
-    WCHAR GetChar() { return m_Char; }
-    void SetChar(_In_ WCHAR ch) { m_Char = ch; }
+    UINT GetChar() { return m_Char; }
+    void SetChar(_In_ UINT ch) { m_Char = ch; }
 
     bool OnPaint(
-        _In_ PAINTSTRUCT &PaintStruct
+        _In_ PAINTSTRUCT &PaintStruct,
+        _In_ CGlyphAtlas &GlyphAtlas
         );
 
     void SetCellCoordinates(
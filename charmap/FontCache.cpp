@@ -0,0 +1,604 @@
+/*
+* PROJECT:     ReactOS Character Map
+* LICENSE:     GPL - See COPYING in the top level directory
+* FILE:        base/applications/charmap/FontCache.cpp
+* PURPOSE:     Keeps the font list and the font coverages on disk between runs
+*/
+
+
+#include "precomp.h"
+#include "FontCache.h"
+
+
+/* DATA *****************************************************/
+
+#define HEAD_TABLE_TAG      0x64616568  // 'head', as GetFontData wants it
+#define HEAD_TABLE_SIZE     36          // up to and including head.modified
+
+#define CACHE_MAGIC         0x43464D43  // 'CMFC'
+#define CACHE_VERSION       1
+#define CACHE_MAX_SIZE      (64 * 1024 * 1024)
+
+#define CACHE_DIRECTORY     L"\\charmap"
+#define CACHE_FILE_NAME     L"\\fontcache.dat"
+
+// The font tables are big endian
+static inline DWORD ReadULong(const BYTE *p) { return ((DWORD)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+// Bounds checked reads from the cache file
+struct CacheReader
+{
+    const BYTE *Data;
+    DWORD Size;
+    DWORD Pos;
+};
+
+static bool
+ReadBytes(CacheReader& Reader, void *Buffer, DWORD Length)
+{
+    if (Length > Reader.Size - Reader.Pos)
+        return false;
+
+    memcpy(Buffer, Reader.Data + Reader.Pos, Length);
+    Reader.Pos += Length;
+    return true;
+}
+
+static bool
+ReadDword(CacheReader& Reader, DWORD& Value)
+{
+    return ReadBytes(Reader, &Value, sizeof(Value));
+}
+
+static bool
+ReadName(CacheReader& Reader, CAtlStringW& Name)
+{
+    WCHAR Buffer[LF_FACESIZE];
+    DWORD Length;
+
+    if (!ReadDword(Reader, Length) || Length == 0 || Length >= LF_FACESIZE)
+        return false;
+    if (!ReadBytes(Reader, Buffer, Length * sizeof(WCHAR)))
+        return false;
+
+    Buffer[Length] = UNICODE_NULL;
+    Name = Buffer;
+    return (Name.GetLength() == (int)Length);
+}
+
+static void
+WriteBytes(CAtlArray<BYTE>& Buffer, const void *Data, size_t Length)
+{
+    size_t Pos = Buffer.GetCount();
+    Buffer.SetCount(Pos + Length);
+    memcpy(Buffer.GetData() + Pos, Data, Length);
+}
+
+static void
+WriteDword(CAtlArray<BYTE>& Buffer, DWORD Value)
+{
+    WriteBytes(Buffer, &Value, sizeof(Value));
+}
+
+static void
+WriteName(CAtlArray<BYTE>& Buffer, const CAtlStringW& Name)
+{
+    WriteDword(Buffer, Name.GetLength());
+    WriteBytes(Buffer, (LPCWSTR)Name, Name.GetLength() * sizeof(WCHAR));
+}
+
+// Finds where the family is, or where it would go, in a sorted list
+static bool
+FindFamily(const FontFamilyList& Families, LPCWSTR Name, size_t& Pos)
+{
+    size_t Low = 0, High = Families.GetCount();
+
+    while (Low < High)
+    {
+        size_t Mid = (Low + High) / 2;
+        int Result = _wcsicmp(Name, Families[Mid].Name);
+        if (Result == 0)
+        {
+            Pos = Mid;
+            return true;
+        }
+        if (Result < 0)
+            High = Mid;
+        else
+            Low = Mid + 1;
+    }
+
+    Pos = Low;
+    return false;
+}
+
+
+/* PUBLIC METHODS **********************************************/
+
+CFontCache::CFontCache() :
+    m_Dirty(false),
+    m_hThread(NULL),
+    m_hNotify(NULL),
+    m_Revalidated(nullptr)
+{
+}
+
+CFontCache::~CFontCache()
+{
+    WaitForRevalidation();
+    delete m_Revalidated;
+    Clear();
+}
+
+bool
+CFontCache::Load()
+{
+    CAtlStringW Path;
+    if (!GetCacheFilePath(Path, false))
+        return false;
+
+    HANDLE hFile;
+    hFile = CreateFileW(Path,
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    CAtlArray<BYTE> Data;
+    DWORD Size, Read = 0;
+    Size = GetFileSize(hFile, NULL);
+    bool bSuccess = (Size != INVALID_FILE_SIZE && Size <= CACHE_MAX_SIZE);
+    if (bSuccess)
+    {
+        Data.SetCount(Size);
+        bSuccess = (ReadFile(hFile, Data.GetData(), Size, &Read, NULL) && Read == Size);
+    }
+    CloseHandle(hFile);
+    if (!bSuccess)
+        return false;
+
+    Clear();
+
+    CacheReader Reader = { Data.GetData(), Size, 0 };
+    DWORD Magic, Version, NumFamilies = 0, NumFonts = 0;
+    bSuccess = (ReadDword(Reader, Magic) && Magic == CACHE_MAGIC &&
+                ReadDword(Reader, Version) && Version == CACHE_VERSION &&
+                ReadDword(Reader, NumFamilies) &&
+                ReadDword(Reader, NumFonts));
+
+    for (DWORD i = 0; bSuccess && i < NumFamilies; i++)
+    {
+        FontFamilyEntry Family;
+        size_t Pos;
+
+        // The list must come back sorted and without duplicates
+        bSuccess = (ReadDword(Reader, Family.Flags) &&
+                    ReadName(Reader, Family.Name) &&
+                    !FindFamily(m_Families, Family.Name, Pos) &&
+                    Pos == m_Families.GetCount());
+        if (bSuccess)
+            m_Families.Add(Family);
+    }
+
+    CAtlArray<CodepointRange> Ranges;
+    CAtlArray<VariationSequence> Sequences;
+    for (DWORD i = 0; bSuccess && i < NumFonts; i++)
+    {
+        FontCacheEntry *Entry = new FontCacheEntry;
+        DWORD NumRanges, NumSequences;
+
+        bSuccess = (ReadName(Reader, Entry->Name) &&
+                    FindFont(Entry->Name) == nullptr &&
+                    ReadDword(Reader, Entry->Identity.Size) &&
+                    ReadDword(Reader, Entry->Identity.Checksum) &&
+                    ReadBytes(Reader, &Entry->Identity.Modified, sizeof(ULONGLONG)) &&
+                    ReadDword(Reader, NumRanges) &&
+                    ReadDword(Reader, NumSequences));
+
+        // Check the counts against what is left before allocating anything
+        bSuccess = bSuccess &&
+                   NumRanges <= (Reader.Size - Reader.Pos) / (2 * sizeof(DWORD)) &&
+                   NumSequences <= (Reader.Size - Reader.Pos - NumRanges * 2 * sizeof(DWORD)) / (2 * sizeof(DWORD));
+        if (bSuccess)
+        {
+            DWORD First, Last;
+
+            Ranges.SetCount(NumRanges);
+            for (DWORD j = 0; j < NumRanges; j++)
+            {
+                ReadDword(Reader, First);
+                ReadDword(Reader, Last);
+                Ranges[j].First = First;
+                Ranges[j].Last = Last;
+                Ranges[j].Index = 0;
+            }
+
+            Sequences.SetCount(NumSequences);
+            for (DWORD j = 0; j < NumSequences; j++)
+            {
+                ReadDword(Reader, First);
+                ReadDword(Reader, Last);
+                Sequences[j].Base = First;
+                Sequences[j].Selector = Last;
+            }
+
+            bSuccess = Entry->Coverage.Assign(Ranges.GetData(),
+                                              NumRanges,
+                                              Sequences.GetData(),
+                                              NumSequences);
+        }
+
+        if (bSuccess)
+            m_Fonts.Add(Entry);
+        else
+            delete Entry;
+    }
+
+    if (!bSuccess || Reader.Pos != Reader.Size)
+    {
+        // Start over from an empty cache, it will be written again on exit
+        Clear();
+        m_Dirty = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+CFontCache::Save()
+{
+    if (!m_Dirty)
+        return true;
+
+    CAtlArray<BYTE> Data;
+    WriteDword(Data, CACHE_MAGIC);
+    WriteDword(Data, CACHE_VERSION);
+    WriteDword(Data, (DWORD)m_Families.GetCount());
+    WriteDword(Data, (DWORD)m_Fonts.GetCount());
+
+    for (size_t i = 0; i < m_Families.GetCount(); i++)
+    {
+        WriteDword(Data, m_Families[i].Flags);
+        WriteName(Data, m_Families[i].Name);
+    }
+
+    for (size_t i = 0; i < m_Fonts.GetCount(); i++)
+    {
+        FontCacheEntry *Entry = m_Fonts[i];
+        CFontCoverage& Coverage = Entry->Coverage;
+
+        WriteName(Data, Entry->Name);
+        WriteDword(Data, Entry->Identity.Size);
+        WriteDword(Data, Entry->Identity.Checksum);
+        WriteBytes(Data, &Entry->Identity.Modified, sizeof(ULONGLONG));
+        WriteDword(Data, (DWORD)Coverage.GetNumRanges());
+        WriteDword(Data, (DWORD)Coverage.GetNumSequences());
+
+        for (size_t j = 0; j < Coverage.GetNumRanges(); j++)
+        {
+            WriteDword(Data, Coverage.GetRange(j).First);
+            WriteDword(Data, Coverage.GetRange(j).Last);
+        }
+
+        for (size_t j = 0; j < Coverage.GetNumSequences(); j++)
+        {
+            WriteDword(Data, Coverage.GetSequence(j).Base);
+            WriteDword(Data, Coverage.GetSequence(j).Selector);
+        }
+    }
+
+    if (Data.GetCount() > CACHE_MAX_SIZE)
+        return false;
+
+    CAtlStringW Path, TempPath;
+    if (!GetCacheFilePath(Path, true))
+        return false;
+    TempPath = Path + L".tmp";
+
+    // Write a new file next to the old one, then swap them, so a failed write never leaves a broken cache
+    HANDLE hFile;
+    hFile = CreateFileW(TempPath,
+                        GENERIC_WRITE,
+                        0,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD Written = 0;
+    bool bSuccess;
+    bSuccess = (WriteFile(hFile, Data.GetData(), (DWORD)Data.GetCount(), &Written, NULL) &&
+                Written == Data.GetCount());
+    CloseHandle(hFile);
+
+    if (bSuccess)
+        bSuccess = !!MoveFileExW(TempPath, Path, MOVEFILE_REPLACE_EXISTING);
+    if (!bSuccess)
+    {
+        DeleteFileW(TempPath);
+        return false;
+    }
+
+    m_Dirty = false;
+    return true;
+}
+
+// Returns whether the list differs from the one we had
+bool
+CFontCache::SetFamilies(
+    _In_ const FontFamilyList& Families
+    )
+{
+    bool bChanged = (Families.GetCount() != m_Families.GetCount());
+    for (size_t i = 0; !bChanged && i < Families.GetCount(); i++)
+    {
+        bChanged = (Families[i].Flags != m_Families[i].Flags ||
+                    Families[i].Name != m_Families[i].Name);
+    }
+    if (!bChanged)
+        return false;
+
+    m_Families.Copy(Families);
+
+    // Forget the coverage of the fonts which went away
+    size_t i = 0;
+    while (i < m_Fonts.GetCount())
+    {
+        size_t Pos;
+        if (FindFamily(m_Families, m_Fonts[i]->Name, Pos))
+        {
+            i++;
+            continue;
+        }
+
+        delete m_Fonts[i];
+        m_Fonts.RemoveAt(i);
+    }
+
+    m_Dirty = true;
+    return true;
+}
+
+// Enumerates the installed fonts on another thread, hNotify gets WM_FONTLIST_CHANGED when done
+bool
+CFontCache::StartRevalidation(
+    _In_ HWND hNotify
+    )
+{
+    if (m_hThread)
+        return false;
+
+    m_hNotify = hNotify;
+    m_hThread = CreateThread(NULL, 0, RevalidateThread, this, 0, NULL);
+    return (m_hThread != NULL);
+}
+
+// Takes the list the background thread found, returns whether the font list changed
+bool
+CFontCache::ApplyRevalidation()
+{
+    FontFamilyList *Families;
+    Families = (FontFamilyList *)InterlockedExchangePointer((PVOID *)&m_Revalidated, nullptr);
+    if (Families == nullptr)
+        return false;
+
+    WaitForRevalidation();
+
+    bool bChanged;
+    bChanged = SetFamilies(*Families);
+    delete Families;
+
+    return bChanged;
+}
+
+// Finds the characters the font selected in hdc covers, from the cache when it still matches the font
+bool
+CFontCache::GetCoverage(
+    _In_ HDC hdc,
+    _In_ const CAtlStringW& FontName,
+    _Out_ CFontCoverage& Coverage
+    )
+{
+    // Without the TrueType tables, there is nothing telling us the font didn't change
+    FontIdentity Identity;
+    if (!GetFontIdentity(hdc, Identity))
+        return Coverage.Load(hdc);
+
+    FontCacheEntry *Entry;
+    Entry = FindFont(FontName);
+    if (Entry &&
+        Entry->Identity.Size == Identity.Size &&
+        Entry->Identity.Checksum == Identity.Checksum &&
+        Entry->Identity.Modified == Identity.Modified)
+    {
+        Coverage = Entry->Coverage;
+        return true;
+    }
+
+    if (!Coverage.Load(hdc))
+        return false;
+
+    if (Entry == nullptr)
+    {
+        Entry = new FontCacheEntry;
+        Entry->Name = FontName;
+        m_Fonts.Add(Entry);
+    }
+
+    Entry->Identity = Identity;
+    Entry->Coverage = Coverage;
+    m_Dirty = true;
+
+    return true;
+}
+
+bool
+CFontCache::EnumFamilies(
+    _In_ HDC hdc,
+    _Out_ FontFamilyList& Families
+    )
+{
+    Families.RemoveAll();
+
+    // Set the fonts which we want to enumerate
+    LOGFONTW FontsToEnum;
+    ZeroMemory(&FontsToEnum, sizeof(LOGFONTW));
+    FontsToEnum.lfCharSet = DEFAULT_CHARSET;
+
+    int ret;
+    ret = EnumFontFamiliesExW(hdc,
+                              &FontsToEnum,
+                              (FONTENUMPROCW)EnumFamilyProc,
+                              (LPARAM)&Families,
+                              0);
+
+    return (ret == 1);
+}
+
+
+/* PRIVATE METHODS **********************************************/
+
+void
+CFontCache::Clear()
+{
+    m_Families.RemoveAll();
+
+    for (size_t i = 0; i < m_Fonts.GetCount(); i++)
+        delete m_Fonts[i];
+    m_Fonts.RemoveAll();
+}
+
+void
+CFontCache::WaitForRevalidation()
+{
+    if (m_hThread == NULL)
+        return;
+
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = NULL;
+}
+
+FontCacheEntry *
+CFontCache::FindFont(
+    _In_ const CAtlStringW& FontName
+    )
+{
+    for (size_t i = 0; i < m_Fonts.GetCount(); i++)
+    {
+        if (m_Fonts[i]->Name.CompareNoCase(FontName) == 0)
+            return m_Fonts[i];
+    }
+
+    return nullptr;
+}
+
+bool
+CFontCache::GetFontIdentity(
+    _In_ HDC hdc,
+    _Out_ FontIdentity& Identity
+    )
+{
+    BYTE Head[HEAD_TABLE_SIZE];
+
+    Identity.Size = GetFontData(hdc, 0, 0, NULL, 0);
+    if (Identity.Size == GDI_ERROR)
+        return false;
+
+    if (GetFontData(hdc, HEAD_TABLE_TAG, 0, Head, sizeof(Head)) != sizeof(Head))
+        return false;
+
+    Identity.Checksum = ReadULong(Head + 8);
+    Identity.Modified = ((ULONGLONG)ReadULong(Head + 28) << 32) | ReadULong(Head + 32);
+
+    return true;
+}
+
+bool
+CFontCache::GetCacheFilePath(
+    _Out_ CAtlStringW& Path,
+    _In_ bool bCreate
+    )
+{
+    WCHAR szAppData[MAX_PATH];
+
+    if (FAILED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, szAppData)))
+        return false;
+
+    Path = szAppData;
+    Path += CACHE_DIRECTORY;
+    if (bCreate && !CreateDirectoryW(Path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        return false;
+
+    Path += CACHE_FILE_NAME;
+    return true;
+}
+
+DWORD
+WINAPI
+CFontCache::RevalidateThread(
+    _In_ LPVOID Param
+    )
+{
+    CFontCache *This = (CFontCache *)Param;
+
+    // A DC of our own, GDI objects can't be shared with the UI thread
+    HDC hdc;
+    hdc = CreateCompatibleDC(NULL);
+    if (hdc == NULL)
+        return 1;
+
+    FontFamilyList *Families = new FontFamilyList;
+    bool bSuccess;
+    bSuccess = EnumFamilies(hdc, *Families);
+    DeleteDC(hdc);
+
+    if (!bSuccess)
+    {
+        delete Families;
+        return 1;
+    }
+
+    InterlockedExchangePointer((PVOID *)&This->m_Revalidated, Families);
+    PostMessageW(This->m_hNotify, WM_FONTLIST_CHANGED, 0, 0);
+
+    return 0;
+}
+
+int
+CALLBACK
+CFontCache::EnumFamilyProc(ENUMLOGFONTEXW *lpelfe,
+                           NEWTEXTMETRICEXW *lpntme,
+                           DWORD FontType,
+                           LPARAM lParam)
+{
+    FontFamilyList *Families = (FontFamilyList *)lParam;
+    LPWSTR pszName = lpelfe->elfLogFont.lfFaceName;
+
+    /* Skip rotated font */
+    if (pszName[0] == L'@') return 1;
+
+    /* make sure font doesn't already exist in our list */
+    size_t Pos;
+    if (!FindFamily(*Families, pszName, Pos))
+    {
+        FontFamilyEntry Family;
+        Family.Name = pszName;
+
+        /* record the font's attributes (Fixedwidth and Truetype) */
+        BOOL fFixed = (lpelfe->elfLogFont.lfPitchAndFamily & FIXED_PITCH) ? TRUE : FALSE;
+        BOOL fTrueType = (lpelfe->elfLogFont.lfOutPrecision == OUT_STROKE_PRECIS) ? TRUE : FALSE;
+        Family.Flags = MAKEWPARAM(fFixed, fTrueType);
+
+        Families->InsertAt(Pos, Family);
+    }
+
+    return 1;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "FontCoverage.h"
+
+// Posted to the main window when the background enumeration of the installed fonts is done
+#define WM_FONTLIST_CHANGED     (WM_APP + 1)
+
+struct FontFamilyEntry
+{
+    CAtlStringW Name;
+    DWORD Flags;    // MAKEWPARAM(fFixed, fTrueType), as stored in the font combo
+};
+
+typedef CAtlArray<FontFamilyEntry> FontFamilyList;   // sorted, case insensitive
+
+// What tells a font file apart from an older or newer version of it
+struct FontIdentity
+{
+    DWORD Size;         // of the whole font data
+    DWORD Checksum;     // head.checkSumAdjustment
+    ULONGLONG Modified; // head.modified
+};
+
+struct FontCacheEntry
+{
+    CAtlStringW Name;
+    FontIdentity Identity;
+    CFontCoverage Coverage;
+};
+
+class CFontCache
+{
+private:
+    FontFamilyList m_Families;
+    CAtlArray<FontCacheEntry *> m_Fonts;
+    bool m_Dirty;
+
+    HANDLE m_hThread;
+    HWND m_hNotify;
+    FontFamilyList *m_Revalidated;  // handed over by the background thread
+
+public:
+    CFontCache();
+    ~CFontCache();
+
+    bool Load();
+    bool Save();
+
+    size_t GetNumFamilies() { return m_Families.GetCount(); }
+    const FontFamilyEntry& GetFamily(_In_ size_t i) { return m_Families[i]; }
+
+    bool SetFamilies(
+        _In_ const FontFamilyList& Families
+        );
+
+    bool StartRevalidation(
+        _In_ HWND hNotify
+        );
+
+    bool ApplyRevalidation();
+
+    bool GetCoverage(
+        _In_ HDC hdc,
+        _In_ const CAtlStringW& FontName,
+        _Out_ CFontCoverage& Coverage
+        );
+
+    static bool EnumFamilies(
+        _In_ HDC hdc,
+        _Out_ FontFamilyList& Families
+        );
+
+private:
+    void Clear();
+
+    void WaitForRevalidation();
+
+    FontCacheEntry *FindFont(
+        _In_ const CAtlStringW& FontName
+        );
+
+    static bool GetFontIdentity(
+        _In_ HDC hdc,
+        _Out_ FontIdentity& Identity
+        );
+
+    static bool GetCacheFilePath(
+        _Out_ CAtlStringW& Path,
+        _In_ bool bCreate
+        );
+
+    static DWORD WINAPI RevalidateThread(
+        _In_ LPVOID Param
+        );
+
+    static int CALLBACK EnumFamilyProc(
+        ENUMLOGFONTEXW *lpelfe,
+        NEWTEXTMETRICEXW *lpntme,
+        DWORD FontType,
+        LPARAM lParam
+        );
+};
@@ -0,0 +1,545 @@
+/*
+* PROJECT:     ReactOS Character Map
+* LICENSE:     GPL - See COPYING in the top level directory
+* FILE:        base/applications/charmap/FontCoverage.cpp
+* PURPOSE:     Finds the characters a font covers from its cmap table
+*/
+
+
+#include "precomp.h"
+#include "FontCoverage.h"
+
+#include <stdlib.h>
+
+
+/* DATA *****************************************************/
+
+#define CMAP_TABLE_TAG  0x70616D63 // 'cmap', as GetFontData wants it
+
+// cmap subtables we know how to read, best first
+static const struct
+{
+    USHORT PlatformId;
+    USHORT EncodingId;
+    USHORT Format;
+} CmapPreference[] =
+{
+    { 3, 10, 12 },  // Windows, full Unicode
+    { 0, 6, 12 },   // Unicode, full repertoire
+    { 0, 4, 12 },   // Unicode 2.0, full repertoire
+    { 3, 1, 4 },    // Windows, BMP
+    { 0, 3, 4 },    // Unicode 2.0, BMP
+    { 0, 2, 4 },
+    { 0, 1, 4 },
+    { 0, 0, 4 },
+    { 3, 0, 4 },    // Windows, symbol
+};
+
+// The font tables are big endian
+static inline USHORT ReadUShort(const BYTE *p) { return (USHORT)((p[0] << 8) | p[1]); }
+static inline UINT ReadUInt24(const BYTE *p) { return ((UINT)p[0] << 16) | (p[1] << 8) | p[2]; }
+static inline UINT ReadUInt(const BYTE *p) { return ((UINT)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+
+/* PUBLIC METHODS **********************************************/
+
+CFontCoverage::CFontCoverage() :
+    m_NumCodepoints(0)
+{
+}
+
+CFontCoverage::CFontCoverage(_In_ const CFontCoverage& Other) :
+    m_NumCodepoints(0)
+{
+    *this = Other;
+}
+
+CFontCoverage::~CFontCoverage()
+{
+}
+
+CFontCoverage&
+CFontCoverage::operator=(
+    _In_ const CFontCoverage& Other
+    )
+{
+    if (this != &Other)
+    {
+        m_Ranges.Copy(Other.m_Ranges);
+        m_Sequences.Copy(Other.m_Sequences);
+        m_NumCodepoints = Other.m_NumCodepoints;
+    }
+    return *this;
+}
+
+void
+CFontCoverage::Clear()
+{
+    m_Ranges.RemoveAll();
+    m_Sequences.RemoveAll();
+    m_NumCodepoints = 0;
+}
+
+bool
+CFontCoverage::Load(
+    _In_ HDC hdc
+    )
+{
+    Clear();
+
+    // Read the cmap table of the font selected in the DC
+    DWORD Size;
+    Size = GetFontData(hdc, CMAP_TABLE_TAG, 0, NULL, 0);
+    if (Size != GDI_ERROR && Size != 0)
+    {
+        CAtlArray<BYTE> Table;
+        if (Table.SetCount(Size) &&
+            GetFontData(hdc, CMAP_TABLE_TAG, 0, Table.GetData(), Size) == Size &&
+            Parse(Table.GetData(), Size))
+        {
+            return true;
+        }
+    }
+
+    // Not a TrueType / OpenType font, ask GDI about the BMP
+    return LoadFromGlyphIndices(hdc);
+}
+
+bool
+CFontCoverage::Parse(
+    _In_reads_bytes_(Size) const BYTE *Data,
+    _In_ DWORD Size
+    )
+{
+    Clear();
+
+    // Table header, then the encoding records
+    if (Size < 4)
+        return false;
+
+    USHORT NumTables;
+    NumTables = ReadUShort(Data + 2);
+    if (Size < 4 + NumTables * 8u)
+        return false;
+
+    size_t Best = _countof(CmapPreference);
+    DWORD BestOffset = 0;
+    DWORD VariationsOffset = 0;
+
+    for (USHORT i = 0; i < NumTables; i++)
+    {
+        const BYTE *Record = Data + 4 + i * 8;
+        USHORT PlatformId = ReadUShort(Record);
+        USHORT EncodingId = ReadUShort(Record + 2);
+        DWORD Offset = ReadUInt(Record + 4);
+
+        if (Offset > Size - 2)
+            continue;
+
+        USHORT Format = ReadUShort(Data + Offset);
+
+        // Unicode variation sequences
+        if (PlatformId == 0 && EncodingId == 5 && Format == 14)
+        {
+            VariationsOffset = Offset;
+            continue;
+        }
+
+        for (size_t j = 0; j < Best; j++)
+        {
+            if (CmapPreference[j].PlatformId == PlatformId &&
+                CmapPreference[j].EncodingId == EncodingId &&
+                CmapPreference[j].Format == Format)
+            {
+                Best = j;
+                BestOffset = Offset;
+                break;
+            }
+        }
+    }
+
+    if (Best == _countof(CmapPreference))
+        return false;
+
+    bool bSuccess;
+    if (CmapPreference[Best].Format == 12)
+        bSuccess = ParseFormat12(Data + BestOffset, Size - BestOffset);
+    else
+        bSuccess = ParseFormat4(Data + BestOffset, Size - BestOffset);
+
+    if (!bSuccess)
+    {
+        Clear();
+        return false;
+    }
+
+    // Those are a bonus, don't fail without them
+    if (VariationsOffset && !ParseFormat14(Data + VariationsOffset, Size - VariationsOffset))
+        m_Sequences.RemoveAll();
+
+    FinishRanges();
+    return true;
+}
+
+// Ranges and sequences saved from another coverage, e.g. on disk
+bool
+CFontCoverage::Assign(
+    _In_reads_(NumRanges) const CodepointRange *Ranges,
+    _In_ size_t NumRanges,
+    _In_reads_(NumSequences) const VariationSequence *Sequences,
+    _In_ size_t NumSequences
+    )
+{
+    Clear();
+
+    for (size_t i = 0; i < NumRanges; i++)
+    {
+        if (Ranges[i].First > Ranges[i].Last || Ranges[i].Last > MAX_CODEPOINT)
+        {
+            Clear();
+            return false;
+        }
+        AddRange(Ranges[i].First, Ranges[i].Last);
+    }
+
+    for (size_t i = 0; i < NumSequences; i++)
+    {
+        if (Sequences[i].Base > MAX_CODEPOINT || Sequences[i].Selector > MAX_CODEPOINT)
+        {
+            Clear();
+            return false;
+        }
+        m_Sequences.Add(Sequences[i]);
+    }
+
+    FinishRanges();
+    return true;
+}
+
+UINT
+CFontCoverage::GetCodepoint(
+    _In_ UINT Index
+    )
+{
+    if (Index >= m_NumCodepoints)
+        return 0;
+
+    // Find the last range starting at or before Index
+    size_t Low = 0, High = m_Ranges.GetCount();
+    while (High - Low > 1)
+    {
+        size_t Middle = (Low + High) / 2;
+        if (m_Ranges[Middle].Index <= Index)
+            Low = Middle;
+        else
+            High = Middle;
+    }
+
+    return m_Ranges[Low].First + (Index - m_Ranges[Low].Index);
+}
+
+bool
+CFontCoverage::Contains(
+    _In_ UINT Codepoint
+    )
+{
+    size_t Low = 0, High = m_Ranges.GetCount();
+    while (Low < High)
+    {
+        size_t Middle = (Low + High) / 2;
+        if (m_Ranges[Middle].Last < Codepoint)
+            Low = Middle + 1;
+        else if (m_Ranges[Middle].First > Codepoint)
+            High = Middle;
+        else
+            return true;
+    }
+
+    return false;
+}
+
+
+/* PRIVATE METHODS **********************************************/
+
+bool
+CFontCoverage::LoadFromGlyphIndices(
+    _In_ HDC hdc
+    )
+{
+    const int NumChars = 0xFFFF;
+
+    CAtlArray<WCHAR> Chars;
+    CAtlArray<WORD> Glyphs;
+    if (!Chars.SetCount(NumChars) || !Glyphs.SetCount(NumChars))
+        return false;
+
+    for (int i = 0; i < NumChars; i++)
+        Chars[i] = (WCHAR)i;
+
+    if (GetGlyphIndicesW(hdc,
+                         Chars.GetData(),
+                         NumChars,
+                         Glyphs.GetData(),
+                         GGI_MARK_NONEXISTING_GLYPHS) == GDI_ERROR)
+    {
+        return false;
+    }
+
+    // Gather the runs of existing glyphs
+    int First = -1;
+    for (int i = 0; i <= NumChars; i++)
+    {
+        bool Exists = (i < NumChars && Glyphs[i] != 0xFFFF);
+        if (Exists && First < 0)
+        {
+            First = i;
+        }
+        else if (!Exists && First >= 0)
+        {
+            AddRange(First, i - 1);
+            First = -1;
+        }
+    }
+
+    FinishRanges();
+    return true;
+}
+
+// Segment mapping to delta values, the BMP
+bool
+CFontCoverage::ParseFormat4(
+    _In_reads_bytes_(Size) const BYTE *Data,
+    _In_ DWORD Size
+    )
+{
+    if (Size < 14)
+        return false;
+
+    USHORT SegCount = ReadUShort(Data + 6) / 2;
+    DWORD EndCodes = 14;
+    DWORD StartCodes = EndCodes + SegCount * 2 + 2;
+    DWORD IdDeltas = StartCodes + SegCount * 2;
+    DWORD IdRangeOffsets = IdDeltas + SegCount * 2;
+    if (Size < IdRangeOffsets + SegCount * 2)
+        return false;
+
+    for (USHORT i = 0; i < SegCount; i++)
+    {
+        UINT End = ReadUShort(Data + EndCodes + i * 2);
+        UINT Start = ReadUShort(Data + StartCodes + i * 2);
+        USHORT Delta = ReadUShort(Data + IdDeltas + i * 2);
+        DWORD RangeOffset = ReadUShort(Data + IdRangeOffsets + i * 2);
+
+        // The last segment only maps 0xFFFF to the missing glyph
+        if (Start > End || Start == 0xFFFF)
+            continue;
+
+        if (RangeOffset == 0)
+        {
+            // All of them map to a glyph, but the one landing on glyph 0
+            UINT Missing = (0x10000 - Delta) & 0xFFFF;
+            if (Missing < Start || Missing > End)
+            {
+                AddRange(Start, End);
+            }
+            else
+            {
+                if (Missing > Start)
+                    AddRange(Start, Missing - 1);
+                if (Missing < End)
+                    AddRange(Missing + 1, End);
+            }
+            continue;
+        }
+
+        // The glyphs are in glyphIdArray, relative to this idRangeOffset entry
+        DWORD GlyphIds = IdRangeOffsets + i * 2 + RangeOffset;
+        int First = -1;
+        for (UINT c = Start; c <= End + 1; c++)
+        {
+            bool Exists = false;
+            if (c <= End)
+            {
+                DWORD Position = GlyphIds + (c - Start) * 2;
+                if (Position <= Size - 2)
+                {
+                    USHORT Glyph = ReadUShort(Data + Position);
+                    Exists = (Glyph != 0 && ((Glyph + Delta) & 0xFFFF) != 0);
+                }
+            }
+
+            if (Exists && First < 0)
+            {
+                First = (int)c;
+            }
+            else if (!Exists && First >= 0)
+            {
+                AddRange(First, c - 1);
+                First = -1;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Segmented coverage, all the planes
+bool
+CFontCoverage::ParseFormat12(
+    _In_reads_bytes_(Size) const BYTE *Data,
+    _In_ DWORD Size
+    )
+{
+    if (Size < 16)
+        return false;
+
+    DWORD NumGroups = ReadUInt(Data + 12);
+    if (NumGroups > (Size - 16) / 12)
+        return false;
+
+    for (DWORD i = 0; i < NumGroups; i++)
+    {
+        const BYTE *Group = Data + 16 + i * 12;
+        UINT First = ReadUInt(Group);
+        UINT Last = ReadUInt(Group + 4);
+        UINT FirstGlyph = ReadUInt(Group + 8);
+
+        if (First > MAX_CODEPOINT || First > Last)
+            continue;
+
+        // The first one would be the missing glyph
+        if (FirstGlyph == 0 && First++ == Last)
+            continue;
+
+        AddRange(First, min(Last, (UINT)MAX_CODEPOINT));
+    }
+
+    return true;
+}
+
+// Unicode variation sequences
+bool
+CFontCoverage::ParseFormat14(
+    _In_reads_bytes_(Size) const BYTE *Data,
+    _In_ DWORD Size
+    )
+{
+    if (Size < 10)
+        return false;
+
+    DWORD NumRecords = ReadUInt(Data + 6);
+    if (NumRecords > (Size - 10) / 11)
+        return false;
+
+    for (DWORD i = 0; i < NumRecords; i++)
+    {
+        const BYTE *Record = Data + 10 + i * 11;
+        UINT Selector = ReadUInt24(Record);
+        DWORD DefaultOffset = ReadUInt(Record + 3);
+        DWORD NonDefaultOffset = ReadUInt(Record + 7);
+
+        // Sequences drawn with the glyph of the base character
+        if (DefaultOffset && DefaultOffset <= Size - 4)
+        {
+            DWORD NumRanges = ReadUInt(Data + DefaultOffset);
+            if (NumRanges > (Size - DefaultOffset - 4) / 4)
+                return false;
+
+            for (DWORD j = 0; j < NumRanges; j++)
+            {
+                const BYTE *Range = Data + DefaultOffset + 4 + j * 4;
+                UINT Base = ReadUInt24(Range);
+                UINT Count = Range[3];
+
+                for (UINT k = 0; k <= Count && Base + k <= MAX_CODEPOINT; k++)
+                {
+                    VariationSequence Sequence = { Base + k, Selector };
+                    m_Sequences.Add(Sequence);
+                }
+            }
+        }
+
+        // Sequences with a glyph of their own
+        if (NonDefaultOffset && NonDefaultOffset <= Size - 4)
+        {
+            DWORD NumMappings = ReadUInt(Data + NonDefaultOffset);
+            if (NumMappings > (Size - NonDefaultOffset - 4) / 5)
+                return false;
+
+            for (DWORD j = 0; j < NumMappings; j++)
+            {
+                const BYTE *Mapping = Data + NonDefaultOffset + 4 + j * 5;
+                VariationSequence Sequence = { ReadUInt24(Mapping), Selector };
+                m_Sequences.Add(Sequence);
+            }
+        }
+    }
+
+    return true;
+}
+
+void
+CFontCoverage::AddRange(
+    _In_ UINT First,
+    _In_ UINT Last
+    )
+{
+    CodepointRange Range = { First, Last, 0 };
+    m_Ranges.Add(Range);
+}
+
+static int __cdecl
+CompareRanges(const void *p1, const void *p2)
+{
+    const CodepointRange *r1 = (const CodepointRange *)p1;
+    const CodepointRange *r2 = (const CodepointRange *)p2;
+
+    if (r1->First != r2->First)
+        return (r1->First < r2->First) ? -1 : 1;
+    return 0;
+}
+
+static int __cdecl
+CompareSequences(const void *p1, const void *p2)
+{
+    const VariationSequence *s1 = (const VariationSequence *)p1;
+    const VariationSequence *s2 = (const VariationSequence *)p2;
+
+    if (s1->Base != s2->Base)
+        return (s1->Base < s2->Base) ? -1 : 1;
+    if (s1->Selector != s2->Selector)
+        return (s1->Selector < s2->Selector) ? -1 : 1;
+    return 0;
+}
+
+void
+CFontCoverage::FinishRanges()
+{
+    size_t Count = m_Ranges.GetCount();
+
+    // Sort them, then merge the ones which overlap or touch
+    qsort(m_Ranges.GetData(), Count, sizeof(CodepointRange), CompareRanges);
+
+    size_t j = 0;
+    for (size_t i = 0; i < Count; i++)
+    {
+        if (j > 0 && m_Ranges[i].First <= m_Ranges[j - 1].Last + 1)
+        {
+            m_Ranges[j - 1].Last = max(m_Ranges[j - 1].Last, m_Ranges[i].Last);
+        }
+        else
+        {
+            m_Ranges[j++] = m_Ranges[i];
+        }
+    }
+    m_Ranges.SetCount(j);
+
+    m_NumCodepoints = 0;
+    for (size_t i = 0; i < j; i++)
+    {
+        m_Ranges[i].Index = m_NumCodepoints;
+        m_NumCodepoints += m_Ranges[i].Last - m_Ranges[i].First + 1;
+    }
+
+    qsort(m_Sequences.GetData(), m_Sequences.GetCount(), sizeof(VariationSequence), CompareSequences);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#define MAX_CODEPOINT   0x10FFFF
+
+struct CodepointRange
+{
+    UINT First;
+    UINT Last;
+    UINT Index;     // position of First among all the covered code points
+};
+
+struct VariationSequence
+{
+    UINT Base;
+    UINT Selector;
+};
+
+class CFontCoverage
+{
+private:
+    CAtlArray<CodepointRange> m_Ranges;         // sorted, not touching each other
+    CAtlArray<VariationSequence> m_Sequences;   // sorted
+    UINT m_NumCodepoints;
+
+public:
+    CFontCoverage();
+    CFontCoverage(_In_ const CFontCoverage& Other);
+    ~CFontCoverage();
+
+    CFontCoverage& operator=(
+        _In_ const CFontCoverage& Other
+        );
+
+    bool Load(
+        _In_ HDC hdc
+        );
+
+    bool Parse(
+        _In_reads_bytes_(Size) const BYTE *Data,
+        _In_ DWORD Size
+        );
+
+    void Clear();
+
+    bool Assign(
+        _In_reads_(NumRanges) const CodepointRange *Ranges,
+        _In_ size_t NumRanges,
+        _In_reads_(NumSequences) const VariationSequence *Sequences,
+        _In_ size_t NumSequences
+        );
+
+    UINT GetCount() { return m_NumCodepoints; }
+    size_t GetNumRanges() { return m_Ranges.GetCount(); }
+    const CodepointRange& GetRange(_In_ size_t i) { return m_Ranges[i]; }
+    size_t GetNumSequences() { return m_Sequences.GetCount(); }
+    const VariationSequence& GetSequence(_In_ size_t i) { return m_Sequences[i]; }
+
+    UINT GetCodepoint(
+        _In_ UINT Index
+        );
+
+    bool Contains(
+        _In_ UINT Codepoint
+        );
+
+private:
+    bool LoadFromGlyphIndices(
+        _In_ HDC hdc
+        );
+
+    bool ParseFormat4(
+        _In_reads_bytes_(Size) const BYTE *Data,
+        _In_ DWORD Size
+        );
+
+    bool ParseFormat12(
+        _In_reads_bytes_(Size) const BYTE *Data,
+        _In_ DWORD Size
+        );
+
+    bool ParseFormat14(
+        _In_reads_bytes_(Size) const BYTE *Data,
+        _In_ DWORD Size
+        );
+
+    void AddRange(
+        _In_ UINT First,
+        _In_ UINT Last
+        );
+
+    void FinishRanges();
+};
@@ -0,0 +1,305 @@
+/*
+* PROJECT:     ReactOS Character Map
+* LICENSE:     GPL - See COPYING in the top level directory
+* FILE:        base/applications/charmap/GlyphAtlas.cpp
+* PURPOSE:     Cache of rendered glyphs the grid cells are blitted from
+*/
+
+
+#include "precomp.h"
+#include "GlyphAtlas.h"
+
+
+/* DATA *****************************************************/
+
+#define GLYPH_TEXT_FORMAT   (DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX)
+
+
+/* PUBLIC METHODS **********************************************/
+
+CGlyphAtlas::CGlyphAtlas() :
+    m_hFont(NULL),
+    m_MaxPages(0),
+    m_ClockHand(0),
+    m_Frame(0),
+    m_PendingHead(0)
+{
+    m_SlotSize.cx = 0;
+    m_SlotSize.cy = 0;
+}
+
+CGlyphAtlas::~CGlyphAtlas()
+{
+    Clear();
+}
+
+// Drops all the glyphs, and renders the next ones with hFont in cells of SlotSize
+void
+CGlyphAtlas::Reset(
+    _In_opt_ HFONT hFont,
+    _In_ SIZE SlotSize
+    )
+{
+    Clear();
+
+    if (hFont == NULL || SlotSize.cx <= 0 || SlotSize.cy <= 0)
+        return;
+
+    m_hFont = hFont;
+    m_SlotSize = SlotSize;
+
+    // Big cells get fewer pages
+    size_t PageBytes;
+    PageBytes = (size_t)SlotSize.cx * ATLAS_PAGE_COLUMNS * SlotSize.cy * ATLAS_PAGE_ROWS * 4;
+    m_MaxPages = max((size_t)1, min((size_t)ATLAS_MAX_PAGES, ATLAS_MAX_BYTES / PageBytes));
+}
+
+// Releases the pages, which must happen before the font gets deleted
+void
+CGlyphAtlas::Clear()
+{
+    for (size_t i = 0; i < m_Pages.GetCount(); i++)
+    {
+        SelectObject(m_Pages[i].hdc, m_Pages[i].hOldFont);
+        SelectObject(m_Pages[i].hdc, m_Pages[i].hOldBitmap);
+        DeleteObject(m_Pages[i].hBitmap);
+        DeleteDC(m_Pages[i].hdc);
+    }
+    m_Pages.RemoveAll();
+
+    m_Slots.RemoveAll();
+    m_Lookup.RemoveAll();
+    m_ClockHand = 0;
+
+    m_Pending.RemoveAll();
+    m_Queued.RemoveAll();
+    m_PendingHead = 0;
+
+    m_hFont = NULL;
+    m_SlotSize.cx = 0;
+    m_SlotSize.cy = 0;
+    m_MaxPages = 0;
+}
+
+// Draws the glyph in Rect, which is the size of a slot. Glyphs we don't have yet
+// are drawn with the font selected in hdc, and queued for rendering into the atlas
+bool
+CGlyphAtlas::Draw(
+    _In_ HDC hdc,
+    _In_ UINT Codepoint,
+    _In_ LPRECT Rect
+    )
+{
+    size_t Slot;
+    if (m_Lookup.Lookup(Codepoint, Slot))
+    {
+        AtlasPage *Page;
+        POINT Origin;
+        GetSlotOrigin(Slot, Page, Origin);
+        m_Slots[Slot].LastFrame = m_Frame;
+        m_Slots[Slot].Referenced = true;
+
+        return !!BitBlt(hdc,
+                        Rect->left, Rect->top,
+                        m_SlotSize.cx, m_SlotSize.cy,
+                        Page->hdc,
+                        Origin.x, Origin.y,
+                        SRCCOPY);
+    }
+
+    Request(Codepoint);
+
+    WCHAR Text[2];
+    int Length;
+    Length = GetText(Codepoint, Text);
+    if (Length == 0)
+        return true;
+
+    return (DrawTextW(hdc, Text, Length, Rect, GLYPH_TEXT_FORMAT) != 0);
+}
+
+void
+CGlyphAtlas::Request(
+    _In_ UINT Codepoint
+    )
+{
+    if (m_hFont == NULL || Codepoint == 0)
+        return;
+
+    // Already rendered or on the way
+    size_t Slot;
+    bool Queued;
+    if (m_Lookup.Lookup(Codepoint, Slot) || m_Queued.Lookup(Codepoint, Queued))
+        return;
+
+    if (m_Pending.GetCount() - m_PendingHead >= ATLAS_MAX_PENDING)
+        return;
+
+    m_Pending.Add(Codepoint);
+    m_Queued.SetAt(Codepoint, true);
+}
+
+// Renders up to MaxGlyphs of the queued glyphs, oldest requests first
+UINT
+CGlyphAtlas::RasterizePending(
+    _In_ UINT MaxGlyphs
+    )
+{
+    UINT Count = 0;
+
+    while (Count < MaxGlyphs && HasPending())
+    {
+        UINT Codepoint = m_Pending[m_PendingHead++];
+        m_Queued.RemoveKey(Codepoint);
+
+        // When the atlas is full of glyphs on screen, the rest can't go anywhere
+        size_t Slot;
+        if (!AllocateSlot(Slot))
+        {
+            m_Pending.RemoveAll();
+            m_Queued.RemoveAll();
+            m_PendingHead = 0;
+            break;
+        }
+
+        AtlasPage *Page;
+        POINT Origin;
+        GetSlotOrigin(Slot, Page, Origin);
+
+        RECT Rect = { Origin.x, Origin.y, Origin.x + m_SlotSize.cx, Origin.y + m_SlotSize.cy };
+        FillRect(Page->hdc, &Rect, (HBRUSH)GetStockObject(WHITE_BRUSH));
+
+        WCHAR Text[2];
+        int Length;
+        Length = GetText(Codepoint, Text);
+        DrawTextW(Page->hdc, Text, Length, &Rect, GLYPH_TEXT_FORMAT);
+
+        m_Slots[Slot].Codepoint = Codepoint;
+        m_Slots[Slot].LastFrame = m_Frame;
+        m_Slots[Slot].Referenced = false;
+        m_Lookup.SetAt(Codepoint, Slot);
+        Count++;
+    }
+
+    if (!HasPending())
+    {
+        m_Pending.RemoveAll();
+        m_PendingHead = 0;
+    }
+
+    return Count;
+}
+
+// Characters outside the BMP take a surrogate pair
+int
+CGlyphAtlas::GetText(
+    _In_ UINT Codepoint,
+    _Out_writes_(2) WCHAR *Text
+    )
+{
+    int Length = 0;
+
+    if (Codepoint > 0xFFFF)
+    {
+        Text[Length++] = (WCHAR)(0xD800 + ((Codepoint - 0x10000) >> 10));
+        Text[Length++] = (WCHAR)(0xDC00 + ((Codepoint - 0x10000) & 0x3FF));
+    }
+    else if (Codepoint != 0)
+    {
+        Text[Length++] = (WCHAR)Codepoint;
+    }
+
+    return Length;
+}
+
+
+/* PRIVATE METHODS **********************************************/
+
+// Finds room for one more glyph, pushing out one which wasn't drawn lately once the atlas is full.
+// The glyphs of the current frame are never pushed out
+bool
+CGlyphAtlas::AllocateSlot(
+    _Out_ size_t& Slot
+    )
+{
+    if (m_Slots.GetCount() == m_Pages.GetCount() * ATLAS_PAGE_SLOTS &&
+        m_Pages.GetCount() < m_MaxPages)
+    {
+        AddPage();
+    }
+
+    if (m_Slots.GetCount() < m_Pages.GetCount() * ATLAS_PAGE_SLOTS)
+    {
+        GlyphSlot NewSlot = { 0, m_Frame, false };
+        Slot = m_Slots.Add(NewSlot);
+        return true;
+    }
+
+    if (m_Slots.GetCount() == 0)
+        return false;
+
+    // Second chance for the glyphs drawn since the hand last passed them
+    for (size_t i = 0; i < 2 * m_Slots.GetCount(); i++)
+    {
+        GlyphSlot& Victim = m_Slots[m_ClockHand];
+        Slot = m_ClockHand;
+        m_ClockHand = (m_ClockHand + 1) % m_Slots.GetCount();
+
+        if (Victim.LastFrame == m_Frame)
+            continue;
+
+        if (!Victim.Referenced)
+        {
+            m_Lookup.RemoveKey(Victim.Codepoint);
+            return true;
+        }
+        Victim.Referenced = false;
+    }
+
+    return false;
+}
+
+bool
+CGlyphAtlas::AddPage()
+{
+    AtlasPage Page;
+
+    HDC hdcScreen;
+    hdcScreen = GetDC(NULL);
+    if (hdcScreen == NULL)
+        return false;
+
+    Page.hdc = CreateCompatibleDC(hdcScreen);
+    Page.hBitmap = CreateCompatibleBitmap(hdcScreen,
+                                          m_SlotSize.cx * ATLAS_PAGE_COLUMNS,
+                                          m_SlotSize.cy * ATLAS_PAGE_ROWS);
+    ReleaseDC(NULL, hdcScreen);
+
+    if (Page.hdc == NULL || Page.hBitmap == NULL)
+    {
+        if (Page.hBitmap) DeleteObject(Page.hBitmap);
+        if (Page.hdc) DeleteDC(Page.hdc);
+        return false;
+    }
+
+    // The font stays selected until the atlas is cleared
+    Page.hOldBitmap = SelectObject(Page.hdc, Page.hBitmap);
+    Page.hOldFont = SelectObject(Page.hdc, m_hFont);
+
+    m_Pages.Add(Page);
+    return true;
+}
+
+void
+CGlyphAtlas::GetSlotOrigin(
+    _In_ size_t Slot,
+    _Out_ AtlasPage*& Page,
+    _Out_ POINT& Origin
+    )
+{
+    size_t Index = Slot % ATLAS_PAGE_SLOTS;
+
+    Page = &m_Pages[Slot / ATLAS_PAGE_SLOTS];
+    Origin.x = (LONG)(Index % ATLAS_PAGE_COLUMNS) * m_SlotSize.cx;
+    Origin.y = (LONG)(Index / ATLAS_PAGE_COLUMNS) * m_SlotSize.cy;
+}
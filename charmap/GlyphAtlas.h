@@ -0,0 +1,89 @@
+#pragma once
+
+#define ATLAS_PAGE_COLUMNS  16
+#define ATLAS_PAGE_ROWS     16
+#define ATLAS_PAGE_SLOTS    (ATLAS_PAGE_COLUMNS * ATLAS_PAGE_ROWS)
+#define ATLAS_MAX_PAGES     16
+#define ATLAS_MAX_BYTES     (32 * 1024 * 1024)  // all the pages together, at 32 bits per pixel
+#define ATLAS_MAX_PENDING   1024
+
+// The glyphs of one font at one size, rendered once and blitted from then on
+class CGlyphAtlas
+{
+private:
+    struct AtlasPage
+    {
+        HDC hdc;
+        HBITMAP hBitmap;
+        HGDIOBJ hOldBitmap;
+        HGDIOBJ hOldFont;
+    };
+
+    struct GlyphSlot
+    {
+        UINT Codepoint;
+        UINT LastFrame;     // last paint it was drawn or rendered in
+        bool Referenced;    // drawn since the clock hand last passed
+    };
+
+    HFONT m_hFont;
+    SIZE m_SlotSize;
+    size_t m_MaxPages;
+
+    CAtlArray<AtlasPage> m_Pages;
+    CAtlArray<GlyphSlot> m_Slots;
+    CAtlMap<UINT, size_t> m_Lookup;     // code point to slot
+    size_t m_ClockHand;
+    UINT m_Frame;
+
+    CAtlArray<UINT> m_Pending;
+    CAtlMap<UINT, bool> m_Queued;
+    size_t m_PendingHead;
+
+public:
+    CGlyphAtlas();
+    ~CGlyphAtlas();
+
+    void Reset(
+        _In_opt_ HFONT hFont,
+        _In_ SIZE SlotSize
+        );
+
+    void Clear();
+
+    void NextFrame() { m_Frame++; }
+
+    bool Draw(
+        _In_ HDC hdc,
+        _In_ UINT Codepoint,
+        _In_ LPRECT Rect
+        );
+
+    void Request(
+        _In_ UINT Codepoint
+        );
+
+    bool HasPending() { return m_PendingHead < m_Pending.GetCount(); }
+
+    UINT RasterizePending(
+        _In_ UINT MaxGlyphs
+        );
+
+    static int GetText(
+        _In_ UINT Codepoint,
+        _Out_writes_(2) WCHAR *Text
+        );
+
+private:
+    bool AllocateSlot(
+        _Out_ size_t& Slot
+        );
+
+    bool AddPage();
+
+    void GetSlotOrigin(
+        _In_ size_t Slot,
+        _Out_ AtlasPage*& Page,
+        _Out_ POINT& Origin
+        );
+};
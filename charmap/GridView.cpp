@@ -10,22 +10,34 @@
 #include "precomp.h"
 #include "GridView.h"
 #include "Cell.h"
+#include "FontCoverage.h"
+#include "FontCache.h"
+#include "UnicodeNames.h"
 
 
 /* DATA *****************************************************/
 
 extern HINSTANCE g_hInstance;
 
+#define IDT_RASTERIZE       1
+#define GLYPH_BATCH_SIZE    64  // glyphs rendered into the atlas per timer tick
+
 
 /* PUBLIC METHODS **********************************************/
 
 CGridView::CGridView() :
     m_xNumCells(20),
     m_yNumCells(10),
+    m_ActiveCell(nullptr),
     m_ScrollPosition(0),
-    m_NumRows(0)
+    m_NumRows(0),
+    m_FontCache(nullptr),
+    m_PrefetchPosition(-1),
+    m_bRasterizing(false),
+    m_bSearching(false)
 {
     m_szMapWndClass = L"CharGridWClass";
+    m_CurrentFont.hFont = NULL;
 }
 
 CGridView::~CGridView()
@@ -91,52 +103,32 @@ CGridView::SetFont(
         return false;
     }
 
-    // Setup an array of all possible non-BMP indices
-    WCHAR ch[MAX_GLYPHS];
-    for (int i = 0; i < MAX_GLYPHS; i++)
-        ch[i] = (WCHAR)i;
-
     HFONT hOldFont;
     hOldFont = (HFONT)SelectObject(hdc, NewFont.hFont);
 
-    // Translate all the indices into glyphs
-    WORD out[MAX_GLYPHS];
-    DWORD Status;
-    Status = GetGlyphIndicesW(hdc,
-                              ch,
-                              MAX_GLYPHS,
-                              out,
-                              GGI_MARK_NONEXISTING_GLYPHS);
+    // Find the characters the font covers, from its cmap table or the cache
+    bool bSuccess;
+    if (m_FontCache)
+        bSuccess = m_FontCache->GetCoverage(hdc, FontName, NewFont.Coverage);
+    else
+        bSuccess = NewFont.Coverage.Load(hdc);
+    SelectObject(hdc, hOldFont);
     ReleaseDC(m_hwnd, hdc);
-    if (Status == GDI_ERROR)
+    if (!bSuccess)
     {
-        SelectObject(hdc, hOldFont);
+        DeleteObject(NewFont.hFont);
         return false;
     }
 
-    // Loop all the glyphs looking for valid ones
-    // and store those in our font data
-    int j = 0;
-    for (int i = 0; i < MAX_GLYPHS; i++)
-    {
-        if (out[i] != 0xffff)
-        {
-            NewFont.ValidGlyphs[j] = ch[i];
-            j++;
-        }
-    }
-    NewFont.NumValidGlyphs = j;
-
-    // Calculate the number of rows required to hold all glyphs
-    m_NumRows = NewFont.NumValidGlyphs / m_xNumCells;
-    if (NewFont.NumValidGlyphs % m_xNumCells)
-        m_NumRows += 1;
-
-    // Set the scrollbar in relation to the rows
-    SetScrollRange(m_hwnd, SB_VERT, 0, m_NumRows - m_yNumCells, FALSE);
-
     // We're done, update the current font
     m_CurrentFont = NewFont;
+    ResetGlyphAtlas();
+
+    // Look for what the user searched for in the new font
+    if (m_bSearching)
+        m_Search.Search(m_CurrentFont.Coverage, m_SearchResults);
+
+    UpdateScrollRange();
 
     // We changed the font, we'll need to repaint the whole window
     InvalidateRect(m_hwnd,
@@ -146,10 +138,71 @@ CGridView::SetFont(
     return true;
 }
 
+// Shows only the characters matching the query, or all of them when it's empty
+bool
+CGridView::SetSearch(
+    _In_z_ LPCWSTR Query
+    )
+{
+    m_bSearching = m_Search.SetQuery(Query);
+    if (m_bSearching)
+        m_Search.Search(m_CurrentFont.Coverage, m_SearchResults);
+    else
+        m_SearchResults.RemoveAll();
+
+    // Start again from the top
+    m_ScrollPosition = 0;
+    SetScrollPos(m_hwnd, SB_VERT, 0, FALSE);
+    m_PrefetchPosition = -1;
+
+    UpdateScrollRange();
+
+    InvalidateRect(m_hwnd,
+                   NULL,
+                   TRUE);
+
+    return m_bSearching;
+}
+
 
 
 /* PRIVATE METHODS **********************************************/
 
+UINT
+CGridView::GetNumCodepoints(
+    )
+{
+    if (m_bSearching)
+        return (UINT)m_SearchResults.GetCount();
+
+    return m_CurrentFont.Coverage.GetCount();
+}
+
+// The character in the Index-th cell from the top of the grid, 0 past the last one
+UINT
+CGridView::GetCodepoint(
+    _In_ UINT Index
+    )
+{
+    if (m_bSearching)
+        return (Index < m_SearchResults.GetCount()) ? m_SearchResults[Index] : 0;
+
+    return m_CurrentFont.Coverage.GetCodepoint(Index);
+}
+
+void
+CGridView::UpdateScrollRange(
+    )
+{
+    // Calculate the number of rows required to hold all glyphs
+    m_NumRows = GetNumCodepoints() / m_xNumCells;
+    if (GetNumCodepoints() % m_xNumCells)
+        m_NumRows += 1;
+
+    // Set the scrollbar in relation to the rows
+    SetScrollRange(m_hwnd, SB_VERT, 0, m_NumRows - m_yNumCells, FALSE);
+}
+
 bool
 CGridView::UpdateCellCoordinates(
     )
@@ -165,7 +218,7 @@ CGridView::UpdateCellCoordinates(
         CellCoordinates.right = (x + 1) * m_CellSize.cx + 1;
         CellCoordinates.bottom = (y + 1) * m_CellSize.cy + 1;
 
-        m_Cells[y][x]->SetCellCoordinates(CellCoordinates);
+        GetCell(x, y).SetCellCoordinates(CellCoordinates);
     }
 
     return true;
@@ -180,20 +233,13 @@ CGridView::OnCreate(
     m_hwnd = hwnd;
     m_hParent = hParent;
 
-    // C++ doesn't allow : "CCells ***C = new CCell***[x * y]"
-    // so we have to build the 2d array up manually
-    m_Cells = new CCell**[m_yNumCells]; // rows
-    for (int i = 0; i < m_yNumCells; i++)
-        m_Cells[i] = new CCell*[m_xNumCells]; // columns
-
-    for (int y = 0; y < m_yNumCells; y++)
-    for (int x = 0; x < m_xNumCells; x++)
-    {
-        m_Cells[y][x] = new CCell(m_hwnd);
-    }
+    // All the cells live in one block, row after row
+    m_Cells.SetCount(m_xNumCells * m_yNumCells);
+    for (size_t i = 0; i < m_Cells.GetCount(); i++)
+        m_Cells[i] = CCell(m_hwnd);
 
     // Give the first cell focus
-    SetCellFocus(m_Cells[0][0]);
+    SetCellFocus(&GetCell(0, 0));
 
     return 0;
 }
@@ -238,7 +284,8 @@ CGridView::OnSize(
     // We scale the font size up or down depending on the cell size
     if (m_CurrentFont.hFont)
     {
-        // Delete the existing font
+        // Delete the existing font, once the atlas let go of it
+        m_GlyphAtlas.Clear();
         DeleteObject(m_CurrentFont.hFont);
 
         HDC hdc;
@@ -252,6 +299,9 @@ CGridView::OnSize(
         }
     }
 
+    // The glyphs have to be rendered again at the new size
+    ResetGlyphAtlas();
+
     // Redraw the whole grid
     InvalidateRect(m_hwnd, &ClientRect, TRUE);
 
@@ -441,8 +491,17 @@ CGridView::MapWndProc(
         break;
     }
 
+    case WM_TIMER:
+    {
+        if (wParam == IDT_RASTERIZE)
+            This->OnRasterizeTimer();
+        break;
+    }
+
     case WM_DESTROY:
     {
+        KillTimer(hwnd, IDT_RASTERIZE);
+        This->m_GlyphAtlas.Clear();
         This->DeleteCells();
         break;
     }
@@ -468,6 +527,9 @@ CGridView::DrawGrid(
     int i;
     i = m_xNumCells * m_ScrollPosition;
 
+    // The glyphs drawn from here on stay in the atlas at least until the next paint
+    m_GlyphAtlas.NextFrame();
+
     // Make sure we have the correct font on the DC
     HFONT hOldFont;
     hOldFont = (HFONT)SelectFont(PaintStruct->hdc,
@@ -477,31 +539,84 @@ CGridView::DrawGrid(
     for (int y = 0; y < m_yNumCells; y++)
     for (int x = 0; x < m_xNumCells; x++)
     {
-        // Update the glyph for this cell
-        WCHAR ch = (WCHAR)m_CurrentFont.ValidGlyphs[i];
-        m_Cells[y][x]->SetChar(ch);
+        // Update the glyph for this cell (none past the last one)
+        UINT ch = GetCodepoint(i);
+        GetCell(x, y).SetChar(ch);
 
         // Tell it to paint itself
-        m_Cells[y][x]->OnPaint(*PaintStruct);
+        GetCell(x, y).OnPaint(*PaintStruct, m_GlyphAtlas);
         i++;
     }
 
     SelectObject(PaintStruct->hdc, hOldFont);
 
+    // Render the glyphs which weren't in the atlas after we're done painting
+    StartRasterizing();
 }
 
 void
 CGridView::DeleteCells()
 {
-    if (m_Cells == nullptr)
+    m_ActiveCell = nullptr;
+    m_Cells.RemoveAll();
+}
+
+void
+CGridView::ResetGlyphAtlas(
+    )
+{
+    // The glyph goes inside the cell borders
+    SIZE SlotSize;
+    SlotSize.cx = m_CellSize.cx - 3;
+    SlotSize.cy = m_CellSize.cy - 3;
+
+    m_GlyphAtlas.Reset(m_CurrentFont.hFont, SlotSize);
+    m_PrefetchPosition = -1;
+}
+
+void
+CGridView::StartRasterizing(
+    )
+{
+    if (m_bRasterizing)
         return;
 
-    // Free cells withing the 2d array
-    for (int i = 0; i < m_yNumCells; i++)
-        delete[] m_Cells[i];
-    delete[] m_Cells;
+    if (!m_GlyphAtlas.HasPending() && m_PrefetchPosition == m_ScrollPosition)
+        return;
+
+    // WM_TIMER only comes when the queue is empty, so this never holds up painting or input
+    if (SetTimer(m_hwnd, IDT_RASTERIZE, USER_TIMER_MINIMUM, NULL))
+        m_bRasterizing = true;
+}
+
+VOID
+CGridView::OnRasterizeTimer(
+    )
+{
+    // Once the glyphs on screen are done, get the pages above and below ready for scrolling
+    if (!m_GlyphAtlas.HasPending() && m_PrefetchPosition != m_ScrollPosition)
+    {
+        m_PrefetchPosition = m_ScrollPosition;
+
+        INT First, Last;
+        First = max(0, m_ScrollPosition - m_yNumCells) * m_xNumCells;
+        Last = (m_ScrollPosition + 2 * m_yNumCells) * m_xNumCells;
+        for (INT i = First; i < Last; i++)
+        {
+            UINT ch = GetCodepoint(i);
+            if (ch == 0) break;
+            m_GlyphAtlas.Request(ch);
+        }
+    }
+
+    if (!m_GlyphAtlas.HasPending())
+    {
+        KillTimer(m_hwnd, IDT_RASTERIZE);
+        m_bRasterizing = false;
+        return;
+    }
 
-    m_Cells = nullptr;
+    m_GlyphAtlas.RasterizePending(GLYPH_BATCH_SIZE);
 }
 
 void
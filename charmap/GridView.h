@@ -1,15 +1,17 @@
 #pragma once
 #include "Cell.h"
+#include "FontCoverage.h"
+#include "GlyphAtlas.h"
+#include "UnicodeNames.h"
 
-#define MAX_GLYPHS 0xFFFF
+class CFontCache;
 
 struct CurrentFont
 {
     CAtlStringW FontName;
     LOGFONTW Font;
     HFONT hFont;
-    USHORT ValidGlyphs[MAX_GLYPHS];
-    USHORT NumValidGlyphs;
+    CFontCoverage Coverage; // the characters the font has a glyph for
 };
 
 
@@ -26,13 +28,22 @@ private:
 
     RECT m_ClientCoordinates;
     SIZE m_CellSize;
-    CCell*** m_Cells; // *m_Cells[][];
+    CAtlArray<CCell> m_Cells; // m_xNumCells * m_yNumCells, row after row
     CCell *m_ActiveCell;
 
     INT m_ScrollPosition;
     int m_NumRows;
 
     CurrentFont m_CurrentFont;
+    CFontCache *m_FontCache;
+
+    CGlyphAtlas m_GlyphAtlas;
+    INT m_PrefetchPosition;     // scroll position the atlas last prefetched rows around
+    bool m_bRasterizing;
+
+    CUnicodeSearch m_Search;
+    CAtlArray<UINT> m_SearchResults;
+    bool m_bSearching;
 
 public:
     CGridView();
@@ -46,6 +57,12 @@ public:
         _In_ CAtlString& FontName
         );
 
+    bool SetSearch(
+        _In_z_ LPCWSTR Query
+        );
+
+    void SetFontCache(_In_opt_ CFontCache *FontCache) { m_FontCache = FontCache; }
+
     HWND GetHwnd() { return m_hwnd; }
 
 private:
@@ -56,6 +73,16 @@ private:
                    WPARAM wParam,
                    LPARAM lParam);
 
+    UINT GetNumCodepoints(
+        );
+
+    UINT GetCodepoint(
+        _In_ UINT Index
+        );
+
+    void UpdateScrollRange(
+        );
+
     LRESULT OnCreate(
         _In_ HWND hwnd,
         _In_ HWND hParent
@@ -76,6 +103,9 @@ private:
         _In_opt_ HDC hdc
         );
 
+    VOID OnRasterizeTimer(
+        );
+
     bool UpdateCellCoordinates(
         );
 
@@ -85,6 +115,14 @@ private:
 
     void DeleteCells();
 
+    CCell& GetCell(_In_ int x, _In_ int y) { return m_Cells[y * m_xNumCells + x]; }
+
+    void ResetGlyphAtlas(
+        );
+
+    void StartRasterizing(
+        );
+
     void SetCellFocus(
         _In_ CCell* NewActiveCell
         );
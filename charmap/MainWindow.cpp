@@ -195,6 +195,10 @@ CCharMapWindow::OnCreate(_In_ HWND hDlg)
         }
     }
 
+    // Pick up the fonts and the coverages we saw last time
+    m_FontCache.Load();
+    m_GridView->SetFontCache(&m_FontCache);
+
     // Add all the fonts to the list
     if (!CreateFontComboBox())
         return FALSE;
@@ -291,6 +295,13 @@ CCharMapWindow::OnCommand(_In_ WPARAM wParam,
         }
         break;
 
+    case IDC_EDIT_SEARCH:
+        if (HIWORD(wParam) == EN_CHANGE)
+        {
+            ChangeSearch();
+        }
+        break;
+
     default:
         // We didn't handle it
         RetCode = -1;
@@ -300,9 +311,49 @@ CCharMapWindow::OnCommand(_In_ WPARAM wParam,
     return RetCode;
 }
 
+BOOL
+CCharMapWindow::OnFontListChanged(void)
+{
+    // Nothing to do if the installed fonts are the ones we listed from the cache
+    if (!m_FontCache.ApplyRevalidation())
+        return TRUE;
+
+    HWND hCombo;
+    hCombo = GetDlgItem(m_hMainWnd, IDC_FONTCOMBO);
+
+    CAtlStringW FontName;
+    INT Length;
+    Length = GetWindowTextLengthW(hCombo);
+    GetWindowTextW(hCombo, FontName.GetBuffer(Length + 1), Length + 1);
+    FontName.ReleaseBuffer();
+
+    FillFontComboBox(hCombo);
+
+    // Keep the current font if it's still installed
+    INT idx;
+    idx = (INT)SendMessageW(hCombo,
+                            CB_FINDSTRINGEXACT,
+                            (WPARAM)-1,
+                            (LPARAM)FontName.GetString());
+    if (idx != CB_ERR)
+    {
+        SendMessageW(hCombo, CB_SETCURSEL, idx, 0);
+    }
+    else
+    {
+        SendMessageW(hCombo, CB_SETCURSEL, 0, 0);
+        ChangeMapFont();
+    }
+
+    return TRUE;
+}
+
 BOOL
 CCharMapWindow::OnDestroy(void)
 {
+    // Keep the font list and the coverages for the next run
+    m_FontCache.Save();
+
     // Clear the user data pointer
     SetWindowLongPtr(m_hMainWnd, GWLP_USERDATA, 0);
 
@@ -400,6 +451,11 @@ CCharMapWindow::DialogProc(
     }
 
 
+    case WM_FONTLIST_CHANGED:
+    {
+        return This->OnFontListChanged();
+    }
+
     case WM_DESTROY:
     {
         // Call the destroy handler
@@ -410,52 +466,6 @@ CCharMapWindow::DialogProc(
     return FALSE;
 }
 
-struct EnumFontParams
-{
-    CCharMapWindow *This;
-    HWND hCombo;
-};
-
-int
-CALLBACK
-CCharMapWindow::EnumDisplayFont(ENUMLOGFONTEXW *lpelfe,
-                                NEWTEXTMETRICEXW *lpntme,
-                                DWORD FontType,
-                                LPARAM lParam)
-{
-    EnumFontParams *Params = (EnumFontParams *)lParam;
-    LPWSTR pszName = lpelfe->elfLogFont.lfFaceName;
-
-    /* Skip rotated font */
-    if (pszName[0] == L'@') return 1;
-
-    /* make sure font doesn't already exist in our list */
-    if (SendMessageW(Params->hCombo,
-                     CB_FINDSTRINGEXACT,
-                     0,
-                     (LPARAM)pszName) == CB_ERR)
-    {
-        INT idx;
-        idx = (INT)SendMessageW(Params->hCombo,
-                                CB_ADDSTRING,
-                                0,
-                                (LPARAM)pszName);
-
-        /* record the font's attributes (Fixedwidth and Truetype) */
-        BOOL fFixed = (lpelfe->elfLogFont.lfPitchAndFamily & FIXED_PITCH) ? TRUE : FALSE;
-        BOOL fTrueType = (lpelfe->elfLogFont.lfOutPrecision == OUT_STROKE_PRECIS) ? TRUE : FALSE;
-
-        /* store this information in the list-item's userdata area */
-        SendMessageW(Params->hCombo,
-                     CB_SETITEMDATA,
-                     idx,
-                     MAKEWPARAM(fFixed, fTrueType));
-    }
-
-    return 1;
-}
-
-
 bool
 CCharMapWindow::CreateFontComboBox()
 {
@@ -479,29 +489,28 @@ CCharMapWindow::CreateFontComboBox()
                  (WPARAM)GuiFont,
                  0);
 
-    // Set the fonts which we want to enumerate
-    LOGFONTW FontsToEnum;
-    ZeroMemory(&FontsToEnum, sizeof(LOGFONTW));
-    FontsToEnum.lfCharSet = DEFAULT_CHARSET;
-
-    // Set the params we want to pass to the callback
-    EnumFontParams Params;
-    Params.This = this;
-    Params.hCombo = hCombo;
-
-    // Get a DC for combo box
-    HDC hdc;
-    hdc = GetDC(hCombo);
-
-    // Enumerate all the fonts
-    int ret;
-    ret = EnumFontFamiliesExW(hdc,
-                              &FontsToEnum,
-                              (FONTENUMPROCW)EnumDisplayFont,
-                              (LPARAM)&Params,
-                              0);
-
-    ReleaseDC(hCombo, hdc);
+    bool bSuccess = true;
+    if (m_FontCache.GetNumFamilies())
+    {
+        // List the fonts we had last time, and check them against the installed ones in the background
+        m_FontCache.StartRevalidation(m_hMainWnd);
+    }
+    else
+    {
+        // Get a DC for combo box
+        HDC hdc;
+        hdc = GetDC(hCombo);
+
+        // Enumerate all the fonts
+        FontFamilyList Families;
+        bSuccess = CFontCache::EnumFamilies(hdc, Families);
+        ReleaseDC(hCombo, hdc);
+
+        if (bSuccess)
+            m_FontCache.SetFamilies(Families);
+    }
+
+    FillFontComboBox(hCombo);
     DeleteObject(GuiFont);
 
     // Select the first item in the list
@@ -510,7 +519,36 @@ CCharMapWindow::CreateFontComboBox()
                  0,
                  0);
 
-    return (ret == 1);
+    return bSuccess;
+}
+
+void
+CCharMapWindow::FillFontComboBox(
+    _In_ HWND hCombo
+    )
+{
+    SendMessageW(hCombo, WM_SETREDRAW, FALSE, 0);
+    SendMessageW(hCombo, CB_RESETCONTENT, 0, 0);
+
+    for (size_t i = 0; i < m_FontCache.GetNumFamilies(); i++)
+    {
+        const FontFamilyEntry& Family = m_FontCache.GetFamily(i);
+
+        INT idx;
+        idx = (INT)SendMessageW(hCombo,
+                                CB_ADDSTRING,
+                                0,
+                                (LPARAM)Family.Name.GetString());
+
+        /* store the font's attributes in the list-item's userdata area */
+        SendMessageW(hCombo,
+                     CB_SETITEMDATA,
+                     idx,
+                     Family.Flags);
+    }
+
+    SendMessageW(hCombo, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(hCombo, NULL, TRUE);
 }
 
 bool
@@ -534,3 +572,20 @@ CCharMapWindow::ChangeMapFont(
 
     return m_GridView->SetFont(FontName);
 }
+
+bool
+CCharMapWindow::ChangeSearch(
+    )
+{
+    HWND hEdit;
+    hEdit = GetDlgItem(m_hMainWnd, IDC_EDIT_SEARCH);
+
+    CAtlStringW Query;
+    INT Length;
+    Length = GetWindowTextLengthW(hEdit);
+    GetWindowTextW(hEdit, Query.GetBuffer(Length + 1), Length + 1);
+    Query.ReleaseBuffer();
+
+    // Filter the grid as the user types
+    return m_GridView->SetSearch(Query);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "GridView.h"
+#include "FontCache.h"
 
 class CCharMapWindow
 {
@@ -9,6 +10,7 @@ class CCharMapWindow
     HMODULE m_hRichEd;
 
     CGridView *m_GridView;
+    CFontCache m_FontCache;
 
 public:
     CCharMapWindow(void);
@@ -68,17 +70,18 @@ private:
         _In_ bool InMenuLoop
         );
 
-    static int CALLBACK
-    EnumDisplayFont(
-        ENUMLOGFONTEXW *lpelfe,
-        NEWTEXTMETRICEXW *lpntme,
-        DWORD FontType,
-        LPARAM lParam
-        );
+    BOOL OnFontListChanged(void);
 
     bool CreateFontComboBox(
         );
 
+    void FillFontComboBox(
+        _In_ HWND hCombo
+        );
+
     bool ChangeMapFont(
         );
+
+    bool ChangeSearch(
+        );
 };
\ No newline at end of file
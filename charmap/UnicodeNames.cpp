@@ -0,0 +1,531 @@
+/*
+* PROJECT:     ReactOS Character Map
+* LICENSE:     GPL - See COPYING in the top level directory
+* FILE:        base/applications/charmap/UnicodeNames.cpp
+* PURPOSE:     Unicode character names, and searching the characters by name
+*/
+
+
+#include "precomp.h"
+#include "UnicodeNames.h"
+#include "UnicodeNameData.h"
+
+
+/* DATA *****************************************************/
+
+#define MIN_SUBSTRING_LENGTH    3   // shorter tokens only match the start of a word
+
+// Short names of the jamo making up the Hangul syllables
+static const char * const JamoLeading[] =
+{
+    "G", "GG", "N", "D", "DD", "R", "M", "B", "BB", "S",
+    "SS", "", "J", "JJ", "C", "K", "T", "P", "H"
+};
+
+static const char * const JamoVowel[] =
+{
+    "A", "AE", "YA", "YAE", "EO", "E", "YEO", "YE", "O", "WA", "WAE",
+    "OE", "YO", "U", "WEO", "WE", "WI", "YU", "EU", "YI", "I"
+};
+
+static const char * const JamoTrailing[] =
+{
+    "", "G", "GG", "GS", "N", "NJ", "NH", "D", "L", "LG", "LM", "LB",
+    "LS", "LT", "LP", "LH", "M", "B", "BS", "S", "SS", "NG", "J", "C",
+    "K", "T", "P", "H"
+};
+
+static inline bool IsHexDigit(char c) { return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F'); }
+
+// A word of the names is one byte below 0x80, two bytes from there
+static inline UINT ReadWordNumber(const BYTE *&p)
+{
+    UINT Number = *p++;
+    if (Number & 0x80)
+        Number = ((Number & 0x7F) << 8) | *p++;
+    return Number;
+}
+
+// Where each word starts in NameWords, worked out on first use
+static const UINT *
+GetWordOffsets()
+{
+    static CAtlArray<UINT> Offsets;
+
+    if (Offsets.GetCount() == 0)
+    {
+        Offsets.SetCount(NUM_NAME_WORDS);
+        UINT Offset = 0;
+        for (UINT i = 0; i < NUM_NAME_WORDS; i++)
+        {
+            Offsets[i] = Offset;
+            Offset += 1 + NameWords[Offset];
+        }
+    }
+
+    return Offsets.GetData();
+}
+
+// Tells if a token is found in a word, or starts it (or starts a part of it
+// after a hyphen) when the token is too short for anything else to make sense
+static bool
+TokenInWord(const char *Token, int TokenLength, const char *Word, int WordLength)
+{
+    if (TokenLength == 0 || TokenLength > WordLength)
+        return false;
+
+    if (TokenLength >= MIN_SUBSTRING_LENGTH)
+    {
+        for (int i = 0; i + TokenLength <= WordLength; i++)
+        {
+            if (memcmp(Word + i, Token, TokenLength) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    for (int i = 0; i + TokenLength <= WordLength; i++)
+    {
+        if ((i == 0 || Word[i - 1] == '-') && memcmp(Word + i, Token, TokenLength) == 0)
+            return true;
+    }
+    return false;
+}
+
+
+/* PUBLIC METHODS **********************************************/
+
+CUnicodeSearch::CUnicodeSearch() :
+    m_NumTokens(0),
+    m_CodepointTokens(0)
+{
+}
+
+CUnicodeSearch::~CUnicodeSearch()
+{
+}
+
+// Splits the query into tokens, returns false when there's nothing to search for.
+// Letters and digits make up words, "U+" starts a code point, and any other
+// character typed in as is stands for itself
+bool
+CUnicodeSearch::SetQuery(
+    _In_z_ LPCWSTR Query
+    )
+{
+    SearchToken Token = { 0 };
+
+    m_NumTokens = 0;
+    m_CodepointTokens = 0;
+
+    for (LPCWSTR p = Query; ; p++)
+    {
+        WCHAR ch = *p;
+
+        if ((ch >= L'a' && ch <= L'z') || (ch >= L'A' && ch <= L'Z') || (ch >= L'0' && ch <= L'9'))
+        {
+            if (Token.Length < MAX_TOKEN_LENGTH)
+                Token.Text[Token.Length++] = (char)((ch >= L'a' && ch <= L'z') ? ch - L'a' + 'A' : ch);
+            continue;
+        }
+
+        if (ch == L'+' && Token.Length == 1 && Token.Text[0] == 'U' && !Token.OnlyCodepoint)
+        {
+            Token.Length = 0;
+            Token.OnlyCodepoint = true;
+            continue;
+        }
+
+        // Anything else ends the token
+        if (Token.Length || Token.OnlyCodepoint)
+            AddToken(Token);
+        ZeroMemory(&Token, sizeof(Token));
+
+        if (ch == UNICODE_NULL)
+            break;
+
+        if (ch == L' ' || ch == L'-' || ch == L'\t')
+            continue;
+
+        // A character to look for as is
+        Token.HasCodepoint = true;
+        Token.OnlyCodepoint = true;
+        Token.Codepoint = ch;
+        if (IS_HIGH_SURROGATE(ch) && IS_LOW_SURROGATE(p[1]))
+        {
+            Token.Codepoint = 0x10000 + ((ch - 0xD800) << 10) + (p[1] - 0xDC00);
+            p++;
+        }
+        AddToken(Token);
+        ZeroMemory(&Token, sizeof(Token));
+    }
+
+    return (m_NumTokens != 0);
+}
+
+// Finds the characters of the font matching all the tokens, in code point order
+void
+CUnicodeSearch::Search(
+    _In_ CFontCoverage& Coverage,
+    _Out_ CAtlArray<UINT>& Results
+    )
+{
+    Results.RemoveAll();
+    if (m_NumTokens == 0)
+        return;
+
+    BYTE AllTokens = (BYTE)((1 << m_NumTokens) - 1);
+
+    // Which words match which tokens, looked at once for all the names
+    m_WordMasks.SetCount(NUM_NAME_WORDS);
+    const BYTE *Word = NameWords;
+    for (UINT i = 0; i < NUM_NAME_WORDS; i++)
+    {
+        m_WordMasks[i] = MatchWord((const char *)Word + 1, Word[0]);
+        Word += 1 + Word[0];
+    }
+
+    m_BlockMasks.SetCount(_countof(UnicodeBlocks));
+    for (size_t i = 0; i < _countof(UnicodeBlocks); i++)
+        m_BlockMasks[i] = MatchText(UnicodeBlocks[i].Name);
+
+    const BYTE *Name = NameData;
+    size_t Block = 0, Range = 0;
+
+    for (size_t i = 0; i < _countof(NameRuns); i++)
+    {
+        // The generated names go in between
+        while (Range < _countof(NameRanges) && NameRanges[Range].First < NameRuns[i].First)
+            SearchRange(NameRanges[Range++], Coverage, Results);
+
+        for (UINT j = 0; j < NameRuns[i].Count; j++)
+        {
+            UINT Codepoint = NameRuns[i].First + j;
+            BYTE Mask;
+
+            Mask = GetBlockMask(Codepoint, Block);
+            if (m_CodepointTokens)
+                Mask |= MatchCodepoint(Codepoint);
+
+            UINT NumWords = *Name++;
+            for (UINT k = 0; k < NumWords; k++)
+                Mask |= m_WordMasks[ReadWordNumber(Name)];
+
+            if (Mask == AllTokens && Coverage.Contains(Codepoint))
+                Results.Add(Codepoint);
+        }
+    }
+
+    while (Range < _countof(NameRanges))
+        SearchRange(NameRanges[Range++], Coverage, Results);
+
+    // A code point on its own finds its character even without a name
+    if (m_NumTokens == 1 && m_Tokens[0].HasCodepoint && Coverage.Contains(m_Tokens[0].Codepoint))
+    {
+        UINT Codepoint = m_Tokens[0].Codepoint;
+        size_t Pos = 0;
+        while (Pos < Results.GetCount() && Results[Pos] < Codepoint)
+            Pos++;
+        if (Pos == Results.GetCount() || Results[Pos] != Codepoint)
+            Results.InsertAt(Pos, Codepoint);
+    }
+}
+
+bool
+CUnicodeSearch::GetName(
+    _In_ UINT Codepoint,
+    _Out_ CAtlStringW& Name
+    )
+{
+    Name.Empty();
+
+    // Look for the run holding the code point
+    size_t Low = 0, High = _countof(NameRuns);
+    while (Low < High)
+    {
+        size_t Mid = (Low + High) / 2;
+        if (Codepoint < NameRuns[Mid].First)
+            High = Mid;
+        else if (Codepoint >= NameRuns[Mid].First + NameRuns[Mid].Count)
+            Low = Mid + 1;
+        else
+        {
+            // Skip to the name from the nearest indexed one
+            UINT Number = NameRuns[Mid].FirstName + (Codepoint - NameRuns[Mid].First);
+            const BYTE *p = NameData + NameIndex[Number / NAME_INDEX_STEP];
+            for (UINT i = 0; i < Number % NAME_INDEX_STEP; i++)
+            {
+                UINT NumWords = *p++;
+                for (UINT j = 0; j < NumWords; j++)
+                    ReadWordNumber(p);
+            }
+
+            const UINT *Offsets = GetWordOffsets();
+            UINT NumWords = *p++;
+            for (UINT i = 0; i < NumWords; i++)
+            {
+                const BYTE *Word = NameWords + Offsets[ReadWordNumber(p)];
+                if (i) Name += L' ';
+                for (UINT j = 1; j <= Word[0]; j++)
+                    Name += (WCHAR)Word[j];
+            }
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < _countof(NameRanges); i++)
+    {
+        if (Codepoint >= NameRanges[i].First && Codepoint <= NameRanges[i].Last)
+        {
+            char Suffix[8];
+            GetRangeSuffix(NameRanges[i], Codepoint, Suffix);
+
+            Name = NameRanges[i].Prefix;
+            Name += Suffix;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+CUnicodeSearch::GetBlockName(
+    _In_ UINT Codepoint,
+    _Out_ CAtlStringW& Name
+    )
+{
+    size_t Low = 0, High = _countof(UnicodeBlocks);
+    while (Low < High)
+    {
+        size_t Mid = (Low + High) / 2;
+        if (Codepoint < UnicodeBlocks[Mid].First)
+            High = Mid;
+        else if (Codepoint > UnicodeBlocks[Mid].Last)
+            Low = Mid + 1;
+        else
+        {
+            Name = UnicodeBlocks[Mid].Name;
+            return true;
+        }
+    }
+
+    Name.Empty();
+    return false;
+}
+
+
+/* PRIVATE METHODS **********************************************/
+
+void
+CUnicodeSearch::AddToken(
+    _In_ SearchToken& Token
+    )
+{
+    if (m_NumTokens == MAX_SEARCH_TOKENS)
+        return;
+
+    // Hex digits could be a code point, after U+ they can only be one
+    if (!Token.HasCodepoint && Token.Length <= 6 &&
+        (Token.OnlyCodepoint || Token.Length >= 4))
+    {
+        bool IsHex = (Token.Length != 0);
+        UINT Value = 0;
+        for (int i = 0; IsHex && i < Token.Length; i++)
+        {
+            IsHex = IsHexDigit(Token.Text[i]);
+            Value = (Value << 4) | (Token.Text[i] <= '9' ? Token.Text[i] - '0' : Token.Text[i] - 'A' + 10);
+        }
+
+        if (IsHex && Value <= MAX_CODEPOINT)
+        {
+            Token.HasCodepoint = true;
+            Token.Codepoint = Value;
+        }
+    }
+
+    // Ignore U+ until a code point follows
+    if (Token.OnlyCodepoint && !Token.HasCodepoint)
+        return;
+
+    if (Token.HasCodepoint)
+        m_CodepointTokens |= 1 << m_NumTokens;
+
+    m_Tokens[m_NumTokens++] = Token;
+}
+
+// Returns the mask of the tokens found in an upper case word of the names
+BYTE
+CUnicodeSearch::MatchWord(
+    _In_reads_(Length) const char *Word,
+    _In_ int Length
+    )
+{
+    BYTE Mask = 0;
+
+    for (UINT i = 0; i < m_NumTokens; i++)
+    {
+        if (!m_Tokens[i].OnlyCodepoint &&
+            TokenInWord(m_Tokens[i].Text, m_Tokens[i].Length, Word, Length))
+        {
+            Mask |= 1 << i;
+        }
+    }
+
+    return Mask;
+}
+
+// Returns the mask of the tokens found in any word of a name or block name
+BYTE
+CUnicodeSearch::MatchText(
+    _In_z_ const char *Text
+    )
+{
+    char Word[MAX_TOKEN_LENGTH + 1];
+    int Length = 0;
+    BYTE Mask = 0;
+
+    for (const char *p = Text; ; p++)
+    {
+        if (*p == ' ' || *p == '\0')
+        {
+            Mask |= MatchWord(Word, Length);
+            Length = 0;
+            if (*p == '\0')
+                break;
+        }
+        else if (Length < MAX_TOKEN_LENGTH)
+        {
+            Word[Length++] = (*p >= 'a' && *p <= 'z') ? *p - 'a' + 'A' : *p;
+        }
+    }
+
+    return Mask;
+}
+
+BYTE
+CUnicodeSearch::MatchCodepoint(
+    _In_ UINT Codepoint
+    )
+{
+    BYTE Mask = 0;
+
+    for (UINT i = 0; i < m_NumTokens; i++)
+    {
+        if (m_Tokens[i].HasCodepoint && m_Tokens[i].Codepoint == Codepoint)
+            Mask |= 1 << i;
+    }
+
+    return Mask;
+}
+
+// Block is where the last call left off, the code points have to come in order
+BYTE
+CUnicodeSearch::GetBlockMask(
+    _In_ UINT Codepoint,
+    _Inout_ size_t& Block
+    )
+{
+    while (Block < _countof(UnicodeBlocks) && UnicodeBlocks[Block].Last < Codepoint)
+        Block++;
+
+    if (Block < _countof(UnicodeBlocks) && UnicodeBlocks[Block].First <= Codepoint)
+        return m_BlockMasks[Block];
+
+    return 0;
+}
+
+// Looks through the characters of the font in a range of generated names
+void
+CUnicodeSearch::SearchRange(
+    _In_ const UnicodeNameRange& Range,
+    _In_ CFontCoverage& Coverage,
+    _Inout_ CAtlArray<UINT>& Results
+    )
+{
+    BYTE AllTokens = (BYTE)((1 << m_NumTokens) - 1);
+    BYTE PrefixMask = MatchText(Range.Prefix);
+
+    // Leave the range alone when some token can't match anything in it
+    BYTE Possible = PrefixMask | (BYTE)m_CodepointTokens;
+    for (size_t i = 0; i < _countof(UnicodeBlocks); i++)
+    {
+        if (UnicodeBlocks[i].First <= Range.Last && UnicodeBlocks[i].Last >= Range.First)
+            Possible |= m_BlockMasks[i];
+    }
+    for (UINT i = 0; i < m_NumTokens; i++)
+    {
+        bool SuffixChars = !m_Tokens[i].OnlyCodepoint;
+        for (int j = 0; SuffixChars && j < m_Tokens[i].Length; j++)
+        {
+            char c = m_Tokens[i].Text[j];
+            SuffixChars = (Range.Kind == NAME_RANGE_HEX) ? IsHexDigit(c) : (c >= 'A' && c <= 'Z');
+        }
+        if (SuffixChars)
+            Possible |= 1 << i;
+    }
+    if (Possible != AllTokens)
+        return;
+
+    size_t Block = 0;
+    for (size_t i = 0; i < Coverage.GetNumRanges(); i++)
+    {
+        const CodepointRange& Covered = Coverage.GetRange(i);
+        UINT First = max(Covered.First, Range.First);
+        UINT Last = min(Covered.Last, Range.Last);
+
+        for (UINT Codepoint = First; First <= Last && Codepoint <= Last; Codepoint++)
+        {
+            BYTE Mask;
+            Mask = PrefixMask | GetBlockMask(Codepoint, Block);
+            if (m_CodepointTokens)
+                Mask |= MatchCodepoint(Codepoint);
+
+            if (Mask != AllTokens)
+            {
+                char Suffix[8];
+                int Length;
+                Length = GetRangeSuffix(Range, Codepoint, Suffix);
+                Mask |= MatchWord(Suffix, Length);
+            }
+
+            if (Mask == AllTokens)
+                Results.Add(Codepoint);
+        }
+    }
+}
+
+int
+CUnicodeSearch::GetRangeSuffix(
+    _In_ const UnicodeNameRange& Range,
+    _In_ UINT Codepoint,
+    _Out_writes_(8) char *Suffix
+    )
+{
+    int Length = 0;
+
+    if (Range.Kind == NAME_RANGE_HANGUL)
+    {
+        UINT Index = Codepoint - 0xAC00;
+        const char *Jamo[3];
+        Jamo[0] = JamoLeading[Index / (_countof(JamoVowel) * _countof(JamoTrailing))];
+        Jamo[1] = JamoVowel[(Index / _countof(JamoTrailing)) % _countof(JamoVowel)];
+        Jamo[2] = JamoTrailing[Index % _countof(JamoTrailing)];
+
+        for (int i = 0; i < 3; i++)
+        {
+            for (const char *p = Jamo[i]; *p; p++)
+                Suffix[Length++] = *p;
+        }
+    }
+    else
+    {
+        // At least 4 digits, like U+ notation
+        int Digits = (Codepoint > 0xFFFFF) ? 6 : (Codepoint > 0xFFFF) ? 5 : 4;
+        for (int i = Digits - 1; i >= 0; i--)
+            Suffix[Length++] = "0123456789ABCDEF"[(Codepoint >> (i * 4)) & 0xF];
+    }
+
+    Suffix[Length] = '\0';
+    return Length;
+}
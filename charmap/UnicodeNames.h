@@ -0,0 +1,109 @@
+#pragma once
+#include "FontCoverage.h"
+
+#define NAME_RANGE_HEX      0   // the prefix and the code point in hex
+#define NAME_RANGE_HANGUL   1   // the prefix and the short names of the syllable's jamo
+
+#define MAX_SEARCH_TOKENS   8
+#define MAX_TOKEN_LENGTH    40
+
+struct UnicodeNameRun
+{
+    UINT First;
+    UINT Count;
+    UINT FirstName;     // number of the name of First in NameData
+};
+
+struct UnicodeNameRange
+{
+    UINT First;
+    UINT Last;
+    UINT Kind;
+    const char *Prefix;
+};
+
+struct UnicodeBlock
+{
+    UINT First;
+    UINT Last;
+    const char *Name;
+};
+
+// Finds the characters whose name, block or code point match what the user typed
+class CUnicodeSearch
+{
+private:
+    struct SearchToken
+    {
+        char Text[MAX_TOKEN_LENGTH + 1];    // upper case
+        int Length;
+        bool HasCodepoint;  // U+XXXX, 4 to 6 hex digits, or a character typed in as is
+        bool OnlyCodepoint; // doesn't match words
+        UINT Codepoint;
+    };
+
+    SearchToken m_Tokens[MAX_SEARCH_TOKENS];
+    UINT m_NumTokens;
+    UINT m_CodepointTokens;             // mask of the tokens with a code point
+
+    CAtlArray<BYTE> m_WordMasks;        // tokens matching each word of the names
+    CAtlArray<BYTE> m_BlockMasks;       // tokens matching each block name
+
+public:
+    CUnicodeSearch();
+    ~CUnicodeSearch();
+
+    bool SetQuery(
+        _In_z_ LPCWSTR Query
+        );
+
+    void Search(
+        _In_ CFontCoverage& Coverage,
+        _Out_ CAtlArray<UINT>& Results
+        );
+
+    static bool GetName(
+        _In_ UINT Codepoint,
+        _Out_ CAtlStringW& Name
+        );
+
+    static bool GetBlockName(
+        _In_ UINT Codepoint,
+        _Out_ CAtlStringW& Name
+        );
+
+private:
+    void AddToken(
+        _In_ SearchToken& Token
+        );
+
+    BYTE MatchWord(
+        _In_reads_(Length) const char *Word,
+        _In_ int Length
+        );
+
+    BYTE MatchText(
+        _In_z_ const char *Text
+        );
+
+    BYTE MatchCodepoint(
+        _In_ UINT Codepoint
+        );
+
+    BYTE GetBlockMask(
+        _In_ UINT Codepoint,
+        _Inout_ size_t& Block
+        );
+
+    void SearchRange(
+        _In_ const UnicodeNameRange& Range,
+        _In_ CFontCoverage& Coverage,
+        _Inout_ CAtlArray<UINT>& Results
+        );
+
+    static int GetRangeSuffix(
+        _In_ const UnicodeNameRange& Range,
+        _In_ UINT Codepoint,
+        _Out_writes_(8) char *Suffix
+        );
+};
@@ -10,6 +10,7 @@
 #include <commctrl.h>
 #include <Uxtheme.h>
 #include <richedit.h>
+#include <shlobj.h>
 
 #define _ATL_CSTRING_EXPLICIT_CONSTRUCTORS      // some CString constructors will be explicit
 #include <tchar.h>
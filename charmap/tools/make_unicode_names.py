@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# PROJECT:     ReactOS Character Map
+# LICENSE:     GPL - See COPYING in the top level directory
+# FILE:        base/applications/charmap/tools/make_unicode_names.py
+# PURPOSE:     Generates UnicodeNameData.h from the Unicode Character Database
+#
+# Usage: make_unicode_names.py UnicodeData.txt Blocks.txt ../UnicodeNameData.h
+#
+# The names are split into words at spaces. Every distinct
+# word is stored once, and every name becomes the list of its word numbers,
+# the most frequent words taking one byte and the others two. Ranges whose
+# names follow a pattern (CJK and Tangut ideographs, Hangul syllables) are
+# kept as ranges and spelled out at run time.
+
+import re
+import sys
+from collections import Counter
+
+INDEX_STEP = 64
+ONE_BYTE_WORDS = 0x80
+MAX_WORDS = 0x8000
+
+# UnicodeData.txt range label -> (kind, prefix)
+ALGORITHMIC_RANGES = [
+    (re.compile(r'^CJK Ideograph'), 'NAME_RANGE_HEX', 'CJK UNIFIED IDEOGRAPH-'),
+    (re.compile(r'^Tangut Ideograph'), 'NAME_RANGE_HEX', 'TANGUT IDEOGRAPH-'),
+    (re.compile(r'^Hangul Syllable'), 'NAME_RANGE_HANGUL', 'HANGUL SYLLABLE '),
+]
+
+
+def read_names(path):
+    names = []
+    ranges = []
+    first = None
+    for line in open(path, encoding='utf-8'):
+        fields = line.rstrip('\n').split(';')
+        if len(fields) < 2:
+            continue
+        codepoint, name = int(fields[0], 16), fields[1]
+        if name.endswith(', First>'):
+            first = codepoint
+            continue
+        if name.endswith(', Last>'):
+            label = name[1:-len(', Last>')]
+            for pattern, kind, prefix in ALGORITHMIC_RANGES:
+                if pattern.match(label):
+                    ranges.append((first, codepoint, kind, prefix))
+            continue
+        if name.startswith('<'):
+            continue
+        if not re.match(r'^[A-Z0-9 -]+$', name):
+            raise ValueError('unexpected name %04X %s' % (codepoint, name))
+        names.append((codepoint, name))
+    return names, ranges
+
+
+def read_blocks(path):
+    version = None
+    blocks = []
+    for line in open(path, encoding='utf-8'):
+        match = re.match(r'^# Blocks-(\d+\.\d+\.\d+)\.txt', line)
+        if match:
+            version = match.group(1)
+        match = re.match(r'^([0-9A-F]+)\.\.([0-9A-F]+); (.+)$', line.strip())
+        if match:
+            blocks.append((int(match.group(1), 16), int(match.group(2), 16), match.group(3)))
+    return version, blocks
+
+
+def write_bytes(out, data):
+    for i in range(0, len(data), 24):
+        out.write('    ' + ','.join('%d' % b for b in data[i:i + 24]) + ',\n')
+
+
+def main(unicode_data, blocks_txt, output):
+    names, ranges = read_names(unicode_data)
+    version, blocks = read_blocks(blocks_txt)
+
+    # Number the words, most frequent first
+    counts = Counter()
+    for codepoint, name in names:
+        counts.update(name.split(' '))
+    words = sorted(counts, key=lambda w: (-counts[w], w))
+    if len(words) > MAX_WORDS or max(len(w) for w in words) > 255:
+        raise ValueError('too many or too long words')
+    numbers = {w: i for i, w in enumerate(words)}
+
+    word_data = bytearray()
+    for word in words:
+        word_data.append(len(word))
+        word_data += word.encode('ascii')
+
+    name_data = bytearray()
+    index = []
+    runs = []
+    for i, (codepoint, name) in enumerate(names):
+        if i % INDEX_STEP == 0:
+            index.append(len(name_data))
+        if runs and runs[-1][0] + runs[-1][1] == codepoint:
+            runs[-1][1] += 1
+        else:
+            runs.append([codepoint, 1, i])
+
+        name_words = name.split(' ')
+        if len(name_words) > 255 or '' in name_words:
+            raise ValueError('unexpected name %04X %s' % (codepoint, name))
+        name_data.append(len(name_words))
+        for word in name_words:
+            number = numbers[word]
+            if number < ONE_BYTE_WORDS:
+                name_data.append(number)
+            else:
+                name_data += bytes([0x80 | (number >> 8), number & 0xFF])
+
+    with open(output, 'w', encoding='ascii', newline='\n') as out:
+        out.write('/* Automatically generated by tools/make_unicode_names.py'
+                  ' from the Unicode %s data, do not edit */\n\n' % version)
+        out.write('#pragma once\n\n')
+        out.write('#define UNICODE_NAMES_VERSION   "%s"\n' % version)
+        out.write('#define NUM_NAME_WORDS          %d\n' % len(words))
+        out.write('#define NUM_NAMES               %d\n' % len(names))
+        out.write('#define NAME_INDEX_STEP         %d\n\n' % INDEX_STEP)
+
+        out.write('// Every word of the names, preceded by its length\n')
+        out.write('static const BYTE NameWords[] =\n{\n')
+        write_bytes(out, word_data)
+        out.write('};\n\n')
+
+        out.write('// Every name, as its number of words followed by the words,'
+                  ' numbers below 0x80 take one byte and the others two\n')
+        out.write('static const BYTE NameData[] =\n{\n')
+        write_bytes(out, name_data)
+        out.write('};\n\n')
+
+        out.write('// Where every NAME_INDEX_STEP-th name starts in NameData\n')
+        out.write('static const UINT NameIndex[] =\n{\n')
+        for i in range(0, len(index), 8):
+            out.write('    ' + ', '.join('%d' % o for o in index[i:i + 8]) + ',\n')
+        out.write('};\n\n')
+
+        out.write('// Consecutive code points with a name in NameData\n')
+        out.write('static const UnicodeNameRun NameRuns[] =\n{\n')
+        for first, count, name in runs:
+            out.write('    { 0x%04X, %d, %d },\n' % (first, count, name))
+        out.write('};\n\n')
+
+        out.write('// Code points whose names are made up at run time\n')
+        out.write('static const UnicodeNameRange NameRanges[] =\n{\n')
+        for first, last, kind, prefix in ranges:
+            out.write('    { 0x%04X, 0x%04X, %s, "%s" },\n' % (first, last, kind, prefix))
+        out.write('};\n\n')
+
+        out.write('static const UnicodeBlock UnicodeBlocks[] =\n{\n')
+        for first, last, name in blocks:
+            out.write('    { 0x%04X, 0x%04X, "%s" },\n' % (first, last, name))
+        out.write('};\n')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 4:
+        sys.exit('usage: make_unicode_names.py UnicodeData.txt Blocks.txt UnicodeNameData.h')
+    main(sys.argv[1], sys.argv[2], sys.argv[3])
@@ -27,7 +27,6 @@ static struct { LPCWCHAR face; int size;}
 
 static int G_FontIndex = -1;
 static VOID SetTextFont(int index);
-static HFONT G_TextFont = NULL;
 
 static const WCHAR szClassName[] = L"ClipBookWClass";
 
@@ -145,6 +144,9 @@ static void SetDisplayFormat(UINT uFormat)
         Globals.uDisplayFormat = uFormat;
     }
 
+    FreeTileCache();
+    Globals.uZoomLevel = 0;
+
     GetClipboardDataDimensions(Globals.uDisplayFormat, &rc);
     Scrollstate.CurrentX = Scrollstate.CurrentY = 0;
     Scrollstate.iWheelCarryoverX = Scrollstate.iWheelCarryoverY = 0;
@@ -153,6 +155,30 @@ static void SetDisplayFormat(UINT uFormat)
     InvalidateRect(Globals.hMainWnd, NULL, TRUE);
 }
 
+static void UpdateHistoryMenu(HMENU hMenu)
+{
+    UINT nEntry, nEntries;
+    WCHAR szLabel[MAX_STRING_LEN];
+
+    while (GetMenuItemCount(hMenu) > 1)
+    {
+        DeleteMenu(hMenu, 1, MF_BYPOSITION);
+    }
+
+    nEntries = GetClipboardHistoryCount();
+    EnableMenuItem(hMenu, CMD_HISTORY_CLEAR, nEntries ? MF_ENABLED : MF_GRAYED);
+    if (nEntries == 0)
+        return;
+
+    AppendMenuW(hMenu, MF_SEPARATOR, 0, NULL);
+
+    for (nEntry = 0; nEntry < nEntries; nEntry++)
+    {
+        if (GetClipboardHistoryLabel(nEntry, szLabel, ARRAYSIZE(szLabel)))
+            AppendMenuW(hMenu, MF_STRING, CMD_HISTORY_FIRST + nEntry, szLabel);
+    }
+}
+
 static void InitMenuPopup(HMENU hMenu, LPARAM index)
 {
     if ((GetMenuItemID(hMenu, 0) == CMD_DELETE) || (GetMenuItemID(hMenu, 1) == CMD_SAVE_AS))
@@ -169,6 +195,10 @@ static void InitMenuPopup(HMENU hMenu, LPARAM index)
         }
     }
 
+    /* Not at the same position in every translation of the menu */
+    if (GetMenuItemID(hMenu, 0) == CMD_HISTORY_CLEAR)
+        UpdateHistoryMenu(hMenu);
+
     DrawMenuBar(Globals.hMainWnd);
 }
 
@@ -290,14 +320,70 @@ static int OnCommand(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             break;
         }
 
+        case CMD_HISTORY_CLEAR:
+        {
+            ClearClipboardHistory();
+            break;
+        }
+
         default:
         {
+            if (LOWORD(wParam) >= CMD_HISTORY_FIRST &&
+                LOWORD(wParam) < CMD_HISTORY_FIRST + HISTORY_MAX_ENTRIES)
+            {
+                RestoreClipboardHistory(LOWORD(wParam) - CMD_HISTORY_FIRST);
+            }
             break;
         }
     }
     return 0;
 }
 
+static void SetZoomLevel(INT iDelta)
+{
+    RECT rc;
+    UINT uOldLevel = Globals.uZoomLevel;
+    INT iLevel;
+    INT CenterX, CenterY;
+
+    /* Only the bitmaps can be zoomed out */
+    switch (Globals.uDisplayFormat)
+    {
+        case CF_DSPBITMAP:
+        case CF_BITMAP:
+        case CF_DIB:
+        case CF_DIBV5:
+            break;
+
+        default:
+            return;
+    }
+
+    /* The full size of the bitmap */
+    Globals.uZoomLevel = 0;
+    GetClipboardDataDimensions(Globals.uDisplayFormat, &rc);
+
+    iLevel = (INT)uOldLevel + iDelta;
+    iLevel = max(0, min(iLevel, (INT)GetTileLevelCount(rc.right, rc.bottom) - 1));
+    if (iLevel > 0 && !CreateTileCache(Globals.uDisplayFormat, rc.right, rc.bottom))
+        iLevel = 0;
+
+    Globals.uZoomLevel = iLevel;
+    if (Globals.uZoomLevel == uOldLevel)
+        return;
+
+    /* Keep the same point of the bitmap in the middle of the window */
+    CenterX = ((Scrollstate.CurrentX + Scrollstate.nPageX / 2) << uOldLevel) >> Globals.uZoomLevel;
+    CenterY = ((Scrollstate.CurrentY + Scrollstate.nPageY / 2) << uOldLevel) >> Globals.uZoomLevel;
+    Scrollstate.CurrentX = max(0, CenterX - Scrollstate.nPageX / 2);
+    Scrollstate.CurrentY = max(0, CenterY - Scrollstate.nPageY / 2);
+
+    GetClipboardDataDimensions(Globals.uDisplayFormat, &rc);
+    UpdateWindowScrollState(Globals.hMainWnd, rc.right, rc.bottom, &Scrollstate);
+
+    InvalidateRect(Globals.hMainWnd, NULL, TRUE);
+}
+
 static void OnPaint(HWND hWnd, WPARAM wParam, LPARAM lParam)
 {
     HDC hdc;
@@ -334,7 +420,7 @@ static void OnPaint(HWND hWnd, WPARAM wParam, LPARAM lParam)
         case CF_OEMTEXT:
         case CF_UNICODETEXT:
         {
-            HFONT hOldFont = (HFONT) SelectObject(hdc, G_TextFont);
+            HFONT hOldFont = (HFONT) SelectObject(hdc, Globals.hFont);
             DrawTextFromClipboard(Globals.uDisplayFormat, ps, Scrollstate);
             SelectObject(hdc, hOldFont);
             break;
@@ -343,14 +429,20 @@ static void OnPaint(HWND hWnd, WPARAM wParam, LPARAM lParam)
         case CF_DSPBITMAP:
         case CF_BITMAP:
         {
-            BitBltFromClipboard(ps, Scrollstate, SRCCOPY);
+            if (Globals.uZoomLevel)
+                DrawTilesFromCache(Globals.uZoomLevel, ps, Scrollstate);
+            else
+                BitBltFromClipboard(ps, Scrollstate, SRCCOPY);
             break;
         }
 
         case CF_DIB:
         case CF_DIBV5:
         {
-            SetDIBitsToDeviceFromClipboard(Globals.uDisplayFormat, ps, Scrollstate, DIB_RGB_COLORS);
+            if (Globals.uZoomLevel)
+                DrawTilesFromCache(Globals.uZoomLevel, ps, Scrollstate);
+            else
+                SetDIBitsToDeviceFromClipboard(Globals.uDisplayFormat, ps, Scrollstate, DIB_RGB_COLORS);
             break;
         }
 
@@ -446,7 +538,10 @@ static LRESULT WINAPI MainWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lP
         case WM_DESTROY:
         {
             ChangeClipboardChain(hWnd, Globals.hWndNext);
-            DeleteObject(G_TextFont);
+            DeleteObject(Globals.hFont);
+            FreeClipboardTextIndex();
+            FreeTileCache();
+            ClearClipboardHistory();
 
             if (Globals.uDisplayFormat == CF_OWNERDISPLAY)
             {
@@ -486,6 +581,13 @@ static LRESULT WINAPI MainWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lP
         case WM_MOUSEWHEEL:
         case WM_MOUSEHWHEEL:
         {
+            /* Ctrl + wheel zooms the bitmaps in and out */
+            if (uMsg == WM_MOUSEWHEEL && (GET_KEYSTATE_WPARAM(wParam) & MK_CONTROL))
+            {
+                SetZoomLevel(GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? -1 : 1);
+                break;
+            }
+
             OnMouseScroll(hWnd, uMsg, wParam, lParam, &Scrollstate);
             break;
         }
@@ -568,7 +670,11 @@ static LRESULT WINAPI MainWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lP
         }
 
         case WM_DESTROYCLIPBOARD:
+        {
+            /* Somebody else emptied the clipboard: the loaded file is not needed anymore */
+            CloseClipboardFile();
             break;
+        }
 
         case WM_RENDERALLFORMATS:
         {
@@ -578,17 +684,22 @@ static LRESULT WINAPI MainWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lP
              * subsequently closed, this message is then sent to us so that
              * we get a chance to render everything we can. Since we don't have
              * anything to render, just empty the clipboard.
+             * The formats of a loaded clipboard file are all rendered instead.
              */
-            DeleteClipboardContent();
+            if (!RenderAllClipboardFileFormats())
+                DeleteClipboardContent();
             break;
         }
 
         case WM_RENDERFORMAT:
-            // TODO!
+        {
+            RenderClipboardFileFormat((UINT)wParam);
             break;
+        }
 
         case WM_DRAWCLIPBOARD:
         {
+            CaptureClipboardHistory();
             UpdateDisplayMenu();
             SetDisplayFormat(0);
 
@@ -776,15 +887,17 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
     return (int)msg.wParam;
 }
 
-// Create font and set G_TextFont
+// Create font and set Globals.hFont
 static VOID SetTextFont(int index)
 {
+    RECT rc;
+
     assert(index >= 0 && index < _countof(FontList));
     if (index == G_FontIndex)
         return;
 
-    if (G_TextFont != NULL)
-       DeleteObject(G_TextFont);
+    if (Globals.hFont != NULL)
+       DeleteObject(Globals.hFont);
 
     HDC hDC = GetDC(Globals.hMainWnd);
 
@@ -794,10 +907,10 @@ static VOID SetTextFont(int index)
     wcscpy(lf.lfFaceName, FontList[index].face);
     lf.lfHeight = - MulDiv( FontList[index].size, dpi, 72);
 
-    G_TextFont = CreateFontIndirect(&lf);
+    Globals.hFont = CreateFontIndirect(&lf);
 
     TEXTMETRICW tm;
-    HFONT hOldFont = SelectObject(hDC, G_TextFont);
+    HFONT hOldFont = SelectObject(hDC, Globals.hFont);
     /*
      * Note that the method with GetObjectW just returns
      * the original parameters with which the font was created.
@@ -816,6 +929,14 @@ static VOID SetTextFont(int index)
     G_FontIndex = index;
     CheckMenuItem(Globals.hMenu, CMD_FONT1 + G_FontIndex, MF_BYCOMMAND|MF_CHECKED);
 
+    /* The text extent depends on the font */
+    FreeClipboardTextIndex();
+    if (Globals.hMainWnd)
+    {
+        GetClipboardDataDimensions(Globals.uDisplayFormat, &rc);
+        UpdateWindowScrollState(Globals.hMainWnd, rc.right, rc.bottom, &Scrollstate);
+    }
+
     InvalidateRect(Globals.hMainWnd, NULL, TRUE);
     UpdateWindow(Globals.hMainWnd);
 }
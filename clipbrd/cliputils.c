@@ -195,54 +195,221 @@ BOOL IsClipboardFormatSupported(UINT uFormat)
     }
 }
 
-SIZE_T
-GetLineExtentW(
-    IN LPCWSTR lpText,
-    OUT LPCWSTR* lpNextLine)
+/*
+ * Line index of the displayed clipboard text. It's rebuilt only when the
+ * clipboard changes, so painting and scrolling cost only the visible lines.
+ */
+static TEXTINDEX TextIndex;
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLIPBRD_SSE2
+#endif
+
+static __inline UINT
+GetLowestBit(UINT uMask)
+{
+#ifdef _MSC_VER
+    unsigned long Index;
+
+    _BitScanForward(&Index, uMask);
+    return Index;
+#else
+    return __builtin_ctz(uMask);
+#endif
+}
+
+/*
+ * Finds the newlines in the cch characters of lpText, and stores the start
+ * of the line following each of them in lpLineStart (if not NULL).
+ * Returns the number of newlines.
+ */
+static SIZE_T
+ScanLineStarts(
+    IN LPCVOID lpText,
+    IN SIZE_T cch,
+    IN BOOL bUnicode,
+    OUT SIZE_T* lpLineStart OPTIONAL)
 {
-    LPCWSTR ptr;
+    SIZE_T i = 0, n = 0;
+#ifdef CLIPBRD_SSE2
+    UINT uMask;
 
-    /* Find the next line of text (lpText is NULL-terminated) */
     /* For newlines, focus only on '\n', not on '\r' */
-    ptr = wcschr(lpText, L'\n'); // Find the end of this line.
-    if (ptr)
+    if (bUnicode)
+    {
+        const __m128i Newline = _mm_set1_epi16(L'\n');
+
+        /* 8 characters at a time, 2 mask bits per character */
+        for (; i + 8 <= cch; i += 8)
+        {
+            uMask = _mm_movemask_epi8(_mm_cmpeq_epi16(
+                        _mm_loadu_si128((const __m128i*)((LPCWSTR)lpText + i)), Newline));
+            for (uMask &= 0x5555; uMask; uMask &= uMask - 1, n++)
+            {
+                if (lpLineStart)
+                    lpLineStart[n] = i + GetLowestBit(uMask) / 2 + 1;
+            }
+        }
+    }
+    else
+    {
+        const __m128i Newline = _mm_set1_epi8('\n');
+
+        /* 16 characters at a time */
+        for (; i + 16 <= cch; i += 16)
+        {
+            uMask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                        _mm_loadu_si128((const __m128i*)((LPCSTR)lpText + i)), Newline));
+            for (; uMask; uMask &= uMask - 1, n++)
+            {
+                if (lpLineStart)
+                    lpLineStart[n] = i + GetLowestBit(uMask) + 1;
+            }
+        }
+    }
+#endif
+
+    for (; i < cch; i++)
     {
-        /* We have the end of this line, go to the next line (ignore the endline in the count) */
-        *lpNextLine = ptr + 1;
+        if (bUnicode ? ((LPCWSTR)lpText)[i] != L'\n' : ((LPCSTR)lpText)[i] != '\n')
+            continue;
+        if (lpLineStart)
+            lpLineStart[n] = i + 1;
+        n++;
     }
+
+    return n;
+}
+
+static BOOL
+BuildTextIndex(
+    IN PTEXTINDEX pIndex,
+    IN LPCVOID lpText,
+    IN SIZE_T cbText,
+    IN BOOL bUnicode)
+{
+    SIZE_T cch, nNewlines;
+
+    /* The text is NULL-terminated, but don't trust it to be */
+    if (bUnicode)
+        cch = wcsnlen((LPCWSTR)lpText, cbText / sizeof(WCHAR));
     else
+        cch = strnlen((LPCSTR)lpText, cbText);
+
+    nNewlines = ScanLineStarts(lpText, cch, bUnicode, NULL);
+
+    /* One more line than newlines, plus the end of the text */
+    pIndex->lpLineStart = HeapAlloc(GetProcessHeap(), 0, (nNewlines + 2) * sizeof(SIZE_T));
+    if (!pIndex->lpLineStart)
+        return FALSE;
+
+    pIndex->lpLineStart[0] = 0;
+    ScanLineStarts(lpText, cch, bUnicode, pIndex->lpLineStart + 1);
+
+    /* A newline at the very end doesn't start another line */
+    pIndex->nLines = nNewlines + 1;
+    if (pIndex->lpLineStart[pIndex->nLines - 1] == cch)
+        pIndex->nLines--;
+    else
+        pIndex->lpLineStart[pIndex->nLines] = cch;
+
+    return TRUE;
+}
+
+static void
+MeasureTextIndex(
+    IN PTEXTINDEX pIndex,
+    IN LPCVOID lpText,
+    IN BOOL bUnicode)
+{
+    HDC hDC;
+    HFONT hOldFont;
+    SIZE_T i, lineSize;
+    LPCVOID lpLine;
+    DWORD dwSize;
+
+    pIndex->MaxWidth = 0;
+
+    hDC = GetDC(Globals.hMainWnd);
+    hOldFont = SelectObject(hDC, Globals.hFont);
+
+    for (i = 0; i < pIndex->nLines; i++)
+    {
+        lineSize = GetIndexedLine(pIndex, lpText, bUnicode, i, &lpLine);
+        if (bUnicode)
+            dwSize = GetTabbedTextExtentW(hDC, lpLine, lineSize, 0, NULL);
+        else
+            dwSize = GetTabbedTextExtentA(hDC, lpLine, lineSize, 0, NULL);
+        pIndex->MaxWidth = max(pIndex->MaxWidth, LOWORD(dwSize));
+    }
+
+    SelectObject(hDC, hOldFont);
+    ReleaseDC(Globals.hMainWnd, hDC);
+}
+
+/*
+ * Returns the line index of the text lpText of the (opened) clipboard in
+ * format uFormat, building it if the clipboard changed since.
+ * The index must be freed when the font changes.
+ */
+PTEXTINDEX
+GetClipboardTextIndex(
+    IN UINT uFormat,
+    IN LPCVOID lpText,
+    IN SIZE_T cbText)
+{
+    BOOL bUnicode = (uFormat == CF_UNICODETEXT);
+    DWORD dwSequence = GetClipboardSequenceNumber();
+
+    if (!TextIndex.lpLineStart ||
+        TextIndex.dwSequence != dwSequence ||
+        TextIndex.uFormat != uFormat)
     {
-        /* This line was the last one, go pointing to the terminating NULL */
-        ptr = lpText + wcslen(lpText);
-        *lpNextLine = ptr;
+        FreeClipboardTextIndex();
+        if (!BuildTextIndex(&TextIndex, lpText, cbText, bUnicode))
+            return NULL;
+        MeasureTextIndex(&TextIndex, lpText, bUnicode);
+        TextIndex.dwSequence = dwSequence;
+        TextIndex.uFormat = uFormat;
     }
 
-    return (ptr - lpText);
+    return &TextIndex;
+}
+
+void FreeClipboardTextIndex(void)
+{
+    if (TextIndex.lpLineStart)
+        HeapFree(GetProcessHeap(), 0, TextIndex.lpLineStart);
+    ZeroMemory(&TextIndex, sizeof(TextIndex));
 }
 
 SIZE_T
-GetLineExtentA(
-    IN LPCSTR lpText,
-    OUT LPCSTR* lpNextLine)
+GetIndexedLine(
+    IN PTEXTINDEX pIndex,
+    IN LPCVOID lpText,
+    IN BOOL bUnicode,
+    IN SIZE_T nLine,
+    OUT LPCVOID* lpLine)
 {
-    LPCSTR ptr;
+    SIZE_T Start = pIndex->lpLineStart[nLine];
+    SIZE_T End = pIndex->lpLineStart[nLine + 1];
 
-    /* Find the next line of text (lpText is NULL-terminated) */
-    /* For newlines, focus only on '\n', not on '\r' */
-    ptr = strchr(lpText, '\n'); // Find the end of this line.
-    if (ptr)
+    /* Ignore the endline in the count */
+    if (bUnicode)
     {
-        /* We have the end of this line, go to the next line (ignore the endline in the count) */
-        *lpNextLine = ptr + 1;
+        *lpLine = (LPCWSTR)lpText + Start;
+        if (End > Start && ((LPCWSTR)lpText)[End - 1] == L'\n')
+            --End;
     }
     else
     {
-        /* This line was the last one, go pointing to the terminating NULL */
-        ptr = lpText + strlen(lpText);
-        *lpNextLine = ptr;
+        *lpLine = (LPCSTR)lpText + Start;
+        if (End > Start && ((LPCSTR)lpText)[End - 1] == '\n')
+            --End;
     }
 
-    return (ptr - lpText);
+    return End - Start;
 }
 
 BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc)
@@ -264,7 +431,9 @@ BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc)
 
             hBitmap = (HBITMAP)GetClipboardData(CF_BITMAP);
             GetObjectW(hBitmap, sizeof(bmp), &bmp);
-            SetRect(pRc, 0, 0, bmp.bmWidth, bmp.bmHeight);
+            SetRect(pRc, 0, 0,
+                    ZOOM_SIZE(bmp.bmWidth,  Globals.uZoomLevel),
+                    ZOOM_SIZE(bmp.bmHeight, Globals.uZoomLevel));
             break;
         }
 
@@ -286,18 +455,19 @@ BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc)
             {
                 LPBITMAPCOREHEADER lpCoreHeader = (LPBITMAPCOREHEADER)lpInfoHeader;
                 SetRect(pRc, 0, 0,
-                        lpCoreHeader->bcWidth,
-                        lpCoreHeader->bcHeight);
+                        ZOOM_SIZE(lpCoreHeader->bcWidth,  Globals.uZoomLevel),
+                        ZOOM_SIZE(lpCoreHeader->bcHeight, Globals.uZoomLevel));
             }
             else if ((lpInfoHeader->biSize == sizeof(BITMAPINFOHEADER)) ||
                      (lpInfoHeader->biSize == sizeof(BITMAPV4HEADER))   ||
                      (lpInfoHeader->biSize == sizeof(BITMAPV5HEADER)))
             {
                 SetRect(pRc, 0, 0,
-                        lpInfoHeader->biWidth,
+                        ZOOM_SIZE(lpInfoHeader->biWidth, Globals.uZoomLevel),
                         /* NOTE: biHeight < 0 for bottom-up DIBs, or > 0 for top-down DIBs */
-                        (lpInfoHeader->biHeight > 0) ?  lpInfoHeader->biHeight
-                                                     : -lpInfoHeader->biHeight);
+                        ZOOM_SIZE((lpInfoHeader->biHeight > 0) ?  lpInfoHeader->biHeight
+                                                               : -lpInfoHeader->biHeight,
+                                  Globals.uZoomLevel));
             }
             else
             {
@@ -313,12 +483,9 @@ BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc)
         case CF_OEMTEXT:
         case CF_UNICODETEXT:
         {
-            HDC hDC;
             HGLOBAL hGlobal;
-            PVOID lpText, ptr;
-            DWORD dwSize;
-            SIZE txtSize = {0, 0};
-            SIZE_T lineSize;
+            PVOID lpText;
+            PTEXTINDEX pIndex;
 
             hGlobal = GetClipboardData(uFormat);
             if (!hGlobal)
@@ -328,35 +495,12 @@ BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc)
             if (!lpText)
                 break;
 
-            hDC = GetDC(Globals.hMainWnd);
-
-            /* Find the size of the rectangle enclosing the text */
-            for (;;)
-            {
-                if (uFormat == CF_UNICODETEXT)
-                {
-                    if (*(LPCWSTR)lpText == UNICODE_NULL)
-                        break;
-                    lineSize = GetLineExtentW(lpText, (LPCWSTR*)&ptr);
-                    dwSize = GetTabbedTextExtentW(hDC, lpText, lineSize, 0, NULL);
-                }
-                else
-                {
-                    if (*(LPCSTR)lpText == ANSI_NULL)
-                        break;
-                    lineSize = GetLineExtentA(lpText, (LPCSTR*)&ptr);
-                    dwSize = GetTabbedTextExtentA(hDC, lpText, lineSize, 0, NULL);
-                }
-                txtSize.cx = max(txtSize.cx, LOWORD(dwSize));
-                txtSize.cy += HIWORD(dwSize);
-                lpText = ptr;
-            }
-
-            ReleaseDC(Globals.hMainWnd, hDC);
+            /* The rectangle enclosing the text, lines are Globals.CharHeight apart */
+            pIndex = GetClipboardTextIndex(uFormat, lpText, GlobalSize(hGlobal));
+            if (pIndex)
+                SetRect(pRc, 0, 0, pIndex->MaxWidth, (LONG)pIndex->nLines * Globals.CharHeight);
 
             GlobalUnlock(hGlobal);
-
-            SetRect(pRc, 0, 0, txtSize.cx, txtSize.cy);
             break;
         }
 
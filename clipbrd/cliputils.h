@@ -26,14 +26,29 @@ void DeleteClipboardContent(void);
 UINT GetAutomaticClipboardFormat(void);
 BOOL IsClipboardFormatSupported(UINT uFormat);
 
-SIZE_T
-GetLineExtentW(
-    IN LPCWSTR lpText,
-    OUT LPCWSTR* lpNextLine);
+typedef struct _TEXTINDEX
+{
+    DWORD dwSequence;       /* Clipboard sequence number the index was built for */
+    UINT uFormat;
+    SIZE_T nLines;
+    SIZE_T* lpLineStart;    /* nLines + 1 line starts (in characters), the last one is the end of the text */
+    LONG MaxWidth;          /* Width of the longest line in the current font, in pixels */
+} TEXTINDEX, *PTEXTINDEX;
+
+PTEXTINDEX
+GetClipboardTextIndex(
+    IN UINT uFormat,
+    IN LPCVOID lpText,
+    IN SIZE_T cbText);
+
+void FreeClipboardTextIndex(void);
 
 SIZE_T
-GetLineExtentA(
-    IN LPCSTR lpText,
-    OUT LPCSTR* lpNextLine);
+GetIndexedLine(
+    IN PTEXTINDEX pIndex,
+    IN LPCVOID lpText,
+    IN BOOL bUnicode,
+    IN SIZE_T nLine,
+    OUT LPCVOID* lpLine);
 
 BOOL GetClipboardDataDimensions(UINT uFormat, PRECT pRc);
@@ -8,70 +8,50 @@
 
 #include "precomp.h"
 
-static HGLOBAL ClipboardReadMemoryBlock(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
+/*
+ * A loaded clipboard file stays mapped while we own the clipboard: its
+ * formats are announced for delayed rendering, and only built from the
+ * mapped view when somebody asks for them (WM_RENDERFORMAT).
+ */
+typedef struct _CLIPFILEFORMAT
 {
-    HGLOBAL hData;
-    LPVOID lpData;
-    DWORD dwBytesRead;
-
-    hData = GlobalAlloc(GHND, dwLength);
-    if (!hData)
-        return NULL;
-
-    lpData = GlobalLock(hData);
-    if (!lpData)
-    {
-        GlobalFree(hData);
-        return NULL;
-    }
-
-    if (SetFilePointer(hFile, dwOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
-    {
-        GlobalUnlock(hData);
-        GlobalFree(hData);
-        return NULL;
-    }
-
-    if (!ReadFile(hFile, lpData, dwLength, &dwBytesRead, NULL))
-    {
-        GlobalUnlock(hData);
-        GlobalFree(hData);
-        return NULL;
-    }
+    UINT uFormat;           /* Clipboard format it is rendered as */
+    DWORD dwOffData;
+    DWORD dwLenData;
+    BOOL bRendered;
+} CLIPFILEFORMAT;
 
-    GlobalUnlock(hData);
+typedef struct _CLIPFILE
+{
+    HANDLE hMapping;
+    PBYTE lpView;
+    SIZE_T cbView;
+    UINT nFormats;
+    CLIPFILEFORMAT* Formats;
+} CLIPFILE;
 
-    return hData;
-}
+static CLIPFILE ClipFile;
 
-static BOOL ClipboardReadMemory(HANDLE hFile, DWORD dwFormat, DWORD dwOffset, DWORD dwLength, WORD FileIdentifier, PVOID lpFormatName)
+static BOOL ClipboardRenderMemory(UINT uFormat, LPCVOID lpData, DWORD dwLength)
 {
     HGLOBAL hData;
-    DWORD dwTemp = 0;
+    LPVOID lpGlobal;
 
-    hData = ClipboardReadMemoryBlock(hFile, dwOffset, dwLength);
+    hData = GlobalAlloc(GMEM_MOVEABLE, dwLength);
     if (!hData)
         return FALSE;
 
-    if ((dwFormat >= 0xC000) && (dwFormat <= 0xFFFF))
-    {
-        if (FileIdentifier == CLIP_FMT_31)
-            dwTemp = RegisterClipboardFormatA((LPCSTR)lpFormatName);
-        else if ((FileIdentifier == CLIP_FMT_NT) || (FileIdentifier == CLIP_FMT_BK))
-            dwTemp = RegisterClipboardFormatW((LPCWSTR)lpFormatName);
-
-        if (!dwTemp)
-        {
-            GlobalFree(hData);
-            return FALSE;
-        }
-    }
-    else
+    lpGlobal = GlobalLock(hData);
+    if (!lpGlobal)
     {
-        dwTemp = dwFormat;
+        GlobalFree(hData);
+        return FALSE;
     }
 
-    if (!SetClipboardData(dwTemp, hData))
+    CopyMemory(lpGlobal, lpData, dwLength);
+    GlobalUnlock(hData);
+
+    if (!SetClipboardData(uFormat, hData))
     {
         GlobalFree(hData);
         return FALSE;
@@ -113,37 +93,25 @@ static BOOL ClipboardWriteMemory(HANDLE hFile, DWORD dwFormat, DWORD dwOffset, P
     return TRUE;
 }
 
-static BOOL ClipboardReadPalette(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
+static BOOL ClipboardRenderPalette(LPCVOID lpData, DWORD dwLength)
 {
-    LPLOGPALETTE lpPalette;
+    const LOGPALETTE* lpPalette = lpData;
     HPALETTE hPalette;
-    HGLOBAL hData;
-
-    hData = ClipboardReadMemoryBlock(hFile, dwOffset, dwLength);
-    if (!hData)
-    {
-        return FALSE;
-    }
 
-    lpPalette = GlobalLock(hData);
-    if (!lpPalette)
+    if (dwLength < FIELD_OFFSET(LOGPALETTE, palPalEntry) ||
+        dwLength < FIELD_OFFSET(LOGPALETTE, palPalEntry[lpPalette->palNumEntries]))
     {
-        GlobalFree(hData);
+        SetLastError(ERROR_INVALID_DATA);
         return FALSE;
     }
 
     hPalette = CreatePalette(lpPalette);
     if (!hPalette)
     {
-        GlobalUnlock(hData);
-        GlobalFree(hData);
         SetLastError(ERROR_OUTOFMEMORY);
         return FALSE;
     }
 
-    GlobalUnlock(hData);
-    GlobalFree(hData);
-
     if (!SetClipboardData(CF_PALETTE, hPalette))
     {
         DeleteObject(hPalette);
@@ -153,132 +121,194 @@ static BOOL ClipboardReadPalette(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
     return TRUE;
 }
 
-static BOOL ClipboardReadMetafile(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
+static BOOL ClipboardRenderMetafile(LPCVOID lpData, DWORD dwLength)
 {
     HMETAFILE hMf;
-    HGLOBAL hData;
-    LPVOID lpData;
 
-    hData = ClipboardReadMemoryBlock(hFile, dwOffset, dwLength);
-    if (!hData)
+    hMf = SetMetaFileBitsEx(dwLength, lpData);
+    if (!hMf)
     {
+        SetLastError(ERROR_OUTOFMEMORY);
         return FALSE;
     }
 
-    lpData = GlobalLock(hData);
-    if (!lpData)
+    if (!SetClipboardData(CF_METAFILEPICT, hMf))
     {
-        GlobalFree(hData);
+        DeleteMetaFile(hMf);
         return FALSE;
     }
 
-    hMf = SetMetaFileBitsEx(dwLength, lpData);
+    return TRUE;
+}
 
-    GlobalUnlock(hData);
-    GlobalFree(hData);
+static BOOL ClipboardRenderEnhMetafile(LPCVOID lpData, DWORD dwLength)
+{
+    HENHMETAFILE hEmf;
 
-    if (!hMf)
+    hEmf = SetEnhMetaFileBits(dwLength, lpData);
+    if (!hEmf)
     {
         SetLastError(ERROR_OUTOFMEMORY);
         return FALSE;
     }
 
-    if (!SetClipboardData(CF_METAFILEPICT, hMf))
+    if (!SetClipboardData(CF_ENHMETAFILE, hEmf))
     {
-        DeleteMetaFile(hMf);
+        DeleteEnhMetaFile(hEmf);
         return FALSE;
     }
 
     return TRUE;
 }
 
-static BOOL ClipboardReadEnhMetafile(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
+static BOOL ClipboardRenderBitmap(LPCVOID lpData, DWORD dwLength)
 {
-    HENHMETAFILE hEmf;
-    HGLOBAL hData;
-    LPVOID lpData;
+    BITMAP Bitmap;
+    HBITMAP hBitmap;
 
-    hData = ClipboardReadMemoryBlock(hFile, dwOffset, dwLength);
-    if (!hData)
+    /* The bits follow the BITMAP structure */
+    if (dwLength < sizeof(Bitmap))
     {
+        SetLastError(ERROR_INVALID_DATA);
         return FALSE;
     }
 
-    lpData = GlobalLock(hData);
-    if (!lpData)
+    CopyMemory(&Bitmap, lpData, sizeof(Bitmap));
+    if (Bitmap.bmWidthBytes < 0 || Bitmap.bmHeight < 0 ||
+        (ULONGLONG)Bitmap.bmWidthBytes * Bitmap.bmHeight * Bitmap.bmPlanes > dwLength - sizeof(Bitmap))
     {
-        GlobalFree(hData);
+        SetLastError(ERROR_INVALID_DATA);
         return FALSE;
     }
+    Bitmap.bmBits = (PBYTE)lpData + sizeof(Bitmap);
 
-    hEmf = SetEnhMetaFileBits(dwLength, lpData);
-
-    GlobalUnlock(hData);
-    GlobalFree(hData);
-
-    if (!hEmf)
+    hBitmap = CreateBitmapIndirect(&Bitmap);
+    if (!hBitmap)
     {
         SetLastError(ERROR_OUTOFMEMORY);
         return FALSE;
     }
 
-    if (!SetClipboardData(CF_ENHMETAFILE, hEmf))
+    if (!SetClipboardData(CF_BITMAP, hBitmap))
     {
-        DeleteEnhMetaFile(hEmf);
+        DeleteObject(hBitmap);
         return FALSE;
     }
 
     return TRUE;
 }
 
-static BOOL ClipboardReadBitmap(HANDLE hFile, DWORD dwOffset, DWORD dwLength)
+static BOOL ClipboardRenderFormat(CLIPFILEFORMAT* pFormat)
 {
-    HGLOBAL hData;
-    HBITMAP hBitmap;
-    LPBITMAP lpBitmap;
+    LPCVOID lpData = ClipFile.lpView + pFormat->dwOffData;
+    BOOL bResult;
 
-    hData = ClipboardReadMemoryBlock(hFile, dwOffset, dwLength);
-    if (!hData)
+    switch (pFormat->uFormat)
     {
-        return FALSE;
+        case CF_BITMAP:
+            bResult = ClipboardRenderBitmap(lpData, pFormat->dwLenData);
+            break;
+
+        case CF_METAFILEPICT:
+            bResult = ClipboardRenderMetafile(lpData, pFormat->dwLenData);
+            break;
+
+        case CF_ENHMETAFILE:
+            bResult = ClipboardRenderEnhMetafile(lpData, pFormat->dwLenData);
+            break;
+
+        case CF_PALETTE:
+            bResult = ClipboardRenderPalette(lpData, pFormat->dwLenData);
+            break;
+
+        default:
+            bResult = ClipboardRenderMemory(pFormat->uFormat, lpData, pFormat->dwLenData);
+            break;
     }
 
-    lpBitmap = GlobalLock(hData);
-    if (!lpBitmap)
+    pFormat->bRendered = bResult;
+    return bResult;
+}
+
+static CLIPFILEFORMAT* FindClipboardFileFormat(UINT uFormat)
+{
+    UINT i;
+
+    /* The last one wins, as when they were all set at once */
+    for (i = ClipFile.nFormats; i > 0; i--)
     {
-        GlobalFree(hData);
-        return FALSE;
+        if (ClipFile.Formats[i - 1].uFormat == uFormat)
+            return &ClipFile.Formats[i - 1];
     }
 
-    lpBitmap->bmBits = lpBitmap + sizeof(BITMAP) + 1;
+    return NULL;
+}
 
-    hBitmap = CreateBitmapIndirect(lpBitmap);
+/* Called on WM_RENDERFORMAT, the clipboard being opened by whoever asked for it */
+BOOL RenderClipboardFileFormat(UINT uFormat)
+{
+    CLIPFILEFORMAT* pFormat = FindClipboardFileFormat(uFormat);
 
-    GlobalUnlock(hData);
-    GlobalFree(hData);
+    if (!pFormat || pFormat->bRendered)
+        return FALSE;
 
-    if (!hBitmap)
-    {
-        SetLastError(ERROR_OUTOFMEMORY);
+    return ClipboardRenderFormat(pFormat);
+}
+
+/* Called on WM_RENDERALLFORMATS; returns FALSE if no clipboard file is loaded */
+BOOL RenderAllClipboardFileFormats(void)
+{
+    UINT i;
+
+    if (!ClipFile.lpView)
         return FALSE;
-    }
 
-    if (!SetClipboardData(CF_BITMAP, hBitmap))
+    if (OpenClipboard(Globals.hMainWnd))
     {
-        DeleteObject(hBitmap);
-        return FALSE;
+        /* Only if the clipboard is still ours */
+        if (GetClipboardOwner() == Globals.hMainWnd)
+        {
+            for (i = 0; i < ClipFile.nFormats; i++)
+            {
+                if (!ClipFile.Formats[i].bRendered && &ClipFile.Formats[i] == FindClipboardFileFormat(ClipFile.Formats[i].uFormat))
+                    ClipboardRenderFormat(&ClipFile.Formats[i]);
+            }
+        }
+        CloseClipboard();
     }
 
+    CloseClipboardFile();
     return TRUE;
 }
 
+BOOL IsClipboardFileFormatPending(UINT uFormat)
+{
+    CLIPFILEFORMAT* pFormat;
+
+    if (!ClipFile.lpView || GetClipboardOwner() != Globals.hMainWnd)
+        return FALSE;
+
+    pFormat = FindClipboardFileFormat(uFormat);
+    return pFormat && !pFormat->bRendered;
+}
+
+void CloseClipboardFile(void)
+{
+    if (ClipFile.Formats)
+        HeapFree(GetProcessHeap(), 0, ClipFile.Formats);
+    if (ClipFile.lpView)
+        UnmapViewOfFile(ClipFile.lpView);
+    if (ClipFile.hMapping)
+        CloseHandle(ClipFile.hMapping);
+
+    ZeroMemory(&ClipFile, sizeof(ClipFile));
+}
+
+/* Must be called with the clipboard opened and emptied by us */
 void ReadClipboardFile(LPCWSTR lpFileName)
 {
-    CLIPFILEHEADER ClipFileHeader;
     CLIPFORMATHEADER ClipFormatArray;
-    NTCLIPFILEHEADER NtClipFileHeader;
     NTCLIPFORMATHEADER NtClipFormatArray;
-    PVOID pClipFileHeader;
     PVOID pClipFormatArray;
     DWORD SizeOfFileHeader, SizeOfFormatHeader;
 
@@ -288,12 +318,14 @@ void ReadClipboardFile(LPCWSTR lpFileName)
     DWORD dwLenData;
     DWORD dwOffData;
     PVOID szName;
+    UINT uFormat;
 
     HANDLE hFile;
-    DWORD dwBytesRead;
-    BOOL bResult;
+    LARGE_INTEGER FileSize;
     int i;
 
+    CloseClipboardFile();
+
     /* Open the file for read access */
     hFile = CreateFileW(lpFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -303,29 +335,52 @@ void ReadClipboardFile(LPCWSTR lpFileName)
         goto done;
     }
 
-    /* Just read enough bytes to get the clipboard file format ID */
-    if (!ReadFile(hFile, &wFileIdentifier, sizeof(wFileIdentifier), &dwBytesRead, NULL))
+    if (!GetFileSizeEx(hFile, &FileSize))
+    {
+        ShowLastWin32Error(Globals.hMainWnd);
+        goto done;
+    }
+
+    /* Enough for the clipboard file format ID? (an empty file cannot be mapped) */
+    if (FileSize.QuadPart < sizeof(CLIPFILEHEADER))
+    {
+        MessageBoxRes(Globals.hMainWnd, Globals.hInstance, ERROR_INVALID_FILE_FORMAT, 0, MB_ICONSTOP | MB_OK);
+        goto done;
+    }
+
+    /* Map the whole file; it stays mapped until the formats are rendered */
+    ClipFile.hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!ClipFile.hMapping)
+    {
+        ShowLastWin32Error(Globals.hMainWnd);
+        goto done;
+    }
+
+    ClipFile.lpView = MapViewOfFile(ClipFile.hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!ClipFile.lpView)
     {
         ShowLastWin32Error(Globals.hMainWnd);
         goto done;
     }
+    ClipFile.cbView = (SIZE_T)FileSize.QuadPart;
 
     /* Set data according to the clipboard file format ID */
+    CopyMemory(&wFileIdentifier, ClipFile.lpView, sizeof(wFileIdentifier));
     switch (wFileIdentifier)
     {
         case CLIP_FMT_31:
             SizeOfFileHeader   = sizeof(CLIPFILEHEADER);
             SizeOfFormatHeader = sizeof(CLIPFORMATHEADER);
-            pClipFileHeader    = &ClipFileHeader;
             pClipFormatArray   = &ClipFormatArray;
+            wFormatCount = ((CLIPFILEHEADER*)ClipFile.lpView)->wFormatCount;
             break;
 
         case CLIP_FMT_NT:
         case CLIP_FMT_BK:
             SizeOfFileHeader   = sizeof(NTCLIPFILEHEADER);
             SizeOfFormatHeader = sizeof(NTCLIPFORMATHEADER);
-            pClipFileHeader    = &NtClipFileHeader;
             pClipFormatArray   = &NtClipFormatArray;
+            wFormatCount = ((NTCLIPFILEHEADER*)ClipFile.lpView)->wFormatCount;
             break;
 
         default:
@@ -333,44 +388,25 @@ void ReadClipboardFile(LPCWSTR lpFileName)
             goto done;
     }
 
-    /* Completely read the header */
-    SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
-    if (!ReadFile(hFile, pClipFileHeader, SizeOfFileHeader, &dwBytesRead, NULL) ||
-        dwBytesRead != SizeOfFileHeader)
+    /* The whole format data array must be in the file */
+    if (SizeOfFileHeader + (SIZE_T)wFormatCount * SizeOfFormatHeader > ClipFile.cbView)
     {
-        ShowLastWin32Error(Globals.hMainWnd);
+        MessageBoxRes(Globals.hMainWnd, Globals.hInstance, ERROR_INVALID_FILE_FORMAT, 0, MB_ICONSTOP | MB_OK);
         goto done;
     }
 
-    /* Get header data */
-    switch (wFileIdentifier)
+    ClipFile.Formats = HeapAlloc(GetProcessHeap(), 0, max(wFormatCount, 1) * sizeof(CLIPFILEFORMAT));
+    if (!ClipFile.Formats)
     {
-        case CLIP_FMT_31:
-            assert(wFileIdentifier == ((CLIPFILEHEADER*)pClipFileHeader)->wFileIdentifier);
-            wFormatCount = ((CLIPFILEHEADER*)pClipFileHeader)->wFormatCount;
-            break;
-
-        case CLIP_FMT_NT:
-        case CLIP_FMT_BK:
-            assert(wFileIdentifier == ((NTCLIPFILEHEADER*)pClipFileHeader)->wFileIdentifier);
-            wFormatCount = ((NTCLIPFILEHEADER*)pClipFileHeader)->wFormatCount;
-            break;
+        SetLastError(ERROR_OUTOFMEMORY);
+        ShowLastWin32Error(Globals.hMainWnd);
+        goto done;
     }
 
     /* Loop through the format data array */
     for (i = 0; i < wFormatCount; i++)
     {
-        if (SetFilePointer(hFile, SizeOfFileHeader + i * SizeOfFormatHeader, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
-        {
-            ShowLastWin32Error(Globals.hMainWnd);
-            goto done;
-        }
-
-        if (!ReadFile(hFile, pClipFormatArray, SizeOfFormatHeader, &dwBytesRead, NULL))
-        {
-            ShowLastWin32Error(Globals.hMainWnd);
-            goto done;
-        }
+        CopyMemory(pClipFormatArray, ClipFile.lpView + SizeOfFileHeader + i * SizeOfFormatHeader, SizeOfFormatHeader);
 
         /* Get format data */
         switch (wFileIdentifier)
@@ -380,6 +416,7 @@ void ReadClipboardFile(LPCWSTR lpFileName)
                 dwLenData  = ((CLIPFORMATHEADER*)pClipFormatArray)->dwLenData;
                 dwOffData  = ((CLIPFORMATHEADER*)pClipFormatArray)->dwOffData;
                 szName     = ((CLIPFORMATHEADER*)pClipFormatArray)->szName;
+                ((CLIPFORMATHEADER*)pClipFormatArray)->szName[MAX_FMT_NAME_LEN - 1] = ANSI_NULL;
                 break;
 
             case CLIP_FMT_NT:
@@ -388,61 +425,80 @@ void ReadClipboardFile(LPCWSTR lpFileName)
                 dwLenData  = ((NTCLIPFORMATHEADER*)pClipFormatArray)->dwLenData;
                 dwOffData  = ((NTCLIPFORMATHEADER*)pClipFormatArray)->dwOffData;
                 szName     = ((NTCLIPFORMATHEADER*)pClipFormatArray)->szName;
+                ((NTCLIPFORMATHEADER*)pClipFormatArray)->szName[MAX_FMT_NAME_LEN - 1] = UNICODE_NULL;
                 break;
         }
 
+        if (dwOffData > ClipFile.cbView || dwLenData > ClipFile.cbView - dwOffData)
+        {
+            MessageBoxRes(Globals.hMainWnd, Globals.hInstance, ERROR_INVALID_FILE_FORMAT, 0, MB_ICONSTOP | MB_OK);
+            continue;
+        }
+
         switch (dwFormatID)
         {
             case CF_OWNERDISPLAY:
-            {
-                break;
-            }
+                continue;
 
             case CF_DSPBITMAP:
             case CF_BITMAP:
-            {
-                bResult = ClipboardReadBitmap(hFile, dwOffData, dwLenData);
+                uFormat = CF_BITMAP;
                 break;
-            }
 
             case CF_DSPMETAFILEPICT:
             case CF_METAFILEPICT:
-            {
-                bResult = ClipboardReadMetafile(hFile, dwOffData, dwLenData);
+                uFormat = CF_METAFILEPICT;
                 break;
-            }
 
             case CF_DSPENHMETAFILE:
             case CF_ENHMETAFILE:
-            {
-                bResult = ClipboardReadEnhMetafile(hFile, dwOffData, dwLenData);
-                break;
-            }
-
-            case CF_PALETTE:
-            {
-                bResult = ClipboardReadPalette(hFile, dwOffData, dwLenData);
+                uFormat = CF_ENHMETAFILE;
                 break;
-            }
 
             default:
             {
-                if ((dwFormatID < CF_PRIVATEFIRST) || (dwFormatID > CF_PRIVATELAST))
+                if ((dwFormatID >= CF_PRIVATEFIRST) && (dwFormatID <= CF_PRIVATELAST))
+                    continue;
+
+                if ((dwFormatID >= 0xC000) && (dwFormatID <= 0xFFFF))
+                {
+                    if (wFileIdentifier == CLIP_FMT_31)
+                        uFormat = RegisterClipboardFormatA((LPCSTR)szName);
+                    else
+                        uFormat = RegisterClipboardFormatW((LPCWSTR)szName);
+
+                    if (!uFormat)
+                    {
+                        ShowLastWin32Error(Globals.hMainWnd);
+                        continue;
+                    }
+                }
+                else
                 {
-                    bResult = ClipboardReadMemory(hFile, dwFormatID, dwOffData, dwLenData, wFileIdentifier, szName);
+                    uFormat = dwFormatID;
                 }
                 break;
             }
         }
 
-        if (!bResult)
-            ShowLastWin32Error(Globals.hMainWnd);
+        /* Announce it; the data is rendered from the view when asked for */
+        SetClipboardData(uFormat, NULL);
+
+        ClipFile.Formats[ClipFile.nFormats].uFormat   = uFormat;
+        ClipFile.Formats[ClipFile.nFormats].dwOffData = dwOffData;
+        ClipFile.Formats[ClipFile.nFormats].dwLenData = dwLenData;
+        ClipFile.Formats[ClipFile.nFormats].bRendered = FALSE;
+        ClipFile.nFormats++;
     }
 
 done:
+    /* The mapping keeps the file open */
     if (hFile != INVALID_HANDLE_VALUE)
         CloseHandle(hFile);
 
+    if (ClipFile.nFormats == 0)
+        CloseClipboardFile();
+
     return;
 }
 
@@ -52,4 +52,8 @@ typedef struct _NTCLIPFORMATHEADER
 } NTCLIPFORMATHEADER;
 
 void ReadClipboardFile(LPCWSTR lpFileName);
+BOOL RenderClipboardFileFormat(UINT uFormat);
+BOOL RenderAllClipboardFileFormats(void);
+BOOL IsClipboardFileFormatPending(UINT uFormat);
+void CloseClipboardFile(void);
 void WriteClipboardFile(LPCWSTR lpFileName, WORD wFileIdentifier);
@@ -0,0 +1,778 @@
+/*
+ * PROJECT:     ReactOS Clipboard Viewer
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Clipboard history helper functions.
+ */
+
+#include "precomp.h"
+
+#include <stdio.h>
+
+/*
+ * Each clipboard change seen through the viewer chain becomes a history
+ * entry, the most recent first. The data of the formats are kept in blobs
+ * shared by content (so copying the same picture twice, or restoring an
+ * entry, costs nothing), the big ones compressed. Blobs are found by hash,
+ * but only shared once their contents compare equal. Above the memory
+ * budget, the blobs of the oldest entries move to temporary files; above
+ * the overall budget, the oldest entries are dropped.
+ */
+
+typedef struct _HISTORYBLOB
+{
+    struct _HISTORYBLOB* Next;  /* In its hash bucket */
+    ULONGLONG Hash;
+    SIZE_T cbData;              /* Size of the clipboard data */
+    SIZE_T cbStored;            /* Size of the stored (maybe compressed) data */
+    BOOL bCompressed;
+    LONG RefCount;
+    PBYTE lpStored;             /* The stored data, or NULL once spilled */
+    HANDLE hSpillFile;          /* Temporary file holding it once spilled */
+} HISTORYBLOB, *PHISTORYBLOB;
+
+typedef struct _HISTORYFORMAT
+{
+    UINT uFormat;
+    PHISTORYBLOB Blob;
+} HISTORYFORMAT;
+
+typedef struct _HISTORYENTRY
+{
+    SYSTEMTIME Time;
+    ULONGLONG Signature;        /* Of all the formats and their data */
+    WCHAR szPreview[HISTORY_PREVIEW_LEN + 1];
+    UINT nFormats;
+    HISTORYFORMAT Formats[1];
+} HISTORYENTRY, *PHISTORYENTRY;
+
+#define HISTORY_HASH_BUCKETS 256
+
+static PHISTORYENTRY HistoryEntries[HISTORY_MAX_ENTRIES];
+static UINT nHistoryEntries;
+static PHISTORYBLOB HistoryBlobs[HISTORY_HASH_BUCKETS];
+static SIZE_T cbHistoryStored;     /* In memory and on disk */
+static SIZE_T cbHistoryMemory;
+
+/*
+ * LZ77 codec, in the spirit of LZ4: sequences of a token byte (4 bits of
+ * literal count, 4 bits of match length - 4, 15 meaning more in the next
+ * bytes), the literals, and a 16-bit little endian match offset. The last
+ * sequence only has literals.
+ */
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    14
+#define LZ_MAX_OFFSET   0xFFFF
+#define LZ_TAIL         12      /* The last bytes are always literals */
+
+static __inline DWORD LzRead32(const BYTE* p)
+{
+    DWORD v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static __inline UINT LzHash(DWORD v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static PBYTE LzWriteLength(PBYTE op, SIZE_T Length)
+{
+    for (; Length >= 255; Length -= 255)
+        *op++ = 255;
+    *op++ = (BYTE)Length;
+    return op;
+}
+
+static PBYTE LzWriteSequence(PBYTE op, const BYTE* lpLiterals, SIZE_T nLiterals, SIZE_T MatchLength, SIZE_T Offset)
+{
+    PBYTE Token = op++;
+
+    *Token = (BYTE)(min(nLiterals, 15) << 4);
+    if (nLiterals >= 15)
+        op = LzWriteLength(op, nLiterals - 15);
+    memcpy(op, lpLiterals, nLiterals);
+    op += nLiterals;
+
+    if (MatchLength)
+    {
+        *op++ = (BYTE)Offset;
+        *op++ = (BYTE)(Offset >> 8);
+        MatchLength -= LZ_MIN_MATCH;
+        *Token |= (BYTE)min(MatchLength, 15);
+        if (MatchLength >= 15)
+            op = LzWriteLength(op, MatchLength - 15);
+    }
+    return op;
+}
+
+/* Worst case size of the compressed data */
+static SIZE_T LzBound(SIZE_T cb)
+{
+    return cb + cb / 255 + 16;
+}
+
+static SIZE_T LzCompress(const BYTE* lpSrc, SIZE_T cbSrc, PBYTE lpDst)
+{
+    const BYTE *ip = lpSrc, *anchor = lpSrc, *ref;
+    const BYTE *limit = lpSrc + (cbSrc > LZ_TAIL ? cbSrc - LZ_TAIL : 0);
+    const BYTE *end = lpSrc + cbSrc;
+    PBYTE op = lpDst;
+    UINT* Table;
+    SIZE_T Length;
+    UINT h;
+
+    Table = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(UINT) << LZ_HASH_BITS);
+    if (!Table)
+        return 0;
+
+    while (ip < limit)
+    {
+        h = LzHash(LzRead32(ip));
+        ref = lpSrc + Table[h];
+        Table[h] = (UINT)(ip - lpSrc);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || LzRead32(ref) != LzRead32(ip))
+        {
+            ip++;
+            continue;
+        }
+
+        /* Extend the match, but not into the tail */
+        for (Length = LZ_MIN_MATCH; ip + Length < limit && ref[Length] == ip[Length]; Length++);
+
+        op = LzWriteSequence(op, anchor, ip - anchor, Length, ip - ref);
+        ip += Length;
+        anchor = ip;
+    }
+
+    op = LzWriteSequence(op, anchor, end - anchor, 0, 0);
+
+    HeapFree(GetProcessHeap(), 0, Table);
+    return op - lpDst;
+}
+
+static BOOL LzReadLength(const BYTE** pip, const BYTE* end, SIZE_T* pLength)
+{
+    const BYTE* ip = *pip;
+    BYTE b;
+
+    do
+    {
+        if (ip >= end)
+            return FALSE;
+        b = *ip++;
+        *pLength += b;
+    } while (b == 255);
+
+    *pip = ip;
+    return TRUE;
+}
+
+static BOOL LzDecompress(const BYTE* lpSrc, SIZE_T cbSrc, PBYTE lpDst, SIZE_T cbDst)
+{
+    const BYTE *ip = lpSrc, *end = lpSrc + cbSrc;
+    PBYTE op = lpDst, oend = lpDst + cbDst;
+    const BYTE* ref;
+    SIZE_T Length, Offset;
+    BYTE Token;
+
+    for (;;)
+    {
+        if (ip >= end)
+            return FALSE;
+        Token = *ip++;
+
+        Length = Token >> 4;
+        if (Length == 15 && !LzReadLength(&ip, end, &Length))
+            return FALSE;
+        if (Length > (SIZE_T)(end - ip) || Length > (SIZE_T)(oend - op))
+            return FALSE;
+        memcpy(op, ip, Length);
+        op += Length;
+        ip += Length;
+
+        /* The last sequence has no match */
+        if (ip == end)
+            return op == oend;
+
+        if (end - ip < 2)
+            return FALSE;
+        Offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (Offset == 0 || Offset > (SIZE_T)(op - lpDst))
+            return FALSE;
+
+        Length = Token & 15;
+        if (Length == 15 && !LzReadLength(&ip, end, &Length))
+            return FALSE;
+        Length += LZ_MIN_MATCH;
+        if (Length > (SIZE_T)(oend - op))
+            return FALSE;
+
+        /* The match may overlap what it produces */
+        for (ref = op - Offset; Length; Length--)
+            *op++ = *ref++;
+    }
+}
+
+static ULONGLONG HashData(const BYTE* lpData, SIZE_T cb)
+{
+    ULONGLONG Hash = 0xCBF29CE484222325ULL ^ cb;
+    ULONGLONG Value;
+    SIZE_T i;
+
+    /* 8 bytes at a time, then the rest */
+    for (i = 0; i + 8 <= cb; i += 8)
+    {
+        memcpy(&Value, lpData + i, sizeof(Value));
+        Hash = (Hash ^ Value) * 0x100000001B3ULL;
+        Hash ^= Hash >> 29;
+    }
+    for (; i < cb; i++)
+        Hash = (Hash ^ lpData[i]) * 0x100000001B3ULL;
+
+    Hash ^= Hash >> 32;
+    return Hash * 0x9E3779B97F4A7C15ULL;
+}
+
+static BOOL ReadSpilledBlob(PHISTORYBLOB Blob, PBYTE lpStored)
+{
+    DWORD cbRead;
+
+    if (SetFilePointer(Blob->hSpillFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        return FALSE;
+    return ReadFile(Blob->hSpillFile, lpStored, (DWORD)Blob->cbStored, &cbRead, NULL) &&
+           cbRead == Blob->cbStored;
+}
+
+static BOOL LoadBlob(PHISTORYBLOB Blob, PBYTE lpData)
+{
+    PBYTE lpStored;
+    BOOL bSuccess;
+
+    if (!Blob->bCompressed)
+    {
+        if (!Blob->lpStored)
+            return ReadSpilledBlob(Blob, lpData);
+        memcpy(lpData, Blob->lpStored, Blob->cbData);
+        return TRUE;
+    }
+
+    if (Blob->lpStored)
+        return LzDecompress(Blob->lpStored, Blob->cbStored, lpData, Blob->cbData);
+
+    lpStored = HeapAlloc(GetProcessHeap(), 0, Blob->cbStored);
+    if (!lpStored)
+        return FALSE;
+    bSuccess = ReadSpilledBlob(Blob, lpStored) &&
+               LzDecompress(lpStored, Blob->cbStored, lpData, Blob->cbData);
+    HeapFree(GetProcessHeap(), 0, lpStored);
+    return bSuccess;
+}
+
+static BOOL SpillBlob(PHISTORYBLOB Blob)
+{
+    WCHAR szTempPath[MAX_PATH];
+    WCHAR szTempFile[MAX_PATH];
+    HANDLE hFile;
+    DWORD cbWritten;
+
+    if (!GetTempPathW(ARRAYSIZE(szTempPath), szTempPath) ||
+        !GetTempFileNameW(szTempPath, L"clp", 0, szTempFile))
+    {
+        return FALSE;
+    }
+
+    /* The file goes away with its handle, even if the viewer crashes */
+    hFile = CreateFileW(szTempFile, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        DeleteFileW(szTempFile);
+        return FALSE;
+    }
+
+    if (!WriteFile(hFile, Blob->lpStored, (DWORD)Blob->cbStored, &cbWritten, NULL) ||
+        cbWritten != Blob->cbStored)
+    {
+        CloseHandle(hFile);
+        return FALSE;
+    }
+
+    HeapFree(GetProcessHeap(), 0, Blob->lpStored);
+    Blob->lpStored = NULL;
+    Blob->hSpillFile = hFile;
+    cbHistoryMemory -= Blob->cbStored;
+    return TRUE;
+}
+
+/* The hash only finds the candidates, the contents decide */
+static BOOL BlobEquals(PHISTORYBLOB Blob, const BYTE* lpData, SIZE_T cbData)
+{
+    PBYTE lpBlobData;
+    BOOL bEqual;
+
+    if (Blob->cbData != cbData)
+        return FALSE;
+    if (!Blob->bCompressed && Blob->lpStored)
+        return memcmp(Blob->lpStored, lpData, cbData) == 0;
+
+    lpBlobData = HeapAlloc(GetProcessHeap(), 0, cbData);
+    if (!lpBlobData)
+        return FALSE;
+    bEqual = LoadBlob(Blob, lpBlobData) && memcmp(lpBlobData, lpData, cbData) == 0;
+    HeapFree(GetProcessHeap(), 0, lpBlobData);
+    return bEqual;
+}
+
+static PHISTORYBLOB StoreBlob(const BYTE* lpData, SIZE_T cbData)
+{
+    ULONGLONG Hash = HashData(lpData, cbData);
+    PHISTORYBLOB Blob;
+    PBYTE lpCompressed = NULL;
+    SIZE_T cbStored = cbData;
+
+    /* Same data already kept? */
+    for (Blob = HistoryBlobs[Hash % HISTORY_HASH_BUCKETS]; Blob; Blob = Blob->Next)
+    {
+        if (Blob->Hash == Hash && BlobEquals(Blob, lpData, cbData))
+        {
+            Blob->RefCount++;
+            return Blob;
+        }
+    }
+
+    /* Keep the compressed data only if it saves at least 1/8 */
+    if (cbData >= HISTORY_COMPRESS_MIN)
+    {
+        lpCompressed = HeapAlloc(GetProcessHeap(), 0, LzBound(cbData));
+        if (lpCompressed)
+        {
+            cbStored = LzCompress(lpData, cbData, lpCompressed);
+            if (!cbStored || cbStored > cbData - cbData / 8)
+            {
+                HeapFree(GetProcessHeap(), 0, lpCompressed);
+                lpCompressed = NULL;
+                cbStored = cbData;
+            }
+        }
+    }
+
+    Blob = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*Blob));
+    if (!Blob)
+    {
+        if (lpCompressed)
+            HeapFree(GetProcessHeap(), 0, lpCompressed);
+        return NULL;
+    }
+
+    if (lpCompressed)
+    {
+        /* Keep the compression buffer, without its slack */
+        Blob->lpStored = HeapReAlloc(GetProcessHeap(), 0, lpCompressed, cbStored);
+        if (!Blob->lpStored)
+            Blob->lpStored = lpCompressed;
+    }
+    else
+    {
+        Blob->lpStored = HeapAlloc(GetProcessHeap(), 0, cbStored);
+        if (!Blob->lpStored)
+        {
+            HeapFree(GetProcessHeap(), 0, Blob);
+            return NULL;
+        }
+        memcpy(Blob->lpStored, lpData, cbStored);
+    }
+
+    Blob->Hash = Hash;
+    Blob->cbData = cbData;
+    Blob->cbStored = cbStored;
+    Blob->bCompressed = (lpCompressed != NULL);
+    Blob->RefCount = 1;
+
+    Blob->Next = HistoryBlobs[Hash % HISTORY_HASH_BUCKETS];
+    HistoryBlobs[Hash % HISTORY_HASH_BUCKETS] = Blob;
+    cbHistoryStored += cbStored;
+    cbHistoryMemory += cbStored;
+    return Blob;
+}
+
+static void ReleaseBlob(PHISTORYBLOB Blob)
+{
+    PHISTORYBLOB* pPrev;
+
+    if (--Blob->RefCount > 0)
+        return;
+
+    for (pPrev = &HistoryBlobs[Blob->Hash % HISTORY_HASH_BUCKETS]; *pPrev != Blob; pPrev = &(*pPrev)->Next);
+    *pPrev = Blob->Next;
+
+    cbHistoryStored -= Blob->cbStored;
+    if (Blob->lpStored)
+    {
+        cbHistoryMemory -= Blob->cbStored;
+        HeapFree(GetProcessHeap(), 0, Blob->lpStored);
+    }
+    else
+    {
+        CloseHandle(Blob->hSpillFile);
+    }
+    HeapFree(GetProcessHeap(), 0, Blob);
+}
+
+static void FreeEntry(PHISTORYENTRY Entry)
+{
+    UINT i;
+
+    for (i = 0; i < Entry->nFormats; i++)
+        ReleaseBlob(Entry->Formats[i].Blob);
+    HeapFree(GetProcessHeap(), 0, Entry);
+}
+
+static BOOL IsHistoryFormat(UINT uFormat)
+{
+    switch (uFormat)
+    {
+        /* Handles to GDI objects, or nothing to copy */
+        case CF_BITMAP:
+        case CF_DSPBITMAP:
+        case CF_METAFILEPICT:
+        case CF_DSPMETAFILEPICT:
+        case CF_PALETTE:
+        case CF_OWNERDISPLAY:
+            return FALSE;
+
+        /* Synthesized by the system from the Unicode text or CF_DIBV5 */
+        case CF_TEXT:
+        case CF_OEMTEXT:
+            return !IsClipboardFormatAvailable(CF_UNICODETEXT);
+        case CF_DIB:
+            return !IsClipboardFormatAvailable(CF_DIBV5);
+
+        default:
+            return !(uFormat >= CF_PRIVATEFIRST && uFormat <= CF_PRIVATELAST) &&
+                   !(uFormat >= CF_GDIOBJFIRST  && uFormat <= CF_GDIOBJLAST);
+    }
+}
+
+static PHISTORYBLOB CaptureFormat(UINT uFormat)
+{
+    HANDLE hData;
+    PBYTE lpData;
+    SIZE_T cbData;
+    PHISTORYBLOB Blob = NULL;
+
+    hData = GetClipboardData(uFormat);
+    if (!hData)
+        return NULL;
+
+    if (uFormat == CF_ENHMETAFILE || uFormat == CF_DSPENHMETAFILE)
+    {
+        cbData = GetEnhMetaFileBits(hData, 0, NULL);
+        if (!cbData || cbData > HISTORY_MAX_FORMAT_SIZE)
+            return NULL;
+        lpData = HeapAlloc(GetProcessHeap(), 0, cbData);
+        if (!lpData)
+            return NULL;
+        if (GetEnhMetaFileBits(hData, (UINT)cbData, lpData))
+            Blob = StoreBlob(lpData, cbData);
+        HeapFree(GetProcessHeap(), 0, lpData);
+        return Blob;
+    }
+
+    cbData = GlobalSize(hData);
+    if (!cbData || cbData > HISTORY_MAX_FORMAT_SIZE)
+        return NULL;
+    lpData = GlobalLock(hData);
+    if (!lpData)
+        return NULL;
+    Blob = StoreBlob(lpData, cbData);
+    GlobalUnlock(hData);
+    return Blob;
+}
+
+static void SetEntryPreview(PHISTORYENTRY Entry)
+{
+    HANDLE hData;
+    PVOID lpText;
+    SIZE_T cbText;
+    UINT i;
+
+    if (IsClipboardFormatAvailable(CF_UNICODETEXT) && !IsClipboardFileFormatPending(CF_UNICODETEXT) &&
+        (hData = GetClipboardData(CF_UNICODETEXT)) &&
+        (lpText = GlobalLock(hData)))
+    {
+        cbText = GlobalSize(hData) / sizeof(WCHAR);
+        wcsncpy(Entry->szPreview, lpText, min(cbText, HISTORY_PREVIEW_LEN));
+        GlobalUnlock(hData);
+    }
+    else if (IsClipboardFormatAvailable(CF_TEXT) && !IsClipboardFileFormatPending(CF_TEXT) &&
+             (hData = GetClipboardData(CF_TEXT)) &&
+             (lpText = GlobalLock(hData)))
+    {
+        cbText = GlobalSize(hData);
+        MultiByteToWideChar(CP_ACP, 0, lpText, (int)min(strnlen(lpText, cbText), HISTORY_PREVIEW_LEN),
+                            Entry->szPreview, HISTORY_PREVIEW_LEN);
+        GlobalUnlock(hData);
+    }
+
+    /* Keep it on one line */
+    for (i = 0; i < HISTORY_PREVIEW_LEN && Entry->szPreview[i]; i++)
+    {
+        if (Entry->szPreview[i] < L' ')
+            Entry->szPreview[i] = L' ';
+    }
+}
+
+static void RemoveEntry(UINT nEntry)
+{
+    FreeEntry(HistoryEntries[nEntry]);
+    nHistoryEntries--;
+    MoveMemory(&HistoryEntries[nEntry], &HistoryEntries[nEntry + 1],
+               (nHistoryEntries - nEntry) * sizeof(HistoryEntries[0]));
+}
+
+/* Blobs are shared by content, so equal formats have the same blob */
+static BOOL EntryEquals(PHISTORYENTRY Entry1, PHISTORYENTRY Entry2)
+{
+    UINT i;
+
+    if (Entry1->Signature != Entry2->Signature || Entry1->nFormats != Entry2->nFormats)
+        return FALSE;
+    for (i = 0; i < Entry1->nFormats; i++)
+    {
+        if (Entry1->Formats[i].uFormat != Entry2->Formats[i].uFormat ||
+            Entry1->Formats[i].Blob != Entry2->Formats[i].Blob)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Moves the data of the oldest entry still having some in memory to disk */
+static BOOL SpillOldestBlob(void)
+{
+    PHISTORYBLOB Blob;
+    UINT i, j;
+
+    for (i = nHistoryEntries; i-- > 0;)
+    {
+        for (j = 0; j < HistoryEntries[i]->nFormats; j++)
+        {
+            Blob = HistoryEntries[i]->Formats[j].Blob;
+            if (Blob->lpStored && Blob->cbStored >= HISTORY_COMPRESS_MIN)
+                return SpillBlob(Blob);
+        }
+    }
+    return FALSE;
+}
+
+static void InsertEntry(PHISTORYENTRY Entry)
+{
+    UINT i;
+
+    /* Already there (copied again, or restored): move it first */
+    for (i = 0; i < nHistoryEntries; i++)
+    {
+        if (EntryEquals(HistoryEntries[i], Entry))
+        {
+            HistoryEntries[i]->Time = Entry->Time;
+            FreeEntry(Entry);
+            Entry = HistoryEntries[i];
+            MoveMemory(&HistoryEntries[1], &HistoryEntries[0], i * sizeof(HistoryEntries[0]));
+            HistoryEntries[0] = Entry;
+            return;
+        }
+    }
+
+    if (nHistoryEntries == HISTORY_MAX_ENTRIES)
+        RemoveEntry(nHistoryEntries - 1);
+
+    MoveMemory(&HistoryEntries[1], &HistoryEntries[0], nHistoryEntries * sizeof(HistoryEntries[0]));
+    HistoryEntries[0] = Entry;
+    nHistoryEntries++;
+
+    /* Drop the oldest entries above the budgets, but always keep the new one */
+    while (nHistoryEntries > 1 &&
+           (cbHistoryStored > HISTORY_MAX_BYTES ||
+            (cbHistoryMemory > HISTORY_MAX_MEMORY && !SpillOldestBlob())))
+    {
+        RemoveEntry(nHistoryEntries - 1);
+    }
+}
+
+void CaptureClipboardHistory(void)
+{
+    PHISTORYENTRY Entry;
+    PHISTORYBLOB Blob;
+    UINT uFormat, nFormats;
+
+    if (!OpenClipboard(Globals.hMainWnd))
+        return;
+
+    nFormats = CountClipboardFormats();
+    if (nFormats == 0)
+    {
+        CloseClipboard();
+        return;
+    }
+
+    Entry = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                      FIELD_OFFSET(HISTORYENTRY, Formats[nFormats]));
+    if (!Entry)
+    {
+        CloseClipboard();
+        return;
+    }
+
+    GetLocalTime(&Entry->Time);
+    Entry->Signature = 0xCBF29CE484222325ULL;
+
+    for (uFormat = EnumClipboardFormats(0); uFormat && Entry->nFormats < nFormats;
+         uFormat = EnumClipboardFormats(uFormat))
+    {
+        /* Do not render the formats of a loaded clipboard file just for the history */
+        if (!IsHistoryFormat(uFormat) || IsClipboardFileFormatPending(uFormat))
+            continue;
+
+        Blob = CaptureFormat(uFormat);
+        if (!Blob)
+            continue;
+
+        Entry->Formats[Entry->nFormats].uFormat = uFormat;
+        Entry->Formats[Entry->nFormats].Blob = Blob;
+        Entry->nFormats++;
+        Entry->Signature = (Entry->Signature ^ Blob->Hash ^ uFormat) * 0x100000001B3ULL;
+    }
+
+    SetEntryPreview(Entry);
+
+    CloseClipboard();
+
+    if (Entry->nFormats == 0)
+    {
+        FreeEntry(Entry);
+        return;
+    }
+
+    InsertEntry(Entry);
+}
+
+BOOL RestoreClipboardHistory(UINT nEntry)
+{
+    PHISTORYENTRY Entry;
+    HGLOBAL hData;
+    HENHMETAFILE hEmf;
+    PBYTE lpData;
+    BOOL bSuccess = TRUE;
+    UINT i;
+
+    if (nEntry >= nHistoryEntries)
+        return FALSE;
+    Entry = HistoryEntries[nEntry];
+
+    if (!OpenClipboard(Globals.hMainWnd))
+        return FALSE;
+
+    if (!EmptyClipboard())
+    {
+        CloseClipboard();
+        return FALSE;
+    }
+
+    for (i = 0; i < Entry->nFormats; i++)
+    {
+        UINT uFormat = Entry->Formats[i].uFormat;
+        PHISTORYBLOB Blob = Entry->Formats[i].Blob;
+
+        hData = GlobalAlloc(GMEM_MOVEABLE, Blob->cbData);
+        if (!hData)
+        {
+            bSuccess = FALSE;
+            continue;
+        }
+
+        lpData = GlobalLock(hData);
+        if (!lpData || !LoadBlob(Blob, lpData))
+        {
+            if (lpData)
+                GlobalUnlock(hData);
+            GlobalFree(hData);
+            bSuccess = FALSE;
+            continue;
+        }
+
+        if (uFormat == CF_ENHMETAFILE || uFormat == CF_DSPENHMETAFILE)
+        {
+            hEmf = SetEnhMetaFileBits((UINT)Blob->cbData, lpData);
+            GlobalUnlock(hData);
+            GlobalFree(hData);
+
+            if (!hEmf || !SetClipboardData(uFormat, hEmf))
+            {
+                if (hEmf)
+                    DeleteEnhMetaFile(hEmf);
+                bSuccess = FALSE;
+            }
+            continue;
+        }
+
+        GlobalUnlock(hData);
+        if (!SetClipboardData(uFormat, hData))
+        {
+            GlobalFree(hData);
+            bSuccess = FALSE;
+        }
+    }
+
+    CloseClipboard();
+
+    return bSuccess;
+}
+
+void ClearClipboardHistory(void)
+{
+    while (nHistoryEntries)
+        RemoveEntry(nHistoryEntries - 1);
+}
+
+UINT GetClipboardHistoryCount(void)
+{
+    return nHistoryEntries;
+}
+
+BOOL GetClipboardHistoryLabel(UINT nEntry, LPWSTR lpszLabel, UINT cch)
+{
+    PHISTORYENTRY Entry;
+    WCHAR szTime[32];
+    WCHAR szFormatName[MAX_FMT_NAME_LEN + 1];
+    SIZE_T cbData = 0;
+    UINT i;
+
+    if (nEntry >= nHistoryEntries)
+        return FALSE;
+    Entry = HistoryEntries[nEntry];
+
+    if (!GetTimeFormatW(LOCALE_USER_DEFAULT, 0, &Entry->Time, NULL, szTime, ARRAYSIZE(szTime)))
+        szTime[0] = UNICODE_NULL;
+
+    if (Entry->szPreview[0])
+    {
+        _snwprintf(lpszLabel, cch, L"&%u  %s  %s", (nEntry + 1) % 10, szTime, Entry->szPreview);
+    }
+    else
+    {
+        for (i = 0; i < Entry->nFormats; i++)
+            cbData += Entry->Formats[i].Blob->cbData;
+
+        RetrieveClipboardFormatName(Globals.hInstance, Entry->Formats[0].uFormat, TRUE,
+                                    szFormatName, ARRAYSIZE(szFormatName));
+        _snwprintf(lpszLabel, cch, L"&%u  %s  %s, %Iu KB", (nEntry + 1) % 10, szTime,
+                   szFormatName, (cbData + 1023) / 1024);
+    }
+    lpszLabel[cch - 1] = UNICODE_NULL;
+
+    return TRUE;
+}
@@ -0,0 +1,20 @@
+/*
+ * PROJECT:     ReactOS Clipboard Viewer
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Clipboard history helper functions.
+ */
+
+#pragma once
+
+#define HISTORY_MAX_ENTRIES     32
+#define HISTORY_MAX_BYTES       (64 * 1024 * 1024)  /* Stored (compressed) data of all the entries */
+#define HISTORY_MAX_MEMORY      (16 * 1024 * 1024)  /* Of which in memory, the rest in temporary files */
+#define HISTORY_MAX_FORMAT_SIZE (16 * 1024 * 1024)  /* Larger formats are not kept */
+#define HISTORY_COMPRESS_MIN    4096                /* Smaller formats are kept as they are, in memory */
+#define HISTORY_PREVIEW_LEN     40
+
+void CaptureClipboardHistory(void);
+BOOL RestoreClipboardHistory(UINT nEntry);
+void ClearClipboardHistory(void);
+UINT GetClipboardHistoryCount(void);
+BOOL GetClipboardHistoryLabel(UINT nEntry, LPWSTR lpszLabel, UINT cch);
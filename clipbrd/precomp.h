@@ -36,7 +36,9 @@
 #include "resources.h"
 #include "cliputils.h"
 #include "fileutils.h"
+#include "history.h"
 #include "scrollutils.h"
+#include "tileutils.h"
 #include "winutils.h"
 
 #define MAX_STRING_LEN 255
@@ -51,8 +53,10 @@ typedef struct _CLIPBOARD_GLOBALS
     HMENU hMenu;
     UINT uDisplayFormat;
     UINT uCheckedItem;
+    UINT uZoomLevel;        /* Bitmaps are shown scaled down by 2^uZoomLevel */
 
-    /* Metrics of the current font */
+    /* Current text font, and its metrics */
+    HFONT hFont;
     LONG CharWidth;
     LONG CharHeight;
 } CLIPBOARD_GLOBALS;
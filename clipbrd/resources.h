@@ -26,6 +26,9 @@
 #define CMD_FONT5C  135
 #define CMD_FONT6T  136
 
+#define CMD_HISTORY_CLEAR 140
+#define CMD_HISTORY_FIRST 900  /* Up to HISTORY_MAX_ENTRIES, below CMD_AUTOMATIC */
+
 #define CMD_AUTOMATIC 1000
 
 #define STRING_CLIPBOARD    120
@@ -0,0 +1,589 @@
+/*
+ * PROJECT:     ReactOS Clipboard Viewer
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Downscaled bitmap tiles helper functions.
+ */
+
+#include "precomp.h"
+
+/*
+ * A bitmap zoomed out is drawn from tiles of TILE_SIZE x TILE_SIZE pixels,
+ * level n holding the bitmap scaled down by 2^n. The tiles are produced by
+ * a background thread from a 32bpp copy of the bitmap, scaled down to fit
+ * TILE_SOURCE_MAX_BYTES: the coarsest level (a single tile) first, then
+ * the tiles the paints asked for. Until a tile is there, the matching part
+ * of a coarser one is stretched in its place. The levels finer than the
+ * copy are stretched straight from the clipboard when painted.
+ */
+
+typedef struct _TILE
+{
+    struct _TILE* Prev;     /* Less recently drawn */
+    struct _TILE* Next;
+    UINT uLevel;
+    UINT nTile;             /* Index in its level */
+    LONG Width;             /* At most TILE_SIZE */
+    LONG Height;
+    DWORD Pixels[1];        /* Width x Height, bottom-up */
+} TILE, *PTILE;
+
+typedef struct _TILELEVEL
+{
+    LONG Width;
+    LONG Height;
+    UINT nTilesX;
+    UINT nTilesY;
+    PTILE* Tiles;
+} TILELEVEL;
+
+typedef struct _TILECACHE
+{
+    UINT uFormat;
+    LONG Width;             /* Of the bitmap */
+    LONG Height;
+    UINT nLevels;           /* The last one is a single tile */
+    TILELEVEL Levels[TILE_MAX_LEVELS];
+    UINT uSourceLevel;      /* Of hSource; the finer levels have no tiles */
+    HBITMAP hSource;        /* 32bpp copy of the bitmap, for the thread */
+    SIZE_T cbSource;
+
+    CRITICAL_SECTION Lock;  /* Everything below, and the tiles */
+    PTILE LruHead;          /* Most recently drawn first; not the coarsest level */
+    PTILE LruTail;
+    SIZE_T cbTiles;
+    UINT uWantedLevel;
+    UINT nWanted;
+    UINT Wanted[TILE_MAX_WANTED];   /* Most recently asked for last */
+
+    HANDLE hThread;
+    HANDLE hWakeEvent;
+    volatile LONG bQuit;
+} TILECACHE, *PTILECACHE;
+
+static PTILECACHE TileCache;
+
+static void InitTileInfo(BITMAPINFOHEADER* lpInfoHeader, LONG Width, LONG Height)
+{
+    ZeroMemory(lpInfoHeader, sizeof(*lpInfoHeader));
+    lpInfoHeader->biSize = sizeof(*lpInfoHeader);
+    lpInfoHeader->biWidth = Width;
+    lpInfoHeader->biHeight = Height;    /* < 0 for top-down */
+    lpInfoHeader->biPlanes = 1;
+    lpInfoHeader->biBitCount = 32;
+    lpInfoHeader->biCompression = BI_RGB;
+}
+
+UINT GetTileLevelCount(LONG Width, LONG Height)
+{
+    UINT nLevels = 1;
+
+    while (nLevels < TILE_MAX_LEVELS &&
+           (ZOOM_SIZE(Width, nLevels - 1) > TILE_SIZE || ZOOM_SIZE(Height, nLevels - 1) > TILE_SIZE))
+    {
+        nLevels++;
+    }
+
+    return nLevels;
+}
+
+static void UnlinkTile(PTILECACHE pCache, PTILE pTile)
+{
+    if (pTile->Prev)
+        pTile->Prev->Next = pTile->Next;
+    else
+        pCache->LruHead = pTile->Next;
+
+    if (pTile->Next)
+        pTile->Next->Prev = pTile->Prev;
+    else
+        pCache->LruTail = pTile->Prev;
+}
+
+static void LinkTile(PTILECACHE pCache, PTILE pTile)
+{
+    pTile->Prev = NULL;
+    pTile->Next = pCache->LruHead;
+    if (pCache->LruHead)
+        pCache->LruHead->Prev = pTile;
+    else
+        pCache->LruTail = pTile;
+    pCache->LruHead = pTile;
+}
+
+/* Called with the lock held */
+static void InsertTile(PTILECACHE pCache, PTILE pTile)
+{
+    PTILE pOldest;
+
+    pCache->Levels[pTile->uLevel].Tiles[pTile->nTile] = pTile;
+
+    /* The coarsest level stands in for all the others, keep it */
+    if (pTile->uLevel == pCache->nLevels - 1)
+        return;
+
+    LinkTile(pCache, pTile);
+    pCache->cbTiles += FIELD_OFFSET(TILE, Pixels[pTile->Width * pTile->Height]);
+
+    while (pCache->cbSource + pCache->cbTiles > TILE_CACHE_MAX_BYTES && pCache->LruTail != pTile)
+    {
+        pOldest = pCache->LruTail;
+        UnlinkTile(pCache, pOldest);
+        pCache->Levels[pOldest->uLevel].Tiles[pOldest->nTile] = NULL;
+        pCache->cbTiles -= FIELD_OFFSET(TILE, Pixels[pOldest->Width * pOldest->Height]);
+        HeapFree(GetProcessHeap(), 0, pOldest);
+    }
+}
+
+static PTILE RenderTile(PTILECACHE pCache, HDC hdcSource, HDC hdcTile, PDWORD lpTileBits, UINT uLevel, UINT nTile)
+{
+    TILELEVEL* pLevel = &pCache->Levels[uLevel];
+    TILELEVEL* pSource = &pCache->Levels[pCache->uSourceLevel];
+    UINT Shift = uLevel - pCache->uSourceLevel;
+    PTILE pTile;
+    LONG x, y, Width, Height, Row;
+
+    x = (nTile % pLevel->nTilesX) * TILE_SIZE;
+    y = (nTile / pLevel->nTilesX) * TILE_SIZE;
+    Width  = min(TILE_SIZE, pLevel->Width  - x);
+    Height = min(TILE_SIZE, pLevel->Height - y);
+
+    pTile = HeapAlloc(GetProcessHeap(), 0, FIELD_OFFSET(TILE, Pixels[Width * Height]));
+    if (!pTile)
+        return NULL;
+
+    pTile->uLevel = uLevel;
+    pTile->nTile = nTile;
+    pTile->Width = Width;
+    pTile->Height = Height;
+
+    /* Average the source pixels down into the (top-down) tile bitmap */
+    StretchBlt(hdcTile, 0, 0, Width, Height,
+               hdcSource, x << Shift, y << Shift,
+               min(Width  << Shift, pSource->Width  - (x << Shift)),
+               min(Height << Shift, pSource->Height - (y << Shift)),
+               SRCCOPY);
+    GdiFlush();
+
+    for (Row = 0; Row < Height; Row++)
+    {
+        CopyMemory(&pTile->Pixels[(Height - 1 - Row) * Width],
+                   &lpTileBits[Row * TILE_SIZE],
+                   Width * sizeof(DWORD));
+    }
+
+    return pTile;
+}
+
+static DWORD WINAPI TileThreadProc(LPVOID lpParameter)
+{
+    PTILECACHE pCache = lpParameter;
+    BITMAPINFOHEADER InfoHeader;
+    HDC hdcSource, hdcTile;
+    HBITMAP hTileBitmap;
+    HGDIOBJ hOldSource, hOldTile;
+    PVOID lpTileBits;
+    PTILE pTile;
+    UINT uLevel, nTile, nRendered;
+
+    hdcSource = CreateCompatibleDC(NULL);
+    hdcTile = CreateCompatibleDC(NULL);
+    InitTileInfo(&InfoHeader, TILE_SIZE, -TILE_SIZE);
+    hTileBitmap = CreateDIBSection(hdcTile, (LPBITMAPINFO)&InfoHeader, DIB_RGB_COLORS, &lpTileBits, NULL, 0);
+    if (!hdcSource || !hdcTile || !hTileBitmap)
+        goto done;
+
+    hOldSource = SelectObject(hdcSource, pCache->hSource);
+    hOldTile = SelectObject(hdcTile, hTileBitmap);
+    SetStretchBltMode(hdcTile, HALFTONE);
+    SetBrushOrgEx(hdcTile, 0, 0, NULL);
+
+    /* The coarsest level first */
+    pTile = RenderTile(pCache, hdcSource, hdcTile, lpTileBits, pCache->nLevels - 1, 0);
+    if (pTile)
+    {
+        EnterCriticalSection(&pCache->Lock);
+        InsertTile(pCache, pTile);
+        LeaveCriticalSection(&pCache->Lock);
+        InvalidateRect(Globals.hMainWnd, NULL, FALSE);
+    }
+
+    while (WaitForSingleObject(pCache->hWakeEvent, INFINITE) == WAIT_OBJECT_0 && !pCache->bQuit)
+    {
+        nRendered = 0;
+
+        while (!pCache->bQuit)
+        {
+            /* The most recently asked for tile that is still missing */
+            EnterCriticalSection(&pCache->Lock);
+            uLevel = pCache->uWantedLevel;
+            nTile = (UINT)-1;
+            while (pCache->nWanted && nTile == (UINT)-1)
+            {
+                nTile = pCache->Wanted[--pCache->nWanted];
+                if (pCache->Levels[uLevel].Tiles[nTile])
+                    nTile = (UINT)-1;
+            }
+            LeaveCriticalSection(&pCache->Lock);
+
+            if (nTile == (UINT)-1)
+                break;
+
+            pTile = RenderTile(pCache, hdcSource, hdcTile, lpTileBits, uLevel, nTile);
+            if (!pTile)
+                break;
+
+            EnterCriticalSection(&pCache->Lock);
+            if (pCache->Levels[uLevel].Tiles[nTile])
+                HeapFree(GetProcessHeap(), 0, pTile);
+            else
+                InsertTile(pCache, pTile);
+            LeaveCriticalSection(&pCache->Lock);
+
+            /* Show them a few at a time */
+            if (++nRendered % 8 == 0)
+                InvalidateRect(Globals.hMainWnd, NULL, FALSE);
+        }
+
+        if (nRendered % 8 != 0)
+            InvalidateRect(Globals.hMainWnd, NULL, FALSE);
+    }
+
+    SelectObject(hdcTile, hOldTile);
+    SelectObject(hdcSource, hOldSource);
+
+done:
+    if (hTileBitmap)
+        DeleteObject(hTileBitmap);
+    if (hdcTile)
+        DeleteDC(hdcTile);
+    if (hdcSource)
+        DeleteDC(hdcSource);
+
+    return 0;
+}
+
+/* Must be called with the clipboard opened */
+static HBITMAP CreateSourceBitmap(PTILECACHE pCache)
+{
+    TILELEVEL* pSource = &pCache->Levels[pCache->uSourceLevel];
+    BITMAPINFOHEADER InfoHeader;
+    HDC hdcMem;
+    HBITMAP hBitmap;
+    HGDIOBJ hOldBitmap;
+    PVOID lpBits;
+    RECT rcDest, rcSrc;
+
+    hdcMem = CreateCompatibleDC(NULL);
+    if (!hdcMem)
+        return NULL;
+
+    InitTileInfo(&InfoHeader, pSource->Width, -pSource->Height);
+    hBitmap = CreateDIBSection(hdcMem, (LPBITMAPINFO)&InfoHeader, DIB_RGB_COLORS, &lpBits, NULL, 0);
+    if (!hBitmap)
+    {
+        DeleteDC(hdcMem);
+        return NULL;
+    }
+
+    hOldBitmap = SelectObject(hdcMem, hBitmap);
+    SetStretchBltMode(hdcMem, HALFTONE);
+    SetBrushOrgEx(hdcMem, 0, 0, NULL);
+
+    /* Scaled down by GDI straight from the clipboard, never copied at full size */
+    SetRect(&rcDest, 0, 0, pSource->Width, pSource->Height);
+    SetRect(&rcSrc, 0, 0, pCache->Width, pCache->Height);
+    StretchBltFromClipboard(pCache->uFormat, hdcMem, &rcDest, &rcSrc);
+
+    GdiFlush();
+    SelectObject(hdcMem, hOldBitmap);
+    DeleteDC(hdcMem);
+
+    return hBitmap;
+}
+
+BOOL CreateTileCache(UINT uFormat, LONG Width, LONG Height)
+{
+    PTILECACHE pCache;
+    UINT uLevel;
+
+    if (TileCache && TileCache->uFormat == uFormat &&
+        TileCache->Width == Width && TileCache->Height == Height)
+    {
+        return TRUE;
+    }
+
+    FreeTileCache();
+
+    if (Width <= 0 || Height <= 0)
+        return FALSE;
+
+    pCache = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*pCache));
+    if (!pCache)
+        return FALSE;
+
+    pCache->uFormat = uFormat;
+    pCache->Width = Width;
+    pCache->Height = Height;
+    pCache->nLevels = GetTileLevelCount(Width, Height);
+    InitializeCriticalSection(&pCache->Lock);
+    TileCache = pCache;
+
+    /* The finest level whose copy fits, the coarsest one always does */
+    while (pCache->uSourceLevel < pCache->nLevels - 1 &&
+           (ULONGLONG)ZOOM_SIZE(Width, pCache->uSourceLevel) * ZOOM_SIZE(Height, pCache->uSourceLevel) * sizeof(DWORD) >
+               TILE_SOURCE_MAX_BYTES)
+    {
+        pCache->uSourceLevel++;
+    }
+
+    for (uLevel = 0; uLevel < pCache->nLevels; uLevel++)
+    {
+        TILELEVEL* pLevel = &pCache->Levels[uLevel];
+
+        pLevel->Width = ZOOM_SIZE(Width, uLevel);
+        pLevel->Height = ZOOM_SIZE(Height, uLevel);
+        pLevel->nTilesX = (pLevel->Width + TILE_SIZE - 1) / TILE_SIZE;
+        pLevel->nTilesY = (pLevel->Height + TILE_SIZE - 1) / TILE_SIZE;
+
+        /* Level 0, and the levels finer than the copy, are drawn straight from the clipboard */
+        if (uLevel == 0 || uLevel < pCache->uSourceLevel)
+            continue;
+
+        pLevel->Tiles = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                  pLevel->nTilesX * pLevel->nTilesY * sizeof(PTILE));
+        if (!pLevel->Tiles)
+            goto Failure;
+    }
+
+    if (!OpenClipboard(Globals.hMainWnd))
+        goto Failure;
+    pCache->hSource = CreateSourceBitmap(pCache);
+    CloseClipboard();
+    if (!pCache->hSource)
+        goto Failure;
+    pCache->cbSource = (SIZE_T)pCache->Levels[pCache->uSourceLevel].Width *
+                       pCache->Levels[pCache->uSourceLevel].Height * sizeof(DWORD);
+
+    pCache->hWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!pCache->hWakeEvent)
+        goto Failure;
+
+    pCache->hThread = CreateThread(NULL, 0, TileThreadProc, pCache, 0, NULL);
+    if (!pCache->hThread)
+        goto Failure;
+
+    return TRUE;
+
+Failure:
+    FreeTileCache();
+    return FALSE;
+}
+
+void FreeTileCache(void)
+{
+    PTILECACHE pCache = TileCache;
+    UINT uLevel, nTile;
+
+    if (!pCache)
+        return;
+    TileCache = NULL;
+
+    if (pCache->hThread)
+    {
+        InterlockedExchange(&pCache->bQuit, TRUE);
+        SetEvent(pCache->hWakeEvent);
+        WaitForSingleObject(pCache->hThread, INFINITE);
+        CloseHandle(pCache->hThread);
+    }
+    if (pCache->hWakeEvent)
+        CloseHandle(pCache->hWakeEvent);
+    if (pCache->hSource)
+        DeleteObject(pCache->hSource);
+
+    for (uLevel = 0; uLevel < pCache->nLevels; uLevel++)
+    {
+        TILELEVEL* pLevel = &pCache->Levels[uLevel];
+
+        if (!pLevel->Tiles)
+            continue;
+
+        for (nTile = 0; nTile < pLevel->nTilesX * pLevel->nTilesY; nTile++)
+        {
+            if (pLevel->Tiles[nTile])
+                HeapFree(GetProcessHeap(), 0, pLevel->Tiles[nTile]);
+        }
+        HeapFree(GetProcessHeap(), 0, pLevel->Tiles);
+    }
+
+    DeleteCriticalSection(&pCache->Lock);
+    HeapFree(GetProcessHeap(), 0, pCache);
+}
+
+/* Called with the lock held */
+static void WantTile(PTILECACHE pCache, UINT uLevel, UINT nTile)
+{
+    UINT i;
+
+    if (pCache->uWantedLevel != uLevel)
+    {
+        pCache->uWantedLevel = uLevel;
+        pCache->nWanted = 0;
+    }
+
+    for (i = 0; i < pCache->nWanted; i++)
+    {
+        if (pCache->Wanted[i] == nTile)
+        {
+            MoveMemory(&pCache->Wanted[i], &pCache->Wanted[i + 1],
+                       (pCache->nWanted - i - 1) * sizeof(pCache->Wanted[0]));
+            pCache->nWanted--;
+            break;
+        }
+    }
+
+    /* Forget the oldest ones, likely scrolled away */
+    if (pCache->nWanted == TILE_MAX_WANTED)
+    {
+        MoveMemory(&pCache->Wanted[0], &pCache->Wanted[1],
+                   (TILE_MAX_WANTED - 1) * sizeof(pCache->Wanted[0]));
+        pCache->nWanted--;
+    }
+
+    pCache->Wanted[pCache->nWanted++] = nTile;
+}
+
+/* Called with the lock held; the part of a coarser tile covering the tile, stretched */
+static BOOL DrawCoarserTile(PTILECACHE pCache, HDC hdc, UINT uLevel, LONG x, LONG y,
+                            LONG Width, LONG Height, LONG xDest, LONG yDest)
+{
+    BITMAPINFOHEADER InfoHeader;
+    TILELEVEL* pLevel;
+    PTILE pTile;
+    UINT uCoarser, Shift;
+    LONG xCoarse, yCoarse, xSrc, ySrc, cxSrc, cySrc;
+
+    for (uCoarser = uLevel + 1; uCoarser < pCache->nLevels; uCoarser++)
+    {
+        pLevel = &pCache->Levels[uCoarser];
+        Shift = uCoarser - uLevel;
+        xCoarse = x >> Shift;
+        yCoarse = y >> Shift;
+
+        pTile = pLevel->Tiles[(yCoarse / TILE_SIZE) * pLevel->nTilesX + xCoarse / TILE_SIZE];
+        if (!pTile)
+            continue;
+
+        xSrc = xCoarse % TILE_SIZE;
+        ySrc = yCoarse % TILE_SIZE;
+        cxSrc = max(1, min(pTile->Width  - xSrc, Width  >> Shift));
+        cySrc = max(1, min(pTile->Height - ySrc, Height >> Shift));
+
+        InitTileInfo(&InfoHeader, pTile->Width, pTile->Height);
+        StretchDIBits(hdc, xDest, yDest, Width, Height,
+                      xSrc, pTile->Height - (ySrc + cySrc), cxSrc, cySrc,
+                      pTile->Pixels, (LPBITMAPINFO)&InfoHeader, DIB_RGB_COLORS, SRCCOPY);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Must be called with the clipboard opened; for the levels without tiles */
+static void DrawFromClipboard(PTILECACHE pCache, UINT uLevel, PAINTSTRUCT ps, SCROLLSTATE state)
+{
+    TILELEVEL* pLevel = &pCache->Levels[uLevel];
+    RECT rcDest, rcSrc;
+    LONG x, y;
+    int iOldMode;
+
+    /* Note that CurrentX/Y are in pixels! */
+    x = ps.rcPaint.left + state.CurrentX;
+    y = ps.rcPaint.top  + state.CurrentY;
+    SetRect(&rcDest, ps.rcPaint.left, ps.rcPaint.top,
+            ps.rcPaint.left + min(ps.rcPaint.right  - ps.rcPaint.left, pLevel->Width  - x),
+            ps.rcPaint.top  + min(ps.rcPaint.bottom - ps.rcPaint.top,  pLevel->Height - y));
+    if (x < 0 || y < 0 || IsRectEmpty(&rcDest))
+        return;
+
+    SetRect(&rcSrc, x << uLevel, y << uLevel,
+            min((rcDest.right  - ps.rcPaint.left + x) << uLevel, pCache->Width),
+            min((rcDest.bottom - ps.rcPaint.top  + y) << uLevel, pCache->Height));
+
+    iOldMode = SetStretchBltMode(ps.hdc, HALFTONE);
+    SetBrushOrgEx(ps.hdc, 0, 0, NULL);
+    StretchBltFromClipboard(pCache->uFormat, ps.hdc, &rcDest, &rcSrc);
+    SetStretchBltMode(ps.hdc, iOldMode);
+}
+
+void DrawTilesFromCache(UINT uLevel, PAINTSTRUCT ps, SCROLLSTATE state)
+{
+    PTILECACHE pCache = TileCache;
+    BITMAPINFOHEADER InfoHeader;
+    TILELEVEL* pLevel;
+    PTILE pTile;
+    RECT rc;
+    UINT FirstX, FirstY, LastX, LastY, tx, ty, nTile;
+    BOOL bWanted = FALSE;
+
+    if (!pCache || uLevel == 0 || uLevel >= pCache->nLevels)
+        return;
+    pLevel = &pCache->Levels[uLevel];
+
+    if (uLevel < pCache->uSourceLevel)
+    {
+        DrawFromClipboard(pCache, uLevel, ps, state);
+        return;
+    }
+
+    /* The tiles in the update rectangle (Note that CurrentX/Y are in pixels!) */
+    if (ps.rcPaint.right + state.CurrentX <= 0 || ps.rcPaint.bottom + state.CurrentY <= 0)
+        return;
+    FirstX = max(0, ps.rcPaint.left + state.CurrentX) / TILE_SIZE;
+    FirstY = max(0, ps.rcPaint.top  + state.CurrentY) / TILE_SIZE;
+    LastX = min((UINT)(ps.rcPaint.right  + state.CurrentX - 1) / TILE_SIZE, pLevel->nTilesX - 1);
+    LastY = min((UINT)(ps.rcPaint.bottom + state.CurrentY - 1) / TILE_SIZE, pLevel->nTilesY - 1);
+
+    EnterCriticalSection(&pCache->Lock);
+
+    for (ty = FirstY; ty <= LastY; ty++)
+    {
+        for (tx = FirstX; tx <= LastX; tx++)
+        {
+            nTile = ty * pLevel->nTilesX + tx;
+            rc.left = tx * TILE_SIZE - state.CurrentX;
+            rc.top  = ty * TILE_SIZE - state.CurrentY;
+            rc.right  = rc.left + min(TILE_SIZE, pLevel->Width  - (LONG)(tx * TILE_SIZE));
+            rc.bottom = rc.top  + min(TILE_SIZE, pLevel->Height - (LONG)(ty * TILE_SIZE));
+
+            pTile = pLevel->Tiles[nTile];
+            if (pTile)
+            {
+                InitTileInfo(&InfoHeader, pTile->Width, pTile->Height);
+                SetDIBitsToDevice(ps.hdc, rc.left, rc.top, pTile->Width, pTile->Height,
+                                  0, 0, 0, pTile->Height, pTile->Pixels,
+                                  (LPBITMAPINFO)&InfoHeader, DIB_RGB_COLORS);
+
+                if (uLevel != pCache->nLevels - 1)
+                {
+                    UnlinkTile(pCache, pTile);
+                    LinkTile(pCache, pTile);
+                }
+                continue;
+            }
+
+            WantTile(pCache, uLevel, nTile);
+            bWanted = TRUE;
+
+            if (!DrawCoarserTile(pCache, ps.hdc, uLevel, tx * TILE_SIZE, ty * TILE_SIZE,
+                                 rc.right - rc.left, rc.bottom - rc.top, rc.left, rc.top))
+            {
+                FillRect(ps.hdc, &rc, (HBRUSH)(COLOR_WINDOW + 1));
+            }
+        }
+    }
+
+    LeaveCriticalSection(&pCache->Lock);
+
+    if (bWanted)
+        SetEvent(pCache->hWakeEvent);
+}
@@ -0,0 +1,21 @@
+/*
+ * PROJECT:     ReactOS Clipboard Viewer
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Downscaled bitmap tiles helper functions.
+ */
+
+#pragma once
+
+#define TILE_SIZE               256
+#define TILE_MAX_LEVELS         16
+#define TILE_MAX_WANTED         64                  /* Missing tiles queued by the last paints */
+#define TILE_CACHE_MAX_BYTES    (128 * 1024 * 1024) /* The copy of the bitmap, and the tiles of all the levels but the coarsest one */
+#define TILE_SOURCE_MAX_BYTES   (32 * 1024 * 1024)  /* Of which the copy of the bitmap, scaled down to fit */
+
+/* Size of a bitmap dimension at zoom level uLevel (scaled down by 2^uLevel) */
+#define ZOOM_SIZE(Size, uLevel) (((Size) + (1 << (uLevel)) - 1) >> (uLevel))
+
+UINT GetTileLevelCount(LONG Width, LONG Height);
+BOOL CreateTileCache(UINT uFormat, LONG Width, LONG Height);
+void FreeTileCache(void);
+void DrawTilesFromCache(UINT uLevel, PAINTSTRUCT ps, SCROLLSTATE state);
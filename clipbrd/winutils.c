@@ -76,9 +76,11 @@ void DrawTextFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE state)
 {
     POINT ptOrg;
     HGLOBAL hGlobal;
-    PVOID lpText, ptr;
+    PVOID lpText;
+    LPCVOID lpLine;
+    PTEXTINDEX pIndex;
     SIZE_T lineSize;
-    INT FirstLine, LastLine;
+    INT FirstLine, LastLine, Line;
 
     hGlobal = GetClipboardData(uFormat);
     if (!hGlobal)
@@ -88,65 +90,39 @@ void DrawTextFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE state)
     if (!lpText)
         return;
 
-    /* Find the first and last line indices to display (Note that CurrentX/Y are in pixels!) */
-    FirstLine = max(0, (state.CurrentY + ps.rcPaint.top) / Globals.CharHeight);
-    // LastLine = min(LINES - 1, (state.CurrentY + ps.rcPaint.bottom) / Globals.CharHeight);
-    // NOTE: Can be less or greater than the actual number of lines in the text.
-    LastLine = (state.CurrentY + ps.rcPaint.bottom) / Globals.CharHeight;
-
-    /* Find the first text line to display */
-    while (FirstLine > 0)
+    pIndex = GetClipboardTextIndex(uFormat, lpText, GlobalSize(hGlobal));
+    if (!pIndex || pIndex->nLines == 0)
     {
-        if (uFormat == CF_UNICODETEXT)
-        {
-            if (*(LPCWSTR)lpText == UNICODE_NULL)
-                break;
-            GetLineExtentW(lpText, (LPCWSTR*)&ptr);
-        }
-        else
-        {
-            if (*(LPCSTR)lpText == ANSI_NULL)
-                break;
-            GetLineExtentA(lpText, (LPCSTR*)&ptr);
-        }
-
-        --FirstLine;
-        --LastLine;
-
-        lpText = ptr;
+        GlobalUnlock(hGlobal);
+        return;
     }
 
+    /* Find the first and last line indices to display (Note that CurrentX/Y are in pixels!) */
+    FirstLine = max(0, (state.CurrentY + ps.rcPaint.top) / Globals.CharHeight);
+    LastLine = (INT)min((SIZE_T)((state.CurrentY + ps.rcPaint.bottom) / Globals.CharHeight),
+                        pIndex->nLines - 1);
+
     ptOrg.x = ps.rcPaint.left;
-    ptOrg.y = /* FirstLine */ max(0, (state.CurrentY + ps.rcPaint.top) / Globals.CharHeight)
-                    * Globals.CharHeight - state.CurrentY;
+    ptOrg.y = FirstLine * Globals.CharHeight - state.CurrentY;
 
-    /* Display each line from the current one up to the last one */
-    ++LastLine;
-    while (LastLine >= 0)
+    /* Display each line from the first one up to the last one */
+    for (Line = FirstLine; Line <= LastLine; Line++)
     {
+        lineSize = GetIndexedLine(pIndex, lpText, uFormat == CF_UNICODETEXT, Line, &lpLine);
         if (uFormat == CF_UNICODETEXT)
         {
-            if (*(LPCWSTR)lpText == UNICODE_NULL)
-                break;
-            lineSize = GetLineExtentW(lpText, (LPCWSTR*)&ptr);
             TabbedTextOutW(ps.hdc, /*ptOrg.x*/0 - state.CurrentX, ptOrg.y,
-                           lpText, lineSize, 0, NULL,
+                           lpLine, lineSize, 0, NULL,
                            /*ptOrg.x*/0 - state.CurrentX);
         }
         else
         {
-            if (*(LPCSTR)lpText == ANSI_NULL)
-                break;
-            lineSize = GetLineExtentA(lpText, (LPCSTR*)&ptr);
             TabbedTextOutA(ps.hdc, /*ptOrg.x*/0 - state.CurrentX, ptOrg.y,
-                           lpText, lineSize, 0, NULL,
+                           lpLine, lineSize, 0, NULL,
                            /*ptOrg.x*/0 - state.CurrentX);
         }
 
-        --LastLine;
-
         ptOrg.y += Globals.CharHeight;
-        lpText = ptr;
     }
 
     GlobalUnlock(hGlobal);
@@ -184,22 +160,11 @@ void BitBltFromClipboard(PAINTSTRUCT ps, SCROLLSTATE state, DWORD dwRop)
     DeleteDC(hdcMem);
 }
 
-void SetDIBitsToDeviceFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE state, UINT fuColorUse)
+/* Returns the bits following the header and color table of a packed DIB */
+static LPBYTE GetPackedDIBBits(LPBITMAPINFOHEADER lpInfoHeader, UINT fuColorUse, PLONG pWidth, PLONG pHeight)
 {
-    HGLOBAL hGlobal;
-    LPBITMAPINFOHEADER lpInfoHeader;
-    LPBYTE lpBits;
-    LONG bmWidth, bmHeight;
     DWORD dwPalSize = 0;
 
-    hGlobal = GetClipboardData(uFormat);
-    if (!hGlobal)
-        return;
-
-    lpInfoHeader = GlobalLock(hGlobal);
-    if (!lpInfoHeader)
-        return;
-
     if (lpInfoHeader->biSize == sizeof(BITMAPCOREHEADER))
     {
         LPBITMAPCOREHEADER lpCoreHeader = (LPBITMAPCOREHEADER)lpInfoHeader;
@@ -216,8 +181,8 @@ void SetDIBitsToDeviceFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE st
                 dwPalSize *= sizeof(WORD);
         }
 
-        bmWidth  = lpCoreHeader->bcWidth;
-        bmHeight = lpCoreHeader->bcHeight;
+        *pWidth  = lpCoreHeader->bcWidth;
+        *pHeight = lpCoreHeader->bcHeight;
     }
     else if ((lpInfoHeader->biSize == sizeof(BITMAPINFOHEADER)) ||
              (lpInfoHeader->biSize == sizeof(BITMAPV4HEADER))   ||
@@ -269,18 +234,68 @@ void SetDIBitsToDeviceFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE st
         }
 #endif
 
-        bmWidth  = lpInfoHeader->biWidth;
+        *pWidth  = lpInfoHeader->biWidth;
         /* NOTE: biHeight < 0 for bottom-up DIBs, or > 0 for top-down DIBs */
-        bmHeight = lpInfoHeader->biHeight;
+        *pHeight = lpInfoHeader->biHeight;
     }
     else
     {
         /* Invalid format */
+        return NULL;
+    }
+
+    return (LPBYTE)lpInfoHeader + lpInfoHeader->biSize + dwPalSize;
+}
+
+void SetDIBitsToDeviceFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE state, UINT fuColorUse)
+{
+    HGLOBAL hGlobal;
+    LPBITMAPINFOHEADER lpInfoHeader;
+    LPBYTE lpBits;
+    LONG bmWidth, bmHeight;
+
+    hGlobal = GetClipboardData(uFormat);
+    if (!hGlobal)
+        return;
+
+    lpInfoHeader = GlobalLock(hGlobal);
+    if (!lpInfoHeader)
+        return;
+
+    lpBits = GetPackedDIBBits(lpInfoHeader, fuColorUse, &bmWidth, &bmHeight);
+    if (!lpBits)
+    {
         GlobalUnlock(hGlobal);
         return;
     }
 
-    lpBits = (LPBYTE)lpInfoHeader + lpInfoHeader->biSize + dwPalSize;
+    /* Only set the bits of the update rectangle, for the (usual) bottom-up DIBs */
+    if (bmHeight > 0)
+    {
+        LONG xSrc = ps.rcPaint.left + state.CurrentX;
+        LONG ySrc = ps.rcPaint.top  + state.CurrentY;
+        LONG cx = min(ps.rcPaint.right  - ps.rcPaint.left, bmWidth  - xSrc);
+        LONG cy = min(ps.rcPaint.bottom - ps.rcPaint.top,  bmHeight - ySrc);
+
+        if (cx > 0 && cy > 0)
+        {
+            SetDIBitsToDevice(ps.hdc,
+                              ps.rcPaint.left,
+                              ps.rcPaint.top,
+                              cx,
+                              cy,
+                              xSrc,
+                              bmHeight - (ySrc + cy),
+                              0,
+                              bmHeight,
+                              lpBits,
+                              (LPBITMAPINFO)lpInfoHeader,
+                              fuColorUse);
+        }
+
+        GlobalUnlock(hGlobal);
+        return;
+    }
 
     /*
      * The seventh parameter (YSrc) of SetDIBitsToDevice always designates
@@ -303,6 +318,67 @@ void SetDIBitsToDeviceFromClipboard(UINT uFormat, PAINTSTRUCT ps, SCROLLSTATE st
     GlobalUnlock(hGlobal);
 }
 
+/* Draws lprcSrc of the bitmap into lprcDest, in the stretch mode of hdc */
+void StretchBltFromClipboard(UINT uFormat, HDC hdc, const RECT* lprcDest, const RECT* lprcSrc)
+{
+    HGLOBAL hGlobal;
+    LPBITMAPINFOHEADER lpInfoHeader;
+    LPBYTE lpBits;
+    HDC hdcMem;
+    HBITMAP hBitmap;
+    HGDIOBJ hOldBitmap;
+    LONG bmWidth, bmHeight;
+
+    if (uFormat == CF_BITMAP || uFormat == CF_DSPBITMAP)
+    {
+        hBitmap = (HBITMAP)GetClipboardData(CF_BITMAP);
+        if (!hBitmap)
+            return;
+
+        hdcMem = CreateCompatibleDC(hdc);
+        if (!hdcMem)
+            return;
+
+        hOldBitmap = SelectObject(hdcMem, hBitmap);
+        StretchBlt(hdc,
+                   lprcDest->left, lprcDest->top,
+                   lprcDest->right - lprcDest->left, lprcDest->bottom - lprcDest->top,
+                   hdcMem,
+                   lprcSrc->left, lprcSrc->top,
+                   lprcSrc->right - lprcSrc->left, lprcSrc->bottom - lprcSrc->top,
+                   SRCCOPY);
+        SelectObject(hdcMem, hOldBitmap);
+        DeleteDC(hdcMem);
+        return;
+    }
+
+    hGlobal = GetClipboardData(uFormat);
+    if (!hGlobal)
+        return;
+
+    lpInfoHeader = GlobalLock(hGlobal);
+    if (!lpInfoHeader)
+        return;
+
+    lpBits = GetPackedDIBBits(lpInfoHeader, DIB_RGB_COLORS, &bmWidth, &bmHeight);
+    if (lpBits)
+    {
+        /* The source rectangle of the (usual) bottom-up DIBs starts from the bottom */
+        StretchDIBits(hdc,
+                      lprcDest->left, lprcDest->top,
+                      lprcDest->right - lprcDest->left, lprcDest->bottom - lprcDest->top,
+                      lprcSrc->left,
+                      bmHeight > 0 ? bmHeight - lprcSrc->bottom : lprcSrc->top,
+                      lprcSrc->right - lprcSrc->left, lprcSrc->bottom - lprcSrc->top,
+                      lpBits,
+                      (LPBITMAPINFO)lpInfoHeader,
+                      DIB_RGB_COLORS,
+                      SRCCOPY);
+    }
+
+    GlobalUnlock(hGlobal);
+}
+
 void PlayMetaFileFromClipboard(HDC hdc, const RECT *lpRect)
 {
     LPMETAFILEPICT mp;
@@ -29,12 +29,29 @@
 #define GCL_HICONSM     GCLP_HICON
 #endif
 
-typedef struct
+/*
+ * The refresh thread keeps the list items in a hash table by HWND and
+ * diffs every enumeration against it: only new, changed and vanished
+ * windows cause list view calls. Each item owns an image list slot for
+ * its whole life, and its icon is only asked for again every
+ * APPL_ICON_REFRESH refreshes.
+ */
+#define APPL_HASH_BUCKETS       256
+#define APPL_ICON_REFRESH       10
+
+typedef struct _APPLICATION_PAGE_LIST_ITEM
 {
     HWND    hWnd;
     WCHAR   szTitle[260];
     HICON   hIcon;
     BOOL    bHung;
+
+    /* Only used by the refresh thread */
+    struct _APPLICATION_PAGE_LIST_ITEM *pHashNext;
+    INT     iImage;             /* Slot in both image lists */
+    DWORD   dwLastSeen;         /* Enumeration that last found the window */
+    DWORD   dwIconTime;         /* Enumeration that last asked for the icon */
+    BOOL    bLargeIcon;
 } APPLICATION_PAGE_LIST_ITEM, *LPAPPLICATION_PAGE_LIST_ITEM;
 
 HWND            hApplicationPage;               /* Application List Property Page */
@@ -46,11 +63,17 @@ static int      nApplicationPageWidth;
 static int      nApplicationPageHeight;
 static BOOL     bSortAscending = TRUE;
 DWORD WINAPI    ApplicationPageRefreshThread(void *lpParameter);
-BOOL            noApps;
 BOOL            bApplicationPageSelectionMade = FALSE;
 
+static LPAPPLICATION_PAGE_LIST_ITEM AppHash[APPL_HASH_BUCKETS];
+static DWORD    dwAppGeneration;
+static PINT     pAppFreeImages;                 /* Image slots of removed items */
+static INT      nAppFreeImages;
+static INT      nAppFreeImagesMax;
+
 BOOL CALLBACK   EnumWindowsProc(HWND hWnd, LPARAM lParam);
-void            AddOrUpdateHwnd(HWND hWnd, WCHAR *szTitle, HICON hIcon, BOOL bHung);
+void            AddOrUpdateHwnd(HWND hWnd, WCHAR *szTitle, BOOL bHung);
+static void     ApplicationPageRemoveStale(void);
 void            ApplicationPageUpdate(void);
 void            ApplicationPageOnNotify(WPARAM wParam, LPARAM lParam);
 void            ApplicationPageShowContextMenu1(void);
@@ -102,6 +125,12 @@ void AppPageCleanup(void)
         pData = (LPAPPLICATION_PAGE_LIST_ITEM)item.lParam;
         HeapFree(GetProcessHeap(), 0, pData);
     }
+
+    ZeroMemory(AppHash, sizeof(AppHash));
+    if (pAppFreeImages)
+        HeapFree(GetProcessHeap(), 0, pAppFreeImages);
+    pAppFreeImages = NULL;
+    nAppFreeImages = nAppFreeImagesMax = 0;
 }
 
 
@@ -271,12 +300,6 @@ void UpdateApplicationListControlViewSetting(void)
 DWORD WINAPI ApplicationPageRefreshThread(void *lpParameter)
 {
     MSG msg;
-    INT i;
-    BOOL                            bItemRemoved = FALSE;
-    LV_ITEM                         item;
-    LPAPPLICATION_PAGE_LIST_ITEM    pAPLI = NULL;
-    HIMAGELIST                      hImageListLarge;
-    HIMAGELIST                      hImageListSmall;
 
     /* If we couldn't create the event then exit the thread */
     while (1)
@@ -292,59 +315,18 @@ DWORD WINAPI ApplicationPageRefreshThread(void *lpParameter)
              *
              * Should this be EnumDesktopWindows() instead?
              */
-            noApps = TRUE;
+            dwAppGeneration++;
             EnumWindows(EnumWindowsProc, 0);
-            if (noApps)
-            {
-                (void)ListView_DeleteAllItems(hApplicationPageListCtrl);
-                bApplicationPageSelectionMade = FALSE;
-            }
-
-            /* Get the image lists */
-            hImageListLarge = ListView_GetImageList(hApplicationPageListCtrl, LVSIL_NORMAL);
-            hImageListSmall = ListView_GetImageList(hApplicationPageListCtrl, LVSIL_SMALL);
 
-            /* Check to see if we need to remove any items from the list */
-            for (i=ListView_GetItemCount(hApplicationPageListCtrl)-1; i>=0; i--)
-            {
-                memset(&item, 0, sizeof(LV_ITEM));
-                item.mask = LVIF_IMAGE|LVIF_PARAM;
-                item.iItem = i;
-                (void)ListView_GetItem(hApplicationPageListCtrl, &item);
-
-                pAPLI = (LPAPPLICATION_PAGE_LIST_ITEM)item.lParam;
-                if (!IsWindow(pAPLI->hWnd)||
-                    (wcslen(pAPLI->szTitle) <= 0) ||
-                    !IsWindowVisible(pAPLI->hWnd) ||
-                    (GetParent(pAPLI->hWnd) != NULL) ||
-                    (GetWindow(pAPLI->hWnd, GW_OWNER) != NULL) ||
-                    (GetWindowLongPtr(pAPLI->hWnd, GWL_EXSTYLE) & WS_EX_TOOLWINDOW))
-                {
-                    ImageList_Remove(hImageListLarge, item.iItem);
-                    ImageList_Remove(hImageListSmall, item.iItem);
-
-                    (void)ListView_DeleteItem(hApplicationPageListCtrl, item.iItem);
-                    HeapFree(GetProcessHeap(), 0, pAPLI);
-                    bItemRemoved = TRUE;
-                }
-            }
+            /* Whatever wasn't enumerated this time is gone */
+            ApplicationPageRemoveStale();
 
-            /*
-             * If an item was removed from the list then
-             * we need to resync all the items with the
-             * image list
-             */
-            if (bItemRemoved)
+            /* Select first item if any */
+            if ((ListView_GetNextItem(hApplicationPageListCtrl, -1, LVNI_FOCUSED | LVNI_SELECTED) == -1) &&
+                (ListView_GetItemCount(hApplicationPageListCtrl) > 0) && !bApplicationPageSelectionMade)
             {
-                for (i=0; i<ListView_GetItemCount(hApplicationPageListCtrl); i++)
-                {
-                    memset(&item, 0, sizeof(LV_ITEM));
-                    item.mask = LVIF_IMAGE;
-                    item.iItem = i;
-                    item.iImage = i;
-                    (void)ListView_SetItem(hApplicationPageListCtrl, &item);
-                }
-                bItemRemoved = FALSE;
+                ListView_SetItemState(hApplicationPageListCtrl, 0, LVIS_FOCUSED | LVIS_SELECTED, LVIS_FOCUSED | LVIS_SELECTED);
+                bApplicationPageSelectionMade = TRUE;
             }
 
             ApplicationPageUpdate();
@@ -352,36 +334,52 @@ DWORD WINAPI ApplicationPageRefreshThread(void *lpParameter)
     }
 }
 
-BOOL CALLBACK EnumWindowsProc(HWND hWnd, LPARAM lParam)
+static LPAPPLICATION_PAGE_LIST_ITEM *
+ApplicationPageHashLink(HWND hWnd)
 {
-    HICON   hIcon;
-    WCHAR   szText[260];
-    BOOL    bLargeIcon;
-    BOOL    bHung = FALSE;
-    LRESULT bAlive;
+    return &AppHash[((ULONG_PTR)hWnd >> 1) % APPL_HASH_BUCKETS];
+}
 
-    typedef int (FAR __stdcall *IsHungAppWindowProc)(HWND);
-    IsHungAppWindowProc IsHungAppWindow;
+static LPAPPLICATION_PAGE_LIST_ITEM
+ApplicationPageFindHwnd(HWND hWnd)
+{
+    LPAPPLICATION_PAGE_LIST_ITEM pAPLI;
 
-    /* Skip our window */
-    if (hWnd == hMainWnd)
-        return TRUE;
+    for (pAPLI = *ApplicationPageHashLink(hWnd); pAPLI; pAPLI = pAPLI->pHashNext)
+    {
+        if (pAPLI->hWnd == hWnd)
+            return pAPLI;
+    }
 
-    bLargeIcon = (TaskManagerSettings.ViewMode == ID_VIEW_LARGE);
+    return NULL;
+}
 
-    GetWindowTextW(hWnd, szText, 260); /* Get the window text */
+/*
+ * Not cached: class atoms are shared by same-named classes of different
+ * modules, and SetClassLongPtr can change the icons at any time. Reading
+ * the class doesn't send the window a message anyway.
+ */
+static HICON
+ApplicationPageGetClassIcon(HWND hWnd, BOOL bLargeIcon)
+{
+    HICON   hIcon;
 
-    /* Check and see if this is a top-level app window */
-    if ((wcslen(szText) <= 0) ||
-        !IsWindowVisible(hWnd) ||
-        (GetParent(hWnd) != NULL) ||
-        (GetWindow(hWnd, GW_OWNER) != NULL) ||
-        (GetWindowLongPtrW(hWnd, GWL_EXSTYLE) & WS_EX_TOOLWINDOW))
-    {
-        return TRUE; /* Skip this window */
-    }
+    hIcon = (HICON)(LONG_PTR)GetClassLongPtrW(hWnd, bLargeIcon ? GCL_HICON : GCL_HICONSM);
+    if (!hIcon)
+        hIcon = (HICON)(LONG_PTR)GetClassLongPtrW(hWnd, bLargeIcon ? GCL_HICONSM : GCL_HICON);
+
+    /* If we still do not have any icon, load the default one */
+    if (!hIcon)
+        hIcon = LoadIconW(hInst, bLargeIcon ? MAKEINTRESOURCEW(IDI_WINDOW) : MAKEINTRESOURCEW(IDI_WINDOWSM));
+
+    return hIcon;
+}
 
-    noApps = FALSE;
+static HICON
+ApplicationPageGetIcon(HWND hWnd, BOOL bLargeIcon)
+{
+    HICON   hIcon;
+    LRESULT bAlive;
 
 #define GET_ICON(type) \
     SendMessageTimeoutW(hWnd, WM_GETICON, (type), 0, SMTO_ABORTIFHUNG, 100, (PDWORD_PTR)&hIcon)
@@ -395,115 +393,214 @@ BOOL CALLBACK EnumWindowsProc(HWND hWnd, LPARAM lParam)
         if (!hIcon && bAlive)
             GET_ICON(bLargeIcon ? ICON_SMALL : ICON_BIG);
         if (!hIcon)
-            hIcon = (HICON)(LONG_PTR)GetClassLongPtrW(hWnd, bLargeIcon ? GCL_HICON : GCL_HICONSM);
-        if (!hIcon)
-            hIcon = (HICON)(LONG_PTR)GetClassLongPtrW(hWnd, bLargeIcon ? GCL_HICONSM : GCL_HICON);
-
-        /* If we still do not have any icon, load the default one */
-        if (!hIcon) hIcon = LoadIconW(hInst, bLargeIcon ? MAKEINTRESOURCEW(IDI_WINDOW) : MAKEINTRESOURCEW(IDI_WINDOWSM));
+            hIcon = ApplicationPageGetClassIcon(hWnd, bLargeIcon);
     }
 #undef GET_ICON
 
-    bHung = FALSE;
+    return hIcon;
+}
 
-    IsHungAppWindow = (IsHungAppWindowProc)(FARPROC)GetProcAddress(GetModuleHandleW(L"USER32.DLL"), "IsHungAppWindow");
+BOOL CALLBACK EnumWindowsProc(HWND hWnd, LPARAM lParam)
+{
+    WCHAR   szText[260];
+    BOOL    bHung = FALSE;
+
+    typedef int (FAR __stdcall *IsHungAppWindowProc)(HWND);
+    static IsHungAppWindowProc IsHungAppWindow;
+    static BOOL bIsHungAppWindowLoaded;
+
+    /* Skip our window */
+    if (hWnd == hMainWnd)
+        return TRUE;
+
+    /* Check and see if this is a top-level app window */
+    if (!IsWindowVisible(hWnd) ||
+        (GetParent(hWnd) != NULL) ||
+        (GetWindow(hWnd, GW_OWNER) != NULL) ||
+        (GetWindowLongPtrW(hWnd, GWL_EXSTYLE) & WS_EX_TOOLWINDOW))
+    {
+        return TRUE; /* Skip this window */
+    }
+
+    GetWindowTextW(hWnd, szText, 260); /* Get the window text */
+    if (szText[0] == UNICODE_NULL)
+        return TRUE;
+
+    if (!bIsHungAppWindowLoaded)
+    {
+        IsHungAppWindow = (IsHungAppWindowProc)(FARPROC)GetProcAddress(GetModuleHandleW(L"USER32.DLL"), "IsHungAppWindow");
+        bIsHungAppWindowLoaded = TRUE;
+    }
 
     if (IsHungAppWindow)
         bHung = IsHungAppWindow(hWnd);
 
-    AddOrUpdateHwnd(hWnd, szText, hIcon, bHung);
+    AddOrUpdateHwnd(hWnd, szText, bHung);
 
     return TRUE;
 }
 
-void AddOrUpdateHwnd(HWND hWnd, WCHAR *szTitle, HICON hIcon, BOOL bHung)
+void AddOrUpdateHwnd(HWND hWnd, WCHAR *szTitle, BOOL bHung)
 {
-    LPAPPLICATION_PAGE_LIST_ITEM    pAPLI = NULL;
+    LPAPPLICATION_PAGE_LIST_ITEM    pAPLI;
+    LPAPPLICATION_PAGE_LIST_ITEM    *pLink;
     HIMAGELIST                      hImageListLarge;
     HIMAGELIST                      hImageListSmall;
     LV_ITEM                         item;
+    LVFINDINFO                      find;
+    HICON                           hIcon;
+    BOOL                            bLargeIcon;
+    BOOL                            bChanged;
     int                             i;
-    BOOL                            bAlreadyInList = FALSE;
 
-    memset(&item, 0, sizeof(LV_ITEM));
+    bLargeIcon = (TaskManagerSettings.ViewMode == ID_VIEW_LARGE);
 
     /* Get the image lists */
     hImageListLarge = ListView_GetImageList(hApplicationPageListCtrl, LVSIL_NORMAL);
     hImageListSmall = ListView_GetImageList(hApplicationPageListCtrl, LVSIL_SMALL);
 
-    /* Check to see if it's already in our list */
-    for (i=0; i<ListView_GetItemCount(hApplicationPageListCtrl); i++)
+    pAPLI = ApplicationPageFindHwnd(hWnd);
+
+    /* If it is already in the list then update it if necessary */
+    if (pAPLI)
     {
-        memset(&item, 0, sizeof(LV_ITEM));
-        item.mask = LVIF_IMAGE|LVIF_PARAM;
-        item.iItem = i;
-        (void)ListView_GetItem(hApplicationPageListCtrl, &item);
+        pAPLI->dwLastSeen = dwAppGeneration;
 
-        pAPLI = (LPAPPLICATION_PAGE_LIST_ITEM)item.lParam;
-        if (pAPLI->hWnd == hWnd)
+        /*
+         * Asking for the icon is a message to the window's thread, only do
+         * it now and then, when the view changes, or never if it's hung
+         */
+        hIcon = pAPLI->hIcon;
+        if (!bHung &&
+            (pAPLI->bLargeIcon != bLargeIcon ||
+             dwAppGeneration - pAPLI->dwIconTime >= APPL_ICON_REFRESH))
         {
-            bAlreadyInList = TRUE;
-            break;
+            hIcon = ApplicationPageGetIcon(hWnd, bLargeIcon);
+            pAPLI->bLargeIcon = bLargeIcon;
+            pAPLI->dwIconTime = dwAppGeneration;
         }
-    }
 
-    /* If it is already in the list then update it if necessary */
-    if (bAlreadyInList)
-    {
         /* Check to see if anything needs updating */
-        if ((pAPLI->hIcon != hIcon) ||
-            (_wcsicmp(pAPLI->szTitle, szTitle) != 0) ||
-            (pAPLI->bHung != bHung))
+        bChanged = FALSE;
+        if (pAPLI->hIcon != hIcon)
         {
-            /* Update the structure */
             pAPLI->hIcon = hIcon;
+            ImageList_ReplaceIcon(hImageListLarge, pAPLI->iImage, hIcon);
+            ImageList_ReplaceIcon(hImageListSmall, pAPLI->iImage, hIcon);
+            bChanged = TRUE;
+        }
+        if (pAPLI->bHung != bHung || wcscmp(pAPLI->szTitle, szTitle) != 0)
+        {
             pAPLI->bHung = bHung;
             wcscpy(pAPLI->szTitle, szTitle);
+            bChanged = TRUE;
+        }
 
-            /* Update the image list */
-            ImageList_ReplaceIcon(hImageListLarge, item.iItem, hIcon);
-            ImageList_ReplaceIcon(hImageListSmall, item.iItem, hIcon);
-
-            /* Update the list view */
-            (void)ListView_RedrawItems(hApplicationPageListCtrl, 0, ListView_GetItemCount(hApplicationPageListCtrl));
-            /* UpdateWindow(hApplicationPageListCtrl); */
-            InvalidateRect(hApplicationPageListCtrl, NULL, 0);
+        /* Only repaint that item */
+        if (bChanged)
+        {
+            find.flags = LVFI_PARAM;
+            find.lParam = (LPARAM)pAPLI;
+            i = ListView_FindItem(hApplicationPageListCtrl, -1, &find);
+            if (i != -1)
+                (void)ListView_RedrawItems(hApplicationPageListCtrl, i, i);
         }
     }
     /* It is not already in the list so add it */
     else
     {
-        pAPLI = (LPAPPLICATION_PAGE_LIST_ITEM)HeapAlloc(GetProcessHeap(), 0, sizeof(APPLICATION_PAGE_LIST_ITEM));
+        pAPLI = (LPAPPLICATION_PAGE_LIST_ITEM)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(APPLICATION_PAGE_LIST_ITEM));
+        if (!pAPLI)
+            return;
 
         pAPLI->hWnd = hWnd;
-        pAPLI->hIcon = hIcon;
+        pAPLI->hIcon = ApplicationPageGetIcon(hWnd, bLargeIcon);
         pAPLI->bHung = bHung;
+        pAPLI->bLargeIcon = bLargeIcon;
+        pAPLI->dwIconTime = dwAppGeneration;
+        pAPLI->dwLastSeen = dwAppGeneration;
         wcscpy(pAPLI->szTitle, szTitle);
 
+        /* Reuse the image slot of a removed window, if any */
+        if (nAppFreeImages)
+        {
+            pAPLI->iImage = pAppFreeImages[--nAppFreeImages];
+            ImageList_ReplaceIcon(hImageListLarge, pAPLI->iImage, pAPLI->hIcon);
+            ImageList_ReplaceIcon(hImageListSmall, pAPLI->iImage, pAPLI->hIcon);
+        }
+        else
+        {
+            ImageList_AddIcon(hImageListLarge, pAPLI->hIcon);
+            pAPLI->iImage = ImageList_AddIcon(hImageListSmall, pAPLI->hIcon);
+        }
+
+        pLink = ApplicationPageHashLink(hWnd);
+        pAPLI->pHashNext = *pLink;
+        *pLink = pAPLI;
+
         /* Add the item to the list */
         memset(&item, 0, sizeof(LV_ITEM));
         item.mask = LVIF_TEXT|LVIF_IMAGE|LVIF_PARAM;
-        ImageList_AddIcon(hImageListLarge, hIcon);
-        item.iImage = ImageList_AddIcon(hImageListSmall, hIcon);
+        item.iImage = pAPLI->iImage;
         item.pszText = LPSTR_TEXTCALLBACK;
         item.iItem = ListView_GetItemCount(hApplicationPageListCtrl);
         item.lParam = (LPARAM)pAPLI;
         (void)ListView_InsertItem(hApplicationPageListCtrl, &item);
     }
+}
+
+/*
+ * Drops the windows not seen by the last enumeration. Their image slots
+ * are kept for the next new windows, so no other item has to be touched.
+ */
+static void ApplicationPageRemoveStale(void)
+{
+    LPAPPLICATION_PAGE_LIST_ITEM    pAPLI;
+    LPAPPLICATION_PAGE_LIST_ITEM    *pLink;
+    LVFINDINFO                      find;
+    PINT                            pNewFreeImages;
+    int                             i, Bucket;
 
-    /* Select first item if any */
-    if ((ListView_GetNextItem(hApplicationPageListCtrl, -1, LVNI_FOCUSED | LVNI_SELECTED) == -1) &&
-        (ListView_GetItemCount(hApplicationPageListCtrl) > 0) && !bApplicationPageSelectionMade)
+    for (Bucket = 0; Bucket < APPL_HASH_BUCKETS; Bucket++)
     {
-        ListView_SetItemState(hApplicationPageListCtrl, 0, LVIS_FOCUSED | LVIS_SELECTED, LVIS_FOCUSED | LVIS_SELECTED);
-        bApplicationPageSelectionMade = TRUE;
+        pLink = &AppHash[Bucket];
+        while ((pAPLI = *pLink) != NULL)
+        {
+            if (pAPLI->dwLastSeen == dwAppGeneration)
+            {
+                pLink = &pAPLI->pHashNext;
+                continue;
+            }
+
+            *pLink = pAPLI->pHashNext;
+
+            find.flags = LVFI_PARAM;
+            find.lParam = (LPARAM)pAPLI;
+            i = ListView_FindItem(hApplicationPageListCtrl, -1, &find);
+            if (i != -1)
+                (void)ListView_DeleteItem(hApplicationPageListCtrl, i);
+
+            if (nAppFreeImages == nAppFreeImagesMax)
+            {
+                if (pAppFreeImages)
+                    pNewFreeImages = HeapReAlloc(GetProcessHeap(), 0, pAppFreeImages, (nAppFreeImagesMax + 16) * sizeof(INT));
+                else
+                    pNewFreeImages = HeapAlloc(GetProcessHeap(), 0, 16 * sizeof(INT));
+                if (pNewFreeImages)
+                {
+                    pAppFreeImages = pNewFreeImages;
+                    nAppFreeImagesMax += 16;
+                }
+            }
+            if (nAppFreeImages < nAppFreeImagesMax)
+                pAppFreeImages[nAppFreeImages++] = pAPLI->iImage;
+
+            HeapFree(GetProcessHeap(), 0, pAPLI);
+        }
     }
-    /*
-    else
-    {
+
+    if (ListView_GetItemCount(hApplicationPageListCtrl) == 0)
         bApplicationPageSelectionMade = FALSE;
-    }
-    */
 }
 
 void ApplicationPageUpdate(void)
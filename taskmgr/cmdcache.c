@@ -0,0 +1,513 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  cmdcache.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Command line and executable path cache.
+ *
+ * Reading the command line of a process means opening it and walking its
+ * PEB with ReadProcessMemory, far too slow to do for every list item being
+ * painted or sorted. Entries are keyed by process id and creation time, so
+ * a recycled process id never shows the command line of a dead process.
+ *
+ * A lookup that misses queues the process and returns an empty string; a
+ * worker thread reads the process memory outside of the lock and asks the
+ * process page to refresh once its queue is drained. The cache holds at
+ * most CMDCACHE_ENTRIES entries and CMDCACHE_MAX_BYTES of strings, the
+ * least recently used entries are dropped first.
+ */
+
+#include "precomp.h"
+
+#define NTOS_MODE_USER
+#include "sdk/psfuncs.h"
+
+#define CMDCACHE_ENTRIES        8192                /* Power of two */
+#define CMDCACHE_BUCKETS        (CMDCACHE_ENTRIES * 2)
+#define CMDCACHE_MAX_BYTES      (16 * 1024 * 1024)
+#define CMDCACHE_NIL            ((ULONG)-1)
+
+#define CMDCACHE_FREE           0
+#define CMDCACHE_PENDING        1                   /* Queued for the worker */
+#define CMDCACHE_READY          2
+
+typedef struct _CMDCACHE_ENTRY
+{
+    ULONG       ProcessId;
+    ULONGLONG   CreateTime;
+    ULONG       State;
+    ULONG       HashNext;           /* Bucket chain, or free list */
+    ULONG       LruPrev;            /* Towards the most recently used */
+    ULONG       LruNext;
+    LPWSTR      pszCommandLine;     /* One allocation, the image path follows */
+    LPWSTR      pszImagePath;
+    SIZE_T      cbStrings;
+} CMDCACHE_ENTRY, *PCMDCACHE_ENTRY;
+
+typedef struct _CMDCACHE_KEY
+{
+    ULONG       ProcessId;
+    ULONGLONG   CreateTime;
+} CMDCACHE_KEY, *PCMDCACHE_KEY;
+
+static CRITICAL_SECTION CmdCacheCriticalSection;
+static PCMDCACHE_ENTRY  CmdCacheEntries;
+static PULONG           CmdCacheBuckets;
+static ULONG            CmdCacheFree = CMDCACHE_NIL;
+static ULONG            CmdCacheLruHead = CMDCACHE_NIL;
+static ULONG            CmdCacheLruTail = CMDCACHE_NIL;
+static SIZE_T           CmdCacheBytes;
+
+/* Work queue, a ring of the keys of the pending entries */
+static PCMDCACHE_KEY    CmdCacheQueue;
+static ULONG            CmdCacheQueueHead;
+static ULONG            CmdCacheQueueCount;
+
+static HANDLE           hCmdCacheWakeEvent;
+static HANDLE           hCmdCacheThread;
+static BOOL             bCmdCacheShutdown;
+
+static ULONG
+CmdCacheHash(ULONG ProcessId, ULONGLONG CreateTime)
+{
+    /* Process ids are multiples of four */
+    return (((ProcessId >> 2) ^ (ULONG)CreateTime ^ (ULONG)(CreateTime >> 32)) * 2654435761u) & (CMDCACHE_BUCKETS - 1);
+}
+
+static ULONG
+CmdCacheFind(ULONG ProcessId, ULONGLONG CreateTime)
+{
+    ULONG Index;
+
+    for (Index = CmdCacheBuckets[CmdCacheHash(ProcessId, CreateTime)];
+         Index != CMDCACHE_NIL;
+         Index = CmdCacheEntries[Index].HashNext)
+    {
+        if (CmdCacheEntries[Index].ProcessId == ProcessId &&
+            CmdCacheEntries[Index].CreateTime == CreateTime)
+        {
+            return Index;
+        }
+    }
+
+    return CMDCACHE_NIL;
+}
+
+static void
+CmdCacheLruUnlink(ULONG Index)
+{
+    PCMDCACHE_ENTRY pEntry = &CmdCacheEntries[Index];
+
+    if (pEntry->LruPrev != CMDCACHE_NIL)
+        CmdCacheEntries[pEntry->LruPrev].LruNext = pEntry->LruNext;
+    else
+        CmdCacheLruHead = pEntry->LruNext;
+
+    if (pEntry->LruNext != CMDCACHE_NIL)
+        CmdCacheEntries[pEntry->LruNext].LruPrev = pEntry->LruPrev;
+    else
+        CmdCacheLruTail = pEntry->LruPrev;
+}
+
+static void
+CmdCacheLruPushFront(ULONG Index)
+{
+    PCMDCACHE_ENTRY pEntry = &CmdCacheEntries[Index];
+
+    pEntry->LruPrev = CMDCACHE_NIL;
+    pEntry->LruNext = CmdCacheLruHead;
+    if (CmdCacheLruHead != CMDCACHE_NIL)
+        CmdCacheEntries[CmdCacheLruHead].LruPrev = Index;
+    else
+        CmdCacheLruTail = Index;
+    CmdCacheLruHead = Index;
+}
+
+static void
+CmdCacheEvict(ULONG Index)
+{
+    PCMDCACHE_ENTRY pEntry = &CmdCacheEntries[Index];
+    PULONG          pLink;
+
+    pLink = &CmdCacheBuckets[CmdCacheHash(pEntry->ProcessId, pEntry->CreateTime)];
+    while (*pLink != Index)
+        pLink = &CmdCacheEntries[*pLink].HashNext;
+    *pLink = pEntry->HashNext;
+
+    CmdCacheLruUnlink(Index);
+
+    if (pEntry->pszCommandLine)
+    {
+        HeapFree(GetProcessHeap(), 0, pEntry->pszCommandLine);
+        CmdCacheBytes -= pEntry->cbStrings;
+    }
+
+    ZeroMemory(pEntry, sizeof(*pEntry));
+    pEntry->HashNext = CmdCacheFree;
+    CmdCacheFree = Index;
+}
+
+static ULONG
+CmdCacheInsert(ULONG ProcessId, ULONGLONG CreateTime)
+{
+    PCMDCACHE_ENTRY pEntry;
+    ULONG           Index, Bucket;
+
+    if (CmdCacheFree == CMDCACHE_NIL)
+        CmdCacheEvict(CmdCacheLruTail);
+
+    Index = CmdCacheFree;
+    pEntry = &CmdCacheEntries[Index];
+    CmdCacheFree = pEntry->HashNext;
+
+    pEntry->ProcessId = ProcessId;
+    pEntry->CreateTime = CreateTime;
+    pEntry->State = CMDCACHE_PENDING;
+
+    Bucket = CmdCacheHash(ProcessId, CreateTime);
+    pEntry->HashNext = CmdCacheBuckets[Bucket];
+    CmdCacheBuckets[Bucket] = Index;
+
+    CmdCacheLruPushFront(Index);
+    return Index;
+}
+
+/* Copies a cached string, cutting it with an ellipsis when it doesn't fit */
+static void
+CmdCacheCopyText(LPWSTR lpText, ULONG nMaxCount, LPCWSTR pszText)
+{
+    SIZE_T Length = wcslen(pszText);
+
+    if (Length < nMaxCount)
+    {
+        memcpy(lpText, pszText, (Length + 1) * sizeof(WCHAR));
+        return;
+    }
+
+    Length = nMaxCount - 1;
+    memcpy(lpText, pszText, Length * sizeof(WCHAR));
+    lpText[Length] = UNICODE_NULL;
+    if (Length >= 3)
+        wcscpy(lpText + Length - 3, L"...");
+}
+
+static BOOL
+CmdCacheReadString(HANDLE hProcess, PVOID ProcessParams, ULONG FieldOffset, LPWSTR *ppszText)
+{
+    UNICODE_STRING  String;
+    LPWSTR          pszText;
+
+    /* Get the pointer to the string buffer and its size... */
+    if (!ReadProcessMemory(hProcess,
+                           (PVOID)((ULONG_PTR)ProcessParams + FieldOffset),
+                           &String,
+                           sizeof(String),
+                           NULL))
+    {
+        return FALSE;
+    }
+
+    pszText = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, String.Length + sizeof(UNICODE_NULL));
+    if (!pszText)
+        return FALSE;
+
+    /* ... then copy the string from the other process */
+    if (String.Length &&
+        !ReadProcessMemory(hProcess, String.Buffer, pszText, String.Length, NULL))
+    {
+        HeapFree(GetProcessHeap(), 0, pszText);
+        return FALSE;
+    }
+
+    *ppszText = pszText;
+    return TRUE;
+}
+
+/*
+ * Reads PEB->ProcessParameters->CommandLine and ImagePathName. Returns one
+ * allocation holding both strings, empty ones for processes we can't read.
+ */
+static LPWSTR
+CmdCacheReadProcess(ULONG ProcessId, LPWSTR *ppszImagePath, PSIZE_T pcbStrings)
+{
+    PROCESS_BASIC_INFORMATION pbi = {0};
+    PVOID       ProcessParams = NULL;
+    HANDLE      hProcess;
+    NTSTATUS    Status;
+    LPWSTR      pszCommandLine = NULL;
+    LPWSTR      pszImagePath = NULL;
+    LPWSTR      pszStrings;
+    SIZE_T      cchCommandLine, cchImagePath;
+
+    hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, ProcessId);
+    if (hProcess)
+    {
+        /* First off, get the ProcessEnvironmentBlock location in that process' address space */
+        Status = NtQueryInformationProcess(hProcess, 0, &pbi, sizeof(pbi), NULL);
+
+        /* Then get the PEB.ProcessParameters member pointer */
+        if (NT_SUCCESS(Status) &&
+            ReadProcessMemory(hProcess,
+                              (PVOID)((ULONG_PTR)pbi.PebBaseAddress + FIELD_OFFSET(PEB, ProcessParameters)),
+                              &ProcessParams,
+                              sizeof(ProcessParams),
+                              NULL))
+        {
+            CmdCacheReadString(hProcess, ProcessParams,
+                               FIELD_OFFSET(RTL_USER_PROCESS_PARAMETERS, CommandLine),
+                               &pszCommandLine);
+            CmdCacheReadString(hProcess, ProcessParams,
+                               FIELD_OFFSET(RTL_USER_PROCESS_PARAMETERS, ImagePathName),
+                               &pszImagePath);
+        }
+
+        CloseHandle(hProcess);
+    }
+
+    cchCommandLine = pszCommandLine ? wcslen(pszCommandLine) + 1 : 1;
+    cchImagePath = pszImagePath ? wcslen(pszImagePath) + 1 : 1;
+    *pcbStrings = (cchCommandLine + cchImagePath) * sizeof(WCHAR);
+
+    pszStrings = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, *pcbStrings);
+    if (pszStrings)
+    {
+        if (pszCommandLine)
+            memcpy(pszStrings, pszCommandLine, cchCommandLine * sizeof(WCHAR));
+        if (pszImagePath)
+            memcpy(pszStrings + cchCommandLine, pszImagePath, cchImagePath * sizeof(WCHAR));
+        *ppszImagePath = pszStrings + cchCommandLine;
+    }
+
+    if (pszCommandLine)
+        HeapFree(GetProcessHeap(), 0, pszCommandLine);
+    if (pszImagePath)
+        HeapFree(GetProcessHeap(), 0, pszImagePath);
+
+    return pszStrings;
+}
+
+static DWORD WINAPI
+CmdCacheThread(LPVOID lpParameter)
+{
+    CMDCACHE_KEY    Key;
+    PCMDCACHE_ENTRY pEntry;
+    LPWSTR          pszStrings, pszImagePath;
+    SIZE_T          cbStrings;
+    ULONG           Index;
+    BOOL            bFilled;
+
+    for (;;)
+    {
+        WaitForSingleObject(hCmdCacheWakeEvent, INFINITE);
+
+        bFilled = FALSE;
+        for (;;)
+        {
+            EnterCriticalSection(&CmdCacheCriticalSection);
+            if (bCmdCacheShutdown)
+            {
+                LeaveCriticalSection(&CmdCacheCriticalSection);
+                return 0;
+            }
+            if (!CmdCacheQueueCount)
+            {
+                LeaveCriticalSection(&CmdCacheCriticalSection);
+                break;
+            }
+            Key = CmdCacheQueue[CmdCacheQueueHead];
+            CmdCacheQueueHead = (CmdCacheQueueHead + 1) % CMDCACHE_ENTRIES;
+            CmdCacheQueueCount--;
+            LeaveCriticalSection(&CmdCacheCriticalSection);
+
+            pszStrings = CmdCacheReadProcess(Key.ProcessId, &pszImagePath, &cbStrings);
+
+            EnterCriticalSection(&CmdCacheCriticalSection);
+
+            /* The entry may have been evicted while we were reading */
+            Index = CmdCacheFind(Key.ProcessId, Key.CreateTime);
+            if (Index != CMDCACHE_NIL && CmdCacheEntries[Index].State == CMDCACHE_PENDING)
+            {
+                if (!pszStrings)
+                {
+                    /* Out of memory: forget the entry, the next lookup queues it again */
+                    CmdCacheEvict(Index);
+                }
+                else
+                {
+                    pEntry = &CmdCacheEntries[Index];
+                    pEntry->pszCommandLine = pszStrings;
+                    pEntry->pszImagePath = pszImagePath;
+                    pEntry->cbStrings = cbStrings;
+                    pEntry->State = CMDCACHE_READY;
+                    CmdCacheBytes += cbStrings;
+                    pszStrings = NULL;
+                    bFilled = TRUE;
+
+                    while (CmdCacheBytes > CMDCACHE_MAX_BYTES && CmdCacheLruTail != Index)
+                        CmdCacheEvict(CmdCacheLruTail);
+                }
+            }
+
+            LeaveCriticalSection(&CmdCacheCriticalSection);
+
+            if (pszStrings)
+                HeapFree(GetProcessHeap(), 0, pszStrings);
+        }
+
+        /* Show (and sort by) the new strings */
+        if (bFilled)
+            RefreshProcessPage();
+    }
+}
+
+BOOL CmdCacheInitialize(void)
+{
+    ULONG Index;
+
+    CmdCacheEntries = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, CMDCACHE_ENTRIES * sizeof(CMDCACHE_ENTRY));
+    CmdCacheBuckets = HeapAlloc(GetProcessHeap(), 0, CMDCACHE_BUCKETS * sizeof(ULONG));
+    CmdCacheQueue = HeapAlloc(GetProcessHeap(), 0, CMDCACHE_ENTRIES * sizeof(CMDCACHE_KEY));
+    if (!CmdCacheEntries || !CmdCacheBuckets || !CmdCacheQueue)
+        goto fail;
+
+    for (Index = 0; Index < CMDCACHE_BUCKETS; Index++)
+        CmdCacheBuckets[Index] = CMDCACHE_NIL;
+
+    for (Index = 0; Index < CMDCACHE_ENTRIES; Index++)
+        CmdCacheEntries[Index].HashNext = Index + 1 < CMDCACHE_ENTRIES ? Index + 1 : CMDCACHE_NIL;
+    CmdCacheFree = 0;
+
+    InitializeCriticalSection(&CmdCacheCriticalSection);
+
+    hCmdCacheWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!hCmdCacheWakeEvent)
+        goto fail_lock;
+
+    bCmdCacheShutdown = FALSE;
+    hCmdCacheThread = CreateThread(NULL, 0, CmdCacheThread, NULL, 0, NULL);
+    if (!hCmdCacheThread)
+    {
+        CloseHandle(hCmdCacheWakeEvent);
+        hCmdCacheWakeEvent = NULL;
+        goto fail_lock;
+    }
+
+    return TRUE;
+
+fail_lock:
+    DeleteCriticalSection(&CmdCacheCriticalSection);
+fail:
+    if (CmdCacheEntries)
+        HeapFree(GetProcessHeap(), 0, CmdCacheEntries);
+    if (CmdCacheBuckets)
+        HeapFree(GetProcessHeap(), 0, CmdCacheBuckets);
+    if (CmdCacheQueue)
+        HeapFree(GetProcessHeap(), 0, CmdCacheQueue);
+    CmdCacheEntries = NULL;
+    CmdCacheBuckets = NULL;
+    CmdCacheQueue = NULL;
+    return FALSE;
+}
+
+void CmdCacheUninitialize(void)
+{
+    ULONG Index;
+
+    if (!hCmdCacheThread)
+        return;
+
+    EnterCriticalSection(&CmdCacheCriticalSection);
+    bCmdCacheShutdown = TRUE;
+    LeaveCriticalSection(&CmdCacheCriticalSection);
+
+    SetEvent(hCmdCacheWakeEvent);
+    WaitForSingleObject(hCmdCacheThread, INFINITE);
+    CloseHandle(hCmdCacheThread);
+    CloseHandle(hCmdCacheWakeEvent);
+    hCmdCacheThread = NULL;
+    hCmdCacheWakeEvent = NULL;
+
+    for (Index = 0; Index < CMDCACHE_ENTRIES; Index++)
+    {
+        if (CmdCacheEntries[Index].pszCommandLine)
+            HeapFree(GetProcessHeap(), 0, CmdCacheEntries[Index].pszCommandLine);
+    }
+
+    HeapFree(GetProcessHeap(), 0, CmdCacheEntries);
+    HeapFree(GetProcessHeap(), 0, CmdCacheBuckets);
+    HeapFree(GetProcessHeap(), 0, CmdCacheQueue);
+    CmdCacheEntries = NULL;
+    CmdCacheBuckets = NULL;
+    CmdCacheQueue = NULL;
+
+    CmdCacheFree = CmdCacheLruHead = CmdCacheLruTail = CMDCACHE_NIL;
+    CmdCacheBytes = 0;
+    CmdCacheQueueHead = CmdCacheQueueCount = 0;
+
+    DeleteCriticalSection(&CmdCacheCriticalSection);
+}
+
+/*
+ * Copies the command line or image path of a process. Returns FALSE with an
+ * empty string when it isn't known yet; the worker then reads it and
+ * refreshes the process page.
+ */
+BOOL CmdCacheLookup(ULONG ProcessId, ULONGLONG CreateTime, UINT Field, LPWSTR lpText, ULONG nMaxCount)
+{
+    PCMDCACHE_ENTRY pEntry;
+    ULONG           Index;
+    BOOL            bFound = FALSE;
+
+    if (!nMaxCount)
+        return FALSE;
+    lpText[0] = UNICODE_NULL;
+
+    if (!hCmdCacheThread)
+        return FALSE;
+
+    EnterCriticalSection(&CmdCacheCriticalSection);
+
+    Index = CmdCacheFind(ProcessId, CreateTime);
+    if (Index != CMDCACHE_NIL)
+    {
+        pEntry = &CmdCacheEntries[Index];
+        CmdCacheLruUnlink(Index);
+        CmdCacheLruPushFront(Index);
+
+        if (pEntry->State == CMDCACHE_READY)
+        {
+            CmdCacheCopyText(lpText, nMaxCount,
+                             Field == CMDCACHE_IMAGEPATH ? pEntry->pszImagePath : pEntry->pszCommandLine);
+            bFound = TRUE;
+        }
+    }
+    else if (CmdCacheQueueCount < CMDCACHE_ENTRIES)
+    {
+        CmdCacheInsert(ProcessId, CreateTime);
+
+        CmdCacheQueue[(CmdCacheQueueHead + CmdCacheQueueCount) % CMDCACHE_ENTRIES].ProcessId = ProcessId;
+        CmdCacheQueue[(CmdCacheQueueHead + CmdCacheQueueCount) % CMDCACHE_ENTRIES].CreateTime = CreateTime;
+        CmdCacheQueueCount++;
+        SetEvent(hCmdCacheWakeEvent);
+    }
+
+    LeaveCriticalSection(&CmdCacheCriticalSection);
+
+    return bFound;
+}
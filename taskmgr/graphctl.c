@@ -12,17 +12,316 @@
 
 WNDPROC OldGraphCtrlWndProc;
 
+/*
+ * The graph is kept in a 32-bit top-down DIB section used as a circular
+ * buffer of columns: logical column x (the newest one being the rightmost,
+ * BitmapWidth - 1) lives at physical column (x + Origin) % BitmapWidth.
+ * Adding a point moves the origin by PLOT_SHIFT and rasterizes only the
+ * new columns straight into the pixels, WM_PAINT unrolls the ring with
+ * at most two blits.
+ *
+ * In per-processor mode the same bitmap holds one small graph per
+ * processor, laid out in rows grouped by NUMA node, and is redrawn as a
+ * whole on every point.
+ */
+
+#define GRAPH_NO_SPAN           (-1)
+#define GRAPH_CELL_GAP          3
+#define GRAPH_CELL_MIN_SIZE     12
+
+typedef struct _GRAPH_COLUMN
+{
+    SHORT   Top[NUM_PLOTS];         /* Plot span in this column, GRAPH_NO_SPAN if none */
+    SHORT   Bottom[NUM_PLOTS];
+    BOOL    bGrid;
+} GRAPH_COLUMN, *PGRAPH_COLUMN;
+
+typedef struct _GRAPH_LAYOUT
+{
+    INT     Columns;
+    INT     CellWidth;
+    INT     CellHeight;
+} GRAPH_LAYOUT, *PGRAPH_LAYOUT;
+
+static void GraphCtrl_Redraw(PTM_GRAPH_CONTROL inst, INT h);
+
+static DWORD
+GraphCtrl_PixelFromColor(COLORREF clr)
+{
+    /* DIB pixels are stored as BGRX */
+    return (GetRValue(clr) << 16) | (GetGValue(clr) << 8) | GetBValue(clr);
+}
+
+static BOOL
+GraphCtrl_CreateBitmap(PTM_GRAPH_CONTROL inst, INT h)
+{
+    BITMAPINFO  bmi;
+    HBITMAP     hbmOld;
+    PVOID       pBits;
+
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = inst->BitmapWidth;
+    bmi.bmiHeader.biHeight = -max(h, 1);
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    hbmOld = inst->hbmGraph;
+    inst->hbmGraph = CreateDIBSection(inst->hdcGraph, &bmi, DIB_RGB_COLORS, &pBits, NULL, 0);
+    if (!inst->hbmGraph)
+    {
+        inst->hbmGraph = hbmOld;
+        return FALSE;
+    }
+
+    SelectObject(inst->hdcGraph, inst->hbmGraph);
+    if (hbmOld)
+        DeleteObject(hbmOld);
+
+    inst->pBits = (PDWORD)pBits;
+    inst->BitmapHeight = h;
+    inst->Origin = 0;
+    return TRUE;
+}
+
+static INT
+GraphCtrl_ValueToY(INT Height, UINT val)
+{
+    INT y = Height - (INT)(val * Height / 100);
+
+    return min(max(y, 0), Height - 1);
+}
+
+/*
+ * Plot span of the column k (1..PLOT_SHIFT) columns to the right of a point
+ * at height y0, on the segment to the next point at height y1. Consecutive
+ * spans touch, so steep segments stay connected like with LineTo.
+ */
+static void
+GraphCtrl_SegmentSpan(INT y0, INT y1, INT k, PSHORT pTop, PSHORT pBottom)
+{
+    INT ya = y0 + (y1 - y0) * (k - 1) / PLOT_SHIFT;
+    INT yb = y0 + (y1 - y0) * k / PLOT_SHIFT;
+
+    *pTop = (SHORT)min(ya, yb);
+    *pBottom = (SHORT)max(ya, yb);
+}
+
+/* Grid lines move with the plot; x is counted in columns from the left of a graph of Width columns */
+static BOOL
+GraphCtrl_IsGridColumn(PTM_GRAPH_CONTROL inst, INT Width, INT x)
+{
+    return (Width - 1 - x - inst->CurrShift) % inst->GridCellWidth == 0;
+}
+
+/* Writes the pixels of one physical column of the main graph */
+static void
+GraphCtrl_FillColumn(PTM_GRAPH_CONTROL inst, INT px, PGRAPH_COLUMN pColumn)
+{
+    PDWORD  pPixel = inst->pBits + px;
+    INT     y, Plot;
+    DWORD   clr;
+
+    for (y = 0; y < inst->BitmapHeight; y++, pPixel += inst->BitmapWidth)
+    {
+        if (pColumn->bGrid || (y % inst->GridCellHeight) == inst->GridCellHeight - 1)
+            clr = inst->clrGrid;
+        else
+            clr = inst->clrBack;
+
+        /* The primary plot is drawn over the secondary one */
+        for (Plot = NUM_PLOTS - 1; Plot >= 0; Plot--)
+        {
+            if (y >= pColumn->Top[Plot] && y <= pColumn->Bottom[Plot])
+                clr = Plot ? inst->clrPlot1 : inst->clrPlot0;
+        }
+
+        *pPixel = clr;
+    }
+}
+
+/*
+ * Draws a whole graph of Width x Height pixels at pPixels from its point
+ * ring (newest point at CurrIndex). The plot spans of every column are
+ * computed first, then each pixel is written once, row by row.
+ * pColumns must hold Width entries.
+ */
+static void
+GraphCtrl_DrawGraph(PTM_GRAPH_CONTROL inst, PDWORD pPixels, INT Width, INT Height,
+                    PBYTE pPoints[NUM_PLOTS], UINT32 CurrIndex, PGRAPH_COLUMN pColumns)
+{
+    PBYTE   t;
+    PDWORD  pPixel;
+    INT     Plot, i, j, k, x, y, y0, y1;
+    DWORD   clrRow;
+
+    for (x = 0; x < Width; x++)
+    {
+        pColumns[x].bGrid = GraphCtrl_IsGridColumn(inst, Width, x);
+        for (Plot = 0; Plot < NUM_PLOTS; Plot++)
+            pColumns[x].Top[Plot] = pColumns[x].Bottom[Plot] = GRAPH_NO_SPAN;
+    }
+
+    for (Plot = 0; Plot < NUM_PLOTS; Plot++)
+    {
+        if (!pPoints[Plot])
+            continue;
+
+        /* Walk back from the newest point, one segment every PLOT_SHIFT columns */
+        t = pPoints[Plot];
+        j = CurrIndex;
+        x = Width - 1;
+        y1 = GraphCtrl_ValueToY(Height, *(t + j));
+        pColumns[x].Top[Plot] = pColumns[x].Bottom[Plot] = (SHORT)y1;
+
+        for (i = 1; i < (INT)inst->NumberOfPoints && x - PLOT_SHIFT >= 0; i++)
+        {
+            j = (j ? j : inst->NumberOfPoints) - 1;
+            y0 = GraphCtrl_ValueToY(Height, *(t + j));
+
+            for (k = 1; k <= PLOT_SHIFT; k++)
+            {
+                GraphCtrl_SegmentSpan(y0, y1, k,
+                                      &pColumns[x - PLOT_SHIFT + k].Top[Plot],
+                                      &pColumns[x - PLOT_SHIFT + k].Bottom[Plot]);
+            }
+
+            x -= PLOT_SHIFT;
+            y1 = y0;
+        }
+    }
+
+    for (y = 0; y < Height; y++)
+    {
+        clrRow = (y % inst->GridCellHeight) == inst->GridCellHeight - 1 ? inst->clrGrid : inst->clrBack;
+        pPixel = pPixels + y * inst->BitmapWidth;
+
+        for (x = 0; x < Width; x++, pPixel++)
+        {
+            if (y >= pColumns[x].Top[0] && y <= pColumns[x].Bottom[0])
+                *pPixel = inst->clrPlot0;
+            else if (y >= pColumns[x].Top[1] && y <= pColumns[x].Bottom[1])
+                *pPixel = inst->clrPlot1;
+            else if (pColumns[x].bGrid)
+                *pPixel = inst->clrGrid;
+            else
+                *pPixel = clrRow;
+        }
+    }
+}
+
+/*
+ * Picks the number of graphs per row giving the largest graphs that fit
+ * Width x Height, each NUMA node starting on a new row.
+ */
+static BOOL
+GraphCtrl_Layout(PTM_GRAPH_CONTROL inst, INT Width, INT Height, PGRAPH_LAYOUT pLayout)
+{
+    INT     Columns, Rows, CellWidth, CellHeight, Area, BestArea = 0;
+    ULONG   i, Run;
+
+    for (Columns = 1; Columns <= (INT)inst->NumberOfProcessors; Columns++)
+    {
+        /* Rows needed: every run of processors of one node is wrapped separately */
+        Rows = 0;
+        for (i = 0, Run = 0; i < inst->NumberOfProcessors; i++)
+        {
+            if (i > 0 &&
+                inst->ProcessorNodes[inst->ProcessorOrder[i]] != inst->ProcessorNodes[inst->ProcessorOrder[i - 1]])
+            {
+                Rows += (Run + Columns - 1) / Columns;
+                Run = 0;
+            }
+            Run++;
+        }
+        Rows += (Run + Columns - 1) / Columns;
+
+        CellWidth = (Width - GRAPH_CELL_GAP * (Columns - 1)) / Columns;
+        CellHeight = (Height - GRAPH_CELL_GAP * (Rows - 1)) / Rows;
+        if (CellWidth < GRAPH_CELL_MIN_SIZE || CellHeight < GRAPH_CELL_MIN_SIZE)
+            continue;
+
+        /* Graphs taller than wide waste room, count them as square */
+        Area = CellWidth * min(CellWidth, CellHeight);
+        if (Area > BestArea)
+        {
+            BestArea = Area;
+            pLayout->Columns = Columns;
+            pLayout->CellWidth = CellWidth;
+            pLayout->CellHeight = CellHeight;
+        }
+    }
+
+    return BestArea != 0;
+}
+
+static void
+GraphCtrl_RedrawProcessors(PTM_GRAPH_CONTROL inst)
+{
+    GRAPH_LAYOUT  Layout;
+    PGRAPH_COLUMN pColumns;
+    PBYTE   pPoints[NUM_PLOTS];
+    PDWORD  pPixel;
+    INT     Width, Height, Column, Row, x, y;
+    ULONG   i, Processor;
+
+    Width = min(inst->ClientWidth, inst->BitmapWidth);
+    Height = inst->BitmapHeight;
+
+    for (y = 0; y < Height; y++)
+    {
+        pPixel = inst->pBits + y * inst->BitmapWidth;
+        for (x = 0; x < Width; x++)
+            *pPixel++ = inst->clrBack;
+    }
+
+    if (!GraphCtrl_Layout(inst, Width, Height, &Layout))
+        return;
+
+    pColumns = HeapAlloc(GetProcessHeap(), 0, Layout.CellWidth * sizeof(GRAPH_COLUMN));
+    if (!pColumns)
+        return;
+
+    Column = Row = 0;
+    for (i = 0; i < inst->NumberOfProcessors; i++)
+    {
+        Processor = inst->ProcessorOrder[i];
+
+        if (i > 0 &&
+            (Column == Layout.Columns ||
+             inst->ProcessorNodes[Processor] != inst->ProcessorNodes[inst->ProcessorOrder[i - 1]]))
+        {
+            Column = 0;
+            Row++;
+        }
+
+        pPoints[0] = inst->ProcessorPoints + Processor * inst->NumberOfPoints;
+        pPoints[1] = NULL;
+        if (inst->DrawSecondaryPlot)
+            pPoints[1] = pPoints[0] + inst->NumberOfProcessors * inst->NumberOfPoints;
+
+        x = Column * (Layout.CellWidth + GRAPH_CELL_GAP);
+        y = Row * (Layout.CellHeight + GRAPH_CELL_GAP);
+        GraphCtrl_DrawGraph(inst, inst->pBits + y * inst->BitmapWidth + x,
+                            Layout.CellWidth, Layout.CellHeight,
+                            pPoints, inst->ProcessorIndex, pColumns);
+        Column++;
+    }
+
+    HeapFree(GetProcessHeap(), 0, pColumns);
+}
+
 BOOL
 GraphCtrl_Create(PTM_GRAPH_CONTROL inst, HWND hWnd, HWND hParentWnd, PTM_FORMAT fmt)
 {
-    HDC     hdc, hdcg;
-    HBITMAP hbmOld;
+    HDC     hdc;
     UINT    Size;
-    INT     p;
     RECT    rc;
 
     inst->hParentWnd = hParentWnd;
     inst->hWnd = hWnd;
+    InitializeCriticalSection(&inst->Lock);
 
     Size = GetSystemMetrics(SM_CXSCREEN);
     inst->BitmapWidth = Size;
@@ -37,18 +336,10 @@ GraphCtrl_Create(PTM_GRAPH_CONTROL inst, HWND hWnd, HWND hParentWnd, PTM_FORMAT
     inst->CurrIndex = 0;
 
     /* Styling */
-    inst->hPenGrid = CreatePen(PS_SOLID, 0, fmt->clrGrid);
-    inst->hPen0 = CreatePen(PS_SOLID, 0, fmt->clrPlot0);
-    inst->hPen1 = CreatePen(PS_SOLID, 0, fmt->clrPlot1);
-    inst->hBrushBack = CreateSolidBrush(fmt->clrBack);
-
-    if (!inst->hPenGrid ||
-        !inst->hPen0 ||
-        !inst->hPen1 ||
-        !inst->hBrushBack)
-    {
-        goto fail;
-    }
+    inst->clrBack = GraphCtrl_PixelFromColor(fmt->clrBack);
+    inst->clrGrid = GraphCtrl_PixelFromColor(fmt->clrGrid);
+    inst->clrPlot0 = GraphCtrl_PixelFromColor(fmt->clrPlot0);
+    inst->clrPlot1 = GraphCtrl_PixelFromColor(fmt->clrPlot1);
 
     if (fmt->GridCellWidth >= PLOT_SHIFT << 2)
         inst->GridCellWidth = fmt->GridCellWidth;
@@ -60,48 +351,25 @@ GraphCtrl_Create(PTM_GRAPH_CONTROL inst, HWND hWnd, HWND hParentWnd, PTM_FORMAT
         inst->GridCellHeight = PLOT_SHIFT << 2;
 
     inst->DrawSecondaryPlot = fmt->DrawSecondaryPlot;
-
-    GetClientRect(hWnd, &rc);
-    inst->BitmapHeight = rc.bottom;
-    inst->ftPixelsPerPercent = (FLOAT)(inst->BitmapHeight) / 100.00f;
+    inst->CurrShift = 0;
 
     hdc = GetDC(hParentWnd);
-    hdcg = CreateCompatibleDC(hdc);
-    inst->hdcGraph = hdcg;
-    inst->hbmGraph = CreateCompatibleBitmap(hdc, inst->BitmapWidth, inst->BitmapHeight);
-
-    if (!hdc ||
-        !hdcg ||
-        !inst->hbmGraph)
+    if (!hdc)
     {
         goto fail;
     }
-
+    inst->hdcGraph = CreateCompatibleDC(hdc);
     ReleaseDC(hParentWnd, hdc);
-    hbmOld = (HBITMAP)SelectObject(hdcg, inst->hbmGraph);
-    DeleteObject(hbmOld);
 
-    SetBkColor(hdcg, fmt->clrBack);
-    rc.right = inst->BitmapWidth;
-    FillRect(hdcg, &rc, inst->hBrushBack);
-
-    inst->CurrShift = 0;
-    SelectObject(hdcg, inst->hPenGrid);
-    for (p = inst->GridCellHeight - 1;
-         p < inst->BitmapHeight;
-         p += inst->GridCellHeight)
-    {
-        MoveToEx(hdcg, 0, p, NULL);
-        LineTo(hdcg, inst->BitmapWidth, p);
-    }
-    for (p = inst->BitmapWidth - 1;
-         p > 0;
-         p -= inst->GridCellWidth)
+    GetClientRect(hWnd, &rc);
+    inst->ClientWidth = rc.right;
+    if (!inst->hdcGraph ||
+        !GraphCtrl_CreateBitmap(inst, rc.bottom))
     {
-        MoveToEx(hdcg, p, 0, NULL);
-        LineTo(hdcg, p, inst->BitmapHeight);
+        goto fail;
     }
-    SelectObject(hdcg, inst->hPen0);
+
+    GraphCtrl_RedrawBitmap(inst, inst->BitmapHeight);
 
     return TRUE;
 
@@ -113,40 +381,84 @@ fail:
 void
 GraphCtrl_Dispose(PTM_GRAPH_CONTROL inst)
 {
+    /* Not created, or already disposed after a failed creation */
+    if (!inst->hWnd)
+        return;
+
     if (inst->PointBuffer)
         HeapFree(GetProcessHeap(), 0, inst->PointBuffer);
 
-    if (inst->hPenGrid)
-        DeleteObject(inst->hPenGrid);
+    if (inst->ProcessorPoints)
+        HeapFree(GetProcessHeap(), 0, inst->ProcessorPoints);
 
-    if (inst->hPen0)
-        DeleteObject(inst->hPen0);
+    if (inst->ProcessorNodes)
+        HeapFree(GetProcessHeap(), 0, inst->ProcessorNodes);
 
-    if (inst->hPen1)
-        DeleteObject(inst->hPen1);
+    if (inst->ProcessorOrder)
+        HeapFree(GetProcessHeap(), 0, inst->ProcessorOrder);
 
-    if (inst->hBrushBack)
-        DeleteObject(inst->hBrushBack);
+    if (inst->hdcGraph)
+        DeleteDC(inst->hdcGraph);
 
     if (inst->hbmGraph)
         DeleteObject(inst->hbmGraph);
 
-    if (inst->hdcGraph)
-        DeleteObject(inst->hdcGraph);
+    DeleteCriticalSection(&inst->Lock);
+    ZeroMemory(inst, sizeof(*inst));
+}
+
+/*
+ * Enables the per-processor history. pNodes gives the NUMA node of every
+ * processor; the graphs are shown by node, then by processor number.
+ */
+BOOL
+GraphCtrl_SetProcessors(PTM_GRAPH_CONTROL inst, ULONG nProcessors, const BYTE *pNodes)
+{
+    ULONG   i, j;
+    USHORT  Processor;
+
+    inst->ProcessorPoints = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                      nProcessors * inst->NumberOfPoints * NUM_PLOTS);
+    inst->ProcessorNodes = HeapAlloc(GetProcessHeap(), 0, nProcessors);
+    inst->ProcessorOrder = HeapAlloc(GetProcessHeap(), 0, nProcessors * sizeof(USHORT));
+    if (!inst->ProcessorPoints || !inst->ProcessorNodes || !inst->ProcessorOrder)
+        return FALSE;
+
+    memcpy(inst->ProcessorNodes, pNodes, nProcessors);
+
+    /* Insertion sort, stable so processors stay in order within a node */
+    for (i = 0; i < nProcessors; i++)
+    {
+        Processor = (USHORT)i;
+        for (j = i; j > 0 && inst->ProcessorNodes[inst->ProcessorOrder[j - 1]] > pNodes[i]; j--)
+            inst->ProcessorOrder[j] = inst->ProcessorOrder[j - 1];
+        inst->ProcessorOrder[j] = Processor;
+    }
+
+    inst->NumberOfProcessors = nProcessors;
+    inst->ProcessorIndex = 0;
+    return TRUE;
+}
+
+void
+GraphCtrl_SetPerProcessor(PTM_GRAPH_CONTROL inst, BOOL bPerProcessor)
+{
+    EnterCriticalSection(&inst->Lock);
+    inst->DrawPerProcessor = bPerProcessor && inst->NumberOfProcessors;
+    GraphCtrl_Redraw(inst, inst->BitmapHeight);
+    LeaveCriticalSection(&inst->Lock);
 }
 
 void
 GraphCtrl_AddPoint(PTM_GRAPH_CONTROL inst, BYTE val0, BYTE val1)
 {
-    HDC    hdcg;
+    GRAPH_COLUMN Column;
     PBYTE  t;
-    RECT   rcDirt;
+    UINT   Prev0, Prev1;
+    INT    x, k, px;
 
-    UINT   Prev0, Prev1, RetainingWidth;
-    INT    PrevY, CurrY, p, v;
+    EnterCriticalSection(&inst->Lock);
 
-    hdcg = inst->hdcGraph;
-    RetainingWidth = inst->BitmapWidth - PLOT_SHIFT;
     t = inst->PointBuffer;
     Prev0 = *(t + inst->CurrIndex);
     Prev1 = *(t + inst->CurrIndex + inst->NumberOfPoints);
@@ -161,134 +473,120 @@ GraphCtrl_AddPoint(PTM_GRAPH_CONTROL inst, BYTE val0, BYTE val1)
     *(t + inst->CurrIndex) = val0;
     *(t + inst->CurrIndex + inst->NumberOfPoints) = val1;
 
-    /* Drawing points, first shifting the plot left */
-    BitBlt(hdcg, 0, 0, RetainingWidth, inst->BitmapHeight, hdcg, PLOT_SHIFT, 0, SRCCOPY);
+    inst->CurrShift = (inst->CurrShift + PLOT_SHIFT) % inst->GridCellWidth;
 
-    rcDirt.left = RetainingWidth;
-    rcDirt.top = 0;
-    rcDirt.right = inst->BitmapWidth;
-    rcDirt.bottom = inst->BitmapHeight;
-    FillRect(hdcg, &rcDirt, inst->hBrushBack);
-
-    SelectObject(hdcg, inst->hPenGrid);
-    for (p = inst->GridCellHeight - 1;
-         p < inst->BitmapHeight;
-         p += inst->GridCellHeight)
-    {
-        MoveToEx(hdcg, RetainingWidth, p, NULL);
-        LineTo(hdcg, inst->BitmapWidth, p);
-    }
-    v = inst->CurrShift + PLOT_SHIFT;
-    if (v >= inst->GridCellWidth)
+    /* The per-processor graphs are redrawn by GraphCtrl_AddProcessorPoints() */
+    if (inst->pBits && inst->BitmapHeight > 0 && !inst->DrawPerProcessor)
     {
-        v -= inst->GridCellWidth;
-        p = inst->BitmapWidth - v - 1;
-        MoveToEx(hdcg, p, 0, NULL);
-        LineTo(hdcg, p, inst->BitmapHeight);
-    }
-    inst->CurrShift = v;
+        /* Scroll by moving the origin, the oldest columns become the new ones */
+        inst->Origin = (inst->Origin + PLOT_SHIFT) % inst->BitmapWidth;
 
-    if (inst->DrawSecondaryPlot)
-    {
-        SelectObject(inst->hdcGraph, inst->hPen1);
+        for (k = 1; k <= PLOT_SHIFT; k++)
+        {
+            x = inst->BitmapWidth - 1 - PLOT_SHIFT + k;
+            px = (x + inst->Origin) % inst->BitmapWidth;
+
+            Column.bGrid = GraphCtrl_IsGridColumn(inst, inst->BitmapWidth, x);
+            GraphCtrl_SegmentSpan(GraphCtrl_ValueToY(inst->BitmapHeight, Prev0),
+                                  GraphCtrl_ValueToY(inst->BitmapHeight, val0),
+                                  k, &Column.Top[0], &Column.Bottom[0]);
+            if (inst->DrawSecondaryPlot)
+            {
+                GraphCtrl_SegmentSpan(GraphCtrl_ValueToY(inst->BitmapHeight, Prev1),
+                                      GraphCtrl_ValueToY(inst->BitmapHeight, val1),
+                                      k, &Column.Top[1], &Column.Bottom[1]);
+            }
+            else
+            {
+                Column.Top[1] = Column.Bottom[1] = GRAPH_NO_SPAN;
+            }
 
-        PrevY = inst->BitmapHeight - Prev1 * inst->ftPixelsPerPercent;
-        MoveToEx(inst->hdcGraph, RetainingWidth - 1, PrevY, NULL);
-        CurrY = inst->BitmapHeight - val1 * inst->ftPixelsPerPercent;
-        LineTo(inst->hdcGraph, inst->BitmapWidth - 1, CurrY);
+            GraphCtrl_FillColumn(inst, px, &Column);
+        }
     }
 
-    SelectObject(inst->hdcGraph, inst->hPen0);
-    PrevY = inst->BitmapHeight - Prev0 * inst->ftPixelsPerPercent;
-    MoveToEx(inst->hdcGraph, RetainingWidth - 1, PrevY, NULL);
-    CurrY = inst->BitmapHeight - val0 * inst->ftPixelsPerPercent;
-    LineTo(inst->hdcGraph, inst->BitmapWidth - 1, CurrY);
+    LeaveCriticalSection(&inst->Lock);
 }
 
-inline void
-GraphCtrl_RedrawBitmap(PTM_GRAPH_CONTROL inst, INT h)
+/*
+ * Adds one point per processor, pUsage and pKernelUsage hold
+ * NumberOfProcessors percentages. Call after GraphCtrl_AddPoint().
+ */
+void
+GraphCtrl_AddProcessorPoints(PTM_GRAPH_CONTROL inst, const BYTE *pUsage, const BYTE *pKernelUsage)
 {
-    HDC    hdcg;
-    PBYTE  t;
-    RECT   rc;
-    INT    i, j, y, x, p;
-    FLOAT  coef;
+    PBYTE   t;
+    ULONG   i, Index;
 
-    hdcg = inst->hdcGraph;
-    rc.left = 0; rc.top = 0;
-    rc.right = inst->BitmapWidth; rc.bottom = h;
-    FillRect(hdcg, &rc, inst->hBrushBack);
+    if (!inst->NumberOfProcessors)
+        return;
 
-    SelectObject(hdcg, inst->hPenGrid);
+    /* The layout follows the client width and the bitmap set on WM_SIZE */
+    EnterCriticalSection(&inst->Lock);
 
-    for (p = inst->GridCellHeight - 1;
-         p < inst->BitmapHeight;
-         p += inst->GridCellHeight)
-    {
-        MoveToEx(hdcg, 0, p, NULL);
-        LineTo(hdcg, inst->BitmapWidth, p);
-    }
+    Index = inst->ProcessorIndex + 1;
+    if (Index == inst->NumberOfPoints)
+        Index = 0;
+    inst->ProcessorIndex = Index;
 
-    for (p = inst->BitmapWidth - inst->CurrShift - 1;
-         p > 0;
-         p -= inst->GridCellWidth)
+    t = inst->ProcessorPoints;
+    for (i = 0; i < inst->NumberOfProcessors; i++)
     {
-        MoveToEx(hdcg, p, 0, NULL);
-        LineTo(hdcg, p, inst->BitmapHeight);
+        t[i * inst->NumberOfPoints + Index] = pUsage[i];
+        t[(inst->NumberOfProcessors + i) * inst->NumberOfPoints + Index] = pKernelUsage[i];
     }
 
-    coef = inst->ftPixelsPerPercent;
+    if (inst->DrawPerProcessor && inst->pBits && inst->BitmapHeight > 0)
+        GraphCtrl_RedrawProcessors(inst);
 
-    if (inst->DrawSecondaryPlot)
-    {
-        SelectObject(hdcg, inst->hPen1);
-        t = inst->PointBuffer + inst->NumberOfPoints;
-        x = inst->BitmapWidth - 1;
-        j = inst->CurrIndex;
-        y = h - *(t + j) * coef;
-        MoveToEx(hdcg, x, y, NULL);
-        for (i = 0; i < inst->NumberOfPoints; i++)
-        {
-            j = (j ? j : inst->NumberOfPoints) - 1;
-            y = h - *(t + j) * coef;
-            x -= PLOT_SHIFT;
-            LineTo(hdcg, x, y);
-        }
-    }
+    LeaveCriticalSection(&inst->Lock);
+}
 
-    SelectObject(hdcg, inst->hPen0);
-    t = inst->PointBuffer;
-    x = inst->BitmapWidth - 1;
-    j = inst->CurrIndex;
-    y = h - *(t + j) * coef;
-    MoveToEx(hdcg, x, y, NULL);
+static void
+GraphCtrl_Redraw(PTM_GRAPH_CONTROL inst, INT h)
+{
+    PGRAPH_COLUMN pColumns;
+    PBYTE   pPoints[NUM_PLOTS];
+
+    if (!inst->pBits || h <= 0)
+        return;
 
-    for (i = 0; i < inst->NumberOfPoints; i++)
+    /* The ring restarts at the left edge of the bitmap */
+    inst->Origin = 0;
+
+    if (inst->DrawPerProcessor)
     {
-        j = (j ? j : inst->NumberOfPoints) - 1;
-        y = h - *(t + j) * coef;
-        x -= PLOT_SHIFT;
-        LineTo(hdcg, x, y);
+        GraphCtrl_RedrawProcessors(inst);
+        return;
     }
+
+    pColumns = HeapAlloc(GetProcessHeap(), 0, inst->BitmapWidth * sizeof(GRAPH_COLUMN));
+    if (!pColumns)
+        return;
+
+    pPoints[0] = inst->PointBuffer;
+    pPoints[1] = inst->DrawSecondaryPlot ? inst->PointBuffer + inst->NumberOfPoints : NULL;
+    GraphCtrl_DrawGraph(inst, inst->pBits, inst->BitmapWidth, h, pPoints, inst->CurrIndex, pColumns);
+
+    HeapFree(GetProcessHeap(), 0, pColumns);
 }
 
 inline void
-GraphCtrl_RedrawOnHeightChange(PTM_GRAPH_CONTROL inst, INT nh)
+GraphCtrl_RedrawBitmap(PTM_GRAPH_CONTROL inst, INT h)
 {
-    HDC     hdc;
-    HBITMAP hbmOld;
-
-    inst->BitmapHeight = nh;
-    inst->ftPixelsPerPercent = (FLOAT)nh / 100.00f;
-
-    hdc = GetDC(inst->hParentWnd);
-    hbmOld = inst->hbmGraph;
-    inst->hbmGraph = CreateCompatibleBitmap(hdc, inst->BitmapWidth, nh);
-    SelectObject(inst->hdcGraph, inst->hbmGraph);
-    DeleteObject(hbmOld);
-    ReleaseDC(inst->hParentWnd, hdc);
+    EnterCriticalSection(&inst->Lock);
+    GraphCtrl_Redraw(inst, h);
+    LeaveCriticalSection(&inst->Lock);
+}
 
-    GraphCtrl_RedrawBitmap(inst, nh);
+inline void
+GraphCtrl_RedrawOnHeightChange(PTM_GRAPH_CONTROL inst, INT nh)
+{
+    /* The refresh thread must not draw into the bitmap being replaced */
+    EnterCriticalSection(&inst->Lock);
+    if (GraphCtrl_CreateBitmap(inst, nh))
+        GraphCtrl_Redraw(inst, nh);
+    LeaveCriticalSection(&inst->Lock);
 }
 
 extern TM_GRAPH_CONTROL PerformancePageCpuUsageHistoryGraph;
@@ -371,10 +669,20 @@ GraphCtrl_WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             else
                 return 0;
 
+            EnterCriticalSection(&graph->Lock);
             if (HIWORD(lParam) != graph->BitmapHeight)
             {
+                graph->ClientWidth = LOWORD(lParam);
                 GraphCtrl_RedrawOnHeightChange(graph, HIWORD(lParam));
             }
+            else if (LOWORD(lParam) != graph->ClientWidth)
+            {
+                /* The per-processor layout depends on the width too */
+                graph->ClientWidth = LOWORD(lParam);
+                if (graph->DrawPerProcessor)
+                    GraphCtrl_Redraw(graph, graph->BitmapHeight);
+            }
+            LeaveCriticalSection(&graph->Lock);
             InvalidateRect(hWnd, NULL, FALSE);
 
             return 0;
@@ -385,6 +693,7 @@ GraphCtrl_WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             RECT        rcClient;
             HDC         hdc;
             PAINTSTRUCT ps;
+            INT         Width, First, Part;
 
             if (hWnd == hPerformancePageCpuUsageHistoryGraph)
                 graph = &PerformancePageCpuUsageHistoryGraph;
@@ -395,13 +704,34 @@ GraphCtrl_WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
             hdc = BeginPaint(hWnd, &ps);
             GetClientRect(hWnd, &rcClient);
+            EnterCriticalSection(&graph->Lock);
+
+            /* Unroll the circular bitmap: the newest columns end at the right edge.
+             * The per-processor graphs are laid out from the left edge. */
+            Width = min(rcClient.right, graph->BitmapWidth);
+            if (graph->DrawPerProcessor)
+                First = 0;
+            else
+                First = (graph->BitmapWidth - Width + graph->Origin) % graph->BitmapWidth;
+            Part = min(Width, graph->BitmapWidth - First);
             BitBlt(hdc, 0, 0,
-                   rcClient.right,
+                   Part,
                    rcClient.bottom,
                    graph->hdcGraph,
-                   graph->BitmapWidth - rcClient.right,
+                   First,
                    0,
                    SRCCOPY);
+            if (Part < Width)
+            {
+                BitBlt(hdc, Part, 0,
+                       Width - Part,
+                       rcClient.bottom,
+                       graph->hdcGraph,
+                       0,
+                       0,
+                       SRCCOPY);
+            }
+            LeaveCriticalSection(&graph->Lock);
             EndPaint(hWnd, &ps);
             return 0;
         }
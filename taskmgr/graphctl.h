@@ -37,23 +37,35 @@ typedef struct _TM_GRAPH_CONTROL
     HWND     hWnd;
     HDC      hdcGraph;
     HBITMAP  hbmGraph;
-    HPEN     hPenGrid;
-    HPEN     hPen0;
-    HPEN     hPen1;
-    HBRUSH   hBrushBack;
+    PDWORD   pBits;          /* Pixels of hbmGraph, top-down 32-bit */
+    CRITICAL_SECTION Lock;   /* The refresh thread draws while the window resizes and paints */
+
+    DWORD    clrBack;        /* Colors in the DIB pixel format */
+    DWORD    clrGrid;
+    DWORD    clrPlot0;
+    DWORD    clrPlot1;
 
     INT      BitmapWidth;
     INT      BitmapHeight;
     INT      GridCellWidth;
     INT      GridCellHeight;
     INT      CurrShift;
+    INT      Origin;         /* Physical column of the leftmost logical column */
 
     PBYTE    PointBuffer;
     UINT32   NumberOfPoints;
     UINT32   CurrIndex;
 
-    FLOAT    ftPixelsPerPercent;
     BOOL     DrawSecondaryPlot;
+
+    /* One small graph per processor, see GraphCtrl_SetProcessors() */
+    BOOL     DrawPerProcessor;
+    ULONG    NumberOfProcessors;
+    PBYTE    ProcessorNodes;         /* NUMA node of each processor */
+    PUSHORT  ProcessorOrder;         /* Processors sorted by node */
+    PBYTE    ProcessorPoints;        /* [plot][processor][NumberOfPoints] */
+    UINT32   ProcessorIndex;
+    INT      ClientWidth;
 }
 TM_GRAPH_CONTROL, *PTM_GRAPH_CONTROL;
 
@@ -75,6 +87,9 @@ INT_PTR CALLBACK GraphCtrl_WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARA
 BOOL GraphCtrl_Create(PTM_GRAPH_CONTROL inst, HWND hWnd, HWND hParentWnd, PTM_FORMAT fmt);
 void GraphCtrl_Dispose(PTM_GRAPH_CONTROL inst);
 void GraphCtrl_AddPoint(PTM_GRAPH_CONTROL inst, BYTE val0, BYTE val1);
+BOOL GraphCtrl_SetProcessors(PTM_GRAPH_CONTROL inst, ULONG nProcessors, const BYTE *pNodes);
+void GraphCtrl_SetPerProcessor(PTM_GRAPH_CONTROL inst, BOOL bPerProcessor);
+void GraphCtrl_AddProcessorPoints(PTM_GRAPH_CONTROL inst, const BYTE *pUsage, const BYTE *pKernelUsage);
 void GraphCtrl_RedrawOnHeightChange(PTM_GRAPH_CONTROL inst, INT nh);
 void GraphCtrl_RedrawBitmap(PTM_GRAPH_CONTROL inst, INT h);
 
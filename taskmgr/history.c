@@ -0,0 +1,728 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  history.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Counter history store.
+ *
+ * System and per-process counters are kept in fixed-size, columnar ring
+ * buffers with three tiers: every refresh, one-minute averages and one-hour
+ * averages. The whole store lives in a memory-mapped file under the local
+ * application data folder, so the history survives restarts of the Task
+ * Manager, and it can be exported to CSV from the File menu.
+ *
+ * Per-process history is kept for HISTORY_MAX_PROCESSES slots. A process
+ * gets a slot the first time it uses CPU; when all slots are taken, the one
+ * idle for the longest time is recycled.
+ *
+ * All functions are called from the main window thread.
+ */
+
+#include "precomp.h"
+
+#include <commdlg.h>
+#include <shlobj.h>
+#include <strsafe.h>
+
+#define HISTORY_FILE_NAME       L"XTaskMgr.hst"
+#define HISTORY_MAGIC           0x53484D54  /* 'TMHS' */
+#define HISTORY_VERSION         1
+
+#define HISTORY_MAX_PROCESSES   128
+#define HISTORY_NO_VALUE        0xFFFFFFFF
+#define HISTORY_NAME_LENGTH     64
+
+/* System counters */
+#define HISTORY_SYS_CPU         0   /* % */
+#define HISTORY_SYS_KERNEL      1   /* % */
+#define HISTORY_SYS_COMMIT      2   /* K */
+#define HISTORY_SYS_PHYSAVAIL   3   /* K */
+#define HISTORY_SYS_HANDLES     4
+#define HISTORY_SYS_THREADS     5
+#define HISTORY_SYS_PROCESSES   6
+#define HISTORY_SYS_COUNTERS    7
+
+/* Per-process counters */
+#define HISTORY_PROC_CPU        0   /* % */
+#define HISTORY_PROC_WORKINGSET 1   /* K */
+#define HISTORY_PROC_COUNTERS   2
+
+/* PID -> slot index, open addressing, at most half full */
+#define HISTORY_INDEX_SIZE      (HISTORY_MAX_PROCESSES * 2)
+
+static const ULONG HistoryTierInterval[HISTORY_TIERS] = { 1, 60, 3600 };
+static const ULONG HistoryTierCapacity[HISTORY_TIERS] = { 900, 1440, 720 };
+static const LPCSTR HistoryTierName[HISTORY_TIERS] = { "Seconds", "Minutes", "Hours" };
+
+typedef struct _HISTORY_PROCESS_SLOT
+{
+    ULONG       ProcessId;
+    ULONG       NameHash;           /* 0 when the slot is free */
+    ULONGLONG   LastSeen;
+    ULONGLONG   LastActive;         /* Last sample with some CPU usage */
+    WCHAR       ImageName[HISTORY_NAME_LENGTH];
+} HISTORY_PROCESS_SLOT, *PHISTORY_PROCESS_SLOT;
+
+typedef struct _HISTORY_TIER
+{
+    ULONG       Head;               /* Next sample to be written */
+    ULONG       Count;              /* Number of valid samples */
+
+    /* Samples of the lower tier being averaged into this one */
+    ULONGLONG   AccumTime;
+    ULONG       AccumSamples;
+    ULONG       AccumProcessSamples[HISTORY_MAX_PROCESSES];
+    ULONGLONG   AccumSystem[HISTORY_SYS_COUNTERS];
+    ULONGLONG   AccumProcess[HISTORY_MAX_PROCESSES][HISTORY_PROC_COUNTERS];
+} HISTORY_TIER, *PHISTORY_TIER;
+
+/* Start of the history file, followed by the column arrays of every tier */
+typedef struct _HISTORY_HEADER
+{
+    DWORD                   Magic;
+    DWORD                   Version;
+    DWORD                   cbSize;
+    DWORD                   Reserved;
+    HISTORY_PROCESS_SLOT    Slots[HISTORY_MAX_PROCESSES];
+    HISTORY_TIER            Tiers[HISTORY_TIERS];
+} HISTORY_HEADER, *PHISTORY_HEADER;
+
+typedef struct _HISTORY_COLUMNS
+{
+    PULONGLONG  Time;               /* Seconds since 1601, UTC */
+    PULONG      System[HISTORY_SYS_COUNTERS];
+    PULONG      Process[HISTORY_MAX_PROCESSES][HISTORY_PROC_COUNTERS];
+} HISTORY_COLUMNS, *PHISTORY_COLUMNS;
+
+typedef ULONG HISTORY_PROCESS_VALUES[HISTORY_MAX_PROCESSES][HISTORY_PROC_COUNTERS];
+
+static PHISTORY_HEADER  pHistory = NULL;
+static HANDLE           hHistoryFile = INVALID_HANDLE_VALUE;
+static HANDLE           hHistoryMapping = NULL;
+static HISTORY_COLUMNS  HistoryColumns[HISTORY_TIERS];
+static SHORT            HistorySlotIndex[HISTORY_INDEX_SIZE];
+
+/*
+ * Computes the layout of the store. When pBase is given, also points
+ * HistoryColumns at the column arrays. Returns the total size in bytes.
+ */
+static SIZE_T HistoryLayout(LPBYTE pBase)
+{
+    SIZE_T  Offset = sizeof(HISTORY_HEADER);
+    UINT    Tier, c, s;
+    ULONG   Capacity;
+
+#define HISTORY_ALIGN(x)  (((x) + 7) & ~(SIZE_T)7)
+
+    for (Tier = 0; Tier < HISTORY_TIERS; Tier++)
+    {
+        Capacity = HistoryTierCapacity[Tier];
+
+        Offset = HISTORY_ALIGN(Offset);
+        if (pBase)
+            HistoryColumns[Tier].Time = (PULONGLONG)(pBase + Offset);
+        Offset += Capacity * sizeof(ULONGLONG);
+
+        for (c = 0; c < HISTORY_SYS_COUNTERS; c++)
+        {
+            if (pBase)
+                HistoryColumns[Tier].System[c] = (PULONG)(pBase + Offset);
+            Offset += Capacity * sizeof(ULONG);
+        }
+
+        for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+        {
+            for (c = 0; c < HISTORY_PROC_COUNTERS; c++)
+            {
+                if (pBase)
+                    HistoryColumns[Tier].Process[s][c] = (PULONG)(pBase + Offset);
+                Offset += Capacity * sizeof(ULONG);
+            }
+        }
+    }
+
+#undef HISTORY_ALIGN
+
+    return Offset;
+}
+
+static ULONGLONG HistoryGetTime(void)
+{
+    FILETIME        ft;
+    ULARGE_INTEGER  li;
+
+    GetSystemTimeAsFileTime(&ft);
+    li.LowPart = ft.dwLowDateTime;
+    li.HighPart = ft.dwHighDateTime;
+    return li.QuadPart / 10000000;
+}
+
+static ULONG HistoryHashName(LPCWSTR lpName)
+{
+    ULONG Hash = 2166136261u;
+
+    while (*lpName)
+    {
+        Hash ^= *lpName++;
+        Hash *= 16777619u;
+    }
+
+    /* 0 marks a free slot */
+    return Hash ? Hash : 1;
+}
+
+static void HistoryRebuildIndex(void)
+{
+    UINT  s;
+    ULONG i;
+
+    for (i = 0; i < HISTORY_INDEX_SIZE; i++)
+        HistorySlotIndex[i] = -1;
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        if (pHistory->Slots[s].NameHash == 0)
+            continue;
+
+        i = pHistory->Slots[s].ProcessId % HISTORY_INDEX_SIZE;
+        while (HistorySlotIndex[i] != -1)
+            i = (i + 1) % HISTORY_INDEX_SIZE;
+        HistorySlotIndex[i] = (SHORT)s;
+    }
+}
+
+static int HistoryLookupSlot(ULONG ProcessId, ULONG NameHash)
+{
+    ULONG i = ProcessId % HISTORY_INDEX_SIZE;
+    PHISTORY_PROCESS_SLOT pSlot;
+
+    while (HistorySlotIndex[i] != -1)
+    {
+        pSlot = &pHistory->Slots[HistorySlotIndex[i]];
+        if (pSlot->ProcessId == ProcessId && pSlot->NameHash == NameHash)
+            return HistorySlotIndex[i];
+        i = (i + 1) % HISTORY_INDEX_SIZE;
+    }
+
+    return -1;
+}
+
+/*
+ * Takes over the slot idle for the longest time (or a free one) for a new
+ * process, and forgets the history the slot held so far.
+ */
+static int HistoryAllocSlot(ULONG ProcessId, ULONG NameHash, LPCWSTR lpImageName, ULONGLONG Now)
+{
+    PHISTORY_PROCESS_SLOT pSlot;
+    int     Victim = -1;
+    UINT    s, Tier, c;
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        pSlot = &pHistory->Slots[s];
+        if (pSlot->NameHash == 0)
+        {
+            Victim = s;
+            break;
+        }
+
+        /* Never recycle the slot of a process sampled right now */
+        if (pSlot->LastSeen == Now)
+            continue;
+
+        if (Victim == -1 || pSlot->LastActive < pHistory->Slots[Victim].LastActive)
+            Victim = s;
+    }
+
+    if (Victim == -1)
+        return -1;
+
+    for (Tier = 0; Tier < HISTORY_TIERS; Tier++)
+    {
+        for (c = 0; c < HISTORY_PROC_COUNTERS; c++)
+        {
+            memset(HistoryColumns[Tier].Process[Victim][c], 0xFF, HistoryTierCapacity[Tier] * sizeof(ULONG));
+            pHistory->Tiers[Tier].AccumProcess[Victim][c] = 0;
+        }
+        pHistory->Tiers[Tier].AccumProcessSamples[Victim] = 0;
+    }
+
+    pSlot = &pHistory->Slots[Victim];
+    pSlot->ProcessId = ProcessId;
+    pSlot->NameHash = NameHash;
+    pSlot->LastSeen = Now;
+    pSlot->LastActive = Now;
+    StringCchCopyW(pSlot->ImageName, _countof(pSlot->ImageName), lpImageName);
+
+    HistoryRebuildIndex();
+    return Victim;
+}
+
+static void HistoryStore(UINT Tier, ULONGLONG Time, const ULONG *System, HISTORY_PROCESS_VALUES Process)
+{
+    PHISTORY_TIER    pTier = &pHistory->Tiers[Tier];
+    PHISTORY_COLUMNS pColumns = &HistoryColumns[Tier];
+    ULONG            i = pTier->Head;
+    UINT             c, s;
+
+    pColumns->Time[i] = Time;
+
+    for (c = 0; c < HISTORY_SYS_COUNTERS; c++)
+        pColumns->System[c][i] = System[c];
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        for (c = 0; c < HISTORY_PROC_COUNTERS; c++)
+            pColumns->Process[s][c][i] = Process[s][c];
+    }
+
+    pTier->Head = (i + 1) % HistoryTierCapacity[Tier];
+    if (pTier->Count < HistoryTierCapacity[Tier])
+        pTier->Count++;
+}
+
+static void HistoryAccumulate(UINT Tier, ULONGLONG Time, const ULONG *System, HISTORY_PROCESS_VALUES Process);
+
+/* Stores the average of the accumulated samples, and passes it on to the next tier */
+static void HistoryFlush(UINT Tier)
+{
+    PHISTORY_TIER           pTier = &pHistory->Tiers[Tier];
+    ULONG                   System[HISTORY_SYS_COUNTERS];
+    HISTORY_PROCESS_VALUES  Process;
+    ULONGLONG               Time = pTier->AccumTime;
+    UINT                    c, s;
+
+    for (c = 0; c < HISTORY_SYS_COUNTERS; c++)
+        System[c] = (ULONG)(pTier->AccumSystem[c] / pTier->AccumSamples);
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        for (c = 0; c < HISTORY_PROC_COUNTERS; c++)
+        {
+            if (pTier->AccumProcessSamples[s])
+                Process[s][c] = (ULONG)(pTier->AccumProcess[s][c] / pTier->AccumProcessSamples[s]);
+            else
+                Process[s][c] = HISTORY_NO_VALUE;
+        }
+    }
+
+    HistoryStore(Tier, Time, System, Process);
+
+    pTier->AccumSamples = 0;
+    ZeroMemory(pTier->AccumProcessSamples, sizeof(pTier->AccumProcessSamples));
+    ZeroMemory(pTier->AccumSystem, sizeof(pTier->AccumSystem));
+    ZeroMemory(pTier->AccumProcess, sizeof(pTier->AccumProcess));
+
+    HistoryAccumulate(Tier + 1, Time, System, Process);
+}
+
+static void HistoryAccumulate(UINT Tier, ULONGLONG Time, const ULONG *System, HISTORY_PROCESS_VALUES Process)
+{
+    PHISTORY_TIER   pTier;
+    ULONGLONG       Bucket;
+    UINT            c, s;
+
+    if (Tier >= HISTORY_TIERS)
+        return;
+
+    pTier = &pHistory->Tiers[Tier];
+    Bucket = Time - Time % HistoryTierInterval[Tier];
+
+    if (pTier->AccumSamples && pTier->AccumTime != Bucket)
+        HistoryFlush(Tier);
+
+    if (pTier->AccumSamples == 0)
+        pTier->AccumTime = Bucket;
+    pTier->AccumSamples++;
+
+    for (c = 0; c < HISTORY_SYS_COUNTERS; c++)
+        pTier->AccumSystem[c] += System[c];
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        if (Process[s][HISTORY_PROC_CPU] == HISTORY_NO_VALUE)
+            continue;
+
+        for (c = 0; c < HISTORY_PROC_COUNTERS; c++)
+            pTier->AccumProcess[s][c] += Process[s][c];
+        pTier->AccumProcessSamples[s]++;
+    }
+}
+
+/*
+ * Checks a history file left by a previous session before using it, the
+ * ring positions and slots index the column arrays directly.
+ */
+static BOOL HistoryIsValid(SIZE_T cbSize)
+{
+    PHISTORY_TIER   pTier;
+    UINT            Tier, s;
+
+    if (pHistory->Magic != HISTORY_MAGIC ||
+        pHistory->Version != HISTORY_VERSION ||
+        pHistory->cbSize != cbSize)
+    {
+        return FALSE;
+    }
+
+    for (Tier = 0; Tier < HISTORY_TIERS; Tier++)
+    {
+        pTier = &pHistory->Tiers[Tier];
+
+        /* The ring is filled from the start before it wraps */
+        if (pTier->Head >= HistoryTierCapacity[Tier] ||
+            pTier->Count > HistoryTierCapacity[Tier] ||
+            (pTier->Count < HistoryTierCapacity[Tier] && pTier->Head != pTier->Count))
+        {
+            return FALSE;
+        }
+
+        if (pTier->AccumTime % HistoryTierInterval[Tier] != 0)
+            return FALSE;
+    }
+
+    for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+    {
+        if (FAILED(StringCchLengthW(pHistory->Slots[s].ImageName,
+                                    _countof(pHistory->Slots[s].ImageName), NULL)))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL HistoryInitialize(void)
+{
+    WCHAR   szPath[MAX_PATH];
+    SIZE_T  cbSize;
+
+    cbSize = HistoryLayout(NULL);
+
+    if (SUCCEEDED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, szPath)) &&
+        SUCCEEDED(StringCchCatW(szPath, _countof(szPath), L"\\" HISTORY_FILE_NAME)))
+    {
+        hHistoryFile = CreateFileW(szPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                   OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hHistoryFile != INVALID_HANDLE_VALUE)
+        {
+            hHistoryMapping = CreateFileMappingW(hHistoryFile, NULL, PAGE_READWRITE, 0, (DWORD)cbSize, NULL);
+            if (hHistoryMapping)
+                pHistory = MapViewOfFile(hHistoryMapping, FILE_MAP_WRITE, 0, 0, cbSize);
+        }
+    }
+
+    /* No history file, keep the history of this session only */
+    if (!pHistory)
+    {
+        if (hHistoryMapping)
+        {
+            CloseHandle(hHistoryMapping);
+            hHistoryMapping = NULL;
+        }
+        if (hHistoryFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hHistoryFile);
+            hHistoryFile = INVALID_HANDLE_VALUE;
+        }
+
+        pHistory = VirtualAlloc(NULL, cbSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!pHistory)
+            return FALSE;
+    }
+
+    if (!HistoryIsValid(cbSize))
+    {
+        ZeroMemory(pHistory, cbSize);
+        pHistory->Magic = HISTORY_MAGIC;
+        pHistory->Version = HISTORY_VERSION;
+        pHistory->cbSize = (DWORD)cbSize;
+    }
+
+    HistoryLayout((LPBYTE)pHistory);
+    HistoryRebuildIndex();
+
+    return TRUE;
+}
+
+void HistoryUninitialize(void)
+{
+    if (!pHistory)
+        return;
+
+    if (hHistoryMapping)
+    {
+        FlushViewOfFile(pHistory, 0);
+        UnmapViewOfFile(pHistory);
+        CloseHandle(hHistoryMapping);
+        CloseHandle(hHistoryFile);
+        hHistoryMapping = NULL;
+        hHistoryFile = INVALID_HANDLE_VALUE;
+    }
+    else
+    {
+        VirtualFree(pHistory, 0, MEM_RELEASE);
+    }
+
+    pHistory = NULL;
+}
+
+void HistoryAddSample(void)
+{
+    ULONGLONG               Now;
+    ULONG                   System[HISTORY_SYS_COUNTERS];
+    HISTORY_PROCESS_VALUES  Process;
+    PPERFDATA               pData;
+    ULONG                   nProcesses, i, ProcessId, NameHash;
+    int                     Slot;
+
+    if (!pHistory)
+        return;
+
+    Now = HistoryGetTime();
+
+    System[HISTORY_SYS_CPU] = min(PerfDataGetProcessorUsage(), 100);
+    System[HISTORY_SYS_KERNEL] = min(PerfDataGetProcessorSystemUsage(), 100);
+    System[HISTORY_SYS_COMMIT] = PerfDataGetCommitChargeTotalK();
+    System[HISTORY_SYS_PHYSAVAIL] = PerfDataGetPhysicalMemoryAvailableK();
+    System[HISTORY_SYS_HANDLES] = PerfDataGetSystemHandleCount();
+    System[HISTORY_SYS_THREADS] = PerfDataGetTotalThreadCount();
+    System[HISTORY_SYS_PROCESSES] = PerfDataGetProcessCount();
+
+    memset(Process, 0xFF, sizeof(Process));
+
+    pData = PerfDataLock(&nProcesses);
+    for (i = 0; i < nProcesses; i++)
+    {
+        /* The idle process is already accounted for by the system CPU usage */
+        ProcessId = PtrToUlong(pData[i].ProcessId);
+        if (ProcessId == 0)
+            continue;
+
+        NameHash = HistoryHashName(pData[i].ImageName);
+        Slot = HistoryLookupSlot(ProcessId, NameHash);
+        if (Slot == -1)
+        {
+            if (pData[i].CPUUsage == 0)
+                continue;
+
+            Slot = HistoryAllocSlot(ProcessId, NameHash, pData[i].ImageName, Now);
+            if (Slot == -1)
+                continue;
+        }
+
+        pHistory->Slots[Slot].LastSeen = Now;
+        if (pData[i].CPUUsage)
+            pHistory->Slots[Slot].LastActive = Now;
+
+        Process[Slot][HISTORY_PROC_CPU] = min(pData[i].CPUUsage, 100);
+        Process[Slot][HISTORY_PROC_WORKINGSET] = pData[i].WorkingSetSizeBytes / 1024;
+    }
+    PerfDataUnlock();
+
+    HistoryStore(HISTORY_TIER_SECONDS, Now, System, Process);
+    HistoryAccumulate(HISTORY_TIER_MINUTES, Now, System, Process);
+}
+
+/*
+ * CSV export
+ */
+
+typedef struct _HISTORY_WRITER
+{
+    HANDLE  hFile;
+    DWORD   cbUsed;
+    BOOL    bFailed;
+    CHAR    Buffer[64 * 1024];
+} HISTORY_WRITER, *PHISTORY_WRITER;
+
+static void HistoryWriterFlush(PHISTORY_WRITER pWriter)
+{
+    DWORD cbWritten;
+
+    if (pWriter->cbUsed && !pWriter->bFailed)
+    {
+        if (!WriteFile(pWriter->hFile, pWriter->Buffer, pWriter->cbUsed, &cbWritten, NULL) ||
+            cbWritten != pWriter->cbUsed)
+        {
+            pWriter->bFailed = TRUE;
+        }
+    }
+    pWriter->cbUsed = 0;
+}
+
+static void HistoryWriterPrintf(PHISTORY_WRITER pWriter, LPCSTR lpFormat, ...)
+{
+    va_list args;
+    CHAR    szLine[512];
+    size_t  cchLine;
+
+    va_start(args, lpFormat);
+    StringCchVPrintfA(szLine, _countof(szLine), lpFormat, args);
+    va_end(args);
+
+    StringCchLengthA(szLine, _countof(szLine), &cchLine);
+    if (pWriter->cbUsed + cchLine > sizeof(pWriter->Buffer))
+        HistoryWriterFlush(pWriter);
+
+    memcpy(pWriter->Buffer + pWriter->cbUsed, szLine, cchLine);
+    pWriter->cbUsed += (DWORD)cchLine;
+}
+
+static void HistoryFormatTime(ULONGLONG Time, LPSTR lpText, ULONG cchText)
+{
+    ULARGE_INTEGER  li;
+    FILETIME        ft, ftLocal;
+    SYSTEMTIME      st;
+
+    li.QuadPart = Time * 10000000;
+    ft.dwLowDateTime = li.LowPart;
+    ft.dwHighDateTime = li.HighPart;
+
+    if (!FileTimeToLocalFileTime(&ft, &ftLocal) || !FileTimeToSystemTime(&ftLocal, &st))
+        ZeroMemory(&st, sizeof(st));
+
+    StringCchPrintfA(lpText, cchText, "%04u-%02u-%02u %02u:%02u:%02u",
+                     st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+}
+
+BOOL HistoryExportCsv(LPCWSTR lpFileName)
+{
+    PHISTORY_WRITER     pWriter;
+    PHISTORY_TIER       pTier;
+    PHISTORY_COLUMNS    pColumns;
+    ULONG               Capacity, n, i;
+    UINT                Tier, s;
+    CHAR                szTime[32];
+    CHAR                szName[HISTORY_NAME_LENGTH * 3];
+    BOOL                bSuccess;
+
+    if (!pHistory)
+        return FALSE;
+
+    pWriter = HeapAlloc(GetProcessHeap(), 0, sizeof(HISTORY_WRITER));
+    if (!pWriter)
+        return FALSE;
+
+    pWriter->hFile = CreateFileW(lpFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pWriter->hFile == INVALID_HANDLE_VALUE)
+    {
+        HeapFree(GetProcessHeap(), 0, pWriter);
+        return FALSE;
+    }
+    pWriter->cbUsed = 0;
+    pWriter->bFailed = FALSE;
+
+    /* System counters, oldest sample first */
+    HistoryWriterPrintf(pWriter, "Tier,Time,CPU %%,Kernel %%,Commit (K),Available Physical (K),Handles,Threads,Processes\r\n");
+    for (Tier = 0; Tier < HISTORY_TIERS; Tier++)
+    {
+        pTier = &pHistory->Tiers[Tier];
+        pColumns = &HistoryColumns[Tier];
+        Capacity = HistoryTierCapacity[Tier];
+
+        for (n = 0; n < pTier->Count; n++)
+        {
+            i = (pTier->Head + Capacity - pTier->Count + n) % Capacity;
+            HistoryFormatTime(pColumns->Time[i], szTime, _countof(szTime));
+            HistoryWriterPrintf(pWriter, "%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n",
+                                HistoryTierName[Tier], szTime,
+                                pColumns->System[HISTORY_SYS_CPU][i],
+                                pColumns->System[HISTORY_SYS_KERNEL][i],
+                                pColumns->System[HISTORY_SYS_COMMIT][i],
+                                pColumns->System[HISTORY_SYS_PHYSAVAIL][i],
+                                pColumns->System[HISTORY_SYS_HANDLES][i],
+                                pColumns->System[HISTORY_SYS_THREADS][i],
+                                pColumns->System[HISTORY_SYS_PROCESSES][i]);
+        }
+    }
+
+    /* Per-process counters, one row per process and sample */
+    HistoryWriterPrintf(pWriter, "\r\nTier,Time,PID,Image Name,CPU %%,Mem Usage (K)\r\n");
+    for (Tier = 0; Tier < HISTORY_TIERS; Tier++)
+    {
+        pTier = &pHistory->Tiers[Tier];
+        pColumns = &HistoryColumns[Tier];
+        Capacity = HistoryTierCapacity[Tier];
+
+        for (s = 0; s < HISTORY_MAX_PROCESSES; s++)
+        {
+            if (pHistory->Slots[s].NameHash == 0)
+                continue;
+
+            if (!WideCharToMultiByte(CP_UTF8, 0, pHistory->Slots[s].ImageName, -1,
+                                     szName, sizeof(szName), NULL, NULL))
+                szName[0] = 0;
+
+            for (n = 0; n < pTier->Count; n++)
+            {
+                i = (pTier->Head + Capacity - pTier->Count + n) % Capacity;
+                if (pColumns->Process[s][HISTORY_PROC_CPU][i] == HISTORY_NO_VALUE)
+                    continue;
+
+                HistoryFormatTime(pColumns->Time[i], szTime, _countof(szTime));
+                HistoryWriterPrintf(pWriter, "%s,%s,%lu,\"%s\",%lu,%lu\r\n",
+                                    HistoryTierName[Tier], szTime,
+                                    pHistory->Slots[s].ProcessId, szName,
+                                    pColumns->Process[s][HISTORY_PROC_CPU][i],
+                                    pColumns->Process[s][HISTORY_PROC_WORKINGSET][i]);
+            }
+        }
+    }
+
+    HistoryWriterFlush(pWriter);
+    bSuccess = !pWriter->bFailed;
+
+    CloseHandle(pWriter->hFile);
+    HeapFree(GetProcessHeap(), 0, pWriter);
+
+    return bSuccess;
+}
+
+void TaskManager_OnFileExportHistory(void)
+{
+    OPENFILENAMEW   ofn;
+    WCHAR           szFileName[MAX_PATH] = L"history.csv";
+    WCHAR           szFilter[256];
+    LPWSTR          p;
+
+    /* The filter is stored with '|' separators in the string table */
+    LoadStringW(hInst, IDS_HISTORY_FILTER, szFilter, _countof(szFilter));
+    for (p = szFilter; *p; p++)
+    {
+        if (*p == L'|')
+            *p = UNICODE_NULL;
+    }
+
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hMainWnd;
+    ofn.lpstrFilter = szFilter;
+    ofn.lpstrFile = szFileName;
+    ofn.nMaxFile = _countof(szFileName);
+    ofn.lpstrDefExt = L"csv";
+    ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+
+    if (!GetSaveFileNameW(&ofn))
+        return;
+
+    if (!HistoryExportCsv(szFileName))
+        ShowWin32Error(GetLastError());
+}
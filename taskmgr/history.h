@@ -0,0 +1,41 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  history.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTORY_TIER_SECONDS    0
+#define HISTORY_TIER_MINUTES    1
+#define HISTORY_TIER_HOURS      2
+#define HISTORY_TIERS           3
+
+BOOL    HistoryInitialize(void);
+void    HistoryUninitialize(void);
+void    HistoryAddSample(void);
+BOOL    HistoryExportCsv(LPCWSTR lpFileName);
+
+void    TaskManager_OnFileExportHistory(void);
+
+#ifdef __cplusplus
+};
+#endif
@@ -30,6 +30,8 @@
 #include "sdk/psfuncs.h"
 #include "sdk/exfuncs.h"
 
+#include "perfprov.h"
+
 CRITICAL_SECTION                           PerfDataCriticalSection;
 PPERFDATA                                  pPerfDataOld = NULL;    /* Older perf data (saved to establish delta values) */
 PPERFDATA                                  pPerfData = NULL;       /* Most recent copy of perf data */
@@ -43,15 +45,15 @@ double                                     OldKernelTime = 0;
 LARGE_INTEGER                              liOldSystemTime = {{0,0}};
 SYSTEM_PERFORMANCE_INFORMATION             SystemPerfInfo;
 SYSTEM_BASIC_INFORMATION                   SystemBasicInfo;
+ULONG                                      SystemNumberOfProcessors;    /* In all processor groups */
 SYSTEM_FILECACHE_INFORMATION               SystemCacheInfo;
 ULONG                                      SystemNumberOfHandles;
 PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION  SystemProcessorTimeInfo = NULL;
+PBYTE                                      ProcessorUsage = NULL;       /* Per processor CPU usage % */
+PBYTE                                      ProcessorKernelUsage = NULL; /* Per processor kernel time % */
+PBYTE                                      ProcessorNode = NULL;        /* Per processor NUMA node */
 PSID                                       SystemUserSid = NULL;
 
-PCMD_LINE_CACHE global_cache = NULL;
-
-#define CMD_LINE_MIN(a, b) (a < b ? a - sizeof(WCHAR) : b)
-
 typedef struct _SIDTOUSERNAME
 {
     LIST_ENTRY List;
@@ -64,17 +66,36 @@ static LIST_ENTRY SidToUserNameHead = {&SidToUserNameHead, &SidToUserNameHead};
 BOOL PerfDataInitialize(void)
 {
     SID_IDENTIFIER_AUTHORITY NtSidAuthority = {SECURITY_NT_AUTHORITY};
-    NTSTATUS    status;
+    ULONG Count;
 
     InitializeCriticalSection(&PerfDataCriticalSection);
 
     /*
      * Get number of processors in the system
      */
-    status = NtQuerySystemInformation(SystemBasicInformation, &SystemBasicInfo, sizeof(SystemBasicInfo), NULL);
-    if (!NT_SUCCESS(status))
+    if (!pPerfDataProvider->Initialize(&SystemBasicInfo, &SystemNumberOfProcessors))
+        return FALSE;
+
+    /*
+     * Per processor usage and NUMA node
+     */
+    Count = SystemNumberOfProcessors;
+    ProcessorUsage = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Count);
+    ProcessorKernelUsage = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Count);
+    ProcessorNode = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Count);
+    if (!ProcessorUsage || !ProcessorKernelUsage || !ProcessorNode)
         return FALSE;
 
+    /* Recorded and generated samples don't carry a topology: one node */
+    if (pPerfDataProvider->GetProcessorNodes)
+        pPerfDataProvider->GetProcessorNodes(ProcessorNode, Count);
+
+    /*
+     * Command lines are read from the process memory in the background
+     */
+    if (pPerfDataProvider->bLiveSystem)
+        CmdCacheInitialize();
+
     /*
      * Create the SYSTEM Sid
      */
@@ -90,6 +111,10 @@ void PerfDataUninitialize(void)
     if (pPerfData != NULL)
         HeapFree(GetProcessHeap(), 0, pPerfData);
 
+    pPerfDataProvider->Uninitialize();
+
+    CmdCacheUninitialize();
+
     DeleteCriticalSection(&PerfDataCriticalSection);
 
     if (SystemUserSid != NULL)
@@ -110,6 +135,13 @@ void PerfDataUninitialize(void)
     if (SystemProcessorTimeInfo) {
         HeapFree(GetProcessHeap(), 0, SystemProcessorTimeInfo);
     }
+
+    if (ProcessorUsage)
+        HeapFree(GetProcessHeap(), 0, ProcessorUsage);
+    if (ProcessorKernelUsage)
+        HeapFree(GetProcessHeap(), 0, ProcessorKernelUsage);
+    if (ProcessorNode)
+        HeapFree(GetProcessHeap(), 0, ProcessorNode);
 }
 
 static void SidToUserName(PSID Sid, LPWSTR szBuffer, DWORD BufferSize)
@@ -174,91 +206,58 @@ CachedGetUserFromSid(
 
 void PerfDataRefresh(void)
 {
-    ULONG                                      ulSize;
-    NTSTATUS                                   status;
+    PERFDATA_SAMPLE                            Sample;
     LPBYTE                                     pBuffer;
-    ULONG                                      BufferSize;
     PSYSTEM_PROCESS_INFORMATION                pSPI;
     PPERFDATA                                  pPDOld;
     ULONG                                      Idx, Idx2;
     HANDLE                                     hProcess;
     HANDLE                                     hProcessToken;
-    SYSTEM_PERFORMANCE_INFORMATION             SysPerfInfo;
-    SYSTEM_TIMEOFDAY_INFORMATION               SysTimeInfo;
-    SYSTEM_FILECACHE_INFORMATION               SysCacheInfo;
-    SYSTEM_HANDLE_INFORMATION                  SysHandleInfoData;
-    PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION  SysProcessorTimeInfo;
     double                                     CurrentKernelTime;
     PSECURITY_DESCRIPTOR                       ProcessSD;
     PSID                                       ProcessUser;
     ULONG                                      Buffer[64]; /* must be 4 bytes aligned! */
     ULONG                                      cwcUserName;
 
-    /* Get new system time */
-    status = NtQuerySystemInformation(SystemTimeOfDayInformation, &SysTimeInfo, sizeof(SysTimeInfo), NULL);
-    if (!NT_SUCCESS(status))
-        return;
-
-    /* Get new CPU's idle time */
-    status = NtQuerySystemInformation(SystemPerformanceInformation, &SysPerfInfo, sizeof(SysPerfInfo), NULL);
-    if (!NT_SUCCESS(status))
-        return;
-
-    /* Get system cache information */
-    status = NtQuerySystemInformation(SystemFileCacheInformation, &SysCacheInfo, sizeof(SysCacheInfo), NULL);
-    if (!NT_SUCCESS(status))
+    /* Get the system and process counters from the provider */
+    ZeroMemory(&Sample, sizeof(Sample));
+    if (!pPerfDataProvider->QuerySample(&Sample))
         return;
 
-    /* Get processor time information */
-    SysProcessorTimeInfo = (PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION)HeapAlloc(GetProcessHeap(), 0, sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * SystemBasicInfo.NumberOfProcessors);
-    status = NtQuerySystemInformation(SystemProcessorPerformanceInformation, SysProcessorTimeInfo, sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * SystemBasicInfo.NumberOfProcessors, &ulSize);
-
-    if (!NT_SUCCESS(status))
-    {
-        if (SysProcessorTimeInfo != NULL)
-            HeapFree(GetProcessHeap(), 0, SysProcessorTimeInfo);
-        return;
-    }
-
-    /* Get handle information
-     * Number of handles is enough, no need for data array.
-     */
-    status = NtQuerySystemInformation(SystemHandleInformation, &SysHandleInfoData, sizeof(SysHandleInfoData), NULL);
-    /* On unexpected error, reuse previous value.
-     * STATUS_SUCCESS (0-1 handle) should never happen.
-     */
-    if (status != STATUS_INFO_LENGTH_MISMATCH)
-        SysHandleInfoData.NumberOfHandles = SystemNumberOfHandles;
-
-    /* Get process information
-     * We don't know how much data there is so just keep
-     * increasing the buffer size until the call succeeds
-     */
-    BufferSize = 0;
-    do
-    {
-        BufferSize += 0x10000;
-        pBuffer = (LPBYTE)HeapAlloc(GetProcessHeap(), 0, BufferSize);
-
-        status = NtQuerySystemInformation(SystemProcessInformation, pBuffer, BufferSize, &ulSize);
-
-        if (status == STATUS_INFO_LENGTH_MISMATCH) {
-            HeapFree(GetProcessHeap(), 0, pBuffer);
-        }
-
-    } while (status == STATUS_INFO_LENGTH_MISMATCH);
+    pBuffer = (LPBYTE)Sample.pProcessInfo;
 
     EnterCriticalSection(&PerfDataCriticalSection);
 
     /*
      * Save system performance info
      */
-    memcpy(&SystemPerfInfo, &SysPerfInfo, sizeof(SYSTEM_PERFORMANCE_INFORMATION));
+    memcpy(&SystemPerfInfo, &Sample.PerfInfo, sizeof(SYSTEM_PERFORMANCE_INFORMATION));
 
     /*
      * Save system cache info
      */
-    memcpy(&SystemCacheInfo, &SysCacheInfo, sizeof(SYSTEM_FILECACHE_INFORMATION));
+    memcpy(&SystemCacheInfo, &Sample.CacheInfo, sizeof(SYSTEM_FILECACHE_INFORMATION));
+
+    /*
+     * Per processor usage from the deltas against the last sample.
+     * KernelTime includes the idle time.
+     */
+    if (SystemProcessorTimeInfo && !Sample.bRestart) {
+        for (Idx=0; Idx<SystemNumberOfProcessors; Idx++) {
+            LONGLONG Idle, Kernel, Total, Usage;
+
+            Idle = Sample.ProcessorTimeInfo[Idx].IdleTime.QuadPart - SystemProcessorTimeInfo[Idx].IdleTime.QuadPart;
+            Kernel = Sample.ProcessorTimeInfo[Idx].KernelTime.QuadPart - SystemProcessorTimeInfo[Idx].KernelTime.QuadPart;
+            Total = Kernel + Sample.ProcessorTimeInfo[Idx].UserTime.QuadPart - SystemProcessorTimeInfo[Idx].UserTime.QuadPart;
+            if (Total <= 0)
+                continue;
+
+            Usage = 100 - Idle * 100 / Total;
+            ProcessorUsage[Idx] = (BYTE)min(max(Usage, 0), 100);
+            Usage = (Kernel - Idle) * 100 / Total;
+            ProcessorKernelUsage[Idx] = (BYTE)min(max(Usage, 0), 100);
+        }
+    }
 
     /*
      * Save system processor time info
@@ -266,14 +265,25 @@ void PerfDataRefresh(void)
     if (SystemProcessorTimeInfo) {
         HeapFree(GetProcessHeap(), 0, SystemProcessorTimeInfo);
     }
-    SystemProcessorTimeInfo = SysProcessorTimeInfo;
+    SystemProcessorTimeInfo = Sample.ProcessorTimeInfo;
 
     /*
      * Save system handle info
      */
-    SystemNumberOfHandles = SysHandleInfoData.NumberOfHandles;
+    if (Sample.NumberOfHandles != PERFDATA_UNKNOWN_HANDLES)
+        SystemNumberOfHandles = Sample.NumberOfHandles;
+
+    /* Counters went back to their start, e.g. a replay looping: skip the deltas */
+    if (Sample.bRestart)
+    {
+        liOldIdleTime.QuadPart = 0;
+        if (pPerfDataOld) {
+            HeapFree(GetProcessHeap(), 0, pPerfDataOld);
+            pPerfDataOld = NULL;
+        }
+    }
 
-    for (CurrentKernelTime=0, Idx=0; Idx<(ULONG)SystemBasicInfo.NumberOfProcessors; Idx++) {
+    for (CurrentKernelTime=0, Idx=0; Idx<SystemNumberOfProcessors; Idx++) {
         CurrentKernelTime += Li2Double(SystemProcessorTimeInfo[Idx].KernelTime);
         CurrentKernelTime += Li2Double(SystemProcessorTimeInfo[Idx].DpcTime);
         CurrentKernelTime += Li2Double(SystemProcessorTimeInfo[Idx].InterruptTime);
@@ -282,26 +292,26 @@ void PerfDataRefresh(void)
     /* If it's a first call - skip idle time calcs */
     if (liOldIdleTime.QuadPart != 0) {
         /*  CurrentValue = NewValue - OldValue */
-        dbIdleTime = Li2Double(SysPerfInfo.IdleProcessTime) - Li2Double(liOldIdleTime);
+        dbIdleTime = Li2Double(Sample.PerfInfo.IdleProcessTime) - Li2Double(liOldIdleTime);
         dbKernelTime = CurrentKernelTime - OldKernelTime;
-        dbSystemTime = Li2Double(SysTimeInfo.CurrentTime) - Li2Double(liOldSystemTime);
+        dbSystemTime = Li2Double(Sample.CurrentTime) - Li2Double(liOldSystemTime);
 
         /*  CurrentCpuIdle = IdleTime / SystemTime */
         dbIdleTime = dbIdleTime / dbSystemTime;
         dbKernelTime = dbKernelTime / dbSystemTime;
 
         /*  CurrentCpuUsage% = 100 - (CurrentCpuIdle * 100) / NumberOfProcessors */
-        dbIdleTime = 100.0 - dbIdleTime * 100.0 / (double)SystemBasicInfo.NumberOfProcessors; /* + 0.5; */
-        dbKernelTime = 100.0 - dbKernelTime * 100.0 / (double)SystemBasicInfo.NumberOfProcessors; /* + 0.5; */
+        dbIdleTime = 100.0 - dbIdleTime * 100.0 / (double)SystemNumberOfProcessors; /* + 0.5; */
+        dbKernelTime = 100.0 - dbKernelTime * 100.0 / (double)SystemNumberOfProcessors; /* + 0.5; */
     }
 
     /* Store new CPU's idle and system time */
-    liOldIdleTime = SysPerfInfo.IdleProcessTime;
-    liOldSystemTime = SysTimeInfo.CurrentTime;
+    liOldIdleTime = Sample.PerfInfo.IdleProcessTime;
+    liOldSystemTime = Sample.CurrentTime;
     OldKernelTime = CurrentKernelTime;
 
     /* Determine the process count
-     * We loop through the data we got from NtQuerySystemInformation
+     * We loop through the data we got from the provider
      * and count how many structures there are (until RelativeOffset is 0)
      */
     ProcessCountOld = ProcessCount;
@@ -348,7 +358,7 @@ void PerfDataRefresh(void)
             double    CurTime = Li2Double(pSPI->KernelTime) + Li2Double(pSPI->UserTime);
             double    OldTime = Li2Double(pPDOld->KernelTime) + Li2Double(pPDOld->UserTime);
             double    CpuTime = (CurTime - OldTime) / dbSystemTime;
-            CpuTime = CpuTime * 100.0 / (double)SystemBasicInfo.NumberOfProcessors; /* + 0.5; */
+            CpuTime = CpuTime * 100.0 / (double)SystemNumberOfProcessors; /* + 0.5; */
             pPerfData[Idx].CPUUsage = (ULONG)CpuTime;
         }
         pPerfData[Idx].CPUTime.QuadPart = pSPI->UserTime.QuadPart + pSPI->KernelTime.QuadPart;
@@ -376,7 +386,15 @@ void PerfDataRefresh(void)
         ProcessUser = SystemUserSid;
         ProcessSD = NULL;
 
-        if (pSPI->UniqueProcessId != NULL) {
+        if (!pPerfDataProvider->bLiveSystem) {
+            /* Recorded or simulated process: nothing to open, take the I/O counters from the sample */
+            pPerfData[Idx].IOCounters.ReadOperationCount = pSPI->ReadOperationCount.QuadPart;
+            pPerfData[Idx].IOCounters.WriteOperationCount = pSPI->WriteOperationCount.QuadPart;
+            pPerfData[Idx].IOCounters.OtherOperationCount = pSPI->OtherOperationCount.QuadPart;
+            pPerfData[Idx].IOCounters.ReadTransferCount = pSPI->ReadTransferCount.QuadPart;
+            pPerfData[Idx].IOCounters.WriteTransferCount = pSPI->WriteTransferCount.QuadPart;
+            pPerfData[Idx].IOCounters.OtherTransferCount = pSPI->OtherTransferCount.QuadPart;
+        } else if (pSPI->UniqueProcessId != NULL) {
             hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | READ_CONTROL, FALSE, PtrToUlong(pSPI->UniqueProcessId));
             if (hProcess) {
                 /* don't query the information of the system process. It's possible but
@@ -417,8 +435,10 @@ ClearInfo:
             ZeroMemory(&pPerfData[Idx].IOCounters, sizeof(IO_COUNTERS));
         }
 
-        cwcUserName = sizeof(pPerfData[0].UserName) / sizeof(pPerfData[0].UserName[0]);
-        CachedGetUserFromSid(ProcessUser, pPerfData[Idx].UserName, &cwcUserName);
+        if (pPerfDataProvider->bLiveSystem) {
+            cwcUserName = sizeof(pPerfData[0].UserName) / sizeof(pPerfData[0].UserName[0]);
+            CachedGetUserFromSid(ProcessUser, pPerfData[Idx].UserName, &cwcUserName);
+        }
 
         if (ProcessSD != NULL)
         {
@@ -427,6 +447,7 @@ ClearInfo:
 
         pPerfData[Idx].UserTime.QuadPart = pSPI->UserTime.QuadPart;
         pPerfData[Idx].KernelTime.QuadPart = pSPI->KernelTime.QuadPart;
+        pPerfData[Idx].CreateTime.QuadPart = pSPI->CreateTime.QuadPart;
         pSPI = (PSYSTEM_PROCESS_INFORMATION)((LPBYTE)pSPI + pSPI->NextEntryOffset);
     }
     HeapFree(GetProcessHeap(), 0, pBuffer);
@@ -487,6 +508,32 @@ ULONG PerfDataGetProcessorSystemUsage(void)
     return Result;
 }
 
+ULONG PerfDataGetProcessorCount(void)
+{
+    return SystemNumberOfProcessors;
+}
+
+BOOL PerfDataGetProcessorUsages(PBYTE pUsage, PBYTE pKernelUsage, ULONG nCount)
+{
+    if (nCount != SystemNumberOfProcessors)
+        return FALSE;
+
+    EnterCriticalSection(&PerfDataCriticalSection);
+    memcpy(pUsage, ProcessorUsage, nCount);
+    memcpy(pKernelUsage, ProcessorKernelUsage, nCount);
+    LeaveCriticalSection(&PerfDataCriticalSection);
+    return TRUE;
+}
+
+BOOL PerfDataGetProcessorNodes(PBYTE pNodes, ULONG nCount)
+{
+    if (nCount != SystemNumberOfProcessors)
+        return FALSE;
+
+    memcpy(pNodes, ProcessorNode, nCount);
+    return TRUE;
+}
+
 BOOL PerfDataGetImageName(ULONG Index, LPWSTR lpImageName, ULONG nMaxCount)
 {
     BOOL  bSuccessful;
@@ -537,128 +584,46 @@ BOOL PerfDataGetUserName(ULONG Index, LPWSTR lpUserName, ULONG nMaxCount)
     return bSuccessful;
 }
 
-BOOL PerfDataGetCommandLine(ULONG Index, LPWSTR lpCommandLine, ULONG nMaxCount)
+/*
+ * Reads the process key under the lock; the strings come from the command
+ * line cache, which fills them in the background.
+ */
+static BOOL PerfDataGetCachedString(ULONG Index, UINT Field, LPWSTR lpText, ULONG nMaxCount)
 {
-    static const LPWSTR ellipsis = L"...";
-
-    PROCESS_BASIC_INFORMATION pbi = {0};
-    UNICODE_STRING CommandLineStr = {0};
-
-    PVOID ProcessParams = NULL;
-    HANDLE hProcess;
-    ULONG ProcessId;
-
-    NTSTATUS Status;
-    BOOL result;
+    ULONG      ProcessId;
+    ULONGLONG  CreateTime;
 
-    PCMD_LINE_CACHE new_entry;
-    LPWSTR new_string;
+    if (nMaxCount)
+        lpText[0] = UNICODE_NULL;
 
-    PCMD_LINE_CACHE cache = global_cache;
-
-    /* [A] Search for a string already in cache? If so, use it */
-    while (cache && cache->pnext != NULL)
-    {
-        if (cache->idx == Index && cache->str != NULL)
-        {
-            /* Found it. Use it, and add some ellipsis at the very end to make it cute */
-            wcsncpy(lpCommandLine, cache->str, CMD_LINE_MIN(nMaxCount, cache->len));
-            wcscpy(lpCommandLine + CMD_LINE_MIN(nMaxCount, cache->len) - wcslen(ellipsis), ellipsis);
-            return TRUE;
-        }
-
-        cache = cache->pnext;
-    }
+    EnterCriticalSection(&PerfDataCriticalSection);
 
-    /* [B] We don't; let's allocate and load a value from the process mem... and cache it */
-    ProcessId = PerfDataGetProcessId(Index);
-
-    /* Default blank command line in case things don't work out */
-    wcsncpy(lpCommandLine, L"", nMaxCount);
-
-    /* Ask for a handle to the target process so that we can read its memory and query stuff */
-    hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, ProcessId);
-    if (!hProcess)
-        goto cleanup;
-
-    /* First off, get the ProcessEnvironmentBlock location in that process' address space */
-    Status = NtQueryInformationProcess(hProcess, 0, &pbi, sizeof(pbi), NULL);
-    if (!NT_SUCCESS(Status))
-        goto cleanup;
-
-    /* Then get the PEB.ProcessParameters member pointer */
-    result = ReadProcessMemory(hProcess,
-                               (PVOID)((ULONG_PTR)pbi.PebBaseAddress + FIELD_OFFSET(PEB, ProcessParameters)),
-                               &ProcessParams,
-                               sizeof(ProcessParams),
-                               NULL);
-    if (!result)
-        goto cleanup;
-
-    /* Then copy the PEB->ProcessParameters.CommandLine member
-       to get the pointer to the string buffer and its size */
-    result = ReadProcessMemory(hProcess,
-                               (PVOID)((ULONG_PTR)ProcessParams + FIELD_OFFSET(RTL_USER_PROCESS_PARAMETERS, CommandLine)),
-                               &CommandLineStr,
-                               sizeof(CommandLineStr),
-                               NULL);
-    if (!result)
-        goto cleanup;
-
-    /* Allocate the next cache entry and its accompanying string in one go */
-    new_entry = HeapAlloc(GetProcessHeap(),
-                          HEAP_ZERO_MEMORY,
-                          sizeof(CMD_LINE_CACHE) + CommandLineStr.Length + sizeof(UNICODE_NULL));
-    if (!new_entry)
-        goto cleanup;
-
-    new_string = (LPWSTR)((ULONG_PTR)new_entry + sizeof(CMD_LINE_CACHE));
-
-    /* Bingo, the command line should be stored there,
-       copy the string from the other process */
-    result = ReadProcessMemory(hProcess,
-                               CommandLineStr.Buffer,
-                               new_string,
-                               CommandLineStr.Length,
-                               NULL);
-    if (!result)
-    {
-        /* Weird, after successfully reading the mem of that process
-           various times it fails now, forget it and bail out */
-        HeapFree(GetProcessHeap(), 0, new_entry);
-        goto cleanup;
+    if (Index >= ProcessCount) {
+        LeaveCriticalSection(&PerfDataCriticalSection);
+        return FALSE;
     }
 
-    /* Add our pointer to the cache... */
-    new_entry->idx = Index;
-    new_entry->str = new_string;
-    new_entry->len = CommandLineStr.Length;
+    ProcessId = PtrToUlong(pPerfData[Index].ProcessId);
+    CreateTime = pPerfData[Index].CreateTime.QuadPart;
 
-    if (!global_cache)
-        global_cache = new_entry;
-    else
-        cache->pnext = new_entry;
+    LeaveCriticalSection(&PerfDataCriticalSection);
 
-    /* ... and print the buffer for the first time */
-    wcsncpy(lpCommandLine, new_string, CMD_LINE_MIN(nMaxCount, CommandLineStr.Length));
+    /* Recorded and generated process ids don't belong to this machine */
+    if (!pPerfDataProvider->bLiveSystem)
+        return TRUE;
 
-cleanup:
-    if (hProcess) CloseHandle(hProcess);
+    CmdCacheLookup(ProcessId, CreateTime, Field, lpText, nMaxCount);
     return TRUE;
 }
 
-void PerfDataDeallocCommandLineCache()
+BOOL PerfDataGetCommandLine(ULONG Index, LPWSTR lpCommandLine, ULONG nMaxCount)
 {
-    PCMD_LINE_CACHE cache = global_cache;
-    PCMD_LINE_CACHE cache_old;
-
-    while (cache && cache->pnext != NULL)
-    {
-        cache_old = cache;
-        cache = cache->pnext;
+    return PerfDataGetCachedString(Index, CMDCACHE_COMMANDLINE, lpCommandLine, nMaxCount);
+}
 
-        HeapFree(GetProcessHeap(), 0, cache_old);
-    }
+BOOL PerfDataGetImagePath(ULONG Index, LPWSTR lpImagePath, ULONG nMaxCount)
+{
+    return PerfDataGetCachedString(Index, CMDCACHE_IMAGEPATH, lpImagePath, nMaxCount);
 }
 
 ULONG PerfDataGetSessionId(ULONG Index)
@@ -1121,6 +1086,28 @@ ULONG PerfDataGetTotalThreadCount(void)
     return ThreadCount;
 }
 
+BOOL PerfDataIsLiveSystem(void)
+{
+    return pPerfDataProvider->bLiveSystem;
+}
+
+/*
+ * Bulk readers (e.g. the process sort stage) take the lock once and
+ * walk the array directly instead of going through PerfDataGet* per field.
+ * Every PerfDataLock() must be paired with PerfDataUnlock().
+ */
+PPERFDATA PerfDataLock(PULONG pCount)
+{
+    EnterCriticalSection(&PerfDataCriticalSection);
+    *pCount = ProcessCount;
+    return pPerfData;
+}
+
+void PerfDataUnlock(void)
+{
+    LeaveCriticalSection(&PerfDataCriticalSection);
+}
+
 BOOL PerfDataGet(ULONG Index, PPERFDATA *lppData)
 {
     BOOL  bSuccessful = FALSE;
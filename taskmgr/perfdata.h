@@ -53,32 +53,32 @@ typedef struct _PERFDATA
 
 	LARGE_INTEGER		UserTime;
 	LARGE_INTEGER		KernelTime;
+	LARGE_INTEGER		CreateTime;
 } PERFDATA, *PPERFDATA;
 
-typedef struct _CMD_LINE_CACHE
-{
-     DWORD idx;
-    LPWSTR str;
-     ULONG len;
-    struct _CMD_LINE_CACHE* pnext;
-} CMD_LINE_CACHE, *PCMD_LINE_CACHE;
-
+void	PerfDataSelectProvider(LPCWSTR lpCmdLine);
+BOOL	PerfDataIsLiveSystem(void);
 BOOL	PerfDataInitialize(void);
 void	PerfDataUninitialize(void);
 void	PerfDataRefresh(void);
 
 BOOL	PerfDataGet(ULONG Index, PPERFDATA *lppData);
+PPERFDATA	PerfDataLock(PULONG pCount);
+void	PerfDataUnlock(void);
 ULONG	PerfDataGetProcessIndex(ULONG pid);
 ULONG	PerfDataGetProcessCount(void);
 ULONG	PerfDataGetProcessorUsage(void);
 ULONG	PerfDataGetProcessorSystemUsage(void);
+ULONG	PerfDataGetProcessorCount(void);
+BOOL	PerfDataGetProcessorUsages(PBYTE pUsage, PBYTE pKernelUsage, ULONG nCount);
+BOOL	PerfDataGetProcessorNodes(PBYTE pNodes, ULONG nCount);
 
 BOOL	PerfDataGetImageName(ULONG Index, LPWSTR lpImageName, ULONG nMaxCount);
 ULONG	PerfDataGetProcessId(ULONG Index);
 BOOL	PerfDataGetUserName(ULONG Index, LPWSTR lpUserName, ULONG nMaxCount);
 
 BOOL	PerfDataGetCommandLine(ULONG Index, LPWSTR lpCommandLine, ULONG nMaxCount);
-void	PerfDataDeallocCommandLineCache();
+BOOL	PerfDataGetImagePath(ULONG Index, LPWSTR lpImagePath, ULONG nMaxCount);
 
 ULONG	PerfDataGetSessionId(ULONG Index);
 ULONG	PerfDataGetCPUUsage(ULONG Index);
@@ -59,6 +59,11 @@ static HANDLE hPerformanceThread = NULL;
 static DWORD  dwPerformanceThread;
 #endif
 
+/* Per processor usage, fed to the CPU history graph */
+static ULONG   nProcessors;
+static PBYTE   pProcessorUsage;
+static PBYTE   pProcessorKernelUsage;
+
 static int     nPerformancePageWidth;
 static int     nPerformancePageHeight;
 static int     lastX, lastY;
@@ -120,11 +125,15 @@ PerformancePageWndProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 
     switch (message) {
     case WM_DESTROY:
-        GraphCtrl_Dispose(&PerformancePageCpuUsageHistoryGraph);
-        GraphCtrl_Dispose(&PerformancePageMemUsageHistoryGraph);
+        /* The refresh thread draws into the graphs, stop it first */
 #ifdef RUN_PERF_PAGE
         EndLocalThread(&hPerformanceThread, dwPerformanceThread);
 #endif
+        GraphCtrl_Dispose(&PerformancePageCpuUsageHistoryGraph);
+        GraphCtrl_Dispose(&PerformancePageMemUsageHistoryGraph);
+        if (pProcessorUsage)
+            HeapFree(GetProcessHeap(), 0, pProcessorUsage);
+        pProcessorUsage = NULL;
         break;
 
     case WM_INITDIALOG:
@@ -185,6 +194,19 @@ PerformancePageWndProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
             return FALSE;
         }
 
+        /*  One buffer for the usages, the kernel usages and the nodes */
+        nProcessors = PerfDataGetProcessorCount();
+        pProcessorUsage = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, nProcessors * 3);
+        if (pProcessorUsage)
+        {
+            pProcessorKernelUsage = pProcessorUsage + nProcessors;
+            if (PerfDataGetProcessorNodes(pProcessorKernelUsage + nProcessors, nProcessors) &&
+                GraphCtrl_SetProcessors(&PerformancePageCpuUsageHistoryGraph, nProcessors, pProcessorKernelUsage + nProcessors))
+            {
+                GraphCtrl_SetPerProcessor(&PerformancePageCpuUsageHistoryGraph, TaskManagerSettings.CPUHistory_OneGraphPerCPU);
+            }
+        }
+
         fmt.clrPlot0 = RGB(255, 255, 0);
         fmt.clrPlot1 = RGB(100, 255, 255);
         fmt.DrawSecondaryPlot = TRUE;
@@ -469,6 +491,11 @@ DWORD WINAPI PerformancePageRefreshThread(void *lpParameter)
             nBarsUsed2 = PhysicalMemoryTotal ? ((PhysicalMemoryAvailable * 100) / PhysicalMemoryTotal) : 0;
 
             GraphCtrl_AddPoint(&PerformancePageCpuUsageHistoryGraph, CpuUsage, CpuKernelUsage);
+            if (pProcessorUsage &&
+                PerfDataGetProcessorUsages(pProcessorUsage, pProcessorKernelUsage, nProcessors))
+            {
+                GraphCtrl_AddProcessorPoints(&PerformancePageCpuUsageHistoryGraph, pProcessorUsage, pProcessorKernelUsage);
+            }
             GraphCtrl_AddPoint(&PerformancePageMemUsageHistoryGraph, nBarsUsed1, nBarsUsed2);
             InvalidateRect(hPerformancePageMemUsageHistoryGraph, NULL, FALSE);
             InvalidateRect(hPerformancePageCpuUsageHistoryGraph, NULL, FALSE);
@@ -486,6 +513,7 @@ void PerformancePage_OnViewShowKernelTimes(void)
     hViewMenu = GetSubMenu(hMenu, 2);
 
     /*  Check or uncheck the show 16-bit tasks menu item */
+    EnterCriticalSection(&PerformancePageCpuUsageHistoryGraph.Lock);
     if (GetMenuState(hViewMenu, ID_VIEW_SHOWKERNELTIMES, MF_BYCOMMAND) & MF_CHECKED)
     {
         CheckMenuItem(hViewMenu, ID_VIEW_SHOWKERNELTIMES, MF_BYCOMMAND|MF_UNCHECKED);
@@ -500,6 +528,7 @@ void PerformancePage_OnViewShowKernelTimes(void)
     }
 
     GraphCtrl_RedrawBitmap(&PerformancePageCpuUsageHistoryGraph, PerformancePageCpuUsageHistoryGraph.BitmapHeight);
+    LeaveCriticalSection(&PerformancePageCpuUsageHistoryGraph.Lock);
     RefreshPerformancePage();
 }
 
@@ -515,6 +544,9 @@ void PerformancePage_OnViewCPUHistoryOneGraphAll(void)
 
     TaskManagerSettings.CPUHistory_OneGraphPerCPU = FALSE;
     CheckMenuRadioItem(hCPUHistoryMenu, ID_VIEW_CPUHISTORY_ONEGRAPHALL, ID_VIEW_CPUHISTORY_ONEGRAPHPERCPU, ID_VIEW_CPUHISTORY_ONEGRAPHALL, MF_BYCOMMAND);
+
+    GraphCtrl_SetPerProcessor(&PerformancePageCpuUsageHistoryGraph, FALSE);
+    InvalidateRect(hPerformancePageCpuUsageHistoryGraph, NULL, FALSE);
 }
 
 void PerformancePage_OnViewCPUHistoryOneGraphPerCPU(void)
@@ -529,5 +561,8 @@ void PerformancePage_OnViewCPUHistoryOneGraphPerCPU(void)
 
     TaskManagerSettings.CPUHistory_OneGraphPerCPU = TRUE;
     CheckMenuRadioItem(hCPUHistoryMenu, ID_VIEW_CPUHISTORY_ONEGRAPHALL, ID_VIEW_CPUHISTORY_ONEGRAPHPERCPU, ID_VIEW_CPUHISTORY_ONEGRAPHPERCPU, MF_BYCOMMAND);
+
+    GraphCtrl_SetPerProcessor(&PerformancePageCpuUsageHistoryGraph, TRUE);
+    InvalidateRect(hPerformancePageCpuUsageHistoryGraph, NULL, FALSE);
 }
 
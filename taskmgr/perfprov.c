@@ -0,0 +1,860 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  perfprov.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Performance data providers.
+ *
+ * perfdata.c turns raw samples into PERFDATA; the samples come from one of:
+ *
+ *  - the native provider, which asks NtQuerySystemInformation and can
+ *    record every sample to a capture file (/record:<file>),
+ *  - the replay provider, which plays such a capture back in a loop
+ *    (/replay:<file>),
+ *  - the synthetic provider, which simulates a machine with many busy
+ *    processes (/synthetic[:<count>], 10000 processes by default).
+ *
+ * Only the native provider needs a live NT system, so the rest of the
+ * pipeline (deltas, sorting, history, drawing) can be load-tested with
+ * the other two anywhere the Win32 API is available.
+ */
+
+#include "precomp.h"
+
+#define NTOS_MODE_USER
+#include "sdk/psfuncs.h"
+#include "sdk/exfuncs.h"
+
+#include <strsafe.h>
+
+#include "perfprov.h"
+
+PCPERFDATA_PROVIDER pPerfDataProvider = &NativePerfDataProvider;
+
+/*
+ * Capture file: a PERFDATA_CAPTURE_HEADER followed by one frame per sample.
+ * A frame is a PERFDATA_CAPTURE_FRAME, the per-processor times and the raw
+ * SystemProcessInformation buffer. The image names in that buffer point
+ * into the buffer itself, so they are rebased when played back.
+ */
+#define PERFDATA_CAPTURE_MAGIC      0x43504D54  /* 'TMPC' */
+#define PERFDATA_CAPTURE_VERSION    1
+#define PERFDATA_MAX_PROCESSORS     0xFFFF
+
+typedef struct _PERFDATA_CAPTURE_HEADER
+{
+    DWORD                           Magic;
+    DWORD                           Version;
+    DWORD                           PointerSize;
+    DWORD                           NumberOfProcessors; /* In all groups, 0 in older captures */
+    SYSTEM_BASIC_INFORMATION        BasicInfo;
+} PERFDATA_CAPTURE_HEADER, *PPERFDATA_CAPTURE_HEADER;
+
+typedef struct _PERFDATA_CAPTURE_FRAME
+{
+    DWORD                           cbFrame;            /* Including this header */
+    ULONG                           NumberOfHandles;
+    ULONG                           cbProcessInfo;
+    ULONG                           Reserved;
+    ULONGLONG                       ProcessInfoBase;    /* Address of the buffer when recorded */
+    LARGE_INTEGER                   CurrentTime;
+    SYSTEM_PERFORMANCE_INFORMATION  PerfInfo;
+    SYSTEM_FILECACHE_INFORMATION    CacheInfo;
+} PERFDATA_CAPTURE_FRAME, *PPERFDATA_CAPTURE_FRAME;
+
+static WCHAR    szRecordFile[MAX_PATH];
+static WCHAR    szReplayFile[MAX_PATH];
+static HANDLE   hCaptureFile = INVALID_HANDLE_VALUE;
+static ULONG    CaptureNumberOfProcessors;
+
+static BOOL CaptureWrite(LPCVOID lpData, DWORD cbData)
+{
+    DWORD cbWritten;
+
+    return WriteFile(hCaptureFile, lpData, cbData, &cbWritten, NULL) && cbWritten == cbData;
+}
+
+static BOOL CaptureRead(LPVOID lpData, DWORD cbData, PDWORD pcbRead)
+{
+    return ReadFile(hCaptureFile, lpData, cbData, pcbRead, NULL);
+}
+
+static void CaptureClose(void)
+{
+    if (hCaptureFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hCaptureFile);
+        hCaptureFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+/*
+ * Native provider
+ *
+ * SystemProcessorPerformanceInformation only returns the processor group of
+ * the calling thread. On machines with more than 64 logical processors the
+ * other groups are asked for one by one through NtQuerySystemInformationEx,
+ * which (like the group functions of kernel32) only exists since Windows 7.
+ */
+
+typedef WORD (WINAPI *GETACTIVEPROCESSORGROUPCOUNTPROC)(void);
+typedef DWORD (WINAPI *GETACTIVEPROCESSORCOUNTPROC)(WORD GroupNumber);
+typedef BOOL (WINAPI *GETNUMAPROCESSORNODEEXPROC)(PPROCESSOR_NUMBER Processor, PUSHORT NodeNumber);
+typedef NTSTATUS (NTAPI *NTQUERYSYSTEMINFORMATIONEXPROC)(SYSTEM_INFORMATION_CLASS SystemInformationClass,
+                                                         PVOID InputBuffer, ULONG InputBufferLength,
+                                                         PVOID SystemInformation, ULONG SystemInformationLength,
+                                                         PULONG ReturnLength);
+
+static NTQUERYSYSTEMINFORMATIONEXPROC   pNtQuerySystemInformationEx;
+static WORD                             NativeGroupCount;           /* 0 when there is only one group */
+static PULONG                           NativeGroupProcessors;      /* Active processors of each group */
+
+static void NativeInitializeGroups(void)
+{
+    GETACTIVEPROCESSORGROUPCOUNTPROC    pGetActiveProcessorGroupCount;
+    GETACTIVEPROCESSORCOUNTPROC         pGetActiveProcessorCount;
+    HMODULE                             hKernel32 = GetModuleHandleW(L"kernel32.dll");
+    WORD                                GroupCount, Group;
+    ULONG                               Total = 0;
+
+    pGetActiveProcessorGroupCount = (GETACTIVEPROCESSORGROUPCOUNTPROC)(FARPROC)GetProcAddress(hKernel32, "GetActiveProcessorGroupCount");
+    pGetActiveProcessorCount = (GETACTIVEPROCESSORCOUNTPROC)(FARPROC)GetProcAddress(hKernel32, "GetActiveProcessorCount");
+    pNtQuerySystemInformationEx = (NTQUERYSYSTEMINFORMATIONEXPROC)(FARPROC)GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQuerySystemInformationEx");
+    if (!pGetActiveProcessorGroupCount || !pGetActiveProcessorCount || !pNtQuerySystemInformationEx)
+        return;
+
+    GroupCount = pGetActiveProcessorGroupCount();
+    if (GroupCount <= 1)
+        return;
+
+    NativeGroupProcessors = HeapAlloc(GetProcessHeap(), 0, GroupCount * sizeof(ULONG));
+    if (!NativeGroupProcessors)
+        return;
+
+    for (Group = 0; Group < GroupCount; Group++)
+    {
+        NativeGroupProcessors[Group] = pGetActiveProcessorCount(Group);
+        Total += NativeGroupProcessors[Group];
+    }
+
+    /* Should match GetActiveProcessorCount(ALL_PROCESSOR_GROUPS) */
+    if (Total == 0 || Total > PERFDATA_MAX_PROCESSORS)
+    {
+        HeapFree(GetProcessHeap(), 0, NativeGroupProcessors);
+        NativeGroupProcessors = NULL;
+        return;
+    }
+
+    NativeGroupCount = GroupCount;
+    CaptureNumberOfProcessors = Total;
+}
+
+static BOOL NativeInitialize(PSYSTEM_BASIC_INFORMATION pBasicInfo, PULONG pNumberOfProcessors)
+{
+    PERFDATA_CAPTURE_HEADER Header;
+    NTSTATUS                status;
+
+    status = NtQuerySystemInformation(SystemBasicInformation, pBasicInfo, sizeof(*pBasicInfo), NULL);
+    if (!NT_SUCCESS(status))
+        return FALSE;
+
+    CaptureNumberOfProcessors = (UCHAR)pBasicInfo->NumberOfProcessors;
+    NativeInitializeGroups();
+    *pNumberOfProcessors = CaptureNumberOfProcessors;
+
+    /* Recording is best effort, the Task Manager works the same without it */
+    if (szRecordFile[0])
+    {
+        hCaptureFile = CreateFileW(szRecordFile, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                   CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hCaptureFile != INVALID_HANDLE_VALUE)
+        {
+            ZeroMemory(&Header, sizeof(Header));
+            Header.Magic = PERFDATA_CAPTURE_MAGIC;
+            Header.Version = PERFDATA_CAPTURE_VERSION;
+            Header.PointerSize = sizeof(PVOID);
+            Header.NumberOfProcessors = CaptureNumberOfProcessors;
+            Header.BasicInfo = *pBasicInfo;
+
+            if (!CaptureWrite(&Header, sizeof(Header)))
+                CaptureClose();
+        }
+    }
+
+    return TRUE;
+}
+
+static void NativeUninitialize(void)
+{
+    CaptureClose();
+
+    if (NativeGroupProcessors)
+    {
+        HeapFree(GetProcessHeap(), 0, NativeGroupProcessors);
+        NativeGroupProcessors = NULL;
+    }
+    NativeGroupCount = 0;
+}
+
+/* Processors are numbered group by group, in the order the samples list them */
+static void NativeGetProcessorNodes(PBYTE pNodes, ULONG nCount)
+{
+    GETNUMAPROCESSORNODEEXPROC  pGetNumaProcessorNodeEx;
+    PROCESSOR_NUMBER            Processor;
+    USHORT                      NodeNumber;
+    UCHAR                       Node;
+    WORD                        Group = 0;
+    ULONG                       Idx, Number = 0;
+
+    pGetNumaProcessorNodeEx = (GETNUMAPROCESSORNODEEXPROC)(FARPROC)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetNumaProcessorNodeEx");
+
+    for (Idx = 0; Idx < nCount; Idx++, Number++)
+    {
+        if (NativeGroupCount && Number >= NativeGroupProcessors[Group])
+        {
+            if (++Group >= NativeGroupCount)
+                break;
+            Number = 0;
+        }
+
+        pNodes[Idx] = 0;
+        if (pGetNumaProcessorNodeEx)
+        {
+            ZeroMemory(&Processor, sizeof(Processor));
+            Processor.Group = Group;
+            Processor.Number = (BYTE)Number;
+            if (pGetNumaProcessorNodeEx(&Processor, &NodeNumber) && NodeNumber != 0xFFFF)
+                pNodes[Idx] = (BYTE)min(NodeNumber, 0xFF);
+        }
+        else if (Number < 64 && GetNumaProcessorNode((UCHAR)Number, &Node))
+        {
+            pNodes[Idx] = Node;
+        }
+    }
+}
+
+static void NativeRecordSample(PPERFDATA_SAMPLE pSample)
+{
+    PERFDATA_CAPTURE_FRAME  Frame;
+    ULONG                   cbProcessorInfo;
+
+    cbProcessorInfo = sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * CaptureNumberOfProcessors;
+
+    ZeroMemory(&Frame, sizeof(Frame));
+    Frame.cbFrame = sizeof(Frame) + cbProcessorInfo + pSample->cbProcessInfo;
+    Frame.NumberOfHandles = pSample->NumberOfHandles;
+    Frame.cbProcessInfo = pSample->cbProcessInfo;
+    Frame.ProcessInfoBase = (ULONG_PTR)pSample->pProcessInfo;
+    Frame.CurrentTime = pSample->CurrentTime;
+    Frame.PerfInfo = pSample->PerfInfo;
+    Frame.CacheInfo = pSample->CacheInfo;
+
+    /* Stop recording on the first error rather than leave a torn frame behind */
+    if (!CaptureWrite(&Frame, sizeof(Frame)) ||
+        !CaptureWrite(pSample->ProcessorTimeInfo, cbProcessorInfo) ||
+        !CaptureWrite(pSample->pProcessInfo, pSample->cbProcessInfo))
+    {
+        CaptureClose();
+    }
+}
+
+static BOOL NativeQuerySample(PPERFDATA_SAMPLE pSample)
+{
+    ULONG                           ulSize;
+    NTSTATUS                        status;
+    LPBYTE                          pBuffer;
+    ULONG                           BufferSize;
+    SYSTEM_TIMEOFDAY_INFORMATION    SysTimeInfo;
+    SYSTEM_HANDLE_INFORMATION       SysHandleInfoData;
+    ULONG                           Offset;
+    USHORT                          Group;
+
+    /* Get new system time */
+    status = NtQuerySystemInformation(SystemTimeOfDayInformation, &SysTimeInfo, sizeof(SysTimeInfo), NULL);
+    if (!NT_SUCCESS(status))
+        return FALSE;
+    pSample->CurrentTime = SysTimeInfo.CurrentTime;
+
+    /* Get new CPU's idle time */
+    status = NtQuerySystemInformation(SystemPerformanceInformation, &pSample->PerfInfo, sizeof(pSample->PerfInfo), NULL);
+    if (!NT_SUCCESS(status))
+        return FALSE;
+
+    /* Get system cache information */
+    status = NtQuerySystemInformation(SystemFileCacheInformation, &pSample->CacheInfo, sizeof(pSample->CacheInfo), NULL);
+    if (!NT_SUCCESS(status))
+        return FALSE;
+
+    /* Get processor time information */
+    BufferSize = sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * CaptureNumberOfProcessors;
+    pSample->ProcessorTimeInfo = (PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION)HeapAlloc(GetProcessHeap(), 0, BufferSize);
+    if (!pSample->ProcessorTimeInfo)
+        return FALSE;
+
+    if (NativeGroupCount)
+    {
+        for (Offset = 0, Group = 0; Group < NativeGroupCount; Group++)
+        {
+            status = pNtQuerySystemInformationEx(SystemProcessorPerformanceInformation, &Group, sizeof(Group),
+                                                 pSample->ProcessorTimeInfo + Offset,
+                                                 NativeGroupProcessors[Group] * sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION),
+                                                 &ulSize);
+            if (!NT_SUCCESS(status))
+                break;
+            Offset += NativeGroupProcessors[Group];
+        }
+    }
+    else
+    {
+        status = NtQuerySystemInformation(SystemProcessorPerformanceInformation, pSample->ProcessorTimeInfo, BufferSize, &ulSize);
+    }
+    if (!NT_SUCCESS(status))
+    {
+        HeapFree(GetProcessHeap(), 0, pSample->ProcessorTimeInfo);
+        return FALSE;
+    }
+
+    /* Get handle information
+     * Number of handles is enough, no need for data array.
+     */
+    status = NtQuerySystemInformation(SystemHandleInformation, &SysHandleInfoData, sizeof(SysHandleInfoData), NULL);
+    /* On unexpected error, reuse previous value.
+     * STATUS_SUCCESS (0-1 handle) should never happen.
+     */
+    if (status == STATUS_INFO_LENGTH_MISMATCH)
+        pSample->NumberOfHandles = SysHandleInfoData.NumberOfHandles;
+    else
+        pSample->NumberOfHandles = PERFDATA_UNKNOWN_HANDLES;
+
+    /* Get process information
+     * We don't know how much data there is so just keep
+     * increasing the buffer size until the call succeeds
+     */
+    BufferSize = 0;
+    do
+    {
+        BufferSize += 0x10000;
+        pBuffer = (LPBYTE)HeapAlloc(GetProcessHeap(), 0, BufferSize);
+        if (!pBuffer)
+            break;
+
+        status = NtQuerySystemInformation(SystemProcessInformation, pBuffer, BufferSize, &ulSize);
+
+        if (!NT_SUCCESS(status)) {
+            HeapFree(GetProcessHeap(), 0, pBuffer);
+            pBuffer = NULL;
+        }
+
+    } while (status == STATUS_INFO_LENGTH_MISMATCH);
+
+    if (!pBuffer)
+    {
+        HeapFree(GetProcessHeap(), 0, pSample->ProcessorTimeInfo);
+        return FALSE;
+    }
+
+    pSample->pProcessInfo = (PSYSTEM_PROCESS_INFORMATION)pBuffer;
+    pSample->cbProcessInfo = ulSize;
+
+    if (hCaptureFile != INVALID_HANDLE_VALUE)
+        NativeRecordSample(pSample);
+
+    return TRUE;
+}
+
+const PERFDATA_PROVIDER NativePerfDataProvider =
+{
+    L"Native",
+    TRUE,
+    NativeInitialize,
+    NativeUninitialize,
+    NativeQuerySample,
+    NativeGetProcessorNodes
+};
+
+/*
+ * Replay provider
+ */
+
+static BOOL ReplayInitialize(PSYSTEM_BASIC_INFORMATION pBasicInfo, PULONG pNumberOfProcessors)
+{
+    PERFDATA_CAPTURE_HEADER Header;
+    DWORD                   cbRead;
+
+    hCaptureFile = CreateFileW(szReplayFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hCaptureFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    if (!CaptureRead(&Header, sizeof(Header), &cbRead) ||
+        cbRead != sizeof(Header) ||
+        Header.Magic != PERFDATA_CAPTURE_MAGIC ||
+        Header.Version != PERFDATA_CAPTURE_VERSION ||
+        Header.PointerSize != sizeof(PVOID) ||
+        Header.NumberOfProcessors > PERFDATA_MAX_PROCESSORS ||
+        (Header.NumberOfProcessors == 0 && Header.BasicInfo.NumberOfProcessors <= 0))
+    {
+        CaptureClose();
+        return FALSE;
+    }
+
+    *pBasicInfo = Header.BasicInfo;
+    CaptureNumberOfProcessors = Header.NumberOfProcessors ? Header.NumberOfProcessors : (ULONG)Header.BasicInfo.NumberOfProcessors;
+    *pNumberOfProcessors = CaptureNumberOfProcessors;
+    return TRUE;
+}
+
+static void ReplayUninitialize(void)
+{
+    CaptureClose();
+}
+
+/*
+ * Points the image names back into the buffer they were recorded in,
+ * and checks that the entry chain stays inside the buffer.
+ */
+static BOOL ReplayRebase(PPERFDATA_CAPTURE_FRAME pFrame, LPBYTE pBuffer)
+{
+    PSYSTEM_PROCESS_INFORMATION pSPI;
+    ULONG                       Offset = 0;
+    ULONGLONG                   NameOffset;
+    ULONG                       cbBuffer = pFrame->cbProcessInfo;
+
+    for (;;)
+    {
+        if (cbBuffer < sizeof(SYSTEM_PROCESS_INFORMATION) ||
+            Offset > cbBuffer - sizeof(SYSTEM_PROCESS_INFORMATION) ||
+            (Offset & (sizeof(ULONG_PTR) - 1)))
+        {
+            return FALSE;
+        }
+
+        pSPI = (PSYSTEM_PROCESS_INFORMATION)(pBuffer + Offset);
+        if (pSPI->ImageName.Buffer)
+        {
+            NameOffset = (ULONG_PTR)pSPI->ImageName.Buffer - pFrame->ProcessInfoBase;
+            if (NameOffset < cbBuffer && pSPI->ImageName.Length <= cbBuffer - NameOffset)
+            {
+                pSPI->ImageName.Buffer = (PWSTR)(pBuffer + NameOffset);
+            }
+            else
+            {
+                /* Keep the entry, without a name */
+                pSPI->ImageName.Buffer = (PWSTR)pBuffer;
+                pSPI->ImageName.Length = 0;
+            }
+        }
+
+        if (pSPI->NextEntryOffset == 0)
+            return TRUE;
+
+        /* The next entry must follow this one inside the buffer, a corrupt
+         * offset must neither wrap around nor go back to an earlier entry */
+        if (pSPI->NextEntryOffset < sizeof(SYSTEM_PROCESS_INFORMATION) ||
+            pSPI->NextEntryOffset > cbBuffer - Offset)
+        {
+            return FALSE;
+        }
+        Offset += pSPI->NextEntryOffset;
+    }
+}
+
+static BOOL ReplayQuerySample(PPERFDATA_SAMPLE pSample)
+{
+    PERFDATA_CAPTURE_FRAME  Frame;
+    DWORD                   cbRead;
+    ULONG                   cbProcessorInfo;
+    LPBYTE                  pBuffer;
+    BOOL                    bRewound = FALSE;
+
+    cbProcessorInfo = sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * CaptureNumberOfProcessors;
+
+    for (;;)
+    {
+        if (!CaptureRead(&Frame, sizeof(Frame), &cbRead))
+            return FALSE;
+
+        if (cbRead == sizeof(Frame))
+            break;
+
+        /* End of the capture, start over once */
+        if (cbRead != 0 || bRewound)
+            return FALSE;
+
+        SetFilePointer(hCaptureFile, sizeof(PERFDATA_CAPTURE_HEADER), NULL, FILE_BEGIN);
+        bRewound = TRUE;
+    }
+
+    if (Frame.cbFrame != sizeof(Frame) + cbProcessorInfo + Frame.cbProcessInfo)
+        return FALSE;
+
+    pSample->ProcessorTimeInfo = (PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION)HeapAlloc(GetProcessHeap(), 0, cbProcessorInfo);
+    pBuffer = (LPBYTE)HeapAlloc(GetProcessHeap(), 0, Frame.cbProcessInfo);
+
+    if (!pSample->ProcessorTimeInfo || !pBuffer ||
+        !CaptureRead(pSample->ProcessorTimeInfo, cbProcessorInfo, &cbRead) || cbRead != cbProcessorInfo ||
+        !CaptureRead(pBuffer, Frame.cbProcessInfo, &cbRead) || cbRead != Frame.cbProcessInfo ||
+        !ReplayRebase(&Frame, pBuffer))
+    {
+        if (pSample->ProcessorTimeInfo)
+            HeapFree(GetProcessHeap(), 0, pSample->ProcessorTimeInfo);
+        if (pBuffer)
+            HeapFree(GetProcessHeap(), 0, pBuffer);
+        return FALSE;
+    }
+
+    pSample->CurrentTime = Frame.CurrentTime;
+    pSample->PerfInfo = Frame.PerfInfo;
+    pSample->CacheInfo = Frame.CacheInfo;
+    pSample->NumberOfHandles = Frame.NumberOfHandles;
+    pSample->pProcessInfo = (PSYSTEM_PROCESS_INFORMATION)pBuffer;
+    pSample->cbProcessInfo = Frame.cbProcessInfo;
+    pSample->bRestart = bRewound;
+
+    return TRUE;
+}
+
+const PERFDATA_PROVIDER ReplayPerfDataProvider =
+{
+    L"Replay",
+    FALSE,
+    ReplayInitialize,
+    ReplayUninitialize,
+    ReplayQuerySample,
+    NULL
+};
+
+/*
+ * Synthetic provider
+ *
+ * Every sample advances a simulated clock by one second. Most processes
+ * are idle; each has a fixed chance to run in a given second, and a small
+ * share of them exits and is replaced by a new process every second, so
+ * that the list keeps changing like on a busy server.
+ */
+
+#define SYNTHETIC_DEFAULT_PROCESSES 10000
+#define SYNTHETIC_MAX_PROCESSES     100000
+#define SYNTHETIC_PROCESSORS        16
+#define SYNTHETIC_PHYSICAL_PAGES    (64 * 1024 * 1024 / 4)     /* 64 GB */
+#define SYNTHETIC_PAGE_SIZE         4096
+#define SYNTHETIC_TICK              10000000                    /* 100ns units */
+#define SYNTHETIC_FIRST_PID         0x10000000                  /* Out of the range of real process ids */
+#define SYNTHETIC_NAME_LENGTH       16
+
+typedef struct _SYNTHETIC_PROCESS
+{
+    ULONG           Serial;
+    ULONG           Activity;           /* Chance to run in a tick, out of 256 */
+    LARGE_INTEGER   CreateTime;
+    LARGE_INTEGER   UserTime;
+    LARGE_INTEGER   KernelTime;
+    ULONG           WorkingSetPages;
+    ULONG           PeakWorkingSetPages;
+    ULONG           PageFaultCount;
+    ULONG           HandleCount;
+    ULONG           NumberOfThreads;
+} SYNTHETIC_PROCESS, *PSYNTHETIC_PROCESS;
+
+static ULONG                                    SyntheticProcessCount = SYNTHETIC_DEFAULT_PROCESSES;
+static PSYNTHETIC_PROCESS                       pSyntheticProcesses = NULL;
+static ULONG                                    SyntheticNextSerial;
+static ULONG                                    SyntheticSeed;
+static LARGE_INTEGER                            SyntheticTime;
+static LARGE_INTEGER                            SyntheticIdleTime;
+static ULONG                                    SyntheticPeakCommit;
+static SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION SyntheticProcessors[SYNTHETIC_PROCESSORS];
+
+/* xorshift32, fixed seed so that runs are repeatable */
+static ULONG SyntheticRandom(void)
+{
+    SyntheticSeed ^= SyntheticSeed << 13;
+    SyntheticSeed ^= SyntheticSeed >> 17;
+    SyntheticSeed ^= SyntheticSeed << 5;
+    return SyntheticSeed;
+}
+
+static void SyntheticSpawn(PSYNTHETIC_PROCESS pProcess)
+{
+    ULONG r = SyntheticRandom();
+
+    ZeroMemory(pProcess, sizeof(*pProcess));
+    pProcess->Serial = SyntheticNextSerial++;
+    pProcess->CreateTime = SyntheticTime;
+
+    /* A few busy processes, many that wake up once in a while */
+    pProcess->Activity = (r & 0x3F) == 0 ? 128 + (r >> 8) % 128 : (r >> 8) % 8;
+    pProcess->WorkingSetPages = 64 + (r >> 16) % 1024;
+    pProcess->PeakWorkingSetPages = pProcess->WorkingSetPages;
+    pProcess->HandleCount = 20 + (r >> 4) % 200;
+    pProcess->NumberOfThreads = 1 + (r >> 12) % 32;
+}
+
+static BOOL SyntheticInitialize(PSYSTEM_BASIC_INFORMATION pBasicInfo, PULONG pNumberOfProcessors)
+{
+    ULONG i;
+
+    pSyntheticProcesses = HeapAlloc(GetProcessHeap(), 0, SyntheticProcessCount * sizeof(SYNTHETIC_PROCESS));
+    if (!pSyntheticProcesses)
+        return FALSE;
+
+    SyntheticSeed = 0x2545F491;
+    SyntheticNextSerial = 1;
+    SyntheticTime.QuadPart = 0;
+    SyntheticIdleTime.QuadPart = 0;
+    SyntheticPeakCommit = 0;
+    ZeroMemory(SyntheticProcessors, sizeof(SyntheticProcessors));
+
+    for (i = 0; i < SyntheticProcessCount; i++)
+        SyntheticSpawn(&pSyntheticProcesses[i]);
+
+    ZeroMemory(pBasicInfo, sizeof(*pBasicInfo));
+    pBasicInfo->PageSize = SYNTHETIC_PAGE_SIZE;
+    pBasicInfo->NumberOfPhysicalPages = SYNTHETIC_PHYSICAL_PAGES;
+    pBasicInfo->AllocationGranularity = 0x10000;
+    pBasicInfo->NumberOfProcessors = SYNTHETIC_PROCESSORS;
+    pBasicInfo->ActiveProcessorsAffinityMask = (1 << SYNTHETIC_PROCESSORS) - 1;
+    *pNumberOfProcessors = SYNTHETIC_PROCESSORS;
+
+    return TRUE;
+}
+
+static void SyntheticUninitialize(void)
+{
+    if (pSyntheticProcesses)
+    {
+        HeapFree(GetProcessHeap(), 0, pSyntheticProcesses);
+        pSyntheticProcesses = NULL;
+    }
+}
+
+/* Writes one SYSTEM_PROCESS_INFORMATION entry and its name, returns its size */
+static ULONG SyntheticWriteEntry(LPBYTE pEntry, ULONG ProcessId, PSYNTHETIC_PROCESS pProcess)
+{
+    PSYSTEM_PROCESS_INFORMATION pSPI = (PSYSTEM_PROCESS_INFORMATION)pEntry;
+    PWSTR                       pName = (PWSTR)(pSPI + 1);
+    size_t                      cchName;
+
+    ZeroMemory(pSPI, sizeof(*pSPI));
+    pSPI->NumberOfThreads = pProcess->NumberOfThreads;
+    pSPI->CreateTime = pProcess->CreateTime;
+    pSPI->UserTime = pProcess->UserTime;
+    pSPI->KernelTime = pProcess->KernelTime;
+    pSPI->BasePriority = 8;
+    pSPI->UniqueProcessId = UlongToHandle(ProcessId);
+    pSPI->HandleCount = pProcess->HandleCount;
+    pSPI->SessionId = 1;
+    pSPI->VirtualSize = (SIZE_T)pProcess->WorkingSetPages * SYNTHETIC_PAGE_SIZE * 4;
+    pSPI->PeakVirtualSize = pSPI->VirtualSize;
+    pSPI->PageFaultCount = pProcess->PageFaultCount;
+    pSPI->WorkingSetSize = (SIZE_T)pProcess->WorkingSetPages * SYNTHETIC_PAGE_SIZE;
+    pSPI->PeakWorkingSetSize = (SIZE_T)pProcess->PeakWorkingSetPages * SYNTHETIC_PAGE_SIZE;
+    pSPI->QuotaPeakPagedPoolUsage = 64 * 1024;
+    pSPI->QuotaPeakNonPagedPoolUsage = 8 * 1024;
+    pSPI->PagefileUsage = pSPI->WorkingSetSize;
+    pSPI->PrivatePageCount = pSPI->WorkingSetSize;
+
+    if (ProcessId == 0)
+    {
+        /* The idle process has no name, like on a real system */
+        pSPI->ImageName.Buffer = NULL;
+    }
+    else
+    {
+        StringCchPrintfW(pName, SYNTHETIC_NAME_LENGTH, L"synth%05lu.exe", pProcess->Serial % 100000);
+        StringCchLengthW(pName, SYNTHETIC_NAME_LENGTH, &cchName);
+        pSPI->ImageName.Buffer = pName;
+        pSPI->ImageName.Length = (USHORT)(cchName * sizeof(WCHAR));
+        pSPI->ImageName.MaximumLength = SYNTHETIC_NAME_LENGTH * sizeof(WCHAR);
+    }
+
+    return (sizeof(SYSTEM_PROCESS_INFORMATION) + SYNTHETIC_NAME_LENGTH * sizeof(WCHAR) + 7) & ~7;
+}
+
+static BOOL SyntheticQuerySample(PPERFDATA_SAMPLE pSample)
+{
+    SYNTHETIC_PROCESS   Idle;
+    PSYNTHETIC_PROCESS  pProcess;
+    ULONGLONG           Budget, Used = 0, UsedKernel = 0;
+    ULONGLONG           Delta, TotalPages = 0;
+    ULONG               Handles = 0;
+    ULONG               cbEntry, cbBuffer, Offset;
+    ULONG               i, r;
+    LPBYTE              pBuffer;
+    PSYSTEM_PROCESS_INFORMATION pSPI = NULL;
+
+    cbEntry = (sizeof(SYSTEM_PROCESS_INFORMATION) + SYNTHETIC_NAME_LENGTH * sizeof(WCHAR) + 7) & ~7;
+    cbBuffer = cbEntry * (SyntheticProcessCount + 1);
+
+    pSample->ProcessorTimeInfo = (PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION)HeapAlloc(GetProcessHeap(), 0, sizeof(SyntheticProcessors));
+    pBuffer = (LPBYTE)HeapAlloc(GetProcessHeap(), 0, cbBuffer);
+    if (!pSample->ProcessorTimeInfo || !pBuffer)
+    {
+        if (pSample->ProcessorTimeInfo)
+            HeapFree(GetProcessHeap(), 0, pSample->ProcessorTimeInfo);
+        if (pBuffer)
+            HeapFree(GetProcessHeap(), 0, pBuffer);
+        return FALSE;
+    }
+
+    SyntheticTime.QuadPart += SYNTHETIC_TICK;
+    Budget = (ULONGLONG)SYNTHETIC_TICK * SYNTHETIC_PROCESSORS;
+
+    /* About 0.5% of the processes exit every second */
+    for (i = SyntheticProcessCount / 200 + 1; i > 0; i--)
+        SyntheticSpawn(&pSyntheticProcesses[SyntheticRandom() % SyntheticProcessCount]);
+
+    for (i = 0; i < SyntheticProcessCount; i++)
+    {
+        pProcess = &pSyntheticProcesses[i];
+        r = SyntheticRandom();
+
+        /* Up to 50ms of CPU time per process that runs, never over 95% of the machine */
+        if ((r & 0xFF) < pProcess->Activity)
+        {
+            Delta = (r >> 8) % (SYNTHETIC_TICK / 20);
+            if (Used + Delta <= Budget - Budget / 20)
+            {
+                pProcess->UserTime.QuadPart += Delta - Delta / 4;
+                pProcess->KernelTime.QuadPart += Delta / 4;
+                Used += Delta;
+                UsedKernel += Delta / 4;
+
+                pProcess->PageFaultCount += (r >> 20) % 64;
+                if (r & 0x100)
+                    pProcess->WorkingSetPages += (r >> 24);
+                else if (pProcess->WorkingSetPages > 64 + (r >> 24))
+                    pProcess->WorkingSetPages -= (r >> 24);
+                pProcess->PeakWorkingSetPages = max(pProcess->PeakWorkingSetPages, pProcess->WorkingSetPages);
+            }
+        }
+
+        TotalPages += pProcess->WorkingSetPages;
+        Handles += pProcess->HandleCount;
+    }
+
+    /* The rest of the time goes to the idle process, spread over all processors */
+    SyntheticIdleTime.QuadPart += Budget - Used;
+    for (i = 0; i < SYNTHETIC_PROCESSORS; i++)
+    {
+        SyntheticProcessors[i].IdleTime.QuadPart += (Budget - Used) / SYNTHETIC_PROCESSORS;
+        SyntheticProcessors[i].KernelTime.QuadPart += (Budget - Used + UsedKernel) / SYNTHETIC_PROCESSORS;
+        SyntheticProcessors[i].UserTime.QuadPart += (Used - UsedKernel) / SYNTHETIC_PROCESSORS;
+        SyntheticProcessors[i].InterruptCount += 1000;
+    }
+    memcpy(pSample->ProcessorTimeInfo, SyntheticProcessors, sizeof(SyntheticProcessors));
+
+    /* Build the process list, idle process first */
+    ZeroMemory(&Idle, sizeof(Idle));
+    Idle.KernelTime = SyntheticIdleTime;
+    Idle.NumberOfThreads = SYNTHETIC_PROCESSORS;
+
+    Offset = SyntheticWriteEntry(pBuffer, 0, &Idle);
+    for (i = 0; i < SyntheticProcessCount; i++)
+    {
+        pSPI = (PSYSTEM_PROCESS_INFORMATION)(pBuffer + Offset - cbEntry);
+        pSPI->NextEntryOffset = cbEntry;
+
+        pProcess = &pSyntheticProcesses[i];
+        Offset += SyntheticWriteEntry(pBuffer + Offset, SYNTHETIC_FIRST_PID + pProcess->Serial * 4, pProcess);
+    }
+
+    pSample->CurrentTime = SyntheticTime;
+    pSample->NumberOfHandles = Handles;
+    pSample->pProcessInfo = (PSYSTEM_PROCESS_INFORMATION)pBuffer;
+    pSample->cbProcessInfo = Offset;
+
+    ZeroMemory(&pSample->PerfInfo, sizeof(pSample->PerfInfo));
+    pSample->PerfInfo.IdleProcessTime = SyntheticIdleTime;
+    pSample->PerfInfo.AvailablePages = TotalPages < SYNTHETIC_PHYSICAL_PAGES ? (ULONG)(SYNTHETIC_PHYSICAL_PAGES - TotalPages) : 0;
+    pSample->PerfInfo.CommittedPages = (ULONG)min(TotalPages + TotalPages / 2, 0xFFFFFFFF);
+    pSample->PerfInfo.CommitLimit = SYNTHETIC_PHYSICAL_PAGES * 2;
+    SyntheticPeakCommit = max(SyntheticPeakCommit, pSample->PerfInfo.CommittedPages);
+    pSample->PerfInfo.PeakCommitment = SyntheticPeakCommit;
+    pSample->PerfInfo.PagedPoolPages = SyntheticProcessCount * 16;
+    pSample->PerfInfo.NonPagedPoolPages = SyntheticProcessCount * 2;
+
+    ZeroMemory(&pSample->CacheInfo, sizeof(pSample->CacheInfo));
+    pSample->CacheInfo.CurrentSizeIncludingTransitionInPages = SYNTHETIC_PHYSICAL_PAGES / 8;
+    pSample->CacheInfo.PeakSizeIncludingTransitionInPages = SYNTHETIC_PHYSICAL_PAGES / 8;
+
+    return TRUE;
+}
+
+const PERFDATA_PROVIDER SyntheticPerfDataProvider =
+{
+    L"Synthetic",
+    FALSE,
+    SyntheticInitialize,
+    SyntheticUninitialize,
+    SyntheticQuerySample,
+    NULL
+};
+
+/*
+ * Picks the provider from the command line, before PerfDataInitialize():
+ *   /record:<file>       native data, recorded to <file>
+ *   /replay:<file>       plays <file> back
+ *   /synthetic[:<n>]     simulates <n> processes
+ */
+void PerfDataSelectProvider(LPCWSTR lpCmdLine)
+{
+    LPWSTR  *argv;
+    LPWSTR  pszArg;
+    int     argc, i;
+    ULONG   Count;
+
+    if (!lpCmdLine || !*lpCmdLine)
+        return;
+
+    argv = CommandLineToArgvW(lpCmdLine, &argc);
+    if (!argv)
+        return;
+
+    for (i = 0; i < argc; i++)
+    {
+        pszArg = argv[i];
+        if (*pszArg != L'/' && *pszArg != L'-')
+            continue;
+        pszArg++;
+
+        if (_wcsnicmp(pszArg, L"record:", 7) == 0)
+        {
+            StringCchCopyW(szRecordFile, _countof(szRecordFile), pszArg + 7);
+            pPerfDataProvider = &NativePerfDataProvider;
+        }
+        else if (_wcsnicmp(pszArg, L"replay:", 7) == 0)
+        {
+            StringCchCopyW(szReplayFile, _countof(szReplayFile), pszArg + 7);
+            pPerfDataProvider = &ReplayPerfDataProvider;
+        }
+        else if (_wcsnicmp(pszArg, L"synthetic", 9) == 0)
+        {
+            if (pszArg[9] == L':')
+            {
+                Count = wcstoul(pszArg + 10, NULL, 10);
+                if (Count > 0 && Count <= SYNTHETIC_MAX_PROCESSES)
+                    SyntheticProcessCount = Count;
+            }
+            pPerfDataProvider = &SyntheticPerfDataProvider;
+        }
+    }
+
+    LocalFree(argv);
+}
@@ -0,0 +1,69 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  perfprov.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+/*
+ * Sources of raw performance samples for perfdata.c.
+ * Needs the NT types from sdk/exfuncs.h, so it is not part of precomp.h.
+ */
+
+/*
+ * One raw sample, zeroed by the caller. ProcessorTimeInfo and pProcessInfo
+ * are allocated by the provider from the process heap; ownership passes
+ * to the caller.
+ */
+typedef struct _PERFDATA_SAMPLE
+{
+    LARGE_INTEGER                              CurrentTime;
+    SYSTEM_PERFORMANCE_INFORMATION             PerfInfo;
+    SYSTEM_FILECACHE_INFORMATION               CacheInfo;
+    PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION  ProcessorTimeInfo;  /* One entry per processor, group by group */
+    ULONG                                      NumberOfHandles;    /* PERFDATA_UNKNOWN_HANDLES keeps the last count */
+    PSYSTEM_PROCESS_INFORMATION                pProcessInfo;       /* NextEntryOffset chain, no thread entries required */
+    ULONG                                      cbProcessInfo;
+    BOOL                                       bRestart;           /* Counters restarted, no deltas against the last sample */
+} PERFDATA_SAMPLE, *PPERFDATA_SAMPLE;
+
+#define PERFDATA_UNKNOWN_HANDLES    0xFFFFFFFF
+
+typedef struct _PERFDATA_PROVIDER
+{
+    LPCWSTR     pszName;
+
+    /* Process ids refer to processes running on this machine */
+    BOOL        bLiveSystem;
+
+    /* pBasicInfo->NumberOfProcessors only counts the processor group of the Task Manager */
+    BOOL        (*Initialize)(PSYSTEM_BASIC_INFORMATION pBasicInfo, PULONG pNumberOfProcessors);
+    void        (*Uninitialize)(void);
+    BOOL        (*QuerySample)(PPERFDATA_SAMPLE pSample);
+
+    /* NUMA node of each processor, NULL when everything is on node 0 */
+    void        (*GetProcessorNodes)(PBYTE pNodes, ULONG nCount);
+} PERFDATA_PROVIDER, *PPERFDATA_PROVIDER;
+
+typedef const PERFDATA_PROVIDER *PCPERFDATA_PROVIDER;
+
+extern const PERFDATA_PROVIDER  NativePerfDataProvider;     /* NtQuerySystemInformation */
+extern const PERFDATA_PROVIDER  ReplayPerfDataProvider;     /* Recorded capture file */
+extern const PERFDATA_PROVIDER  SyntheticPerfDataProvider;  /* Generated load */
+
+extern PCPERFDATA_PROVIDER      pPerfDataProvider;
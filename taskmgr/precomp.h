@@ -33,5 +33,7 @@
 #include "run.h"
 #include "trayicon.h"
 #include "shutdown.h"
+#include "history.h"
+#include "cmdcache.h"
 
 #endif /* __PRECOMP_H */
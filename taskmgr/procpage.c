@@ -25,6 +25,7 @@
 #include "precomp.h"
 
 #include "proclist.h"
+#include "procsort.h"
 
 #include <strsafe.h>
 
@@ -40,6 +41,7 @@
 typedef struct
 {
     ULONG ProcessId;
+    ULONG SortRank;     /* Position assigned by the last ProcessPageSortItems() */
 } PROCESS_PAGE_LIST_ITEM, *LPPROCESS_PAGE_LIST_ITEM;
 
 HWND hProcessPage;                      /* Process List Property Page */
@@ -58,6 +60,7 @@ static DWORD    dwProcessThread;
 #endif
 
 int CALLBACK    ProcessPageCompareFunc(LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort);
+void ProcessPageSortItems(void);
 void AddProcess(ULONG Index);
 void UpdateProcesses();
 void gethmsfromlargeint(LARGE_INTEGER largeint, DWORD *dwHours, DWORD *dwMinutes, DWORD *dwSeconds);
@@ -307,7 +310,7 @@ void ProcessPageOnNotify(WPARAM wParam, LPARAM lParam)
 
             TaskManagerSettings.SortColumn = ColumnDataHints[pnmhdr->iItem];
             TaskManagerSettings.SortAscending = !TaskManagerSettings.SortAscending;
-            (void)ListView_SortItems(hProcessPageListCtrl, ProcessPageCompareFunc, NULL);
+            ProcessPageSortItems();
 
             break;
 
@@ -531,7 +534,7 @@ void UpdateProcesses()
 
     if (TaskManagerSettings.SortColumn != -1)
     {
-        (void)ListView_SortItems(hProcessPageListCtrl, ProcessPageCompareFunc, NULL);
+        ProcessPageSortItems();
     }
 
     SendMessage(hProcessPageListCtrl, WM_SETREDRAW, TRUE, 0);
@@ -602,6 +605,7 @@ void AddProcess(ULONG Index)
     {
         pData = (LPPROCESS_PAGE_LIST_ITEM)HeapAlloc(GetProcessHeap(), 0, sizeof(PROCESS_PAGE_LIST_ITEM));
         pData->ProcessId = pid;
+        pData->SortRank = 0;
 
         /* Add the item to the list */
         memset(&item, 0, sizeof(LV_ITEM));
@@ -762,227 +766,54 @@ void gethmsfromlargeint(LARGE_INTEGER largeint, DWORD *dwHours, DWORD *dwMinutes
 #endif
 }
 
-int largeintcmp(LARGE_INTEGER l1, LARGE_INTEGER l2)
+/*
+ * Sorts the list by the active column. The keys are extracted and ordered
+ * once by ProcSortEntries(), the list view then only compares ranks.
+ */
+void ProcessPageSortItems(void)
 {
-    int ret = 0;
-    DWORD dwHours1;
-    DWORD dwMinutes1;
-    DWORD dwSeconds1;
-    DWORD dwHours2;
-    DWORD dwMinutes2;
-    DWORD dwSeconds2;
-
-    gethmsfromlargeint(l1, &dwHours1, &dwMinutes1, &dwSeconds1);
-    gethmsfromlargeint(l2, &dwHours2, &dwMinutes2, &dwSeconds2);
-    ret = CMP(dwHours1, dwHours2);
-    if (ret == 0)
+    int             i;
+    int             nCount;
+    LV_ITEM         item;
+    PPROCSORT_ENTRY pEntries;
+    LPPROCESS_PAGE_LIST_ITEM pData;
+
+    nCount = ListView_GetItemCount(hProcessPageListCtrl);
+    if (nCount <= 0)
+        return;
+
+    pEntries = HeapAlloc(GetProcessHeap(), 0, nCount * sizeof(PROCSORT_ENTRY));
+    if (!pEntries)
+        return;
+
+    for (i = 0; i < nCount; i++)
     {
-        ret = CMP(dwMinutes1, dwMinutes2);
-        if (ret == 0)
-        {
-            ret = CMP(dwSeconds1, dwSeconds2);
-        }
+        memset(&item, 0, sizeof(LV_ITEM));
+        item.mask = LVIF_PARAM;
+        item.iItem = i;
+        (void)ListView_GetItem(hProcessPageListCtrl, &item);
+        pData = (LPPROCESS_PAGE_LIST_ITEM)item.lParam;
+        pEntries[i].ProcessId = pData->ProcessId;
+        pEntries[i].Context = pData;
+    }
+
+    if (ProcSortEntries(TaskManagerSettings.SortColumn, TaskManagerSettings.SortAscending, pEntries, nCount))
+    {
+        for (i = 0; i < nCount; i++)
+            ((LPPROCESS_PAGE_LIST_ITEM)pEntries[i].Context)->SortRank = i;
+
+        (void)ListView_SortItems(hProcessPageListCtrl, ProcessPageCompareFunc, NULL);
     }
-    return ret;
+
+    HeapFree(GetProcessHeap(), 0, pEntries);
 }
 
 int CALLBACK ProcessPageCompareFunc(LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort)
 {
-    int ret = 0;
-    LPPROCESS_PAGE_LIST_ITEM Param1;
-    LPPROCESS_PAGE_LIST_ITEM Param2;
-    ULONG IndexParam1;
-    ULONG IndexParam2;
-    WCHAR text1[260];
-    WCHAR text2[260];
-    ULONG l1;
-    ULONG l2;
-    LARGE_INTEGER  time1;
-    LARGE_INTEGER  time2;
-    IO_COUNTERS    iocounters1;
-    IO_COUNTERS    iocounters2;
-    ULONGLONG      ull1;
-    ULONGLONG      ull2;
-
-    if (TaskManagerSettings.SortAscending) {
-        Param1 = (LPPROCESS_PAGE_LIST_ITEM)lParam1;
-        Param2 = (LPPROCESS_PAGE_LIST_ITEM)lParam2;
-    } else {
-        Param1 = (LPPROCESS_PAGE_LIST_ITEM)lParam2;
-        Param2 = (LPPROCESS_PAGE_LIST_ITEM)lParam1;
-    }
-    IndexParam1 = PerfDataGetProcessIndex(Param1->ProcessId);
-    IndexParam2 = PerfDataGetProcessIndex(Param2->ProcessId);
+    LPPROCESS_PAGE_LIST_ITEM Param1 = (LPPROCESS_PAGE_LIST_ITEM)lParam1;
+    LPPROCESS_PAGE_LIST_ITEM Param2 = (LPPROCESS_PAGE_LIST_ITEM)lParam2;
 
-    if (TaskManagerSettings.SortColumn == COLUMN_IMAGENAME)
-    {
-        PerfDataGetImageName(IndexParam1, text1, sizeof (text1) / sizeof (*text1));
-        PerfDataGetImageName(IndexParam2, text2, sizeof (text2) / sizeof (*text2));
-        ret = _wcsicmp(text1, text2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_PID)
-    {
-        l1 = Param1->ProcessId;
-        l2 = Param2->ProcessId;
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_USERNAME)
-    {
-        PerfDataGetUserName(IndexParam1, text1, sizeof (text1) / sizeof (*text1));
-        PerfDataGetUserName(IndexParam2, text2, sizeof (text2) / sizeof (*text2));
-        ret = _wcsicmp(text1, text2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_COMMANDLINE)
-    {
-        PerfDataGetCommandLine(IndexParam1, text1, sizeof (text1) / sizeof (*text1));
-        PerfDataGetCommandLine(IndexParam2, text2, sizeof (text2) / sizeof (*text2));
-        ret = _wcsicmp(text1, text2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_SESSIONID)
-    {
-        l1 = PerfDataGetSessionId(IndexParam1);
-        l2 = PerfDataGetSessionId(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_CPUUSAGE)
-    {
-        l1 = PerfDataGetCPUUsage(IndexParam1);
-        l2 = PerfDataGetCPUUsage(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_CPUTIME)
-    {
-        time1 = PerfDataGetCPUTime(IndexParam1);
-        time2 = PerfDataGetCPUTime(IndexParam2);
-        ret = largeintcmp(time1, time2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_MEMORYUSAGE)
-    {
-        l1 = PerfDataGetWorkingSetSizeBytes(IndexParam1);
-        l2 = PerfDataGetWorkingSetSizeBytes(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_PEAKMEMORYUSAGE)
-    {
-        l1 = PerfDataGetPeakWorkingSetSizeBytes(IndexParam1);
-        l2 = PerfDataGetPeakWorkingSetSizeBytes(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_MEMORYUSAGEDELTA)
-    {
-        l1 = PerfDataGetWorkingSetSizeDelta(IndexParam1);
-        l2 = PerfDataGetWorkingSetSizeDelta(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_PAGEFAULTS)
-    {
-        l1 = PerfDataGetPageFaultCount(IndexParam1);
-        l2 = PerfDataGetPageFaultCount(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_PAGEFAULTSDELTA)
-    {
-        l1 = PerfDataGetPageFaultCountDelta(IndexParam1);
-        l2 = PerfDataGetPageFaultCountDelta(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_VIRTUALMEMORYSIZE)
-    {
-        l1 = PerfDataGetVirtualMemorySizeBytes(IndexParam1);
-        l2 = PerfDataGetVirtualMemorySizeBytes(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_PAGEDPOOL)
-    {
-        l1 = PerfDataGetPagedPoolUsagePages(IndexParam1);
-        l2 = PerfDataGetPagedPoolUsagePages(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_NONPAGEDPOOL)
-    {
-        l1 = PerfDataGetNonPagedPoolUsagePages(IndexParam1);
-        l2 = PerfDataGetNonPagedPoolUsagePages(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_BASEPRIORITY)
-    {
-        l1 = PerfDataGetBasePriority(IndexParam1);
-        l2 = PerfDataGetBasePriority(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_HANDLECOUNT)
-    {
-        l1 = PerfDataGetHandleCount(IndexParam1);
-        l2 = PerfDataGetHandleCount(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_THREADCOUNT)
-    {
-        l1 = PerfDataGetThreadCount(IndexParam1);
-        l2 = PerfDataGetThreadCount(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_USEROBJECTS)
-    {
-        l1 = PerfDataGetUSERObjectCount(IndexParam1);
-        l2 = PerfDataGetUSERObjectCount(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_GDIOBJECTS)
-    {
-        l1 = PerfDataGetGDIObjectCount(IndexParam1);
-        l2 = PerfDataGetGDIObjectCount(IndexParam2);
-        ret = CMP(l1, l2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOREADS)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.ReadOperationCount;
-        ull2 = iocounters2.ReadOperationCount;
-        ret = CMP(ull1, ull2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOWRITES)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.WriteOperationCount;
-        ull2 = iocounters2.WriteOperationCount;
-        ret = CMP(ull1, ull2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOOTHER)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.OtherOperationCount;
-        ull2 = iocounters2.OtherOperationCount;
-        ret = CMP(ull1, ull2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOREADBYTES)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.ReadTransferCount;
-        ull2 = iocounters2.ReadTransferCount;
-        ret = CMP(ull1, ull2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOWRITEBYTES)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.WriteTransferCount;
-        ull2 = iocounters2.WriteTransferCount;
-        ret = CMP(ull1, ull2);
-    }
-    else if (TaskManagerSettings.SortColumn == COLUMN_IOOTHERBYTES)
-    {
-        PerfDataGetIOCounters(IndexParam1, &iocounters1);
-        PerfDataGetIOCounters(IndexParam2, &iocounters2);
-        ull1 = iocounters1.OtherTransferCount;
-        ull2 = iocounters2.OtherTransferCount;
-        ret = CMP(ull1, ull2);
-    }
-    return ret;
+    return CMP(Param1->SortRank, Param2->SortRank);
 }
 
 /**
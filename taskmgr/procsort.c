@@ -0,0 +1,367 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  procsort.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Process list sort stage.
+ *
+ * Instead of fetching and comparing column values inside every call of the
+ * list view compare callback, the active column is extracted once per refresh
+ * into a compact key array: 64-bit integers for numeric columns, and
+ * case-insensitive collation keys (LCMapStringW sort keys) for text columns.
+ * Numeric keys are ordered with a stable LSD radix sort, text keys with a
+ * stable bottom-up merge sort.
+ */
+
+#include "precomp.h"
+
+#include "procsort.h"
+
+/* Collation keys of the current sort, reused from one refresh to the next */
+static LPBYTE   SortKeyBuffer = NULL;
+static SIZE_T   SortKeyBufferSize = 0;
+static SIZE_T   SortKeyBufferUsed = 0;
+
+static BOOL
+ProcSortIsTextColumn(UINT ColumnId)
+{
+    return (ColumnId == COLUMN_IMAGENAME ||
+            ColumnId == COLUMN_USERNAME ||
+            ColumnId == COLUMN_COMMANDLINE);
+}
+
+static ULONGLONG
+ProcSortNumericKey(PPERFDATA pData, UINT ColumnId)
+{
+    switch (ColumnId)
+    {
+        case COLUMN_PID:                return PtrToUlong(pData->ProcessId);
+        case COLUMN_SESSIONID:          return pData->SessionId;
+        case COLUMN_CPUUSAGE:           return pData->CPUUsage;
+        case COLUMN_CPUTIME:            return pData->CPUTime.QuadPart;
+        case COLUMN_MEMORYUSAGE:        return pData->WorkingSetSizeBytes;
+        case COLUMN_PEAKMEMORYUSAGE:    return pData->PeakWorkingSetSizeBytes;
+        case COLUMN_MEMORYUSAGEDELTA:   return pData->WorkingSetSizeDelta;
+        case COLUMN_PAGEFAULTS:         return pData->PageFaultCount;
+        case COLUMN_PAGEFAULTSDELTA:    return pData->PageFaultCountDelta;
+        case COLUMN_VIRTUALMEMORYSIZE:  return pData->VirtualMemorySizeBytes;
+        case COLUMN_PAGEDPOOL:          return pData->PagedPoolUsagePages;
+        case COLUMN_NONPAGEDPOOL:       return pData->NonPagedPoolUsagePages;
+        case COLUMN_BASEPRIORITY:       return pData->BasePriority;
+        case COLUMN_HANDLECOUNT:        return pData->HandleCount;
+        case COLUMN_THREADCOUNT:        return pData->ThreadCount;
+        case COLUMN_USEROBJECTS:        return pData->USERObjectCount;
+        case COLUMN_GDIOBJECTS:         return pData->GDIObjectCount;
+        case COLUMN_IOREADS:            return pData->IOCounters.ReadOperationCount;
+        case COLUMN_IOWRITES:           return pData->IOCounters.WriteOperationCount;
+        case COLUMN_IOOTHER:            return pData->IOCounters.OtherOperationCount;
+        case COLUMN_IOREADBYTES:        return pData->IOCounters.ReadTransferCount;
+        case COLUMN_IOWRITEBYTES:       return pData->IOCounters.WriteTransferCount;
+        case COLUMN_IOOTHERBYTES:       return pData->IOCounters.OtherTransferCount;
+    }
+
+    return 0;
+}
+
+/*
+ * Appends the collation key of lpString to the key buffer and returns its
+ * offset. Offset 0 always holds an empty key, used for missing rows.
+ */
+static ULONGLONG
+ProcSortAddTextKey(LPCWSTR lpString)
+{
+    int     cbKey;
+    LPBYTE  pNewBuffer;
+    SIZE_T  cbNewSize;
+    ULONGLONG Offset;
+
+    cbKey = LCMapStringW(LOCALE_USER_DEFAULT, LCMAP_SORTKEY | NORM_IGNORECASE, lpString, -1, NULL, 0);
+    if (cbKey <= 0)
+        return 0;
+
+    if (SortKeyBufferUsed + cbKey > SortKeyBufferSize)
+    {
+        cbNewSize = max(SortKeyBufferSize * 2, SortKeyBufferUsed + cbKey);
+        pNewBuffer = HeapReAlloc(GetProcessHeap(), 0, SortKeyBuffer, cbNewSize);
+        if (!pNewBuffer)
+            return 0;
+
+        SortKeyBuffer = pNewBuffer;
+        SortKeyBufferSize = cbNewSize;
+    }
+
+    if (!LCMapStringW(LOCALE_USER_DEFAULT, LCMAP_SORTKEY | NORM_IGNORECASE, lpString, -1,
+                      (LPWSTR)(SortKeyBuffer + SortKeyBufferUsed), cbKey))
+        return 0;
+
+    Offset = SortKeyBufferUsed;
+    SortKeyBufferUsed += cbKey;
+    return Offset;
+}
+
+/*
+ * Stable LSD radix sort on the 64-bit Key, one byte per pass.
+ * All eight histograms are built in a single pass over the data, and
+ * passes where every key has the same byte are skipped, so sorting small
+ * values (CPU %, handle counts...) usually costs two or three passes.
+ */
+static void
+ProcSortRadix(PPROCSORT_ENTRY pEntries, PPROCSORT_ENTRY pTemp, ULONG nCount)
+{
+    ULONG           Histogram[8][256];
+    ULONG           i, Pass, Sum, n;
+    PPROCSORT_ENTRY pSrc = pEntries;
+    PPROCSORT_ENTRY pDst = pTemp;
+    PPROCSORT_ENTRY pSwap;
+
+    ZeroMemory(Histogram, sizeof(Histogram));
+    for (i = 0; i < nCount; i++)
+    {
+        for (Pass = 0; Pass < 8; Pass++)
+            Histogram[Pass][(pSrc[i].Key >> (Pass * 8)) & 0xFF]++;
+    }
+
+    for (Pass = 0; Pass < 8; Pass++)
+    {
+        ULONG *Count = Histogram[Pass];
+        UINT   Shift = Pass * 8;
+
+        if (Count[(pSrc[0].Key >> Shift) & 0xFF] == nCount)
+            continue;
+
+        for (Sum = 0, i = 0; i < 256; i++)
+        {
+            n = Count[i];
+            Count[i] = Sum;
+            Sum += n;
+        }
+
+        for (i = 0; i < nCount; i++)
+            pDst[Count[(pSrc[i].Key >> Shift) & 0xFF]++] = pSrc[i];
+
+        pSwap = pSrc;
+        pSrc = pDst;
+        pDst = pSwap;
+    }
+
+    if (pSrc != pEntries)
+        memcpy(pEntries, pSrc, nCount * sizeof(PROCSORT_ENTRY));
+}
+
+/*
+ * Stable bottom-up merge sort on the collation keys referenced by Key.
+ * nSign is 1 for ascending and -1 for descending order.
+ */
+static void
+ProcSortMerge(PPROCSORT_ENTRY pEntries, PPROCSORT_ENTRY pTemp, ULONG nCount, int nSign)
+{
+    ULONG           Width, Lo, Mid, Hi, i, j, k;
+    PPROCSORT_ENTRY pSrc = pEntries;
+    PPROCSORT_ENTRY pDst = pTemp;
+    PPROCSORT_ENTRY pSwap;
+
+    for (Width = 1; Width < nCount; Width *= 2)
+    {
+        for (Lo = 0; Lo < nCount; Lo += 2 * Width)
+        {
+            Mid = min(Lo + Width, nCount);
+            Hi = min(Lo + 2 * Width, nCount);
+
+            for (i = Lo, j = Mid, k = Lo; i < Mid && j < Hi; k++)
+            {
+                /* Take from the right run only when strictly smaller, to stay stable */
+                if (nSign * strcmp((LPCSTR)(SortKeyBuffer + pSrc[j].Key),
+                                   (LPCSTR)(SortKeyBuffer + pSrc[i].Key)) < 0)
+                    pDst[k] = pSrc[j++];
+                else
+                    pDst[k] = pSrc[i++];
+            }
+            while (i < Mid)
+                pDst[k++] = pSrc[i++];
+            while (j < Hi)
+                pDst[k++] = pSrc[j++];
+        }
+
+        pSwap = pSrc;
+        pSrc = pDst;
+        pDst = pSwap;
+    }
+
+    if (pSrc != pEntries)
+        memcpy(pEntries, pSrc, nCount * sizeof(PROCSORT_ENTRY));
+}
+
+/*
+ * Looks up the perf data index of ProcessId in the PID map built by
+ * ProcSortEntries() (sorted by PID, index kept in Context).
+ */
+static ULONG
+ProcSortFindIndex(PPROCSORT_ENTRY pMap, ULONG nMap, ULONG ProcessId)
+{
+    ULONG Lo = 0, Hi = nMap, Mid;
+
+    while (Lo < Hi)
+    {
+        Mid = Lo + (Hi - Lo) / 2;
+        if (pMap[Mid].Key < ProcessId)
+            Lo = Mid + 1;
+        else
+            Hi = Mid;
+    }
+
+    if (Lo < nMap && pMap[Lo].Key == ProcessId)
+        return (ULONG)(ULONG_PTR)pMap[Lo].Context;
+
+    return (ULONG)-1;
+}
+
+BOOL ProcSortEntries(UINT ColumnId, BOOL bAscending, PPROCSORT_ENTRY pEntries, ULONG nCount)
+{
+    PPROCSORT_ENTRY pTemp;
+    PPROCSORT_ENTRY pMap;
+    PPERFDATA       pData;
+    ULONG           nProcesses;
+    ULONG           i, Index;
+    BOOL            bText;
+    WCHAR           szText[MAX_PATH];
+
+    if (nCount == 0)
+        return TRUE;
+
+    bText = ProcSortIsTextColumn(ColumnId);
+
+    /* Scratch space for the merge/radix passes */
+    pTemp = HeapAlloc(GetProcessHeap(), 0, nCount * sizeof(PROCSORT_ENTRY));
+    if (!pTemp)
+        return FALSE;
+
+    if (bText)
+    {
+        if (!SortKeyBuffer)
+        {
+            SortKeyBufferSize = 64 * 1024;
+            SortKeyBuffer = HeapAlloc(GetProcessHeap(), 0, SortKeyBufferSize);
+            if (!SortKeyBuffer)
+            {
+                SortKeyBufferSize = 0;
+                HeapFree(GetProcessHeap(), 0, pTemp);
+                return FALSE;
+            }
+        }
+
+        /* Offset 0 is the empty key */
+        SortKeyBuffer[0] = 0;
+        SortKeyBufferUsed = 1;
+    }
+
+    pData = PerfDataLock(&nProcesses);
+
+    /* Map PIDs to perf data indices once, instead of a linear search per row */
+    pMap = HeapAlloc(GetProcessHeap(), 0, max(nProcesses, 1) * sizeof(PROCSORT_ENTRY));
+    if (!pMap)
+    {
+        PerfDataUnlock();
+        HeapFree(GetProcessHeap(), 0, pTemp);
+        return FALSE;
+    }
+
+    if (nProcesses)
+    {
+        PPROCSORT_ENTRY pMapTemp = HeapAlloc(GetProcessHeap(), 0, nProcesses * sizeof(PROCSORT_ENTRY));
+
+        if (!pMapTemp)
+        {
+            PerfDataUnlock();
+            HeapFree(GetProcessHeap(), 0, pMap);
+            HeapFree(GetProcessHeap(), 0, pTemp);
+            return FALSE;
+        }
+
+        for (i = 0; i < nProcesses; i++)
+        {
+            pMap[i].Key = PtrToUlong(pData[i].ProcessId);
+            pMap[i].Context = (PVOID)(ULONG_PTR)i;
+        }
+        ProcSortRadix(pMap, pMapTemp, nProcesses);
+        HeapFree(GetProcessHeap(), 0, pMapTemp);
+    }
+
+    for (i = 0; i < nCount; i++)
+    {
+        Index = ProcSortFindIndex(pMap, nProcesses, pEntries[i].ProcessId);
+
+        if (ColumnId == COLUMN_COMMANDLINE)
+        {
+            /* Resolved after unlocking, the command line may need to be read from the process */
+            pEntries[i].Key = Index;
+        }
+        else if (Index == (ULONG)-1)
+        {
+            pEntries[i].Key = 0;
+        }
+        else if (ColumnId == COLUMN_IMAGENAME)
+        {
+            pEntries[i].Key = ProcSortAddTextKey(pData[Index].ImageName);
+        }
+        else if (ColumnId == COLUMN_USERNAME)
+        {
+            pEntries[i].Key = ProcSortAddTextKey(pData[Index].UserName);
+        }
+        else
+        {
+            pEntries[i].Key = ProcSortNumericKey(&pData[Index], ColumnId);
+        }
+    }
+
+    PerfDataUnlock();
+    HeapFree(GetProcessHeap(), 0, pMap);
+
+    if (ColumnId == COLUMN_COMMANDLINE)
+    {
+        for (i = 0; i < nCount; i++)
+        {
+            Index = (ULONG)pEntries[i].Key;
+            pEntries[i].Key = 0;
+
+            if (Index != (ULONG)-1 &&
+                PerfDataGetCommandLine(Index, szText, _countof(szText)))
+            {
+                pEntries[i].Key = ProcSortAddTextKey(szText);
+            }
+        }
+    }
+
+    if (bText)
+    {
+        ProcSortMerge(pEntries, pTemp, nCount, bAscending ? 1 : -1);
+    }
+    else
+    {
+        /* Complementing the keys reverses the order and keeps the sort stable */
+        if (!bAscending)
+        {
+            for (i = 0; i < nCount; i++)
+                pEntries[i].Key = ~pEntries[i].Key;
+        }
+        ProcSortRadix(pEntries, pTemp, nCount);
+    }
+
+    HeapFree(GetProcessHeap(), 0, pTemp);
+    return TRUE;
+}
@@ -0,0 +1,35 @@
+/*
+ *  ReactOS Task Manager
+ *
+ *  procsort.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+/*
+ * One row of the process list as seen by the sort stage.
+ * The caller fills ProcessId and Context, ProcSortEntries() fills Key
+ * and reorders the array.
+ */
+typedef struct _PROCSORT_ENTRY
+{
+    ULONGLONG   Key;        /* Numeric key, or byte offset of the collation key */
+    ULONG       ProcessId;
+    PVOID       Context;    /* Caller's per-row data, carried along */
+} PROCSORT_ENTRY, *PPROCSORT_ENTRY;
+
+BOOL    ProcSortEntries(UINT ColumnId, BOOL bAscending, PPROCSORT_ENTRY pEntries, ULONG nCount);
@@ -181,6 +181,7 @@
 #define ID_PROCESS_PAGE_SETPRIORITY_LOW         32814
 #define ID_PROCESS_PAGE_PROPERTIES              32825
 #define ID_PROCESS_PAGE_OPENFILELOCATION        32826
+#define ID_FILE_EXPORTHISTORY                   32827
 
 #define ID_SHUTDOWN_STANDBY         32816
 #define ID_SHUTDOWN_HIBERNATE       32817
@@ -251,6 +252,7 @@
 #define IDS_MSG_WARNINGCHANGEPRIORITY 361
 #define IDS_MSG_TRAYICONCPUUSAGE      362
 #define IDS_MSG_CLOSESYSTEMPROCESS    369
+#define IDS_HISTORY_FILTER            370
 
 #define IDS_STATUS_MEMUSAGE  363
 #define IDS_STATUS_CPUUSAGE  364
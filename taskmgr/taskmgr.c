@@ -174,12 +174,18 @@ int APIENTRY wWinMain(HINSTANCE hInstance,
     /* Load our settings from the registry */
     LoadSettings();
 
-    /* Initialize perf data */
+    /* Initialize perf data, from a capture or a simulation if asked to */
+    PerfDataSelectProvider(lpCmdLine);
     if (!PerfDataInitialize())
     {
         return -1;
     }
 
+    /* Initialize the counter history, the Task Manager works without it.
+     * Replayed or simulated data must not end up in the history file. */
+    if (PerfDataIsLiveSystem())
+        HistoryInitialize();
+
     /*
      * Set our shutdown parameters: we want to shutdown the very last,
      * without displaying any end task dialog if needed.
@@ -190,6 +196,7 @@ int APIENTRY wWinMain(HINSTANCE hInstance,
 
     /* Save our settings to the registry */
     SaveSettings();
+    HistoryUninitialize();
     PerfDataUninitialize();
     CloseHandle(hMutex);
     if (hWindowMenu)
@@ -228,6 +235,9 @@ TaskManagerWndProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
         case ID_FILE_NEW:
             TaskManager_OnFileNew();
             break;
+        case ID_FILE_EXPORTHISTORY:
+            TaskManager_OnFileExportHistory();
+            break;
         case ID_OPTIONS_ALWAYSONTOP:
             TaskManager_OnOptionsAlwaysOnTop();
             break;
@@ -498,8 +508,6 @@ TaskManagerWndProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
             TaskManagerSettings.Maximized = TRUE;
         else
             TaskManagerSettings.Maximized = FALSE;
-        /* Get rid of the allocated command line cache, if any */
-        PerfDataDeallocCommandLineCache();
         if (hWindowMenu)
             DestroyMenu(hWindowMenu);
         return DefWindowProcW(hDlg, message, wParam, lParam);
@@ -507,6 +515,7 @@ TaskManagerWndProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_TIMER:
         /* Refresh the performance data */
         PerfDataRefresh();
+        HistoryAddSample();
         RefreshApplicationPage();
         RefreshProcessPage();
         RefreshPerformancePage();
@@ -0,0 +1,637 @@
+/*
+ * Help Viewer - full text search
+ *
+ * The text of all topics is indexed once, in a background thread, and the
+ * index is kept next to the help file (same name, .fts extension) so that
+ * the next openings only have to map it.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "windef.h"
+#include "winbase.h"
+#include "winhelp.h"
+
+#include "../debug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(winhelp);
+
+#define FTS_MAGIC               0x53544657      /* 'WFTS' */
+#define FTS_VERSION             1
+#define FTS_MAX_TERM            31
+
+/*
+ * On disk (and in memory) layout, all little endian DWORDs:
+ *      FTS_HEADER
+ *      FTS_DOC[num_docs]       one per page, in page list order
+ *      FTS_ENTRY[num_terms]    sorted by hash, then term
+ *      postings                per term, df pairs of varints:
+ *                              (doc - previous doc, occurrences)
+ *      strings                 NUL terminated terms
+ */
+typedef struct
+{
+    DWORD       magic;
+    DWORD       version;
+    DWORD       file_size;      /* of the help file the index was built from */
+    FILETIME    file_time;
+    DWORD       num_docs;
+    DWORD       num_terms;
+    DWORD       total_words;
+    DWORD       terms;          /* offsets from the header */
+    DWORD       postings;
+    DWORD       strings;
+    DWORD       size;
+} FTS_HEADER;
+
+typedef struct
+{
+    DWORD       offset;         /* page offset */
+    DWORD       words;          /* number of words in the page */
+} FTS_DOC;
+
+typedef struct
+{
+    DWORD       hash;
+    DWORD       string;
+    DWORD       postings;
+    DWORD       df;             /* number of pages with the term */
+} FTS_ENTRY;
+
+typedef struct tagFtsIndex
+{
+    HLPFILE*            hlpfile;
+    HANDLE              hThread;
+    LONG                abort;
+    LONG                ready;
+    const BYTE*         data;           /* FTS_HEADER, once ready */
+    BOOL                mapped;
+} FTS_INDEX;
+
+/* one term while building */
+typedef struct
+{
+    DWORD       hash;
+    DWORD       df;
+    DWORD       doc;            /* last page the term was seen in */
+    DWORD       tf;             /* occurrences in that page */
+    DWORD       prev_doc;       /* last page written to postings */
+    BYTE*       postings;
+    DWORD       size;
+    DWORD       allocated;
+    char        term[FTS_MAX_TERM + 1];
+} FTS_TERM;
+
+typedef struct
+{
+    FTS_INDEX*  index;
+    FTS_TERM*   terms;          /* open addressing, power of two */
+    DWORD       num_terms;
+    DWORD       hash_size;
+    FTS_DOC*    docs;
+    DWORD       num_docs;
+    DWORD       allocated_docs;
+    DWORD       total_words;
+    HLPFILE_PAGE* page;         /* page of the current doc */
+    BOOL        failed;
+} FTS_BUILDER;
+
+/***********************************************************************
+ *
+ *           FTS_NextWord
+ *
+ * Extracts the next word of [ptr, end) into word, lowercased and cut to
+ * FTS_MAX_TERM bytes. Returns its length, 0 when there are no more words.
+ */
+static unsigned FTS_NextWord(const char** ptr, const char* end, char* word)
+{
+    const BYTE* p = (const BYTE*)*ptr;
+    unsigned    len = 0;
+
+#define FTS_ISWORD(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || \
+                       ((c) >= '0' && (c) <= '9') || (c) >= 0x80)
+
+    while (p < (const BYTE*)end && !FTS_ISWORD(*p)) p++;
+    for (; p < (const BYTE*)end && FTS_ISWORD(*p); p++)
+    {
+        if (len < FTS_MAX_TERM)
+            word[len++] = (*p >= 'A' && *p <= 'Z') ? *p + 'a' - 'A' : *p;
+    }
+#undef FTS_ISWORD
+
+    word[len] = '\0';
+    *ptr = (const char*)p;
+    return len;
+}
+
+static DWORD FTS_Hash(const char* word)
+{
+    DWORD       hash = 2166136261u;
+
+    while (*word) hash = (hash ^ (BYTE)*word++) * 16777619u;
+    return hash;
+}
+
+static BYTE* FTS_PutVarint(BYTE* ptr, DWORD val)
+{
+    while (val >= 0x80)
+    {
+        *ptr++ = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    *ptr++ = val;
+    return ptr;
+}
+
+/* returns NULL if the varint doesn't end before end */
+static const BYTE* FTS_GetVarint(const BYTE* ptr, const BYTE* end, DWORD* val)
+{
+    unsigned    shift = 0;
+
+    *val = 0;
+    do
+    {
+        if (ptr >= end) return NULL;
+        *val |= (DWORD)(*ptr & 0x7F) << shift;
+        shift += 7;
+    } while (*ptr++ & 0x80 && shift < 32);
+    return ptr;
+}
+
+/***********************************************************************
+ *
+ *           FTS_Flush
+ *
+ * Appends the pending (page, occurrences) pair of a term to its postings.
+ */
+static BOOL FTS_Flush(FTS_TERM* term)
+{
+    BYTE*       new;
+    BYTE*       ptr;
+
+    if (!term->tf) return TRUE;
+    if (term->size + 10 > term->allocated)
+    {
+        DWORD   allocated = max(term->allocated * 2, 16);
+
+        if (term->postings)
+            new = HeapReAlloc(GetProcessHeap(), 0, term->postings, allocated);
+        else
+            new = HeapAlloc(GetProcessHeap(), 0, allocated);
+        if (!new) return FALSE;
+        term->postings = new;
+        term->allocated = allocated;
+    }
+    ptr = FTS_PutVarint(term->postings + term->size, term->doc - term->prev_doc);
+    ptr = FTS_PutVarint(ptr, term->tf);
+    term->size = ptr - term->postings;
+    term->prev_doc = term->doc;
+    term->df++;
+    term->tf = 0;
+    return TRUE;
+}
+
+static FTS_TERM* FTS_FindTerm(FTS_BUILDER* b, const char* word, DWORD hash)
+{
+    FTS_TERM*   term;
+    FTS_TERM*   old;
+    DWORD       i, j, old_size;
+
+    if ((b->num_terms + 1) * 4 > b->hash_size * 3)
+    {
+        old = b->terms;
+        old_size = b->hash_size;
+        b->hash_size = old_size ? old_size * 2 : 4096;
+        b->terms = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, b->hash_size * sizeof(FTS_TERM));
+        if (!b->terms)
+        {
+            b->terms = old;
+            b->hash_size = old_size;
+            return NULL;
+        }
+        for (i = 0; i < old_size; i++)
+        {
+            if (!old[i].term[0]) continue;
+            for (j = old[i].hash & (b->hash_size - 1); b->terms[j].term[0]; j = (j + 1) & (b->hash_size - 1));
+            b->terms[j] = old[i];
+        }
+        HeapFree(GetProcessHeap(), 0, old);
+    }
+
+    for (i = hash & (b->hash_size - 1); ; i = (i + 1) & (b->hash_size - 1))
+    {
+        term = &b->terms[i];
+        if (!term->term[0])
+        {
+            term->hash = hash;
+            strcpy(term->term, word);
+            b->num_terms++;
+            return term;
+        }
+        if (term->hash == hash && !strcmp(term->term, word)) return term;
+    }
+}
+
+static BOOL FTS_AddText(HLPFILE_PAGE* page, const char* text, unsigned size, void* cookie)
+{
+    FTS_BUILDER* b = cookie;
+    FTS_TERM*   term;
+    const char* end = text + size;
+    char        word[FTS_MAX_TERM + 1];
+
+    if (b->index->abort) return FALSE;
+
+    if (page != b->page)
+    {
+        if (b->num_docs == b->allocated_docs)
+        {
+            FTS_DOC*    new;
+
+            b->allocated_docs = max(b->allocated_docs * 2, 256);
+            if (b->docs)
+                new = HeapReAlloc(GetProcessHeap(), 0, b->docs, b->allocated_docs * sizeof(FTS_DOC));
+            else
+                new = HeapAlloc(GetProcessHeap(), 0, b->allocated_docs * sizeof(FTS_DOC));
+            if (!new) {b->failed = TRUE; return FALSE;}
+            b->docs = new;
+        }
+        b->docs[b->num_docs].offset = page->offset;
+        b->docs[b->num_docs].words = 0;
+        b->num_docs++;
+        b->page = page;
+    }
+
+    while (FTS_NextWord(&text, end, word))
+    {
+        DWORD   hash = FTS_Hash(word);
+
+        if (!(term = FTS_FindTerm(b, word, hash))) {b->failed = TRUE; return FALSE;}
+        if (term->tf && term->doc != b->num_docs - 1 && !FTS_Flush(term))
+        {
+            b->failed = TRUE;
+            return FALSE;
+        }
+        term->doc = b->num_docs - 1;
+        term->tf++;
+        b->docs[b->num_docs - 1].words++;
+        b->total_words++;
+    }
+    return TRUE;
+}
+
+static int FTS_CompareTerms(const void* p1, const void* p2)
+{
+    const FTS_TERM* t1 = *(const FTS_TERM* const*)p1;
+    const FTS_TERM* t2 = *(const FTS_TERM* const*)p2;
+
+    if (t1->hash != t2->hash) return t1->hash < t2->hash ? -1 : 1;
+    return strcmp(t1->term, t2->term);
+}
+
+/***********************************************************************
+ *
+ *           FTS_Serialize
+ *
+ * Lays the built terms out in the FTS_HEADER format.
+ */
+static BYTE* FTS_Serialize(FTS_BUILDER* b, const WIN32_FILE_ATTRIBUTE_DATA* fad)
+{
+    FTS_TERM**  sorted;
+    FTS_HEADER* header;
+    FTS_ENTRY*  entry;
+    BYTE*       data;
+    DWORD       i, n, postings = 0, strings = 0, pos, spos;
+
+    sorted = HeapAlloc(GetProcessHeap(), 0, max(b->num_terms, 1) * sizeof(FTS_TERM*));
+    if (!sorted) return NULL;
+    for (i = n = 0; i < b->hash_size; i++)
+    {
+        if (!b->terms[i].term[0]) continue;
+        if (!FTS_Flush(&b->terms[i])) {HeapFree(GetProcessHeap(), 0, sorted); return NULL;}
+        sorted[n++] = &b->terms[i];
+        postings += b->terms[i].size;
+        strings += strlen(b->terms[i].term) + 1;
+    }
+    qsort(sorted, n, sizeof(sorted[0]), FTS_CompareTerms);
+
+    pos = sizeof(FTS_HEADER) + b->num_docs * sizeof(FTS_DOC) + n * sizeof(FTS_ENTRY);
+    data = HeapAlloc(GetProcessHeap(), 0, pos + postings + strings);
+    if (!data) {HeapFree(GetProcessHeap(), 0, sorted); return NULL;}
+
+    header = (FTS_HEADER*)data;
+    header->magic       = FTS_MAGIC;
+    header->version     = FTS_VERSION;
+    header->file_size   = fad->nFileSizeLow;
+    header->file_time   = fad->ftLastWriteTime;
+    header->num_docs    = b->num_docs;
+    header->num_terms   = n;
+    header->total_words = b->total_words;
+    header->terms       = sizeof(FTS_HEADER) + b->num_docs * sizeof(FTS_DOC);
+    header->postings    = pos;
+    header->strings     = pos + postings;
+    header->size        = pos + postings + strings;
+
+    memcpy(data + sizeof(FTS_HEADER), b->docs, b->num_docs * sizeof(FTS_DOC));
+    entry = (FTS_ENTRY*)(data + header->terms);
+    spos = header->strings;
+    for (i = 0; i < n; i++, entry++)
+    {
+        entry->hash     = sorted[i]->hash;
+        entry->string   = spos;
+        entry->postings = pos;
+        entry->df       = sorted[i]->df;
+        memcpy(data + pos, sorted[i]->postings, sorted[i]->size);
+        pos += sorted[i]->size;
+        strcpy((char*)data + spos, sorted[i]->term);
+        spos += strlen(sorted[i]->term) + 1;
+    }
+
+    HeapFree(GetProcessHeap(), 0, sorted);
+    return data;
+}
+
+static void FTS_GetPath(HLPFILE* hlpfile, char* path)
+{
+    char*       ext;
+
+    lstrcpynA(path, hlpfile->lpszPath, MAX_PATH - 4);
+    ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '\\')) ext = path + strlen(path);
+    strcpy(ext, ".fts");
+}
+
+static void FTS_Save(HLPFILE* hlpfile, const BYTE* data)
+{
+    char        path[MAX_PATH];
+    HANDLE      hFile;
+    DWORD       size = ((const FTS_HEADER*)data)->size, written;
+    BOOL        ret;
+
+    FTS_GetPath(hlpfile, path);
+    hFile = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    /* read-only media, the index just won't survive this session */
+    if (hFile == INVALID_HANDLE_VALUE) return;
+    ret = WriteFile(hFile, data, size, &written, NULL) && written == size;
+    CloseHandle(hFile);
+    if (!ret) DeleteFileA(path);
+}
+
+/***********************************************************************
+ *
+ *           FTS_Load
+ *
+ * Maps the sidecar index, if it's there and matches the help file.
+ */
+static BOOL FTS_Load(FTS_INDEX* index, const WIN32_FILE_ATTRIBUTE_DATA* fad)
+{
+    char                path[MAX_PATH];
+    HANDLE              hFile, hMapping;
+    const FTS_HEADER*   header;
+    const FTS_ENTRY*    entry;
+    DWORD               size, i;
+
+    FTS_GetPath(index->hlpfile, path);
+    hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return FALSE;
+    size = GetFileSize(hFile, NULL);
+    hMapping = size >= sizeof(FTS_HEADER) && size != INVALID_FILE_SIZE ?
+        CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    CloseHandle(hFile);
+    if (!hMapping) return FALSE;
+    header = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (!header) return FALSE;
+
+    /* num_docs and num_terms are checked against size before being multiplied */
+    if (header->magic != FTS_MAGIC || header->version != FTS_VERSION ||
+        header->size != size || header->file_size != fad->nFileSizeLow ||
+        CompareFileTime(&header->file_time, &fad->ftLastWriteTime) ||
+        header->num_docs > (size - sizeof(FTS_HEADER)) / sizeof(FTS_DOC) ||
+        header->terms != sizeof(FTS_HEADER) + header->num_docs * sizeof(FTS_DOC) ||
+        header->num_terms > (size - header->terms) / sizeof(FTS_ENTRY) ||
+        header->postings != header->terms + header->num_terms * sizeof(FTS_ENTRY) ||
+        header->postings > header->strings || header->strings > size ||
+        (size && ((const BYTE*)header)[size - 1]))
+    {
+        WINE_TRACE("stale index %s\n", debugstr_a(path));
+        UnmapViewOfFile(header);
+        return FALSE;
+    }
+    entry = (const FTS_ENTRY*)((const BYTE*)header + header->terms);
+    for (i = 0; i < header->num_terms; i++, entry++)
+    {
+        /* each posting takes at least two bytes */
+        if (entry->string < header->strings || entry->string >= size ||
+            entry->postings < header->postings || entry->postings > header->strings ||
+            entry->df > header->num_docs ||
+            entry->df > (header->strings - entry->postings) / 2)
+        {
+            WINE_WARN("corrupted index %s\n", debugstr_a(path));
+            UnmapViewOfFile(header);
+            return FALSE;
+        }
+    }
+
+    index->data = (const BYTE*)header;
+    index->mapped = TRUE;
+    index->ready = TRUE;
+    return TRUE;
+}
+
+static DWORD WINAPI FTS_BuildThread(LPVOID arg)
+{
+    FTS_INDEX*  index = arg;
+    FTS_BUILDER b;
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    BYTE*       data = NULL;
+    DWORD       i;
+
+    memset(&b, 0, sizeof(b));
+    b.index = index;
+
+    if (GetFileAttributesExA(index->hlpfile->lpszPath, GetFileExInfoStandard, &fad) &&
+        HLPFILE_EnumTopicText(index->hlpfile, FTS_AddText, &b) && !b.failed)
+        data = FTS_Serialize(&b, &fad);
+
+    for (i = 0; i < b.hash_size; i++)
+        HeapFree(GetProcessHeap(), 0, b.terms[i].postings);
+    HeapFree(GetProcessHeap(), 0, b.terms);
+    HeapFree(GetProcessHeap(), 0, b.docs);
+
+    if (data)
+    {
+        index->data = data;
+        InterlockedExchange(&index->ready, TRUE);
+        FTS_Save(index->hlpfile, data);
+    }
+    return 0;
+}
+
+/***********************************************************************
+ *
+ *           FTS_Open
+ *
+ * Loads the index of a freshly read help file, or starts building it.
+ */
+void FTS_Open(HLPFILE* hlpfile)
+{
+    FTS_INDEX*  index;
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+
+    index = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*index));
+    if (!index) return;
+    index->hlpfile = hlpfile;
+    hlpfile->fts = index;
+
+    if (GetFileAttributesExA(hlpfile->lpszPath, GetFileExInfoStandard, &fad) &&
+        FTS_Load(index, &fad))
+        return;
+
+    index->hThread = CreateThread(NULL, 0, FTS_BuildThread, index, 0, NULL);
+}
+
+void FTS_Close(HLPFILE* hlpfile)
+{
+    FTS_INDEX*  index = hlpfile->fts;
+
+    if (!index) return;
+    if (index->hThread)
+    {
+        InterlockedExchange(&index->abort, TRUE);
+        WaitForSingleObject(index->hThread, INFINITE);
+        CloseHandle(index->hThread);
+    }
+    if (index->mapped) UnmapViewOfFile(index->data);
+    else HeapFree(GetProcessHeap(), 0, (void*)index->data);
+    HeapFree(GetProcessHeap(), 0, index);
+    hlpfile->fts = NULL;
+}
+
+BOOL FTS_IsReady(HLPFILE* hlpfile)
+{
+    return hlpfile->fts && hlpfile->fts->ready;
+}
+
+static const FTS_ENTRY* FTS_Lookup(const FTS_HEADER* header, const char* word)
+{
+    const FTS_ENTRY*    entries = (const FTS_ENTRY*)((const BYTE*)header + header->terms);
+    DWORD               hash = FTS_Hash(word);
+    DWORD               low = 0, high = header->num_terms, mid;
+
+    /* first entry with this hash */
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (entries[mid].hash < hash) low = mid + 1;
+        else high = mid;
+    }
+    for (; low < header->num_terms && entries[low].hash == hash; low++)
+    {
+        if (!strcmp((const char*)header + entries[low].string, word))
+            return &entries[low];
+    }
+    return NULL;
+}
+
+static int FTS_CompareResults(const void* p1, const void* p2)
+{
+    const FTS_RESULT* r1 = p1;
+    const FTS_RESULT* r2 = p2;
+
+    if (r1->words != r2->words) return r1->words > r2->words ? -1 : 1;
+    if (r1->score != r2->score) return r1->score > r2->score ? -1 : 1;
+    return r1->offset < r2->offset ? -1 : r1->offset > r2->offset;
+}
+
+/***********************************************************************
+ *
+ *           FTS_Query
+ *
+ * Ranks the pages containing words of query: the more query words a page
+ * has the better, then by BM25 score. Returns the number of results
+ * stored, up to max.
+ */
+unsigned FTS_Query(HLPFILE* hlpfile, LPCSTR query, FTS_RESULT* results, unsigned max)
+{
+    const FTS_HEADER*   header;
+    const FTS_DOC*      docs;
+    const FTS_ENTRY*    entry;
+    const BYTE*         ptr;
+    const BYTE*         postings_end;
+    const char*         end = query + strlen(query);
+    char                word[FTS_MAX_TERM + 1];
+    float*              scores;
+    BYTE*               matches;
+    FTS_RESULT*         all;
+    unsigned            count = 0;
+    DWORD               i, doc, delta, tf;
+    float               idf, avg;
+
+    if (!FTS_IsReady(hlpfile) || !max) return 0;
+    header = (const FTS_HEADER*)hlpfile->fts->data;
+    if (!header->num_docs) return 0;
+    docs = (const FTS_DOC*)(header + 1);
+    avg = (float)header->total_words / header->num_docs;
+
+    scores = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                       header->num_docs * (sizeof(float) + sizeof(BYTE)));
+    if (!scores) return 0;
+    matches = (BYTE*)(scores + header->num_docs);
+    postings_end = (const BYTE*)header + header->strings;
+
+    while (FTS_NextWord(&query, end, word))
+    {
+        if (!(entry = FTS_Lookup(header, word))) continue;
+
+        idf = (float)log(1.0 + (header->num_docs - entry->df + 0.5) / (entry->df + 0.5));
+        ptr = (const BYTE*)header + entry->postings;
+        for (i = 0, doc = 0; i < entry->df; i++)
+        {
+            if (!(ptr = FTS_GetVarint(ptr, postings_end, &delta)) ||
+                !(ptr = FTS_GetVarint(ptr, postings_end, &tf)))
+                break;
+            /* deltas are > 0 past the first posting, don't wrap around */
+            if (delta >= header->num_docs - doc) break;
+            doc += delta;
+            /* k1 = 1.2, b = 0.75 */
+            scores[doc] += idf * (tf * 2.2f) / (tf + 1.2f * (0.25f + 0.75f * docs[doc].words / avg));
+            if (matches[doc] < 255) matches[doc]++;
+        }
+    }
+
+    all = HeapAlloc(GetProcessHeap(), 0, header->num_docs * sizeof(FTS_RESULT));
+    if (all)
+    {
+        for (i = 0; i < header->num_docs; i++)
+        {
+            if (!matches[i]) continue;
+            all[count].offset = docs[i].offset;
+            all[count].words = matches[i];
+            all[count].score = scores[i];
+            count++;
+        }
+        qsort(all, count, sizeof(FTS_RESULT), FTS_CompareResults);
+        count = min(count, max);
+        memcpy(results, all, count * sizeof(FTS_RESULT));
+        HeapFree(GetProcessHeap(), 0, all);
+    }
+    HeapFree(GetProcessHeap(), 0, scores);
+    return count;
+}
@@ -0,0 +1,31 @@
+/*
+ * Help Viewer - full text search
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#pragma once
+
+typedef struct
+{
+    ULONG       offset;         /* of the page, for HLPFILE_PageByOffset */
+    unsigned    words;          /* number of query words found in the page */
+    float       score;
+} FTS_RESULT;
+
+void          FTS_Open(HLPFILE* hlpfile);
+void          FTS_Close(HLPFILE* hlpfile);
+BOOL          FTS_IsReady(HLPFILE* hlpfile);
+unsigned      FTS_Query(HLPFILE* hlpfile, LPCSTR query, FTS_RESULT* results, unsigned max);
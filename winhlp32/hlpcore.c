@@ -0,0 +1,1259 @@
+/*
+ * Help Viewer - help file container and decompression
+ *
+ * Copyright    1996 Ulrich Schmid
+ *              2002, 2008 Eric Pouech
+ *              2007 Kirill K. Smirnov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "hlpcore.h"
+
+#ifdef _WIN32
+#include "../debug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(winhelp);
+#else
+/* only errors are worth reporting in the command line tools */
+#define WINE_TRACE(...)         do { } while (0)
+#define WINE_WARN(...)          do { } while (0)
+#define WINE_FIXME(...)         do { } while (0)
+#define WINE_ERR(...)           fprintf(stderr, "hlpcore: " __VA_ARGS__)
+#define debugstr_a(s)           (s)
+
+#ifndef max
+#define max(a, b)               (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b)               (((a) < (b)) ? (a) : (b))
+#endif
+#endif
+
+/***********************************************************************
+ *
+ *           HLPCORE_CheckFile
+ *
+ * Validates the header of a help file of size bytes, and returns in used
+ * the size it claims for itself.
+ */
+BOOL HLPCORE_CheckFile(const BYTE* buf, UINT size, UINT* used)
+{
+    if (size < 16 || GET_UINT(buf, 0) != 0x00035F3F)
+    {WINE_WARN("wrong header\n"); return FALSE;};
+
+    *used = GET_UINT(buf, 12);
+    if (*used < 16 || *used > size)
+    {WINE_WARN("filesize1\n"); return FALSE;};
+    if (*used < size) WINE_WARN("filesize2\n");
+
+    return TRUE;
+}
+
+/**************************************************************************
+ * BPTreePage
+ *
+ * Returns page of the B+ tree in buf, or NULL if it's not in the
+ * embedded file.
+ *
+ */
+static BYTE* BPTreePage(BYTE* buf, unsigned page, BYTE** end)
+{
+    unsigned page_size = GET_USHORT(buf, 9+4);
+
+    /* a page holds at least its header */
+    if (page_size < 8 ||
+        9 + 38 + (page + 1) * (ULONG)page_size > GET_UINT(buf, 0))
+    {
+        WINE_ERR("B+ tree page %u out of the file\n", page);
+        return NULL;
+    }
+    *end = buf + 9 + 38 + (page + 1) * page_size;
+    return *end - page_size;
+}
+
+/**************************************************************************
+ * HLPCORE_BPTreeSearch
+ *
+ * Searches for an element in B+ tree
+ *
+ * PARAMS
+ *     buf        [I] pointer to the embedded file structured as a B+ tree
+ *     key        [I] pointer to data to find
+ *     comp       [I] compare function
+ *
+ * RETURNS
+ *     Pointer to block identified by key, or NULL if failure.
+ *
+ */
+void* HLPCORE_BPTreeSearch(BYTE* buf, const void* key,
+                           HLPFILE_BPTreeCompare comp)
+{
+    unsigned magic;
+    unsigned cur_page;
+    unsigned level;
+    BYTE *ptr, *newptr, *end;
+    int i, entries;
+    int ret;
+
+    /* the header must fit before any of it is read */
+    if (GET_UINT(buf, 0) < 9 + 38)
+    {
+        WINE_ERR("B+ tree header does not fit\n");
+        return NULL;
+    }
+    magic = GET_USHORT(buf, 9);
+    if (magic != 0x293B)
+    {
+        WINE_ERR("Invalid magic in B+ tree: 0x%x\n", magic);
+        return NULL;
+    }
+    cur_page  = GET_USHORT(buf, 9+26);
+    level     = GET_USHORT(buf, 9+32);
+    if (!level) return NULL;
+    while (--level > 0)
+    {
+        if (!(ptr = BPTreePage(buf, cur_page, &end))) return NULL;
+        entries = GET_SHORT(ptr, 2);
+        ptr += 6;
+        for (i = 0; i < entries; i++)
+        {
+            if (comp(ptr, key, 0, (void **)&newptr) > 0) break;
+            if (newptr > end) return NULL;
+            ptr = newptr;
+        }
+        cur_page = GET_USHORT(ptr-2, 0);
+    }
+    if (!(ptr = BPTreePage(buf, cur_page, &end))) return NULL;
+    entries = GET_SHORT(ptr, 2);
+    ptr += 8;
+    for (i = 0; i < entries; i++)
+    {
+        ret = comp(ptr, key, 1, (void **)&newptr);
+        if (ret == 0) return ptr;
+        if (ret > 0 || newptr > end) return NULL;
+        ptr = newptr;
+    }
+    return NULL;
+}
+
+/**************************************************************************
+ * HLPCORE_BPTreeEnum
+ *
+ * Enumerates elements in B+ tree.
+ *
+ * PARAMS
+ *     buf        [I]  pointer to the embedded file structured as a B+ tree
+ *     cb         [I]  compare function
+ *     cookie     [IO] cookie for cb function
+ */
+void HLPCORE_BPTreeEnum(BYTE* buf, HLPFILE_BPTreeCallback cb, void* cookie)
+{
+    unsigned magic;
+    unsigned cur_page;
+    unsigned level;
+    unsigned num_pages;
+    BYTE *page, *ptr, *newptr, *end;
+    int i, entries;
+
+    /* the header must fit before any of it is read */
+    if (GET_UINT(buf, 0) < 9 + 38)
+    {
+        WINE_ERR("B+ tree header does not fit\n");
+        return;
+    }
+    magic = GET_USHORT(buf, 9);
+    if (magic != 0x293B)
+    {
+        WINE_ERR("Invalid magic in B+ tree: 0x%x\n", magic);
+        return;
+    }
+    cur_page  = GET_USHORT(buf, 9+26);
+    level     = GET_USHORT(buf, 9+32);
+    if (!level) return;
+    while (--level > 0)
+    {
+        if (!(ptr = BPTreePage(buf, cur_page, &end))) return;
+        cur_page = GET_USHORT(ptr, 4);
+    }
+    /* leaves are linked, a broken file mustn't loop */
+    for (num_pages = 0; cur_page != 0xFFFF && num_pages < 0xFFFF; num_pages++)
+    {
+        if (!(page = BPTreePage(buf, cur_page, &end))) return;
+        entries = GET_SHORT(page, 2);
+        ptr = page + 8;
+        for (i = 0; i < entries; i++)
+        {
+            cb(ptr, (void **)&newptr, cookie);
+            if (newptr > end) return;
+            ptr = newptr;
+        }
+        cur_page = GET_USHORT(page, 6);
+    }
+}
+
+
+/***********************************************************************
+ *
+ *           HLPCORE_LZ77Size
+ */
+INT HLPCORE_LZ77Size(const BYTE *ptr, const BYTE *end)
+{
+    int  i, newsize = 0;
+
+    while (ptr < end)
+    {
+        int mask = *ptr++;
+        if (!mask && end - ptr >= 8)
+        {
+            newsize += 8;
+            ptr     += 8;
+            continue;
+        }
+        for (i = 0; i < 8 && ptr < end; i++, mask >>= 1)
+	{
+            if (mask & 1)
+	    {
+                int code, len;
+
+                if (end - ptr < 2) return newsize;
+                code = GET_USHORT(ptr, 0);
+                len  = 3 + (code >> 12);
+                newsize += len;
+                ptr     += 2;
+	    }
+            else newsize++, ptr++;
+	}
+    }
+
+    return newsize;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_UncompressLZ77
+ *
+ * Decompresses [ptr, end) to newptr, which holds HLPCORE_LZ77Size bytes.
+ */
+BYTE *HLPCORE_UncompressLZ77(const BYTE *ptr, const BYTE *end, BYTE *newptr)
+{
+    BYTE *start = newptr;
+    int i;
+
+    while (ptr < end)
+    {
+        int mask = *ptr++;
+        if (!mask && end - ptr >= 8)
+        {
+            /* eight literals in a row */
+            memcpy(newptr, ptr, 8);
+            newptr += 8;
+            ptr    += 8;
+            continue;
+        }
+        for (i = 0; i < 8 && ptr < end; i++, mask >>= 1)
+	{
+            if (mask & 1)
+	    {
+                int code, len, offset;
+
+                if (end - ptr < 2) return newptr;
+                code   = GET_USHORT(ptr, 0);
+                len    = 3 + (code >> 12);
+                offset = code & 0xfff;
+                if (offset >= newptr - start)
+                {
+                    /* before the start of the output, broken file */
+                    memset(newptr, 0, len);
+                    newptr += len;
+                    ptr    += 2;
+                    continue;
+                }
+                /*
+                 * When the match overlaps the bytes it produces, we must
+                 * copy byte-by-byte. We cannot use memcpy nor memmove
+                 * there. Just example:
+                 * a[]={1,2,3,4,5,6,7,8,9,10}
+                 * newptr=a+2;
+                 * offset=1;
+                 * We expect:
+                 * {1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 11, 12}
+                 */
+                if (len <= offset + 1)
+                {
+                    memcpy(newptr, newptr - offset - 1, len);
+                    newptr += len;
+                }
+                else for (; len>0; len--, newptr++) *newptr = *(newptr-offset-1);
+                ptr    += 2;
+	    }
+            else *newptr++ = *ptr++;
+	}
+    }
+
+    return newptr;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_CopyPhrase
+ *
+ * Copies phrase to dst if it fits before dst_end. Short phrases go as one
+ * HLPCORE_PHRASE_PAD bytes block when there's room for it, the bytes past
+ * the phrase being overwritten by what follows.
+ */
+static inline BOOL HLPCORE_CopyPhrase(const HLPCORE_PHRASES* phrases, const HLPCORE_PHRASE* phrase,
+                                      char* dst, const char* dst_end)
+{
+    const char* src = phrases->buffer + phrase->offset;
+
+    if (phrase->len <= HLPCORE_PHRASE_PAD && dst_end - dst >= HLPCORE_PHRASE_PAD)
+        memcpy(dst, src, HLPCORE_PHRASE_PAD);
+    else if (dst_end - dst >= (ptrdiff_t)phrase->len)
+        memcpy(dst, src, phrase->len);
+    else
+        return FALSE;
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_HasPhraseCode
+ *
+ * Returns the high bit of the bytes of word that are phrase codes (0x01
+ * to 0x0F), all 8 tested at once.
+ */
+static inline uint64_t HLPCORE_PhraseCodes(uint64_t word)
+{
+    const uint64_t low = 0x7F7F7F7F7F7F7F7FULL, high = 0x8080808080808080ULL;
+    uint64_t below = ~word & ~((word & low) + 0x7070707070707070ULL) & high;
+    uint64_t zero  = ~word & ~((word & low) + low) & high;
+
+    return below & ~zero;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_FirstByte
+ *
+ * Returns the index of the first byte in memory order with its high bit
+ * set in mask (not 0). Words are loaded little endian.
+ */
+static inline unsigned HLPCORE_FirstByte(uint64_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+
+    _BitScanForward64(&bit, mask);
+    return bit / 8;
+#else
+    return __builtin_ctzll(mask) / 8;
+#endif
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_ExpandPhrases
+ */
+void HLPCORE_ExpandPhrases(const HLPCORE_PHRASES* phrases, const BYTE *ptr, const BYTE *end, BYTE *newptr, const BYTE *newend)
+{
+    const HLPCORE_PHRASE* phrase;
+    uint64_t word, codes;
+    unsigned n;
+    UINT code;
+    UINT index;
+
+    while (ptr < end && newptr < newend)
+    {
+        if (!*ptr || *ptr >= 0x10)
+        {
+            if (end - ptr >= 8 && newend - newptr >= 8)
+            {
+                /* copy 8 bytes, keep the ones before the first phrase code */
+                memcpy(&word, ptr, 8);
+                memcpy(newptr, &word, 8);
+                codes = HLPCORE_PhraseCodes(word);
+                n = codes ? HLPCORE_FirstByte(codes) : 8;
+                newptr += n;
+                ptr += n;
+                continue;
+            }
+            *newptr++ = *ptr++;
+            continue;
+        }
+        if (ptr + 1 >= end) break;
+
+        code  = 0x100 * ptr[0] + ptr[1];
+        index = (code - 0x100) / 2;
+        if (index >= phrases->num)
+        {
+            WINE_ERR("index in phrases %u/%u\n", index, phrases->num);
+            index = phrases->num;
+        }
+        phrase = &phrases->table[index];
+
+        if (!HLPCORE_CopyPhrase(phrases, phrase, (char*)newptr, (const char*)newend))
+        {
+            WINE_FIXME("buffer overflow %p > %p for %u bytes\n",
+                       newptr, newend, phrase->len);
+            return;
+        }
+        newptr += phrase->len;
+        if ((code & 1) && newptr < newend) *newptr++ = ' ';
+
+        ptr += 2;
+    }
+}
+
+/******************************************************************
+ *		HLPCORE_ExpandPhrases40
+ *
+ *
+ */
+BOOL HLPCORE_ExpandPhrases40(const HLPCORE_PHRASES* phrases, char* dst, const char* dst_end,
+                             const BYTE* src, const BYTE* src_end)
+{
+    unsigned int idx, len;
+
+    for (; src < src_end; src++)
+    {
+        if ((*src & 0x03) != 0x03)
+        {
+            if ((*src & 1) == 0)
+                idx = *src / 2;
+            else
+            {
+                if (src + 1 >= src_end) break;
+                idx = (*src + 1) * 64;
+                idx += *++src;
+            }
+            if (idx >= phrases->num)
+            {
+                WINE_ERR("index in phrases %d/%d\n", idx, phrases->num);
+                idx = phrases->num;
+            }
+            len = phrases->table[idx].len;
+            HLPCORE_CopyPhrase(phrases, &phrases->table[idx], dst, dst_end);
+        }
+        else if ((*src & 0x07) == 0x03)
+        {
+            len = (*src / 8) + 1;
+            if (len > (unsigned)(src_end - src - 1)) len = src_end - src - 1;
+            if (dst_end - dst >= (ptrdiff_t)len)
+                memcpy(dst, src + 1, len);
+            src += len;
+        }
+        else
+        {
+            len = (*src / 16) + 1;
+            if (dst_end - dst >= (ptrdiff_t)len)
+                memset(dst, ((*src & 0x0F) == 0x07) ? ' ' : 0, len);
+        }
+        dst += len;
+    }
+
+    if (dst > dst_end) WINE_ERR("buffer overflow (%p > %p)\n", dst, dst_end);
+    return TRUE;
+}
+
+/******************************************************************
+ *		HLPCORE_UncompressRLE
+ *
+ *
+ */
+void HLPCORE_UncompressRLE(const BYTE* src, const BYTE* end, BYTE* dst, unsigned dstsz)
+{
+    BYTE        ch;
+    BYTE*       sdst = dst + dstsz;
+
+    while (src < end)
+    {
+        ch = *src++;
+        if (ch & 0x80)
+        {
+            ch &= 0x7F;
+            if (dst + ch <= sdst)
+                memcpy(dst, src, ch);
+            src += ch;
+        }
+        else
+        {
+            if (dst + ch <= sdst)
+                memset(dst, (char)*src, ch);
+            src++;
+        }
+        dst += ch;
+    }
+    if (dst != sdst)
+        WINE_WARN("Buffer X-flow: d(%lu) instead of d(%u)\n",
+                  (SIZE_T)(dst - (sdst - dstsz)), dstsz);
+}
+
+
+/**************************************************************************
+ * comp_FindSubFile
+ *
+ * HLPFILE_BPTreeCompare function for HLPFILE directory.
+ *
+ */
+static int comp_FindSubFile(void *p, const void *key,
+                            int leaf, void** next)
+{
+    *next = (char *)p+strlen(p)+(leaf?5:3);
+    WINE_TRACE("Comparing %s with %s\n", debugstr_a((char *)p), debugstr_a((const char *)key));
+    return strcmp(p, key);
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_FindSubFile
+ */
+BOOL HLPCORE_FindSubFile(BYTE* file, UINT size, LPCSTR name, BYTE **subbuf, BYTE **subend)
+{
+    BYTE *ptr;
+    UINT offset;
+
+    WINE_TRACE("looking for file %s\n", debugstr_a(name));
+    if (GET_UINT(file, 4) >= size - 9 ||
+        GET_UINT(file + GET_UINT(file, 4), 0) > size - GET_UINT(file, 4))
+    {
+        WINE_ERR("directory does not fit\n");
+        return FALSE;
+    }
+    ptr = HLPCORE_BPTreeSearch(file + GET_UINT(file, 4),
+                               name, comp_FindSubFile);
+    if (!ptr)
+    {   /* Subfiles with bitmap images are usually prefixed with '|', but sometimes not.
+           Unfortunately, there is no consensus among different pieces of unofficial
+           documentation. So remove leading '|' and try again. */
+        CHAR c = *name++;
+        if (c == '|')
+        {
+            WINE_TRACE("not found. try %s\n", debugstr_a(name));
+            ptr = HLPCORE_BPTreeSearch(file + GET_UINT(file, 4),
+                                       name, comp_FindSubFile);
+        }
+    }
+    if (!ptr) return FALSE;
+    offset = GET_UINT(ptr, strlen(name)+1);
+    /* the 9 byte header of the internal file, then its contents */
+    if (offset > size - 9 || GET_UINT(file + offset, 0) > size - offset)
+    {
+        WINE_ERR("internal file %s does not fit\n", debugstr_a(name));
+        return FALSE;
+    }
+    *subbuf = file + offset;
+    *subend = *subbuf + GET_UINT(*subbuf, 0);
+    if (GET_UINT(*subbuf, 0) < GET_UINT(*subbuf, 4) + 9)
+    {
+        WINE_ERR("invalid size provided for internal file %s\n", debugstr_a(name));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_ReadSystem
+ *
+ * Decodes the header of the |SYSTEM internal file.
+ */
+BOOL HLPCORE_ReadSystem(const BYTE* buf, const BYTE* end, HLPCORE_SYSTEM* sys)
+{
+    unsigned short magic, minor, major, flags;
+
+    if (end - buf < 9 + 12) {WINE_WARN("system header too small\n"); return FALSE;}
+
+    magic = GET_USHORT(buf + 9, 0);
+    minor = GET_USHORT(buf + 9, 2);
+    major = GET_USHORT(buf + 9, 4);
+    /* gen date on 4 bytes */
+    flags = GET_USHORT(buf + 9, 10);
+    WINE_TRACE("Got system header: magic=%04x version=%d.%d flags=%04x\n",
+               magic, major, minor, flags);
+    if (magic != 0x036C || major != 1)
+    {WINE_WARN("Wrong system header\n"); return FALSE;}
+    if (minor <= 16)
+    {
+        sys->tbsize = 0x800;
+        sys->compressed = FALSE;
+    }
+    else if (flags == 0)
+    {
+        sys->tbsize = 0x1000;
+        sys->compressed = FALSE;
+    }
+    else if (flags == 4)
+    {
+        sys->tbsize = 0x1000;
+        sys->compressed = TRUE;
+    }
+    else
+    {
+        sys->tbsize = 0x800;
+        sys->compressed = TRUE;
+    }
+
+    if (sys->compressed)
+        sys->dsize = 0x4000;
+    else
+        sys->dsize = sys->tbsize - 0x0C;
+
+    sys->version = minor;
+    sys->flags = flags;
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_Hash
+ */
+LONG HLPCORE_Hash(LPCSTR lpszContext)
+{
+    LONG lHash = 0;
+    CHAR c;
+
+    while ((c = *lpszContext++))
+    {
+        CHAR x = 0;
+        if (c >= 'A' && c <= 'Z') x = c - 'A' + 17;
+        if (c >= 'a' && c <= 'z') x = c - 'a' + 17;
+        if (c >= '1' && c <= '9') x = c - '0';
+        if (c == '0') x = 10;
+        if (c == '.') x = 12;
+        if (c == '_') x = 13;
+        if (x) lHash = lHash * 43 + x;
+    }
+    return lHash;
+}
+
+/******************************************************************
+ *		HLPCORE_DecompressGfx
+ *
+ * Decompress the data part of a bitmap or a metafile
+ */
+const BYTE*      HLPCORE_DecompressGfx(const BYTE* src, unsigned csz, unsigned sz, BYTE packing,
+                                       BYTE** alloc)
+{
+    const BYTE* dst;
+    BYTE*       tmp;
+    unsigned    sz77;
+
+    WINE_TRACE("Unpacking (%d) from %u bytes to %u bytes\n", packing, csz, sz);
+
+    switch (packing)
+    {
+    case 0: /* uncompressed */
+        if (sz != csz)
+            WINE_WARN("Bogus gfx sizes (uncompressed): %u / %u\n", sz, csz);
+        dst = src;
+        *alloc = NULL;
+        break;
+    case 1: /* RunLen */
+        dst = *alloc = HLPCORE_Alloc(sz);
+        if (!dst) return NULL;
+        HLPCORE_UncompressRLE(src, src + csz, *alloc, sz);
+        break;
+    case 2: /* LZ77 */
+        sz77 = HLPCORE_LZ77Size(src, src + csz);
+        dst = *alloc = HLPCORE_Alloc(sz77);
+        if (!dst) return NULL;
+        HLPCORE_UncompressLZ77(src, src + csz, *alloc);
+        if (sz77 != sz)
+            WINE_WARN("Bogus gfx sizes (LZ77): %u / %u\n", sz77, sz);
+        break;
+    case 3: /* LZ77 then RLE */
+        sz77 = HLPCORE_LZ77Size(src, src + csz);
+        tmp = HLPCORE_Alloc(sz77);
+        if (!tmp) return FALSE;
+        HLPCORE_UncompressLZ77(src, src + csz, tmp);
+        dst = *alloc = HLPCORE_Alloc(sz);
+        if (!dst)
+        {
+            HLPCORE_Free(tmp);
+            return FALSE;
+        }
+        HLPCORE_UncompressRLE(tmp, tmp + sz77, *alloc, sz);
+        HLPCORE_Free(tmp);
+        break;
+    default:
+        WINE_FIXME("Unsupported packing %u\n", packing);
+        return NULL;
+    }
+    return dst;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_AllocPhrases
+ *
+ * Allocates the table of num phrases and their buffer of size bytes.
+ */
+static BOOL HLPCORE_AllocPhrases(HLPCORE_PHRASES* phrases, UINT num, unsigned size)
+{
+    phrases->num     = num;
+    phrases->table   = HLPCORE_Alloc(sizeof(HLPCORE_PHRASE) * (num + 1));
+    phrases->buffer  = HLPCORE_Alloc(size + HLPCORE_PHRASE_PAD);
+    if (!phrases->table || !phrases->buffer)
+    {
+        HLPCORE_FreePhrases(phrases);
+        return FALSE;
+    }
+    /* bad indexes get this one */
+    phrases->table[num].offset = 0;
+    phrases->table[num].len = 0;
+    memset(phrases->buffer + size, 0, HLPCORE_PHRASE_PAD);
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_SetPhrase
+ *
+ * Sets phrase i to the bytes from start to stop in a buffer of size bytes.
+ */
+static void HLPCORE_SetPhrase(HLPCORE_PHRASES* phrases, UINT i, unsigned start, unsigned stop, unsigned size)
+{
+    if (start > stop || stop > size)
+    {
+        WINE_WARN("phrase %u out of buffer (%u-%u/%u)\n", i, start, stop, size);
+        start = stop = 0;
+    }
+    phrases->table[i].offset = start;
+    phrases->table[i].len = stop - start;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_LoadPhrases
+ */
+BOOL HLPCORE_LoadPhrases(BYTE* file, UINT size, unsigned version, HLPCORE_PHRASES* phrases)
+{
+    UINT i, num, dec_size, head_size;
+    BYTE *buf, *end;
+
+    if (!HLPCORE_FindSubFile(file, size, "|Phrases", &buf, &end)) return FALSE;
+
+    if (version <= 16)
+        head_size = 13;
+    else
+        head_size = 17;
+
+    if (end - buf < 0x13) {WINE_WARN("1a\n"); return FALSE;};
+    num = GET_USHORT(buf, 9);
+    if (buf + 2 * num + 0x13 >= end) {WINE_WARN("1a\n"); return FALSE;};
+
+    if (version <= 16)
+        dec_size = end - buf - 15 - 2 * num;
+    else
+        dec_size = HLPCORE_LZ77Size(buf + 0x13 + 2 * num, end);
+
+    if (!HLPCORE_AllocPhrases(phrases, num, dec_size)) return FALSE;
+
+    for (i = 0; i < num; i++)
+        HLPCORE_SetPhrase(phrases, i, GET_USHORT(buf, head_size + 2 * i) - 2 * num - 2,
+                          GET_USHORT(buf, head_size + 2 * i + 2) - 2 * num - 2, dec_size);
+
+    if (version <= 16)
+        memcpy(phrases->buffer, buf + 15 + 2*num, dec_size);
+    else
+        HLPCORE_UncompressLZ77(buf + 0x13 + 2 * num, end, (BYTE*)phrases->buffer);
+
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_LoadPhrases40
+ */
+BOOL HLPCORE_LoadPhrases40(BYTE* file, UINT size, HLPCORE_PHRASES* phrases)
+{
+    UINT num;
+    INT dec_size, cpr_size;
+    BYTE *buf_idx, *end_idx;
+    BYTE *buf_phs, *end_phs;
+    ULONG* ptr, mask = 0;
+    unsigned int i, offset;
+    unsigned short bc, n;
+    BOOL broken = FALSE;
+
+    if (!HLPCORE_FindSubFile(file, size, "|PhrIndex", &buf_idx, &end_idx) ||
+        !HLPCORE_FindSubFile(file, size, "|PhrImage", &buf_phs, &end_phs)) return FALSE;
+    if (end_idx - buf_idx < 9 + 28) {WINE_WARN("phrase index too small\n"); return FALSE;}
+
+    ptr = (ULONG*)(buf_idx + 9 + 28);
+    bc = GET_USHORT(buf_idx, 9 + 24) & 0x0F;
+    num = GET_USHORT(buf_idx, 9 + 4);
+
+    WINE_TRACE("Index: Magic=%08x #entries=%u CpsdSize=%u PhrImgSize=%u\n"
+               "\tPhrImgCprsdSize=%u 0=%u bc=%x ukn=%x\n",
+               GET_UINT(buf_idx, 9 + 0),
+               GET_UINT(buf_idx, 9 + 4),
+               GET_UINT(buf_idx, 9 + 8),
+               GET_UINT(buf_idx, 9 + 12),
+               GET_UINT(buf_idx, 9 + 16),
+               GET_UINT(buf_idx, 9 + 20),
+               GET_USHORT(buf_idx, 9 + 24),
+               GET_USHORT(buf_idx, 9 + 26));
+
+    dec_size = GET_UINT(buf_idx, 9 + 12);
+    cpr_size = GET_UINT(buf_idx, 9 + 16);
+    if (dec_size < 0 || cpr_size < 0) {WINE_WARN("bad phrase sizes\n"); return FALSE;}
+
+    if (dec_size != cpr_size &&
+        dec_size != HLPCORE_LZ77Size(buf_phs + 9, end_phs))
+    {
+        WINE_WARN("size mismatch %u %u\n",
+                  dec_size, HLPCORE_LZ77Size(buf_phs + 9, end_phs));
+        dec_size = max(dec_size, HLPCORE_LZ77Size(buf_phs + 9, end_phs));
+    }
+
+    if (!HLPCORE_AllocPhrases(phrases, num, dec_size)) return FALSE;
+
+    /* the bits mustn't run past |PhrIndex */
+#define getbit() ((mask <<= 1) ? (*ptr & mask) != 0: \
+                  (BYTE*)(ptr + 2) > end_idx ? (broken = TRUE, 0) : (*++ptr & (mask=1)) != 0)
+
+    offset = 0;
+    ptr--; /* as we'll first increment ptr because mask is 0 on first getbit() call */
+    for (i = 0; i < num && !broken; i++)
+    {
+        for (n = 1; getbit(); n += 1 << bc);
+        if (getbit()) n++;
+        if (bc > 1 && getbit()) n += 2;
+        if (bc > 2 && getbit()) n += 4;
+        if (bc > 3 && getbit()) n += 8;
+        if (bc > 4 && getbit()) n += 16;
+        HLPCORE_SetPhrase(phrases, i, offset, offset + n, dec_size);
+        offset += n;
+    }
+#undef getbit
+    if (broken || (dec_size == cpr_size && dec_size > end_phs - (buf_phs + 9)))
+    {
+        WINE_WARN("phrases don't fit\n");
+        HLPCORE_FreePhrases(phrases);
+        return FALSE;
+    }
+
+    if (dec_size == cpr_size)
+        memcpy(phrases->buffer, buf_phs + 9, dec_size);
+    else
+        HLPCORE_UncompressLZ77(buf_phs + 9, end_phs, (BYTE*)phrases->buffer);
+
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_FreePhrases
+ */
+void HLPCORE_FreePhrases(HLPCORE_PHRASES* phrases)
+{
+    HLPCORE_Free(phrases->table);
+    HLPCORE_Free(phrases->buffer);
+    phrases->table = NULL;
+    phrases->buffer = NULL;
+    phrases->num = 0;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_OpenTopic
+ *
+ * Only sets up the block table of |TOPIC: blocks are decompressed when
+ * first touched, see HLPCORE_TopicBlock. The caller then sets phrases,
+ * and cache_size and decode if it doesn't want the defaults.
+ */
+BOOL HLPCORE_OpenTopic(BYTE* file, UINT size, const HLPCORE_SYSTEM* sys, HLPCORE_TOPIC* topic)
+{
+    BYTE        *buf, *end;
+
+    memset(topic, 0, sizeof(*topic));
+    if (!HLPCORE_FindSubFile(file, size, "|TOPIC", &buf, &end))
+    {WINE_WARN("topic0\n"); return FALSE;}
+
+    buf += 9; /* Skip file header */
+    if (end <= buf || !sys->tbsize || !sys->dsize) {WINE_WARN("topic1\n"); return FALSE;}
+
+    topic->sys = *sys;
+    topic->buf = buf;
+    topic->bufend = end;
+    topic->maplen = (UINT)(end - buf - 1) / sys->tbsize + 1;
+    topic->cache_size = (SIZE_T)-1;
+    topic->blocks = HLPCORE_Alloc(topic->maplen * sizeof(topic->blocks[0]));
+    if (!topic->blocks) return FALSE;
+    memset(topic->blocks, 0, topic->maplen * sizeof(topic->blocks[0]));
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_FlushTopicBlocks
+ *
+ * Drops all the decompressed blocks.
+ */
+void HLPCORE_FlushTopicBlocks(HLPCORE_TOPIC* topic)
+{
+    unsigned    i;
+
+    if (!topic->blocks) return;
+    for (i = 0; i < topic->maplen; i++)
+    {
+        HLPCORE_Free(topic->blocks[i].data);
+        memset(&topic->blocks[i], 0, sizeof(topic->blocks[i]));
+    }
+    topic->lru_head = topic->lru_tail = NULL;
+    topic->cached = 0;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_CloseTopic
+ */
+void HLPCORE_CloseTopic(HLPCORE_TOPIC* topic)
+{
+    HLPCORE_FlushTopicBlocks(topic);
+    HLPCORE_Free(topic->blocks);
+    HLPCORE_Free(topic->scratch);
+    topic->blocks = NULL;
+    topic->scratch = NULL;
+    topic->scratch_size = 0;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_DecodeTopicBlock
+ *
+ * Sizes and decompresses topic block index into its slot. Only touches
+ * that slot, so different blocks can be decoded from different threads;
+ * the block then has to go through HLPCORE_CacheTopicBlock before being
+ * used. Uncompressed blocks are used in place, there's nothing to do.
+ */
+BOOL HLPCORE_DecodeTopicBlock(HLPCORE_TOPIC* topic, unsigned index)
+{
+    HLPCORE_TOPIC_BLOCK*        block = &topic->blocks[index];
+    BYTE                        *ptr, *end;
+
+    if (!topic->sys.compressed) return TRUE;
+
+    ptr = topic->buf + index * topic->sys.tbsize;
+    end = topic->bufend;
+
+    /* I don't know why, it's necessary for printman.hlp */
+    if (end - ptr < 0x44) ptr = end - min(0x44, end - topic->buf);
+    if (end - ptr > topic->sys.tbsize) end = ptr + topic->sys.tbsize;
+
+    block->size = ptr + 0xc < end ? HLPCORE_LZ77Size(ptr + 0xc, end) : 0;
+    block->data = HLPCORE_Alloc(max(block->size, 1));
+    if (!block->data) return FALSE;
+    if (ptr + 0xc < end) HLPCORE_UncompressLZ77(ptr + 0xc, end, block->data);
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_CacheTopicBlock
+ *
+ * Puts a freshly decoded block at the head of the LRU list, dropping the
+ * least recently used blocks above cache_size bytes.
+ */
+void HLPCORE_CacheTopicBlock(HLPCORE_TOPIC* topic, HLPCORE_TOPIC_BLOCK* block)
+{
+    HLPCORE_TOPIC_BLOCK*        old;
+
+    topic->cached += block->size;
+
+    /* Make room, the new block isn't in the list yet so it stays */
+    while (topic->cached > topic->cache_size && topic->lru_tail)
+    {
+        old = topic->lru_tail;
+        topic->lru_tail = old->lru_prev;
+        if (old->lru_prev) old->lru_prev->lru_next = NULL;
+        else topic->lru_head = NULL;
+
+        topic->cached -= old->size;
+        HLPCORE_Free(old->data);
+        old->data = NULL;
+        old->lru_prev = old->lru_next = NULL;
+    }
+
+    block->lru_prev = NULL;
+    block->lru_next = topic->lru_head;
+    if (topic->lru_head) topic->lru_head->lru_prev = block;
+    else topic->lru_tail = block;
+    topic->lru_head = block;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_TopicBlock
+ *
+ * Returns the (decompressed) data of topic block index, without its
+ * 0x0C bytes header. Compressed blocks are kept in a LRU list.
+ */
+BYTE* HLPCORE_TopicBlock(HLPCORE_TOPIC* topic, unsigned index, UINT* size)
+{
+    HLPCORE_TOPIC_BLOCK*        block;
+    BYTE                        *ptr, *end;
+
+    if (index >= topic->maplen) return NULL;
+    if (!topic->sys.compressed)
+    {
+        /* Blocks are used in place */
+        ptr = topic->buf + index * topic->sys.tbsize + 0x0C;
+        end = topic->bufend;
+        *size = ptr < end ? min(topic->sys.dsize, (unsigned)(end - ptr)) : 0;
+        return ptr;
+    }
+
+    block = &topic->blocks[index];
+    if (!block->data)
+    {
+        if (topic->decode)
+            topic->decode(topic, index);
+        else
+            HLPCORE_DecodeTopicBlock(topic, index);
+        if (!block->data) return NULL;
+        HLPCORE_CacheTopicBlock(topic, block);
+    }
+    else if (block != topic->lru_head)
+    {
+        /* unlink, it goes back at the head */
+        block->lru_prev->lru_next = block->lru_next;
+        if (block->lru_next) block->lru_next->lru_prev = block->lru_prev;
+        else topic->lru_tail = block->lru_prev;
+
+        block->lru_prev = NULL;
+        block->lru_next = topic->lru_head;
+        topic->lru_head->lru_prev = block;
+        topic->lru_head = block;
+    }
+
+    *size = block->size;
+    return block->data;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_TopicGather
+ *
+ * Copies up to len bytes of the topic data starting at offset in block
+ * index, continuing in the next blocks, to the scratch buffer.
+ */
+static unsigned HLPCORE_TopicGather(HLPCORE_TOPIC* topic, unsigned index, unsigned offset, unsigned len)
+{
+    BYTE*       data;
+    unsigned    size, done = 0, chunk;
+
+    if (len > topic->scratch_size)
+    {
+        /* nothing in there is kept */
+        HLPCORE_Free(topic->scratch);
+        topic->scratch_size = 0;
+        if (!(topic->scratch = HLPCORE_Alloc(len))) return 0;
+        topic->scratch_size = len;
+    }
+
+    for (; done < len && index < topic->maplen; index++, offset = 0)
+    {
+        data = HLPCORE_TopicBlock(topic, index, &size);
+        if (!data) break;
+        if (offset >= size)
+        {
+            offset -= size;
+            continue;
+        }
+        chunk = min(size - offset, len - done);
+        memcpy(topic->scratch + done, data + offset, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_TopicRecord
+ *
+ * Returns the topic record at offset in block index, and its end. A record
+ * running over the end of its block is gathered into the scratch buffer.
+ * The record stays valid until the next call.
+ */
+BYTE* HLPCORE_TopicRecord(HLPCORE_TOPIC* topic, unsigned index, unsigned offset, BYTE** end)
+{
+    BYTE*       buf;
+    unsigned    size, reclen, avail;
+
+    buf = HLPCORE_TopicBlock(topic, index, &size);
+    if (!buf) return NULL;
+
+    if (offset < size && size - offset > 0x15)
+    {
+        reclen = GET_UINT(buf, offset);
+        if (reclen <= size - offset)
+        {
+            *end = buf + offset + reclen;
+            return buf + offset;
+        }
+    }
+
+    /* Slow path, the record (or its header) spans blocks */
+    avail = HLPCORE_TopicGather(topic, index, offset, 0x16);
+    if (avail < 0x16) return NULL;
+    reclen = GET_UINT(topic->scratch, 0);
+    /* no bigger than the blocks left, broken files would have us allocate GBs */
+    if (reclen > (SIZE_T)(topic->maplen - index) * topic->sys.dsize)
+        reclen = (topic->maplen - index) * topic->sys.dsize;
+    if (reclen > avail)
+        avail = HLPCORE_TopicGather(topic, index, offset, reclen);
+    if (avail < 0x16) return NULL;
+
+    *end = topic->scratch + min(reclen, avail);
+    return topic->scratch;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_StartWalk
+ *
+ * Starts a walk through the topic records at ref, 0x0C for the first one.
+ */
+void HLPCORE_StartWalk(HLPCORE_TOPICWALK* walk, ULONG ref)
+{
+    walk->ref = ref;
+    walk->rec = ref;
+    walk->index = -1;
+    walk->offs = 0;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_NextRecord
+ *
+ * Returns the next topic record of a walk (see HLPCORE_TopicRecord), NULL
+ * once it's over.
+ */
+BYTE* HLPCORE_NextRecord(HLPCORE_TOPIC* topic, HLPCORE_TOPICWALK* walk, BYTE** end)
+{
+    unsigned    index, offset;
+    BYTE*       buf;
+
+    if (walk->ref == 0xffffffff) return NULL;
+    if (topic->sys.version <= 16)
+    {
+        index  = (walk->ref - 0x0C) / topic->sys.dsize;
+        offset = (walk->ref - 0x0C) % topic->sys.dsize;
+    }
+    else
+    {
+        index  = (walk->ref - 0x0C) >> 14;
+        offset = (walk->ref - 0x0C) & 0x3FFF;
+    }
+
+    if (topic->sys.version <= 16 && index != walk->index && walk->index != (unsigned)-1)
+    {
+        /* we jumped to the next block, adjust pointers */
+        walk->ref -= 12;
+        offset -= 12;
+    }
+
+    WINE_TRACE("ref=%08x => [%u/%u]\n", walk->ref, index, offset);
+
+    if (index >= topic->maplen) {WINE_WARN("maplen\n"); buf = NULL;}
+    else if (!(buf = HLPCORE_TopicRecord(topic, index, offset, end))) WINE_WARN("extra\n");
+    if (!buf)
+    {
+        walk->ref = 0xffffffff;
+        return NULL;
+    }
+    if (index != walk->index) {walk->offs = 0; walk->index = index;}
+
+    walk->rec = walk->ref;
+    if (topic->sys.version <= 16)
+        walk->ref = GET_UINT(buf, 0xc) ? walk->ref + GET_UINT(buf, 0xc) : 0xffffffff;
+    else
+        walk->ref = GET_UINT(buf, 0xc);
+    /* records are chained in file order, a broken file mustn't loop */
+    if (walk->ref <= walk->rec)
+    {
+        WINE_WARN("topic records loop at %08x\n", walk->rec);
+        walk->ref = 0xffffffff;
+    }
+    return buf;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_RecordTextSize
+ *
+ * Returns the size of the text of a topic record (page title and macros,
+ * or paragraph text), -1 if the record is malformed.
+ */
+LONG HLPCORE_RecordTextSize(const BYTE* buf, const BYTE* end)
+{
+    LONG        size, datalen;
+
+    if (end - buf < 0x15) return -1;
+    size = GET_UINT(buf, 0x4);
+    datalen = GET_UINT(buf, 0x10);
+    /* room is made for a NUL after the text */
+    if (size < 0 || size == 0x7fffffff || datalen < 0 || datalen > end - buf) return -1;
+    return size;
+}
+
+/***********************************************************************
+ *
+ *           HLPCORE_RecordText
+ *
+ * Copies the text of a topic record, phrases expanded, NUL terminated to
+ * text, which holds HLPCORE_RecordTextSize + 1 bytes. Returns the size of
+ * the text.
+ */
+LONG HLPCORE_RecordText(const HLPCORE_TOPIC* topic, const BYTE* buf, const BYTE* end, char* text)
+{
+    LONG        size, blocksize, datalen;
+
+    blocksize = GET_UINT(buf, 0);
+    size = GET_UINT(buf, 0x4);
+    datalen = GET_UINT(buf, 0x10);
+    if (size > blocksize - datalen && topic->phrases)
+    {
+        /* need to decompress */
+        if (topic->phrases40)
+            HLPCORE_ExpandPhrases40(topic->phrases, text, text + size, buf + datalen, end);
+        else
+            HLPCORE_ExpandPhrases(topic->phrases, buf + datalen, end, (BYTE*)text, (BYTE*)text + size);
+    }
+    else
+    {
+        if (size > blocksize - datalen)
+        {
+            WINE_FIXME("Text size is too long, splitting\n");
+            size = blocksize - datalen;
+        }
+        size = max(min(size, (LONG)(end - buf) - datalen), 0);
+        memcpy(text, buf + datalen, size);
+    }
+    text[size] = '\0';
+    return size;
+}
@@ -0,0 +1,196 @@
+/*
+ * Help Viewer - help file container and decompression
+ *
+ * Copyright    1996 Ulrich Schmid
+ *              2002, 2008 Eric Pouech
+ *              2007 Kirill K. Smirnov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#pragma once
+
+/*
+ * This part of the reader only works on a help file held in memory: it
+ * needs no window, GDI or file API, and builds outside of Windows (see
+ * tools/hlpdump.c). Memory goes through HLPCORE_Alloc/HLPCORE_Free.
+ */
+
+#ifdef _WIN32
+#include "windef.h"
+#include "winbase.h"
+
+#define HLPCORE_Alloc(size)     HeapAlloc(GetProcessHeap(), 0, (size))
+#define HLPCORE_Free(ptr)       HeapFree(GetProcessHeap(), 0, (ptr))
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef unsigned char   BYTE;
+typedef char            CHAR;
+typedef int             BOOL;
+typedef int             INT;
+typedef unsigned int    UINT;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef size_t          SIZE_T;
+typedef const char*     LPCSTR;
+
+#ifndef TRUE
+#define TRUE    1
+#define FALSE   0
+#endif
+
+#define HLPCORE_Alloc(size)     malloc(size)
+#define HLPCORE_Free(ptr)       free(ptr)
+#endif
+
+static inline unsigned short GET_USHORT(const BYTE* buffer, unsigned i)
+{
+    return (BYTE)buffer[i] + 0x100 * (BYTE)buffer[i + 1];
+}
+
+static inline short GET_SHORT(const BYTE* buffer, unsigned i)
+{
+    return (BYTE)buffer[i] + 0x100 * (signed char)buffer[i+1];
+}
+
+static inline unsigned GET_UINT(const BYTE* buffer, unsigned i)
+{
+    return GET_USHORT(buffer, i) + 0x10000u * GET_USHORT(buffer, i + 2);
+}
+
+/*
+ * Compare function type for HLPCORE_BPTreeSearch function.
+ *
+ * PARAMS
+ *     p       [I] pointer to testing block (key + data)
+ *     key     [I] pointer to key value to look for
+ *     leaf    [I] whether this function called for index of leaf page
+ *     next    [O] pointer to pointer to next block
+ */
+typedef int (*HLPFILE_BPTreeCompare)(void *p, const void *key,
+                                     int leaf, void **next);
+
+/*
+ * Callback function type for HLPCORE_BPTreeEnum function.
+ *
+ * PARAMS
+ *     p       [I]  pointer to data block
+ *     next    [O]  pointer to pointer to next block
+ *     cookie  [IO] cookie data
+ */
+typedef void (*HLPFILE_BPTreeCallback)(void *p, void **next, void *cookie);
+
+/* what the |SYSTEM header says about the topic blocks */
+typedef struct
+{
+    unsigned short              version;        /* minor version */
+    unsigned short              flags;
+    unsigned short              tbsize;         /* topic block size */
+    unsigned short              dsize;          /* decompress size */
+    BOOL                        compressed;
+} HLPCORE_SYSTEM;
+
+/* a phrase, in HLPCORE_PHRASES.buffer */
+typedef struct
+{
+    unsigned                    offset;
+    unsigned                    len;
+} HLPCORE_PHRASE;
+
+/* phrases up to this size are copied as one block of that size, so the
+ * buffer has that many spare bytes at its end */
+#define HLPCORE_PHRASE_PAD      16
+
+/* phrases used by the compressed texts */
+typedef struct
+{
+    UINT                        num;
+    HLPCORE_PHRASE*             table;          /* num + 1 phrases, the last one empty */
+    char*                       buffer;         /* padded by HLPCORE_PHRASE_PAD */
+} HLPCORE_PHRASES;
+
+/* a |TOPIC block, decompressed on demand */
+typedef struct tagHlpCoreTopicBlock
+{
+    BYTE*                       data;           /* NULL if not decompressed */
+    UINT                        size;
+    struct tagHlpCoreTopicBlock* lru_prev;
+    struct tagHlpCoreTopicBlock* lru_next;
+} HLPCORE_TOPIC_BLOCK;
+
+/* the |TOPIC internal file, where the pages and their paragraphs are */
+typedef struct tagHlpCoreTopic
+{
+    HLPCORE_SYSTEM              sys;
+    const HLPCORE_PHRASES*      phrases;        /* NULL if the texts aren't compressed */
+    BOOL                        phrases40;      /* phrases are |PhrIndex/|PhrImage ones */
+    BYTE*                       buf;            /* blocks, in the file */
+    BYTE*                       bufend;
+    UINT                        maplen;         /* number of blocks */
+    HLPCORE_TOPIC_BLOCK*        blocks;
+    HLPCORE_TOPIC_BLOCK*        lru_head;
+    HLPCORE_TOPIC_BLOCK*        lru_tail;
+    SIZE_T                      cached;         /* bytes of decompressed blocks */
+    SIZE_T                      cache_size;     /* above it, least recently used blocks are dropped */
+    BYTE*                       scratch;        /* records spanning blocks */
+    UINT                        scratch_size;
+    /* decodes the missing block index, and maybe more ahead (see
+     * HLPCORE_TopicBlock); HLPCORE_DecodeTopicBlock is used when NULL */
+    void                        (*decode)(struct tagHlpCoreTopic* topic, unsigned index);
+} HLPCORE_TOPIC;
+
+/* where a walk through the topic records is */
+typedef struct
+{
+    ULONG                       ref;            /* of the next record, 0xffffffff at the end */
+    ULONG                       rec;            /* of the record last returned */
+    unsigned                    index;          /* its block */
+    unsigned                    offs;           /* paragraph offset in the block, kept by the caller */
+} HLPCORE_TOPICWALK;
+
+BOOL          HLPCORE_CheckFile(const BYTE* buf, UINT size, UINT* used);
+BOOL          HLPCORE_FindSubFile(BYTE* file, UINT size, LPCSTR name, BYTE** subbuf, BYTE** subend);
+void*         HLPCORE_BPTreeSearch(BYTE* buf, const void* key, HLPFILE_BPTreeCompare comp);
+void          HLPCORE_BPTreeEnum(BYTE* buf, HLPFILE_BPTreeCallback cb, void* cookie);
+BOOL          HLPCORE_ReadSystem(const BYTE* buf, const BYTE* end, HLPCORE_SYSTEM* sys);
+LONG          HLPCORE_Hash(LPCSTR lpszContext);
+
+INT           HLPCORE_LZ77Size(const BYTE* ptr, const BYTE* end);
+BYTE*         HLPCORE_UncompressLZ77(const BYTE* ptr, const BYTE* end, BYTE* newptr);
+void          HLPCORE_UncompressRLE(const BYTE* src, const BYTE* end, BYTE* dst, unsigned dstsz);
+const BYTE*   HLPCORE_DecompressGfx(const BYTE* src, unsigned csz, unsigned sz, BYTE packing, BYTE** alloc);
+
+BOOL          HLPCORE_LoadPhrases(BYTE* file, UINT size, unsigned version, HLPCORE_PHRASES* phrases);
+BOOL          HLPCORE_LoadPhrases40(BYTE* file, UINT size, HLPCORE_PHRASES* phrases);
+void          HLPCORE_FreePhrases(HLPCORE_PHRASES* phrases);
+void          HLPCORE_ExpandPhrases(const HLPCORE_PHRASES* phrases, const BYTE* ptr, const BYTE* end,
+                                    BYTE* newptr, const BYTE* newend);
+BOOL          HLPCORE_ExpandPhrases40(const HLPCORE_PHRASES* phrases, char* dst, const char* dst_end,
+                                      const BYTE* src, const BYTE* src_end);
+
+BOOL          HLPCORE_OpenTopic(BYTE* file, UINT size, const HLPCORE_SYSTEM* sys, HLPCORE_TOPIC* topic);
+void          HLPCORE_CloseTopic(HLPCORE_TOPIC* topic);
+BOOL          HLPCORE_DecodeTopicBlock(HLPCORE_TOPIC* topic, unsigned index);
+void          HLPCORE_CacheTopicBlock(HLPCORE_TOPIC* topic, HLPCORE_TOPIC_BLOCK* block);
+void          HLPCORE_FlushTopicBlocks(HLPCORE_TOPIC* topic);
+BYTE*         HLPCORE_TopicBlock(HLPCORE_TOPIC* topic, unsigned index, UINT* size);
+BYTE*         HLPCORE_TopicRecord(HLPCORE_TOPIC* topic, unsigned index, unsigned offset, BYTE** end);
+void          HLPCORE_StartWalk(HLPCORE_TOPICWALK* walk, ULONG ref);
+BYTE*         HLPCORE_NextRecord(HLPCORE_TOPIC* topic, HLPCORE_TOPICWALK* walk, BYTE** end);
+LONG          HLPCORE_RecordTextSize(const BYTE* buf, const BYTE* end);
+LONG          HLPCORE_RecordText(const HLPCORE_TOPIC* topic, const BYTE* buf, const BYTE* end, char* text);
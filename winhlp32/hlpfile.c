@@ -36,362 +36,91 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(winhelp);
 
-static inline unsigned short GET_USHORT(const BYTE* buffer, unsigned i)
-{
-    return (BYTE)buffer[i] + 0x100 * (BYTE)buffer[i + 1];
-}
-
-static inline short GET_SHORT(const BYTE* buffer, unsigned i)
-{
-    return (BYTE)buffer[i] + 0x100 * (signed char)buffer[i+1];
-}
-
-static inline unsigned GET_UINT(const BYTE* buffer, unsigned i)
-{
-    return GET_USHORT(buffer, i) + 0x10000 * GET_USHORT(buffer, i + 2);
-}
-
 static HLPFILE *first_hlpfile = 0;
 
+/* Decompressed topic blocks kept around, per help file */
+#define HLPFILE_TOPIC_CACHE     (2 * 1024 * 1024)
 
-/**************************************************************************
- * HLPFILE_BPTreeSearch
- *
- * Searches for an element in B+ tree
- *
- * PARAMS
- *     buf        [I] pointer to the embedded file structured as a B+ tree
- *     key        [I] pointer to data to find
- *     comp       [I] compare function
- *
- * RETURNS
- *     Pointer to block identified by key, or NULL if failure.
- *
- */
-static void* HLPFILE_BPTreeSearch(BYTE* buf, const void* key,
-                           HLPFILE_BPTreeCompare comp)
-{
-    unsigned magic;
-    unsigned page_size;
-    unsigned cur_page;
-    unsigned level;
-    BYTE *pages, *ptr, *newptr;
-    int i, entries;
-    int ret;
-
-    magic = GET_USHORT(buf, 9);
-    if (magic != 0x293B)
-    {
-        WINE_ERR("Invalid magic in B+ tree: 0x%x\n", magic);
-        return NULL;
-    }
-    page_size = GET_USHORT(buf, 9+4);
-    cur_page  = GET_USHORT(buf, 9+26);
-    level     = GET_USHORT(buf, 9+32);
-    pages     = buf + 9 + 38;
-    while (--level > 0)
-    {
-        ptr = pages + cur_page*page_size;
-        entries = GET_SHORT(ptr, 2);
-        ptr += 6;
-        for (i = 0; i < entries; i++)
-        {
-            if (comp(ptr, key, 0, (void **)&newptr) > 0) break;
-            ptr = newptr;
-        }
-        cur_page = GET_USHORT(ptr-2, 0);
-    }
-    ptr = pages + cur_page*page_size;
-    entries = GET_SHORT(ptr, 2);
-    ptr += 8;
-    for (i = 0; i < entries; i++)
-    {
-        ret = comp(ptr, key, 1, (void **)&newptr);
-        if (ret == 0) return ptr;
-        if (ret > 0) return NULL;
-        ptr = newptr;
-    }
-    return NULL;
-}
+/* The container, the decompressors and the topic records live in hlpcore.c */
 
-/**************************************************************************
- * HLPFILE_BPTreeEnum
- *
- * Enumerates elements in B+ tree.
- *
- * PARAMS
- *     buf        [I]  pointer to the embedded file structured as a B+ tree
- *     cb         [I]  compare function
- *     cookie     [IO] cookie for cb function
- */
 void HLPFILE_BPTreeEnum(BYTE* buf, HLPFILE_BPTreeCallback cb, void* cookie)
 {
-    unsigned magic;
-    unsigned page_size;
-    unsigned cur_page;
-    unsigned level;
-    BYTE *pages, *ptr, *newptr;
-    int i, entries;
-
-    magic = GET_USHORT(buf, 9);
-    if (magic != 0x293B)
-    {
-        WINE_ERR("Invalid magic in B+ tree: 0x%x\n", magic);
-        return;
-    }
-    page_size = GET_USHORT(buf, 9+4);
-    cur_page  = GET_USHORT(buf, 9+26);
-    level     = GET_USHORT(buf, 9+32);
-    pages     = buf + 9 + 38;
-    while (--level > 0)
-    {
-        ptr = pages + cur_page*page_size;
-        cur_page = GET_USHORT(ptr, 4);
-    }
-    while (cur_page != 0xFFFF)
-    {
-        ptr = pages + cur_page*page_size;
-        entries = GET_SHORT(ptr, 2);
-        ptr += 8;
-        for (i = 0; i < entries; i++)
-        {
-            cb(ptr, (void **)&newptr, cookie);
-            ptr = newptr;
-        }
-        cur_page = GET_USHORT(pages+cur_page*page_size, 6);
-    }
-}
-
-
-/***********************************************************************
- *
- *           HLPFILE_UncompressedLZ77_Size
- */
-static INT HLPFILE_UncompressedLZ77_Size(const BYTE *ptr, const BYTE *end)
-{
-    int  i, newsize = 0;
-
-    while (ptr < end)
-    {
-        int mask = *ptr++;
-        for (i = 0; i < 8 && ptr < end; i++, mask >>= 1)
-	{
-            if (mask & 1)
-	    {
-                int code = GET_USHORT(ptr, 0);
-                int len  = 3 + (code >> 12);
-                newsize += len;
-                ptr     += 2;
-	    }
-            else newsize++, ptr++;
-	}
-    }
-
-    return newsize;
+    HLPCORE_BPTreeEnum(buf, cb, cookie);
 }
 
-/***********************************************************************
- *
- *           HLPFILE_UncompressLZ77
- */
-static BYTE *HLPFILE_UncompressLZ77(const BYTE *ptr, const BYTE *end, BYTE *newptr)
+static BOOL HLPFILE_FindSubFile(HLPFILE* hlpfile, LPCSTR name, BYTE **subbuf, BYTE **subend)
 {
-    int i;
-
-    while (ptr < end)
-    {
-        int mask = *ptr++;
-        for (i = 0; i < 8 && ptr < end; i++, mask >>= 1)
-	{
-            if (mask & 1)
-	    {
-                int code   = GET_USHORT(ptr, 0);
-                int len    = 3 + (code >> 12);
-                int offset = code & 0xfff;
-                /*
-                 * We must copy byte-by-byte here. We cannot use memcpy nor
-                 * memmove here. Just example:
-                 * a[]={1,2,3,4,5,6,7,8,9,10}
-                 * newptr=a+2;
-                 * offset=1;
-                 * We expect:
-                 * {1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 11, 12}
-                 */
-                for (; len>0; len--, newptr++) *newptr = *(newptr-offset-1);
-                ptr    += 2;
-	    }
-            else *newptr++ = *ptr++;
-	}
-    }
-
-    return newptr;
+    return HLPCORE_FindSubFile(hlpfile->file_buffer, hlpfile->file_buffer_size, name, subbuf, subend);
 }
 
-/***********************************************************************
- *
- *           HLPFILE_Uncompress2
- */
-
-static void HLPFILE_Uncompress2(HLPFILE* hlpfile, const BYTE *ptr, const BYTE *end, BYTE *newptr, const BYTE *newend)
+LONG HLPFILE_Hash(LPCSTR lpszContext)
 {
-    BYTE *phptr, *phend;
-    UINT code;
-    UINT index;
-
-    while (ptr < end && newptr < newend)
-    {
-        if (!*ptr || *ptr >= 0x10)
-            *newptr++ = *ptr++;
-        else
-	{
-            code  = 0x100 * ptr[0] + ptr[1];
-            index = (code - 0x100) / 2;
-
-            phptr = (BYTE*)hlpfile->phrases_buffer + hlpfile->phrases_offsets[index];
-            phend = (BYTE*)hlpfile->phrases_buffer + hlpfile->phrases_offsets[index + 1];
-
-            if (newptr + (phend - phptr) > newend)
-            {
-                WINE_FIXME("buffer overflow %p > %p for %lu bytes\n",
-                           newptr, newend, (SIZE_T)(phend - phptr));
-                return;
-            }
-            memcpy(newptr, phptr, phend - phptr);
-            newptr += phend - phptr;
-            if (code & 1) *newptr++ = ' ';
-
-            ptr += 2;
-	}
-    }
-    if (newptr > newend) WINE_FIXME("buffer overflow %p > %p\n", newptr, newend);
+    return HLPCORE_Hash(lpszContext);
 }
 
 /******************************************************************
- *		HLPFILE_Uncompress3
+ *		HLPFILE_PageByOffset
  *
  *
  */
-static BOOL HLPFILE_Uncompress3(HLPFILE* hlpfile, char* dst, const char* dst_end,
-                                const BYTE* src, const BYTE* src_end)
+HLPFILE_PAGE *HLPFILE_PageByOffset(HLPFILE* hlpfile, LONG offset, ULONG* relative)
 {
-    unsigned int idx, len;
+    HLPFILE_PAGE*       found;
+    unsigned            low, high, mid;
 
-    for (; src < src_end; src++)
-    {
-        if ((*src & 1) == 0)
-        {
-            idx = *src / 2;
-            if (idx > hlpfile->num_phrases)
-            {
-                WINE_ERR("index in phrases %d/%d\n", idx, hlpfile->num_phrases);
-                len = 0;
-            }
-            else
-            {
-                len = hlpfile->phrases_offsets[idx + 1] - hlpfile->phrases_offsets[idx];
-                if (dst + len <= dst_end)
-                    memcpy(dst, &hlpfile->phrases_buffer[hlpfile->phrases_offsets[idx]], len);
-            }
-        }
-        else if ((*src & 0x03) == 0x01)
-        {
-            idx = (*src + 1) * 64;
-            idx += *++src;
-            if (idx > hlpfile->num_phrases)
-            {
-                WINE_ERR("index in phrases %d/%d\n", idx, hlpfile->num_phrases);
-                len = 0;
-            }
-            else
-            {
-                len = hlpfile->phrases_offsets[idx + 1] - hlpfile->phrases_offsets[idx];
-                if (dst + len <= dst_end)
-                    memcpy(dst, &hlpfile->phrases_buffer[hlpfile->phrases_offsets[idx]], len);
-            }
-        }
-        else if ((*src & 0x07) == 0x03)
-        {
-            len = (*src / 8) + 1;
-            if (dst + len <= dst_end)
-                memcpy(dst, src + 1, len);
-            src += len;
-        }
-        else
-        {
-            len = (*src / 16) + 1;
-            if (dst + len <= dst_end)
-                memset(dst, ((*src & 0x0F) == 0x07) ? ' ' : 0, len);
-        }
-        dst += len;
-    }
+    if (!hlpfile) return 0;
 
-    if (dst > dst_end) WINE_ERR("buffer overflow (%p > %p)\n", dst, dst_end);
-    return TRUE;
-}
+    WINE_TRACE("<%s>[%x]\n", debugstr_a(hlpfile->lpszPath), offset);
 
-/******************************************************************
- *		HLPFILE_UncompressRLE
- *
- *
- */
-static void HLPFILE_UncompressRLE(const BYTE* src, const BYTE* end, BYTE* dst, unsigned dstsz)
-{
-    BYTE        ch;
-    BYTE*       sdst = dst + dstsz;
+    if (offset == 0xFFFFFFFF) return NULL;
 
-    while (src < end)
+    /* last page starting at or before offset */
+    low = 0;
+    high = hlpfile->num_pages;
+    while (low < high)
     {
-        ch = *src++;
-        if (ch & 0x80)
-        {
-            ch &= 0x7F;
-            if (dst + ch <= sdst)
-                memcpy(dst, src, ch);
-            src += ch;
-        }
-        else
-        {
-            if (dst + ch <= sdst)
-                memset(dst, (char)*src, ch);
-            src++;
-        }
-        dst += ch;
+        mid = (low + high) / 2;
+        if (hlpfile->page_index[mid]->offset <= (unsigned)offset) low = mid + 1;
+        else high = mid;
     }
-    if (dst != sdst)
-        WINE_WARN("Buffer X-flow: d(%lu) instead of d(%u)\n",
-                  (SIZE_T)(dst - (sdst - dstsz)), dstsz);
+    if (!low)
+    {
+        WINE_ERR("Page of offset %u not found in file %s\n",
+                 offset, debugstr_a(hlpfile->lpszPath));
+        return NULL;
+    }
+    /* same offset: the first page of the list wins, as it always did */
+    for (low--; low && hlpfile->page_index[low - 1]->offset == hlpfile->page_index[low]->offset; low--);
+    found = hlpfile->page_index[low];
+    *relative = offset - found->offset;
+    return found;
 }
 
-
-/******************************************************************
- *		HLPFILE_PageByOffset
+/***********************************************************************
  *
+ *           HLPFILE_IndexPages
  *
+ * Builds the offset sorted page array used by HLPFILE_PageByOffset.
  */
-HLPFILE_PAGE *HLPFILE_PageByOffset(HLPFILE* hlpfile, LONG offset, ULONG* relative)
+static BOOL HLPFILE_IndexPages(HLPFILE* hlpfile)
 {
     HLPFILE_PAGE*       page;
-    HLPFILE_PAGE*       found;
+    unsigned            i, j;
 
-    if (!hlpfile) return 0;
-
-    WINE_TRACE("<%s>[%x]\n", debugstr_a(hlpfile->lpszPath), offset);
+    for (i = 0, page = hlpfile->first_page; page; page = page->next) i++;
+    hlpfile->page_index = HeapAlloc(GetProcessHeap(), 0, max(i, 1) * sizeof(HLPFILE_PAGE*));
+    if (!hlpfile->page_index) return FALSE;
+    hlpfile->num_pages = i;
 
-    if (offset == 0xFFFFFFFF) return NULL;
-    page = NULL;
-
-    for (found = NULL, page = hlpfile->first_page; page; page = page->next)
+    /* Topics come in offset order, so this (stable) insertion sort
+     * normally doesn't move anything */
+    for (i = 0, page = hlpfile->first_page; page; page = page->next, i++)
     {
-        if (page->offset <= offset && (!found || found->offset < page->offset))
-        {
-            *relative = offset - page->offset;
-            found = page;
-        }
+        for (j = i; j && hlpfile->page_index[j - 1]->offset > page->offset; j--)
+            hlpfile->page_index[j] = hlpfile->page_index[j - 1];
+        hlpfile->page_index[j] = page;
     }
-    if (!found)
-        WINE_ERR("Page of offset %u not found in file %s\n",
-                 offset, debugstr_a(hlpfile->lpszPath));
-    return found;
+    return TRUE;
 }
 
 /***********************************************************************
@@ -439,27 +168,43 @@ static int comp_PageByHash(void *p, const void *key,
 HLPFILE_PAGE *HLPFILE_PageByHash(HLPFILE* hlpfile, LONG lHash, ULONG* relative)
 {
     BYTE *ptr;
+    HLPFILE_HASHENTRY *entry;
+    HLPFILE_PAGE *page;
 
     if (!hlpfile) return NULL;
     if (!lHash) return HLPFILE_Contents(hlpfile, relative);
 
     WINE_TRACE("<%s>[%x]\n", debugstr_a(hlpfile->lpszPath), lHash);
 
+    entry = &hlpfile->hash_cache[((ULONG)lHash ^ ((ULONG)lHash >> 16)) % HLPFILE_HASH_CACHE];
+    if (entry->page && entry->lHash == lHash)
+    {
+        *relative = entry->relative;
+        return entry->page;
+    }
+
     /* For win 3.0 files hash values are really page numbers */
     if (hlpfile->version <= 16)
     {
         if (lHash >= hlpfile->wTOMapLen) return NULL;
-        return HLPFILE_PageByOffset(hlpfile, hlpfile->TOMap[lHash], relative);
+        return HLPFILE_PageByOffset(hlpfile, GET_UINT(hlpfile->TOMap, lHash * 4), relative);
     }
 
-    ptr = HLPFILE_BPTreeSearch(hlpfile->Context, LongToPtr(lHash), comp_PageByHash);
+    ptr = HLPCORE_BPTreeSearch(hlpfile->Context, LongToPtr(lHash), comp_PageByHash);
     if (!ptr)
     {
         WINE_ERR("Page of hash %x not found in file %s\n", lHash, debugstr_a(hlpfile->lpszPath));
         return NULL;
     }
 
-    return HLPFILE_PageByOffset(hlpfile, GET_UINT(ptr, 4), relative);
+    page = HLPFILE_PageByOffset(hlpfile, GET_UINT(ptr, 4), relative);
+    if (page)
+    {
+        entry->lHash    = lHash;
+        entry->page     = page;
+        entry->relative = *relative;
+    }
+    return page;
 }
 
 /***********************************************************************
@@ -484,87 +229,6 @@ HLPFILE_PAGE *HLPFILE_PageByMap(HLPFILE* hlpfile, LONG lMap, ULONG* relative)
     return NULL;
 }
 
-/**************************************************************************
- * comp_FindSubFile
- *
- * HLPFILE_BPTreeCompare function for HLPFILE directory.
- *
- */
-static int comp_FindSubFile(void *p, const void *key,
-                            int leaf, void** next)
-{
-    *next = (char *)p+strlen(p)+(leaf?5:3);
-    WINE_TRACE("Comparing %s with %s\n", debugstr_a((char *)p), debugstr_a((const char *)key));
-    return strcmp(p, key);
-}
-
-/***********************************************************************
- *
- *           HLPFILE_FindSubFile
- */
-static BOOL HLPFILE_FindSubFile(HLPFILE* hlpfile, LPCSTR name, BYTE **subbuf, BYTE **subend)
-{
-    BYTE *ptr;
-
-    WINE_TRACE("looking for file %s\n", debugstr_a(name));
-    ptr = HLPFILE_BPTreeSearch(hlpfile->file_buffer + GET_UINT(hlpfile->file_buffer, 4),
-                               name, comp_FindSubFile);
-    if (!ptr)
-    {   /* Subfiles with bitmap images are usually prefixed with '|', but sometimes not.
-           Unfortunately, there is no consensus among different pieces of unofficial
-           documentation. So remove leading '|' and try again. */
-        CHAR c = *name++;
-        if (c == '|')
-        {
-            WINE_TRACE("not found. try %s\n", debugstr_a(name));
-            ptr = HLPFILE_BPTreeSearch(hlpfile->file_buffer + GET_UINT(hlpfile->file_buffer, 4),
-                                       name, comp_FindSubFile);
-        }
-    }
-    if (!ptr) return FALSE;
-    *subbuf = hlpfile->file_buffer + GET_UINT(ptr, strlen(name)+1);
-    if (*subbuf >= hlpfile->file_buffer + hlpfile->file_buffer_size)
-    {
-        WINE_ERR("internal file %s does not fit\n", debugstr_a(name));
-        return FALSE;
-    }
-    *subend = *subbuf + GET_UINT(*subbuf, 0);
-    if (*subend > hlpfile->file_buffer + hlpfile->file_buffer_size)
-    {
-        WINE_ERR("internal file %s does not fit\n", debugstr_a(name));
-        return FALSE;
-    }
-    if (GET_UINT(*subbuf, 0) < GET_UINT(*subbuf, 4) + 9)
-    {
-        WINE_ERR("invalid size provided for internal file %s\n", debugstr_a(name));
-        return FALSE;
-    }
-    return TRUE;
-}
-
-/***********************************************************************
- *
- *           HLPFILE_Hash
- */
-LONG HLPFILE_Hash(LPCSTR lpszContext)
-{
-    LONG lHash = 0;
-    CHAR c;
-
-    while ((c = *lpszContext++))
-    {
-        CHAR x = 0;
-        if (c >= 'A' && c <= 'Z') x = c - 'A' + 17;
-        if (c >= 'a' && c <= 'z') x = c - 'a' + 17;
-        if (c >= '1' && c <= '9') x = c - '0';
-        if (c == '0') x = 10;
-        if (c == '.') x = 12;
-        if (c == '_') x = 13;
-        if (x) lHash = lHash * 43 + x;
-    }
-    return lHash;
-}
-
 static LONG fetch_long(const BYTE** ptr)
 {
     LONG        ret;
@@ -634,62 +298,6 @@ static unsigned short fetch_ushort(const BYTE** ptr)
     return ret;
 }
 
-/******************************************************************
- *		HLPFILE_DecompressGfx
- *
- * Decompress the data part of a bitmap or a metafile
- */
-static const BYTE*      HLPFILE_DecompressGfx(const BYTE* src, unsigned csz, unsigned sz, BYTE packing,
-                                              BYTE** alloc)
-{
-    const BYTE* dst;
-    BYTE*       tmp;
-    unsigned    sz77;
-
-    WINE_TRACE("Unpacking (%d) from %u bytes to %u bytes\n", packing, csz, sz);
-
-    switch (packing)
-    {
-    case 0: /* uncompressed */
-        if (sz != csz)
-            WINE_WARN("Bogus gfx sizes (uncompressed): %u / %u\n", sz, csz);
-        dst = src;
-        *alloc = NULL;
-        break;
-    case 1: /* RunLen */
-        dst = *alloc = HeapAlloc(GetProcessHeap(), 0, sz);
-        if (!dst) return NULL;
-        HLPFILE_UncompressRLE(src, src + csz, *alloc, sz);
-        break;
-    case 2: /* LZ77 */
-        sz77 = HLPFILE_UncompressedLZ77_Size(src, src + csz);
-        dst = *alloc = HeapAlloc(GetProcessHeap(), 0, sz77);
-        if (!dst) return NULL;
-        HLPFILE_UncompressLZ77(src, src + csz, *alloc);
-        if (sz77 != sz)
-            WINE_WARN("Bogus gfx sizes (LZ77): %u / %u\n", sz77, sz);
-        break;
-    case 3: /* LZ77 then RLE */
-        sz77 = HLPFILE_UncompressedLZ77_Size(src, src + csz);
-        tmp = HeapAlloc(GetProcessHeap(), 0, sz77);
-        if (!tmp) return FALSE;
-        HLPFILE_UncompressLZ77(src, src + csz, tmp);
-        dst = *alloc = HeapAlloc(GetProcessHeap(), 0, sz);
-        if (!dst)
-        {
-            HeapFree(GetProcessHeap(), 0, tmp);
-            return FALSE;
-        }
-        HLPFILE_UncompressRLE(tmp, tmp + sz77, *alloc, sz);
-        HeapFree(GetProcessHeap(), 0, tmp);
-        break;
-    default:
-        WINE_FIXME("Unsupported packing %u\n", packing);
-        return NULL;
-    }
-    return dst;
-}
-
 static BOOL HLPFILE_RtfAddRawString(struct RtfData* rd, const char* str, size_t sz)
 {
     if (rd->ptr + sz >= rd->data + rd->allocated)
@@ -697,6 +305,7 @@ static BOOL HLPFILE_RtfAddRawString(struct RtfData* rd, const char* str, size_t
         char*   new = HeapReAlloc(GetProcessHeap(), 0, rd->data, rd->allocated *= 2);
         if (!new) return FALSE;
         rd->ptr = new + (rd->ptr - rd->data);
+        rd->where = new + (rd->where - rd->data);
         rd->data = new;
     }
     memcpy(rd->ptr, str, sz);
@@ -705,6 +314,27 @@ static BOOL HLPFILE_RtfAddRawString(struct RtfData* rd, const char* str, size_t
     return TRUE;
 }
 
+static BOOL HLPFILE_RtfAddPar(struct RtfData* rd, unsigned offset)
+{
+    HLPFILE_RTFPAR*     new;
+
+    if (rd->num_pars == rd->alloc_pars)
+    {
+        rd->alloc_pars = rd->alloc_pars ? rd->alloc_pars * 2 : 64;
+        if (rd->pars)
+            new = HeapReAlloc(GetProcessHeap(), 0, rd->pars, rd->alloc_pars * sizeof(*new));
+        else
+            new = HeapAlloc(GetProcessHeap(), 0, rd->alloc_pars * sizeof(*new));
+        if (!new) return FALSE;
+        rd->pars = new;
+    }
+    rd->pars[rd->num_pars].offset = offset;
+    rd->pars[rd->num_pars].char_pos = rd->char_pos;
+    rd->num_pars++;
+
+    return TRUE;
+}
+
 static BOOL HLPFILE_RtfAddControl(struct RtfData* rd, const char* str)
 {
     WINE_TRACE("%s\n", debugstr_a(str));
@@ -753,29 +383,108 @@ static BOOL HLPFILE_RtfAddText(struct RtfData* rd, const char* str)
  */
 static BOOL HLPFILE_RtfAddHexBytes(struct RtfData* rd, const void* _ptr, unsigned sz)
 {
-    char        tmp[512];
-    unsigned    i, step;
+    static char _2hex[256][2];
     const BYTE* ptr = _ptr;
-    static const char* _2hex = "0123456789abcdef";
+    char*       dst;
+    char*       new;
+    unsigned    i, need;
 
+    if (!_2hex[0][0])
+    {
+        for (i = 0; i < 256; i++)
+        {
+            _2hex[i][0] = "0123456789abcdef"[i >> 4];
+            _2hex[i][1] = "0123456789abcdef"[i & 0xF];
+        }
+    }
     if (!rd->in_text)
     {
         if (!HLPFILE_RtfAddRawString(rd, " ", 1)) return FALSE;
         rd->in_text = TRUE;
     }
-    for (; sz; sz -= step)
+    /* grow once and encode in place rather than going through a bounce buffer */
+    need = (rd->ptr - rd->data) + 2 * sz + 1;
+    if (need > rd->allocated)
     {
-        step = min(256, sz);
-        for (i = 0; i < step; i++)
-        {
-            tmp[2 * i + 0] = _2hex[*ptr >> 4];
-            tmp[2 * i + 1] = _2hex[*ptr++ & 0xF];
-        }
-        if (!HLPFILE_RtfAddRawString(rd, tmp, 2 * step)) return FALSE;
+        need = max(need, rd->allocated * 2);
+        if (!(new = HeapReAlloc(GetProcessHeap(), 0, rd->data, need))) return FALSE;
+        rd->ptr = new + (rd->ptr - rd->data);
+        rd->where = new + (rd->where - rd->data);
+        rd->data = new;
+        rd->allocated = need;
     }
+    for (dst = rd->ptr; sz; sz--, dst += 2)
+        memcpy(dst, _2hex[*ptr++], 2);
+    rd->ptr = dst;
     return TRUE;
 }
 
+/******************************************************************
+ *		HLPFILE_RtfAddCachedGfx
+ *
+ * Appends the RTF of picture #index if it has already been decoded.
+ */
+static BOOL HLPFILE_RtfAddCachedGfx(struct RtfData* rd, HLPFILE* hlpfile, int index)
+{
+    HLPFILE_GFX*        gfx;
+    HLPFILE_GFX**       pgfx;
+
+    if (index < 0) return FALSE;
+    for (pgfx = &hlpfile->first_gfx; (gfx = *pgfx); pgfx = &gfx->next)
+    {
+        if (gfx->index != (unsigned)index) continue;
+        /* move it to the front */
+        *pgfx = gfx->next;
+        gfx->next = hlpfile->first_gfx;
+        hlpfile->first_gfx = gfx;
+
+        if (!HLPFILE_RtfAddRawString(rd, gfx->data, gfx->size)) return FALSE;
+        rd->in_text = TRUE; /* the picture group has been closed */
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/******************************************************************
+ *		HLPFILE_CacheGfx
+ *
+ * Keeps the RTF of picture #index, so that decompressing and encoding it
+ * is done once per file. The least recently used pictures are dropped
+ * above HLPFILE_GFX_CACHE bytes.
+ */
+static void HLPFILE_CacheGfx(HLPFILE* hlpfile, int index, const char* data, unsigned size)
+{
+    HLPFILE_GFX*        gfx;
+    HLPFILE_GFX**       pgfx;
+
+    if (index < 0 || size > HLPFILE_GFX_CACHE / 4) return;
+    gfx = HeapAlloc(GetProcessHeap(), 0, sizeof(*gfx) + size);
+    if (!gfx) return;
+
+    gfx->index = index;
+    gfx->data = (char*)(gfx + 1);
+    memcpy(gfx->data, data, size);
+    gfx->size = size;
+    gfx->next = hlpfile->first_gfx;
+    hlpfile->first_gfx = gfx;
+    hlpfile->gfx_cached += size;
+
+    /* Most recently used first, cut the tail */
+    pgfx = &gfx->next;
+    while (*pgfx)
+    {
+        size += (*pgfx)->size;
+        if (size > HLPFILE_GFX_CACHE) break;
+        pgfx = &(*pgfx)->next;
+    }
+    while ((gfx = *pgfx))
+    {
+        *pgfx = gfx->next;
+        hlpfile->gfx_cached -= gfx->size;
+        HeapFree(GetProcessHeap(), 0, gfx);
+    }
+}
+
 static HLPFILE_LINK*       HLPFILE_AllocLink(struct RtfData* rd, int cookie,
                                              const char* str, unsigned len, LONG hash,
                                              BOOL clrChange, BOOL bHotSpot, unsigned wnd);
@@ -960,7 +669,8 @@ static BOOL HLPFILE_RtfAddTransparentBitmap(struct RtfData* rd, const BITMAPINFO
  *		HLPFILE_RtfAddBitmap
  *
  */
-static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE* beg, BYTE type, BYTE pack)
+static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE* beg, BYTE type, BYTE pack,
+                                 int index)
 {
     const BYTE*         ptr;
     const BYTE*         pict_beg;
@@ -972,6 +682,7 @@ static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE*
     BOOL                ret = FALSE;
     char                tmp[256];
     unsigned            hs_size, hs_offset;
+    unsigned            start;
 
     bi = HeapAlloc(GetProcessHeap(), 0, sizeof(*bi));
     if (!bi) return FALSE;
@@ -1003,6 +714,13 @@ static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE*
     hs_offset = GET_UINT(ptr, 0); ptr += 4;
     HLPFILE_AddHotSpotLinks(rd, file, beg, hs_size, hs_offset);
 
+    if (HLPFILE_RtfAddCachedGfx(rd, file, index))
+    {
+        HeapFree(GetProcessHeap(), 0, bi);
+        return TRUE;
+    }
+    start = rd->ptr - rd->data;
+
     /* now read palette info */
     if (type == 0x06)
     {
@@ -1024,7 +742,8 @@ static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE*
             ptr += 4;
         }
     }
-    pict_beg = HLPFILE_DecompressGfx(beg + off, csz, bi->bmiHeader.biSizeImage, pack, &alloc);
+    pict_beg = HLPCORE_DecompressGfx(beg + off, csz, bi->bmiHeader.biSizeImage, pack, &alloc);
+    if (!pict_beg) goto done;
 
     if (clrImportant == 1 && nc > 0)
     {
@@ -1051,6 +770,7 @@ static BOOL HLPFILE_RtfAddBitmap(struct RtfData* rd, HLPFILE* file, const BYTE*
 
     ret = TRUE;
 done:
+    if (ret) HLPFILE_CacheGfx(file, index, rd->data + start, (rd->ptr - rd->data) - start);
     HeapFree(GetProcessHeap(), 0, bi);
     HeapFree(GetProcessHeap(), 0, alloc);
 
@@ -1061,14 +781,15 @@ done:
  *		HLPFILE_RtfAddMetaFile
  *
  */
-static BOOL     HLPFILE_RtfAddMetaFile(struct RtfData* rd, HLPFILE* file, const BYTE* beg, BYTE pack)
+static BOOL     HLPFILE_RtfAddMetaFile(struct RtfData* rd, HLPFILE* file, const BYTE* beg, BYTE pack,
+                                       int index)
 {
     ULONG               size, csize, off, hs_offset, hs_size;
     const BYTE*         ptr;
     const BYTE*         bits;
     BYTE*               alloc = NULL;
     char                tmp[256];
-    unsigned            mm;
+    unsigned            mm, start;
     BOOL                ret;
 
     WINE_TRACE("Loading metafile\n");
@@ -1078,7 +799,6 @@ static BOOL     HLPFILE_RtfAddMetaFile(struct RtfData* rd, HLPFILE* file, const
     mm = fetch_ushort(&ptr); /* mapping mode */
     sprintf(tmp, "{\\pict\\wmetafile%u\\picw%u\\pich%u",
             mm, GET_USHORT(ptr, 0), GET_USHORT(ptr, 2));
-    if (!HLPFILE_RtfAddControl(rd, tmp)) return FALSE;
     ptr += 4;
 
     size = fetch_ulong(&ptr); /* decompressed size */
@@ -1090,14 +810,19 @@ static BOOL     HLPFILE_RtfAddMetaFile(struct RtfData* rd, HLPFILE* file, const
 
     HLPFILE_AddHotSpotLinks(rd, file, beg, hs_size, hs_offset);
 
+    if (HLPFILE_RtfAddCachedGfx(rd, file, index)) return TRUE;
+    start = rd->ptr - rd->data;
+
     WINE_TRACE("sz=%u csz=%u offs=%u/%u,%u/%u\n",
                size, csize, off, (ULONG)(ptr - beg), hs_size, hs_offset);
 
-    bits = HLPFILE_DecompressGfx(beg + off, csize, size, pack, &alloc);
+    bits = HLPCORE_DecompressGfx(beg + off, csize, size, pack, &alloc);
     if (!bits) return FALSE;
 
-    ret = HLPFILE_RtfAddHexBytes(rd, bits, size) &&
+    ret = HLPFILE_RtfAddControl(rd, tmp) &&
+        HLPFILE_RtfAddHexBytes(rd, bits, size) &&
         HLPFILE_RtfAddControl(rd, "}");
+    if (ret) HLPFILE_CacheGfx(file, index, rd->data + start, (rd->ptr - rd->data) - start);
 
     HeapFree(GetProcessHeap(), 0, alloc);
 
@@ -1109,7 +834,7 @@ static BOOL     HLPFILE_RtfAddMetaFile(struct RtfData* rd, HLPFILE* file, const
  *
  */
 static  BOOL    HLPFILE_RtfAddGfxByAddr(struct RtfData* rd, HLPFILE *hlpfile,
-                                        const BYTE* ref, ULONG size)
+                                        const BYTE* ref, ULONG size, int index)
 {
     unsigned    i, numpict;
 
@@ -1132,10 +857,10 @@ static  BOOL    HLPFILE_RtfAddGfxByAddr(struct RtfData* rd, HLPFILE *hlpfile,
         {
         case 5: /* device dependent bmp */
         case 6: /* device independent bmp */
-            HLPFILE_RtfAddBitmap(rd, hlpfile, beg, type, pack);
+            HLPFILE_RtfAddBitmap(rd, hlpfile, beg, type, pack, index);
             break;
         case 8:
-            HLPFILE_RtfAddMetaFile(rd, hlpfile, beg, pack);
+            HLPFILE_RtfAddMetaFile(rd, hlpfile, beg, pack, index);
             break;
         default: WINE_FIXME("Unknown type %u\n", type); return FALSE;
         }
@@ -1167,7 +892,7 @@ static  BOOL    HLPFILE_RtfAddGfxByIndex(struct RtfData* rd, HLPFILE *hlpfile,
     if (!HLPFILE_FindSubFile(hlpfile, tmp, &ref, &end)) {WINE_WARN("no sub file\n"); return FALSE;}
 
     ref += 9;
-    return HLPFILE_RtfAddGfxByAddr(rd, hlpfile, ref, end - ref);
+    return HLPFILE_RtfAddGfxByAddr(rd, hlpfile, ref, end - ref, index);
 }
 
 /******************************************************************
@@ -1198,6 +923,7 @@ static HLPFILE_LINK*       HLPFILE_AllocLink(struct RtfData* rd, int cookie,
     link->bClrChange = clrChange;
     link->bHotSpot   = bHotSpot;
     link->window     = wnd;
+    link->code       = NULL;
     link->next       = rd->first_link;
     rd->first_link   = link;
     link->cpMin      = rd->char_pos;
@@ -1218,6 +944,25 @@ static unsigned HLPFILE_HalfPointsScale(HLPFILE_PAGE* page, unsigned pts)
     return pts * page->file->scale - page->file->rounderr;
 }
 
+/***********************************************************************
+ *
+ *           HLPFILE_ParagraphText
+ *
+ * Returns the text of a paragraph record, phrases expanded, as a heap
+ * allocated run of NUL terminated strings.
+ */
+static char* HLPFILE_ParagraphText(HLPFILE* hlpfile, const BYTE* buf, const BYTE* end, LONG* psize)
+{
+    char*       text;
+    LONG        size = HLPCORE_RecordTextSize(buf, end);
+
+    if (size < 0) {WINE_WARN("bad paragraph\n"); return NULL;}
+    text = HeapAlloc(GetProcessHeap(), 0, size + 1);
+    if (!text) return NULL;
+    *psize = HLPCORE_RecordText(&hlpfile->topic, buf, end, text);
+    return text;
+}
+
 /***********************************************************************
  *
  *           HLPFILE_BrowseParagraph
@@ -1228,7 +973,7 @@ static BOOL HLPFILE_BrowseParagraph(HLPFILE_PAGE* page, struct RtfData* rd,
     UINT               textsize;
     const BYTE        *format, *format_end;
     char              *text, *text_base, *text_end;
-    LONG               size, blocksize, datalen;
+    LONG               size;
     unsigned short     bits;
     unsigned           ncol = 1;
     short              nc, lastcol, table_width;
@@ -1238,27 +983,8 @@ static BOOL HLPFILE_BrowseParagraph(HLPFILE_PAGE* page, struct RtfData* rd,
     if (buf + 0x19 > end) {WINE_WARN("header too small\n"); return FALSE;};
 
     *parlen = 0;
-    blocksize = GET_UINT(buf, 0);
-    size = GET_UINT(buf, 0x4);
-    datalen = GET_UINT(buf, 0x10);
-    text = text_base = HeapAlloc(GetProcessHeap(), 0, size);
+    text = text_base = HLPFILE_ParagraphText(page->file, buf, end, &size);
     if (!text) return FALSE;
-    if (size > blocksize - datalen)
-    {
-        /* need to decompress */
-        if (page->file->hasPhrases)
-            HLPFILE_Uncompress2(page->file, buf + datalen, end, (BYTE*)text, (BYTE*)text + size);
-        else if (page->file->hasPhrases40)
-            HLPFILE_Uncompress3(page->file, text, text + size, buf + datalen, end);
-        else
-        {
-            WINE_FIXME("Text size is too long, splitting\n");
-            size = blocksize - datalen;
-            memcpy(text, buf + datalen, size);
-        }
-    }
-    else
-        memcpy(text, buf + datalen, size);
 
     text_end = text + size;
 
@@ -1498,6 +1224,7 @@ static BOOL HLPFILE_BrowseParagraph(HLPFILE_PAGE* page, struct RtfData* rd,
                             page->file->fonts[font].LogFont.lfUnderline ? "\\ul" : "\\ul0",
                             page->file->fonts[font].LogFont.lfStrikeOut ? "\\strike" : "\\strike0");
                     if (!HLPFILE_RtfAddControl(rd, tmp)) goto done;
+                    lstrcpynA(rd->char_format, tmp, sizeof(rd->char_format));
                 }
                break;
 
@@ -1571,7 +1298,7 @@ static BOOL HLPFILE_BrowseParagraph(HLPFILE_PAGE* page, struct RtfData* rd,
                             WINE_FIXME("does it work ??? %x<%u>#%u\n",
                                        GET_SHORT(format, 0),
                                        size, GET_SHORT(format, 2));
-                            HLPFILE_RtfAddGfxByAddr(rd, page->file, format + 2, size - 4);
+                            HLPFILE_RtfAddGfxByAddr(rd, page->file, format + 2, size - 4, -1);
                             rd->char_pos++;
                            break;
                         default:
@@ -1698,29 +1425,166 @@ done:
     return ret;
 }
 
-/******************************************************************
- *		HLPFILE_BrowsePage
+/***********************************************************************
+ *
+ *           HLPFILE_FreeLinks
+ */
+static void HLPFILE_FreeLinks(HLPFILE_LINK* link)
+{
+    HLPFILE_LINK*       next;
+
+    for (; link; link = next)
+    {
+        next = link->next;
+        MACRO_FreeCode(link->code);
+        HeapFree(GetProcessHeap(), 0, link);
+    }
+}
+
+static unsigned HLPFILE_RtfCachedSize(const HLPFILE_RTF* rtf)
+{
+    return rtf->size + rtf->num_pars * sizeof(HLPFILE_RTFPAR);
+}
+
+/***********************************************************************
+ *
+ *           HLPFILE_CacheRtf
+ *
+ * Hands the RTF of a fully generated page over to the file's cache. The
+ * least recently used pages are dropped above HLPFILE_RTF_CACHE bytes.
+ */
+static void HLPFILE_CacheRtf(struct RtfData* rd)
+{
+    HLPFILE*            hlpfile = rd->page->file;
+    HLPFILE_RTF*        rtf;
+    HLPFILE_RTF**       prtf;
+    unsigned            size = rd->ptr - rd->data;
+    unsigned            total;
+    char*               new;
+
+    if (size + rd->num_pars * sizeof(HLPFILE_RTFPAR) > HLPFILE_RTF_CACHE / 4) return;
+    rtf = HeapAlloc(GetProcessHeap(), 0, sizeof(*rtf));
+    if (!rtf) return;
+
+    /* Give back the slack of the doubling buffer */
+    if ((new = HeapReAlloc(GetProcessHeap(), 0, rd->data, max(size, 1))))
+    {
+        rd->ptr = new + size;
+        rd->where = new + (rd->where - rd->data);
+        rd->data = new;
+        rd->allocated = max(size, 1);
+    }
+
+    rtf->page           = rd->page;
+    rtf->font_scale     = rd->font_scale;
+    rtf->pars           = rd->pars;
+    rtf->num_pars       = rd->num_pars;
+    rtf->data           = rd->data;
+    rtf->size           = size;
+    rtf->next           = hlpfile->first_rtf;
+    hlpfile->first_rtf  = rtf;
+    hlpfile->rtf_cached += HLPFILE_RtfCachedSize(rtf);
+    rd->cached = TRUE;
+
+    /* Most recently used first, cut the tail */
+    total = HLPFILE_RtfCachedSize(rtf);
+    prtf = &rtf->next;
+    while (*prtf)
+    {
+        total += HLPFILE_RtfCachedSize(*prtf);
+        if (total > HLPFILE_RTF_CACHE) break;
+        prtf = &(*prtf)->next;
+    }
+    while (*prtf)
+    {
+        rtf = *prtf;
+        *prtf = rtf->next;
+        hlpfile->rtf_cached -= HLPFILE_RtfCachedSize(rtf);
+        HeapFree(GetProcessHeap(), 0, rtf->pars);
+        HeapFree(GetProcessHeap(), 0, rtf->data);
+        HeapFree(GetProcessHeap(), 0, rtf);
+    }
+}
+
+/***********************************************************************
  *
+ *           HLPFILE_BrowseDone
+ */
+static BOOL HLPFILE_BrowseDone(struct RtfData* rd)
+{
+    if (!HLPFILE_RtfAddControl(rd, "}")) return FALSE;
+
+    /* links are kept with the page, someone may still be using them */
+    if (!rd->page->first_link) rd->page->first_link = rd->first_link;
+    else HLPFILE_FreeLinks(rd->first_link);
+    rd->first_link = NULL;
+    rd->done = rd->found_rel = TRUE;
+
+    HLPFILE_CacheRtf(rd);
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           HLPFILE_BrowsePage
+ *
+ * Starts the RTF for a page: either the cached one, or its header only.
+ * The paragraphs are then generated by HLPFILE_BrowseMore as the stream
+ * is read, and HLPFILE_EndBrowse must be called in any case.
  */
 BOOL    HLPFILE_BrowsePage(HLPFILE_PAGE* page, struct RtfData* rd,
                            unsigned font_scale, unsigned relative)
 {
     HLPFILE     *hlpfile = page->file;
-    BYTE        *buf, *end;
-    DWORD       ref = page->reference;
-    unsigned    index, old_index = -1, offset, count = 0, offs = 0;
-    unsigned    cpg, parlen;
+    HLPFILE_RTF *rtf, **prtf;
+    unsigned    index, cpg;
     char        tmp[1024];
     const char* ck = NULL;
 
     rd->in_text = TRUE;
-    rd->data = rd->ptr = HeapAlloc(GetProcessHeap(), 0, rd->allocated = 32768);
     rd->char_pos = 0;
     rd->first_link = rd->current_link = NULL;
     rd->force_color = FALSE;
     rd->font_scale = font_scale;
     rd->relative = relative;
     rd->char_pos_rel = 0;
+    rd->pars = NULL;
+    rd->num_pars = rd->alloc_pars = 0;
+    rd->found_rel = FALSE;
+    rd->char_format[0] = '\0';
+    rd->page = page;
+    HLPCORE_StartWalk(&rd->walk, page->reference);
+    rd->count = 0;
+
+    for (prtf = &hlpfile->first_rtf; (rtf = *prtf); prtf = &rtf->next)
+    {
+        if (rtf->page == page && rtf->font_scale == font_scale)
+        {
+            /* move it to the front */
+            *prtf = rtf->next;
+            rtf->next = hlpfile->first_rtf;
+            hlpfile->first_rtf = rtf;
+
+            rd->data = rd->where = rtf->data;
+            rd->ptr = rtf->data + rtf->size;
+            rd->allocated = rtf->size;
+            rd->pars = rtf->pars;
+            rd->num_pars = rd->alloc_pars = rtf->num_pars;
+            /* same as HLPFILE_BrowseRecords does while generating */
+            for (index = 0; index < rtf->num_pars; index++)
+            {
+                if (relative > rtf->pars[index].offset)
+                    rd->char_pos_rel = rtf->pars[index].char_pos;
+            }
+            rd->done = rd->cached = rd->found_rel = TRUE;
+            rd->header_size = 0;
+            return TRUE;
+        }
+    }
+
+    rd->done = rd->cached = FALSE;
+    rd->data = rd->ptr = rd->where = HeapAlloc(GetProcessHeap(), 0, rd->allocated = 32768);
+    if (!rd->data) return FALSE;
 
     switch (hlpfile->charset)
     {
@@ -1798,61 +1662,131 @@ BOOL    HLPFILE_BrowsePage(HLPFILE_PAGE* page, struct RtfData* rd,
         if (!HLPFILE_RtfAddControl(rd, tmp)) return FALSE;
     }
     if (!HLPFILE_RtfAddControl(rd, "}")) return FALSE;
+    rd->header_size = rd->ptr - rd->data;
 
-    do
-    {
-        if (hlpfile->version <= 16)
-        {
-            index  = (ref - 0x0C) / hlpfile->dsize;
-            offset = (ref - 0x0C) % hlpfile->dsize;
-        }
-        else
-        {
-            index  = (ref - 0x0C) >> 14;
-            offset = (ref - 0x0C) & 0x3FFF;
-        }
+    return TRUE;
+}
 
-        if (hlpfile->version <= 16 && index != old_index && old_index != -1)
-        {
-            /* we jumped to the next block, adjust pointers */
-            ref -= 12;
-            offset -= 12;
-        }
+/***********************************************************************
+ *
+ *           HLPFILE_BrowseMore
+ *
+ * Adds the next paragraphs of the page to the RTF stream, until it has
+ * grown or the page is done.
+ */
+static BOOL HLPFILE_BrowseRecords(struct RtfData* rd)
+{
+    HLPFILE_PAGE *page = rd->page;
+    HLPFILE     *hlpfile = page->file;
+    BYTE        *buf, *end;
+    unsigned    offset, parlen;
+    SIZE_T      size = rd->ptr - rd->data;
 
-        if (index >= hlpfile->topic_maplen) {WINE_WARN("maplen\n"); break;}
-        buf = hlpfile->topic_map[index] + offset;
-        if (buf + 0x15 >= hlpfile->topic_end) {WINE_WARN("extra\n"); break;}
-        end = min(buf + GET_UINT(buf, 0), hlpfile->topic_end);
-        if (index != old_index) {offs = 0; old_index = index;}
+    while (!rd->done && (SIZE_T)(rd->ptr - rd->data) == size)
+    {
+        buf = HLPCORE_NextRecord(&hlpfile->topic, &rd->walk, &end);
+        if (!buf) return HLPFILE_BrowseDone(rd);
 
         switch (buf[0x14])
         {
         case HLP_TOPICHDR:
-            if (count++) goto done;
+            if (rd->count++) return HLPFILE_BrowseDone(rd);
             break;
         case HLP_DISPLAY30:
         case HLP_DISPLAY:
         case HLP_TABLE:
+            offset = rd->walk.index * 0x8000 + rd->walk.offs;
             if (!HLPFILE_BrowseParagraph(page, rd, buf, end, &parlen)) return FALSE;
-            if (relative > index * 0x8000 + offs)
+            if (!HLPFILE_RtfAddPar(rd, offset)) return FALSE;
+            if (rd->relative > offset)
                 rd->char_pos_rel = rd->char_pos;
-            offs += parlen;
+            else
+                rd->found_rel = TRUE;
+            rd->walk.offs += parlen;
             break;
         default:
             WINE_ERR("buf[0x14] = %x\n", buf[0x14]);
         }
-        if (hlpfile->version <= 16)
+    }
+    return TRUE;
+}
+
+BOOL    HLPFILE_BrowseMore(struct RtfData* rd)
+{
+    HLPFILE     *hlpfile = rd->page->file;
+    BOOL        ret;
+
+    /* the topic blocks are shared with the full text indexer */
+    EnterCriticalSection(&hlpfile->topic_cs);
+    ret = HLPFILE_BrowseRecords(rd);
+    LeaveCriticalSection(&hlpfile->topic_cs);
+    return ret;
+}
+
+/***********************************************************************
+ *
+ *           HLPFILE_EndBrowse
+ */
+void    HLPFILE_EndBrowse(struct RtfData* rd)
+{
+    if (!rd->cached)
+    {
+        HeapFree(GetProcessHeap(), 0, rd->data);
+        HeapFree(GetProcessHeap(), 0, rd->pars);
+    }
+    HLPFILE_FreeLinks(rd->first_link);
+    rd->first_link = NULL;
+}
+
+/***********************************************************************
+ *
+ *           HLPFILE_EnumTopicText
+ *
+ * Calls cb with the text of every paragraph, in file order, along with
+ * its page. Can be used from any thread once the file is loaded; stops
+ * when cb returns FALSE.
+ */
+BOOL    HLPFILE_EnumTopicText(HLPFILE* hlpfile, HLPFILE_TextCallback cb, void* cookie)
+{
+    HLPFILE_PAGE *page = NULL;
+    HLPCORE_TOPICWALK walk;
+    BYTE        *buf, *end;
+    char        *text;
+    LONG        size;
+    BOOL        ret = TRUE;
+
+    HLPCORE_StartWalk(&walk, 0x0C);
+    while (ret)
+    {
+        EnterCriticalSection(&hlpfile->topic_cs);
+        text = NULL;
+        buf = HLPCORE_NextRecord(&hlpfile->topic, &walk, &end);
+        if (buf)
         {
-            ref += GET_UINT(buf, 0xc);
-            if (GET_UINT(buf, 0xc) == 0)
+            switch (buf[0x14])
+            {
+            case HLP_TOPICHDR:
+                /* pages were added in this very order */
+                page = page ? page->next : hlpfile->first_page;
                 break;
+            case HLP_DISPLAY30:
+            case HLP_DISPLAY:
+            case HLP_TABLE:
+                if (page && buf + 0x19 <= end)
+                    text = HLPFILE_ParagraphText(hlpfile, buf, end, &size);
+                break;
+            }
         }
-        else
-            ref = GET_UINT(buf, 0xc);
-    } while (ref != 0xffffffff);
-done:
-    page->first_link = rd->first_link;
-    return HLPFILE_RtfAddControl(rd, "}");
+        LeaveCriticalSection(&hlpfile->topic_cs);
+        if (!buf) break;
+
+        if (text)
+        {
+            ret = cb(page, text, size, cookie);
+            HeapFree(GetProcessHeap(), 0, text);
+        }
+    }
+    return ret;
 }
 
 /******************************************************************
@@ -1981,31 +1915,26 @@ static BOOL HLPFILE_ReadFont(HLPFILE* hlpfile)
 
 /***********************************************************************
  *
- *           HLPFILE_ReadFileToBuffer
+ *           HLPFILE_MapFile
+ *
+ * Maps the whole file read-only, subfiles are then used in place.
  */
-static BOOL HLPFILE_ReadFileToBuffer(HLPFILE* hlpfile, HFILE hFile)
+static BOOL HLPFILE_MapFile(HLPFILE* hlpfile, HFILE hFile)
 {
-    BYTE  header[16], dummy[1];
-
-    if (_hread(hFile, header, 16) != 16) {WINE_WARN("header\n"); return FALSE;};
+    HANDLE      hMapping;
+    DWORD       size;
 
-    /* sanity checks */
-    if (GET_UINT(header, 0) != 0x00035F3F)
-    {WINE_WARN("wrong header\n"); return FALSE;};
+    size = GetFileSize(LongToHandle(hFile), NULL);
+    if (size == INVALID_FILE_SIZE || size < 16) {WINE_WARN("header\n"); return FALSE;}
 
-    hlpfile->file_buffer_size = GET_UINT(header, 12);
-    hlpfile->file_buffer = HeapAlloc(GetProcessHeap(), 0, hlpfile->file_buffer_size + 1);
+    hMapping = CreateFileMappingW(LongToHandle(hFile), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping) return FALSE;
+    hlpfile->file_buffer = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    /* the view keeps the mapping alive */
+    CloseHandle(hMapping);
     if (!hlpfile->file_buffer) return FALSE;
 
-    memcpy(hlpfile->file_buffer, header, 16);
-    if (_hread(hFile, hlpfile->file_buffer + 16, hlpfile->file_buffer_size - 16) !=hlpfile->file_buffer_size - 16)
-    {WINE_WARN("filesize1\n"); return FALSE;};
-
-    if (_hread(hFile, dummy, 1) != 0) WINE_WARN("filesize2\n");
-
-    hlpfile->file_buffer[hlpfile->file_buffer_size] = '\0'; /* FIXME: was '0', sounds backwards to me */
-
-    return TRUE;
+    return HLPCORE_CheckFile(hlpfile->file_buffer, size, &hlpfile->file_buffer_size);
 }
 
 /***********************************************************************
@@ -2017,49 +1946,19 @@ static BOOL HLPFILE_SystemCommands(HLPFILE* hlpfile)
     BYTE *buf, *ptr, *end;
     HLPFILE_MACRO *macro, **m;
     LPSTR p;
-    unsigned short magic, minor, major, flags;
+    unsigned short flags;
+    HLPCORE_SYSTEM sys;
 
     hlpfile->lpszTitle = NULL;
 
     if (!HLPFILE_FindSubFile(hlpfile, "|SYSTEM", &buf, &end)) return FALSE;
+    if (!HLPCORE_ReadSystem(buf, end, &sys)) return FALSE;
 
-    magic = GET_USHORT(buf + 9, 0);
-    minor = GET_USHORT(buf + 9, 2);
-    major = GET_USHORT(buf + 9, 4);
-    /* gen date on 4 bytes */
-    flags = GET_USHORT(buf + 9, 10);
-    WINE_TRACE("Got system header: magic=%04x version=%d.%d flags=%04x\n",
-               magic, major, minor, flags);
-    if (magic != 0x036C || major != 1)
-    {WINE_WARN("Wrong system header\n"); return FALSE;}
-    if (minor <= 16)
-    {
-        hlpfile->tbsize = 0x800;
-        hlpfile->compressed = FALSE;
-    }
-    else if (flags == 0)
-    {
-        hlpfile->tbsize = 0x1000;
-        hlpfile->compressed = FALSE;
-    }
-    else if (flags == 4)
-    {
-        hlpfile->tbsize = 0x1000;
-        hlpfile->compressed = TRUE;
-    }
-    else
-    {
-        hlpfile->tbsize = 0x800;
-        hlpfile->compressed = TRUE;
-    }
-
-    if (hlpfile->compressed)
-        hlpfile->dsize = 0x4000;
-    else
-        hlpfile->dsize = hlpfile->tbsize - 0x0C;
-
-    hlpfile->version = minor;
-    hlpfile->flags = flags;
+    hlpfile->tbsize = sys.tbsize;
+    hlpfile->dsize = sys.dsize;
+    hlpfile->compressed = sys.compressed;
+    hlpfile->version = sys.version;
+    hlpfile->flags = sys.flags;
     hlpfile->charset = DEFAULT_CHARSET;
 
     if (hlpfile->version <= 16)
@@ -2106,6 +2005,7 @@ static BOOL HLPFILE_SystemCommands(HLPFILE* hlpfile)
             p = (char*)macro + sizeof(HLPFILE_MACRO);
             strcpy(p, str);
             macro->lpszMacro = p;
+            macro->code = NULL;
             macro->next = 0;
             for (m = &hlpfile->first_macro; *m; m = &(*m)->next);
             *m = macro;
@@ -2185,15 +2085,11 @@ static BOOL HLPFILE_SystemCommands(HLPFILE* hlpfile)
 static BOOL HLPFILE_GetContext(HLPFILE *hlpfile)
 {
     BYTE                *cbuf, *cend;
-    unsigned            clen;
 
     if (!HLPFILE_FindSubFile(hlpfile, "|CONTEXT",  &cbuf, &cend))
     {WINE_WARN("context0\n"); return FALSE;}
 
-    clen = cend - cbuf;
-    hlpfile->Context = HeapAlloc(GetProcessHeap(), 0, clen);
-    if (!hlpfile->Context) return FALSE;
-    memcpy(hlpfile->Context, cbuf, clen);
+    hlpfile->Context = cbuf;
 
     return TRUE;
 }
@@ -2205,28 +2101,17 @@ static BOOL HLPFILE_GetContext(HLPFILE *hlpfile)
 static BOOL HLPFILE_GetKeywords(HLPFILE *hlpfile)
 {
     BYTE                *cbuf, *cend;
-    unsigned            clen;
 
     if (!HLPFILE_FindSubFile(hlpfile, "|KWBTREE", &cbuf, &cend)) return FALSE;
-    clen = cend - cbuf;
-    hlpfile->kwbtree = HeapAlloc(GetProcessHeap(), 0, clen);
-    if (!hlpfile->kwbtree) return FALSE;
-    memcpy(hlpfile->kwbtree, cbuf, clen);
+    hlpfile->kwbtree = cbuf;
 
     if (!HLPFILE_FindSubFile(hlpfile, "|KWDATA", &cbuf, &cend))
     {
         WINE_ERR("corrupted help file: kwbtree present but kwdata absent\n");
-        HeapFree(GetProcessHeap(), 0, hlpfile->kwbtree);
-        return FALSE;
-    }
-    clen = cend - cbuf;
-    hlpfile->kwdata = HeapAlloc(GetProcessHeap(), 0, clen);
-    if (!hlpfile->kwdata)
-    {
-        HeapFree(GetProcessHeap(), 0, hlpfile->kwdata);
+        hlpfile->kwbtree = NULL;
         return FALSE;
     }
-    memcpy(hlpfile->kwdata, cbuf, clen);
+    hlpfile->kwdata = cbuf;
 
     return TRUE;
 }
@@ -2268,9 +2153,7 @@ static BOOL HLPFILE_GetTOMap(HLPFILE *hlpfile)
     {WINE_WARN("no tomap section\n"); return FALSE;}
 
     clen = cend - cbuf - 9;
-    hlpfile->TOMap = HeapAlloc(GetProcessHeap(), 0, clen);
-    if (!hlpfile->TOMap) return FALSE;
-    memcpy(hlpfile->TOMap, cbuf+9, clen);
+    hlpfile->TOMap = cbuf + 9;
     hlpfile->wTOMapLen = clen/4;
     return TRUE;
 }
@@ -2286,6 +2169,7 @@ static void HLPFILE_DeleteMacro(HLPFILE_MACRO* macro)
     while (macro)
     {
         next = macro->next;
+        MACRO_FreeCode(macro->code);
         HeapFree(GetProcessHeap(), 0, macro);
         macro = next;
     }
@@ -2303,6 +2187,7 @@ static void HLPFILE_DeletePage(HLPFILE_PAGE* page)
     {
         next = page->next;
         HLPFILE_DeleteMacro(page->first_macro);
+        HLPFILE_FreeLinks(page->first_link);
         HeapFree(GetProcessHeap(), 0, page);
         page = next;
     }
@@ -2315,9 +2200,14 @@ static void HLPFILE_DeletePage(HLPFILE_PAGE* page)
 void HLPFILE_FreeHlpFile(HLPFILE* hlpfile)
 {
     unsigned i;
+    HLPFILE_RTF* rtf;
+    HLPFILE_GFX* gfx;
 
     if (!hlpfile || --hlpfile->wRefCount > 0) return;
 
+    /* stop the indexer before anything it reads goes away */
+    FTS_Close(hlpfile);
+
     if (hlpfile->next) hlpfile->next->prev = hlpfile->prev;
     if (hlpfile->prev) hlpfile->prev->next = hlpfile->next;
     else first_hlpfile = hlpfile->next;
@@ -2340,207 +2230,152 @@ void HLPFILE_FreeHlpFile(HLPFILE* hlpfile)
         HeapFree(GetProcessHeap(), 0, hlpfile->bmps);
     }
 
+    while ((rtf = hlpfile->first_rtf))
+    {
+        hlpfile->first_rtf = rtf->next;
+        HeapFree(GetProcessHeap(), 0, rtf->pars);
+        HeapFree(GetProcessHeap(), 0, rtf->data);
+        HeapFree(GetProcessHeap(), 0, rtf);
+    }
+    while ((gfx = hlpfile->first_gfx))
+    {
+        hlpfile->first_gfx = gfx->next;
+        HeapFree(GetProcessHeap(), 0, gfx);
+    }
     HLPFILE_DeletePage(hlpfile->first_page);
+    HeapFree(GetProcessHeap(), 0, hlpfile->page_index);
     HLPFILE_DeleteMacro(hlpfile->first_macro);
 
     DestroyIcon(hlpfile->hIcon);
     if (hlpfile->numWindows)    HeapFree(GetProcessHeap(), 0, hlpfile->windows);
-    HeapFree(GetProcessHeap(), 0, hlpfile->Context);
     HeapFree(GetProcessHeap(), 0, hlpfile->Map);
     HeapFree(GetProcessHeap(), 0, hlpfile->lpszTitle);
     HeapFree(GetProcessHeap(), 0, hlpfile->lpszCopyright);
-    HeapFree(GetProcessHeap(), 0, hlpfile->file_buffer);
-    HeapFree(GetProcessHeap(), 0, hlpfile->phrases_offsets);
-    HeapFree(GetProcessHeap(), 0, hlpfile->phrases_buffer);
-    HeapFree(GetProcessHeap(), 0, hlpfile->topic_map);
+    if (hlpfile->file_buffer) UnmapViewOfFile(hlpfile->file_buffer);
+    HLPCORE_FreePhrases(&hlpfile->phrases);
+    HLPCORE_CloseTopic(&hlpfile->topic);
+    DeleteCriticalSection(&hlpfile->topic_cs);
     HeapFree(GetProcessHeap(), 0, hlpfile->help_on_file);
     HeapFree(GetProcessHeap(), 0, hlpfile);
 }
 
-/***********************************************************************
- *
- *           HLPFILE_UncompressLZ77_Phrases
- */
-static BOOL HLPFILE_UncompressLZ77_Phrases(HLPFILE* hlpfile)
+typedef struct
 {
-    UINT i, num, dec_size, head_size;
-    BYTE *buf, *end;
-
-    if (!HLPFILE_FindSubFile(hlpfile, "|Phrases", &buf, &end)) return FALSE;
-
-    if (hlpfile->version <= 16)
-        head_size = 13;
-    else
-        head_size = 17;
-
-    num = hlpfile->num_phrases = GET_USHORT(buf, 9);
-    if (buf + 2 * num + 0x13 >= end) {WINE_WARN("1a\n"); return FALSE;};
-
-    if (hlpfile->version <= 16)
-        dec_size = end - buf - 15 - 2 * num;
-    else
-        dec_size = HLPFILE_UncompressedLZ77_Size(buf + 0x13 + 2 * num, end);
-
-    hlpfile->phrases_offsets = HeapAlloc(GetProcessHeap(), 0, sizeof(unsigned) * (num + 1));
-    hlpfile->phrases_buffer  = HeapAlloc(GetProcessHeap(), 0, dec_size);
-    if (!hlpfile->phrases_offsets || !hlpfile->phrases_buffer)
-    {
-        HeapFree(GetProcessHeap(), 0, hlpfile->phrases_offsets);
-        HeapFree(GetProcessHeap(), 0, hlpfile->phrases_buffer);
-        return FALSE;
-    }
+    HLPFILE*    hlpfile;
+    LONG        next;           /* next block to take */
+    LONG        last;
+    LONG        pending;        /* queued workers still running */
+    HANDLE      done;
+} HLPFILE_TOPIC_BATCH;
+
+static void HLPFILE_DecodeTopicBatch(HLPFILE_TOPIC_BATCH* batch)
+{
+    LONG        index;
 
-    for (i = 0; i <= num; i++)
-        hlpfile->phrases_offsets[i] = GET_USHORT(buf, head_size + 2 * i) - 2 * num - 2;
+    /* Each thread takes the next free block, so slow blocks don't hold
+     * up the others */
+    while ((index = InterlockedIncrement(&batch->next) - 1) < batch->last)
+        HLPCORE_DecodeTopicBlock(&batch->hlpfile->topic, index);
+}
 
-    if (hlpfile->version <= 16)
-        memcpy(hlpfile->phrases_buffer, buf + 15 + 2*num, dec_size);
-    else
-        HLPFILE_UncompressLZ77(buf + 0x13 + 2 * num, end, (BYTE*)hlpfile->phrases_buffer);
+static DWORD WINAPI HLPFILE_TopicBatchWorker(LPVOID arg)
+{
+    HLPFILE_TOPIC_BATCH*        batch = arg;
 
-    hlpfile->hasPhrases = TRUE;
-    return TRUE;
+    HLPFILE_DecodeTopicBatch(batch);
+    if (!InterlockedDecrement(&batch->pending)) SetEvent(batch->done);
+    return 0;
 }
 
 /***********************************************************************
  *
- *           HLPFILE_Uncompress_Phrases40
+ *           HLPFILE_PrefetchTopicBlocks
+ *
+ * Decodes block index and the undecoded blocks following it on
+ * topic_threads threads. All of them but index are added to the cache,
+ * the caller does it for index.
  */
-static BOOL HLPFILE_Uncompress_Phrases40(HLPFILE* hlpfile)
+static void HLPFILE_PrefetchTopicBlocks(HLPFILE* hlpfile, unsigned index)
 {
-    UINT num;
-    INT dec_size, cpr_size;
-    BYTE *buf_idx, *end_idx;
-    BYTE *buf_phs, *end_phs;
-    ULONG* ptr, mask = 0;
-    unsigned int i;
-    unsigned short bc, n;
+    HLPFILE_TOPIC_BATCH         batch;
+    unsigned                    count, limit, workers, i;
 
-    if (!HLPFILE_FindSubFile(hlpfile, "|PhrIndex", &buf_idx, &end_idx) ||
-        !HLPFILE_FindSubFile(hlpfile, "|PhrImage", &buf_phs, &end_phs)) return FALSE;
+    /* The batch must fit in the cache along with what is being used */
+    limit = min(hlpfile->topic_threads * 4, HLPFILE_TOPIC_CACHE / 2 / max(hlpfile->dsize, 1));
+    limit = max(limit, 1);
+    for (count = 0; count < limit && index + count < hlpfile->topic.maplen; count++)
+        if (hlpfile->topic.blocks[index + count].data) break;
 
-    ptr = (ULONG*)(buf_idx + 9 + 28);
-    bc = GET_USHORT(buf_idx, 9 + 24) & 0x0F;
-    num = hlpfile->num_phrases = GET_USHORT(buf_idx, 9 + 4);
+    batch.hlpfile = hlpfile;
+    batch.next    = index;
+    batch.last    = index + count;
+    batch.done    = count > 1 ? CreateEventW(NULL, TRUE, FALSE, NULL) : NULL;
 
-    WINE_TRACE("Index: Magic=%08x #entries=%u CpsdSize=%u PhrImgSize=%u\n"
-               "\tPhrImgCprsdSize=%u 0=%u bc=%x ukn=%x\n",
-               GET_UINT(buf_idx, 9 + 0),
-               GET_UINT(buf_idx, 9 + 4),
-               GET_UINT(buf_idx, 9 + 8),
-               GET_UINT(buf_idx, 9 + 12),
-               GET_UINT(buf_idx, 9 + 16),
-               GET_UINT(buf_idx, 9 + 20),
-               GET_USHORT(buf_idx, 9 + 24),
-               GET_USHORT(buf_idx, 9 + 26));
-
-    dec_size = GET_UINT(buf_idx, 9 + 12);
-    cpr_size = GET_UINT(buf_idx, 9 + 16);
-
-    if (dec_size != cpr_size &&
-        dec_size != HLPFILE_UncompressedLZ77_Size(buf_phs + 9, end_phs))
+    workers = batch.done ? min(hlpfile->topic_threads, count) - 1 : 0;
+    batch.pending = workers;
+    for (i = 0; i < workers; i++)
     {
-        WINE_WARN("size mismatch %u %u\n",
-                  dec_size, HLPFILE_UncompressedLZ77_Size(buf_phs + 9, end_phs));
-        dec_size = max(dec_size, HLPFILE_UncompressedLZ77_Size(buf_phs + 9, end_phs));
+        if (!QueueUserWorkItem(HLPFILE_TopicBatchWorker, &batch, WT_EXECUTEDEFAULT) &&
+            !InterlockedDecrement(&batch.pending))
+            SetEvent(batch.done);
     }
 
-    hlpfile->phrases_offsets = HeapAlloc(GetProcessHeap(), 0, sizeof(unsigned) * (num + 1));
-    hlpfile->phrases_buffer  = HeapAlloc(GetProcessHeap(), 0, dec_size);
-    if (!hlpfile->phrases_offsets || !hlpfile->phrases_buffer)
+    HLPFILE_DecodeTopicBatch(&batch);
+    if (batch.done)
     {
-        HeapFree(GetProcessHeap(), 0, hlpfile->phrases_offsets);
-        HeapFree(GetProcessHeap(), 0, hlpfile->phrases_buffer);
-        return FALSE;
+        if (workers) WaitForSingleObject(batch.done, INFINITE);
+        CloseHandle(batch.done);
     }
 
-#define getbit() ((mask <<= 1) ? (*ptr & mask) != 0: (*++ptr & (mask=1)) != 0)
-
-    hlpfile->phrases_offsets[0] = 0;
-    ptr--; /* as we'll first increment ptr because mask is 0 on first getbit() call */
-    for (i = 0; i < num; i++)
+    /* Backwards, so that the blocks come out of the list in file order */
+    for (i = count - 1; i > 0; i--)
     {
-        for (n = 1; getbit(); n += 1 << bc);
-        if (getbit()) n++;
-        if (bc > 1 && getbit()) n += 2;
-        if (bc > 2 && getbit()) n += 4;
-        if (bc > 3 && getbit()) n += 8;
-        if (bc > 4 && getbit()) n += 16;
-        hlpfile->phrases_offsets[i + 1] = hlpfile->phrases_offsets[i] + n;
+        if (hlpfile->topic.blocks[index + i].data)
+            HLPCORE_CacheTopicBlock(&hlpfile->topic, &hlpfile->topic.blocks[index + i]);
     }
-#undef getbit
+}
 
-    if (dec_size == cpr_size)
-        memcpy(hlpfile->phrases_buffer, buf_phs + 9, dec_size);
-    else
-        HLPFILE_UncompressLZ77(buf_phs + 9, end_phs, (BYTE*)hlpfile->phrases_buffer);
+/***********************************************************************
+ *
+ *           HLPFILE_DecodeTopicBlocks
+ *
+ * Decodes a missing topic block for HLPCORE_TopicBlock, along with the
+ * following ones while the file is being scanned.
+ */
+static void HLPFILE_DecodeTopicBlocks(HLPCORE_TOPIC* topic, unsigned index)
+{
+    HLPFILE*    hlpfile = CONTAINING_RECORD(topic, HLPFILE, topic);
 
-    hlpfile->hasPhrases40 = TRUE;
-    return TRUE;
+    if (hlpfile->topic_threads > 1)
+        HLPFILE_PrefetchTopicBlocks(hlpfile, index);
+    else
+        HLPCORE_DecodeTopicBlock(topic, index);
 }
 
 /***********************************************************************
  *
  *           HLPFILE_Uncompress_Topic
+ *
+ * Only sets up the block table: topic blocks are decompressed when first
+ * touched, see HLPFILE_DecodeTopicBlocks.
  */
 static BOOL HLPFILE_Uncompress_Topic(HLPFILE* hlpfile)
 {
-    BYTE *buf, *ptr, *end, *newptr;
-    unsigned int i, newsize = 0;
-    unsigned int topic_size;
-
-    if (!HLPFILE_FindSubFile(hlpfile, "|TOPIC", &buf, &end))
-    {WINE_WARN("topic0\n"); return FALSE;}
-
-    buf += 9; /* Skip file header */
-    topic_size = end - buf;
-    if (hlpfile->compressed)
-    {
-        hlpfile->topic_maplen = (topic_size - 1) / hlpfile->tbsize + 1;
-
-        for (i = 0; i < hlpfile->topic_maplen; i++)
-        {
-            ptr = buf + i * hlpfile->tbsize;
-
-            /* I don't know why, it's necessary for printman.hlp */
-            if (ptr + 0x44 > end) ptr = end - 0x44;
-
-            newsize += HLPFILE_UncompressedLZ77_Size(ptr + 0xc, min(end, ptr + hlpfile->tbsize));
-        }
-
-        hlpfile->topic_map = HeapAlloc(GetProcessHeap(), 0,
-                                       hlpfile->topic_maplen * sizeof(hlpfile->topic_map[0]) + newsize);
-        if (!hlpfile->topic_map) return FALSE;
-        newptr = (BYTE*)(hlpfile->topic_map + hlpfile->topic_maplen);
-        hlpfile->topic_end = newptr + newsize;
-
-        for (i = 0; i < hlpfile->topic_maplen; i++)
-        {
-            ptr = buf + i * hlpfile->tbsize;
-            if (ptr + 0x44 > end) ptr = end - 0x44;
+    HLPCORE_SYSTEM      sys;
+
+    sys.version    = hlpfile->version;
+    sys.flags      = hlpfile->flags;
+    sys.tbsize     = hlpfile->tbsize;
+    sys.dsize      = hlpfile->dsize;
+    sys.compressed = hlpfile->compressed;
+    if (!HLPCORE_OpenTopic(hlpfile->file_buffer, hlpfile->file_buffer_size, &sys, &hlpfile->topic))
+        return FALSE;
 
-            hlpfile->topic_map[i] = newptr;
-            newptr = HLPFILE_UncompressLZ77(ptr + 0xc, min(end, ptr + hlpfile->tbsize), newptr);
-        }
-    }
-    else
-    {
-        /* basically, we need to copy the TopicBlockSize byte pages
-         * (removing the first 0x0C) in one single area in memory
-         */
-        hlpfile->topic_maplen = (topic_size - 1) / hlpfile->tbsize + 1;
-        hlpfile->topic_map = HeapAlloc(GetProcessHeap(), 0,
-                                       hlpfile->topic_maplen * (sizeof(hlpfile->topic_map[0]) + hlpfile->dsize));
-        if (!hlpfile->topic_map) return FALSE;
-        newptr = (BYTE*)(hlpfile->topic_map + hlpfile->topic_maplen);
-        hlpfile->topic_end = newptr + topic_size;
-
-        for (i = 0; i < hlpfile->topic_maplen; i++)
-        {
-            hlpfile->topic_map[i] = newptr + i * hlpfile->dsize;
-            memcpy(hlpfile->topic_map[i], buf + i * hlpfile->tbsize + 0x0C, hlpfile->dsize);
-        }
-    }
+    if (hlpfile->hasPhrases || hlpfile->hasPhrases40)
+        hlpfile->topic.phrases = &hlpfile->phrases;
+    hlpfile->topic.phrases40 = hlpfile->hasPhrases40;
+    hlpfile->topic.cache_size = HLPFILE_TOPIC_CACHE;
+    hlpfile->topic.decode = HLPFILE_DecodeTopicBlocks;
     return TRUE;
 }
 
@@ -2551,39 +2386,17 @@ static BOOL HLPFILE_Uncompress_Topic(HLPFILE* hlpfile)
 static BOOL HLPFILE_AddPage(HLPFILE *hlpfile, const BYTE *buf, const BYTE *end, unsigned ref, unsigned offset)
 {
     HLPFILE_PAGE* page;
-    const BYTE*   title;
-    UINT          titlesize, blocksize, datalen;
+    LONG          titlesize;
     char*         ptr;
     HLPFILE_MACRO*macro;
 
-    blocksize = GET_UINT(buf, 0);
-    datalen = GET_UINT(buf, 0x10);
-    title = buf + datalen;
-    if (title > end) {WINE_WARN("page2\n"); return FALSE;};
+    titlesize = HLPCORE_RecordTextSize(buf, end);
+    if (titlesize < 0) {WINE_WARN("page2\n"); return FALSE;};
 
-    titlesize = GET_UINT(buf, 4);
     page = HeapAlloc(GetProcessHeap(), 0, sizeof(HLPFILE_PAGE) + titlesize + 1);
     if (!page) return FALSE;
     page->lpszTitle = (char*)page + sizeof(HLPFILE_PAGE);
-
-    if (titlesize > blocksize - datalen)
-    {
-        /* need to decompress */
-        if (hlpfile->hasPhrases)
-            HLPFILE_Uncompress2(hlpfile, title, end, (BYTE*)page->lpszTitle, (BYTE*)page->lpszTitle + titlesize);
-        else if (hlpfile->hasPhrases40)
-            HLPFILE_Uncompress3(hlpfile, page->lpszTitle, page->lpszTitle + titlesize, title, end);
-        else
-        {
-            WINE_FIXME("Text size is too long, splitting\n");
-            titlesize = blocksize - datalen;
-            memcpy(page->lpszTitle, title, titlesize);
-        }
-    }
-    else
-        memcpy(page->lpszTitle, title, titlesize);
-
-    page->lpszTitle[titlesize] = '\0';
+    titlesize = HLPCORE_RecordText(&hlpfile->topic, buf, end, page->lpszTitle);
 
     if (hlpfile->first_page)
     {
@@ -2611,15 +2424,15 @@ static BOOL HLPFILE_AddPage(HLPFILE *hlpfile, const BYTE *buf, const BYTE *end,
 
     if (hlpfile->version <= 16)
     {
-        if (page->browse_bwd == 0xFFFF || page->browse_bwd == 0xFFFFFFFF)
+        if (page->browse_bwd >= hlpfile->wTOMapLen)
             page->browse_bwd = 0xFFFFFFFF;
         else
-            page->browse_bwd = hlpfile->TOMap[page->browse_bwd];
+            page->browse_bwd = GET_UINT(hlpfile->TOMap, page->browse_bwd * 4);
 
-        if (page->browse_fwd == 0xFFFF || page->browse_fwd == 0xFFFFFFFF)
+        if (page->browse_fwd >= hlpfile->wTOMapLen)
             page->browse_fwd = 0xFFFFFFFF;
         else
-            page->browse_fwd = hlpfile->TOMap[page->browse_fwd];
+            page->browse_fwd = GET_UINT(hlpfile->TOMap, page->browse_fwd * 4);
     }
 
     WINE_TRACE("Added page[%d]: title=%s %08x << %08x >> %08x\n",
@@ -2636,6 +2449,7 @@ static BOOL HLPFILE_AddPage(HLPFILE *hlpfile, const BYTE *buf, const BYTE *end,
         WINE_TRACE("macro: %s\n", debugstr_a(ptr));
         macro = HeapAlloc(GetProcessHeap(), 0, sizeof(HLPFILE_MACRO) + len + 1);
         macro->lpszMacro = macro_str = (char*)(macro + 1);
+        macro->code = NULL;
         memcpy(macro_str, ptr, len + 1);
         /* FIXME: shall we really link macro in reverse order ??
          * may produce strange results when played at page opening
@@ -2679,14 +2493,15 @@ static BOOL HLPFILE_DoReadHlpFile(HLPFILE *hlpfile, LPCSTR lpszPath)
     BOOL        ret;
     HFILE       hFile;
     OFSTRUCT    ofs;
-    BYTE*       buf;
-    DWORD       ref = 0x0C;
-    unsigned    index, old_index, offset, len, offs, topicoffset;
+    SYSTEM_INFO si;
+    HLPCORE_TOPICWALK walk;
+    BYTE        *buf, *end;
+    unsigned    len, topicoffset;
 
     hFile = OpenFile(lpszPath, &ofs, OF_READ);
     if (hFile == HFILE_ERROR) return FALSE;
 
-    ret = HLPFILE_ReadFileToBuffer(hlpfile, hFile);
+    ret = HLPFILE_MapFile(hlpfile, hFile);
     _lclose(hFile);
     if (!ret) return FALSE;
 
@@ -2695,74 +2510,47 @@ static BOOL HLPFILE_DoReadHlpFile(HLPFILE *hlpfile, LPCSTR lpszPath)
     if (hlpfile->version <= 16 && !HLPFILE_GetTOMap(hlpfile)) return FALSE;
 
     /* load phrases support */
-    if (!HLPFILE_UncompressLZ77_Phrases(hlpfile))
-        HLPFILE_Uncompress_Phrases40(hlpfile);
+    if (HLPCORE_LoadPhrases(hlpfile->file_buffer, hlpfile->file_buffer_size, hlpfile->version, &hlpfile->phrases))
+        hlpfile->hasPhrases = TRUE;
+    else if (HLPCORE_LoadPhrases40(hlpfile->file_buffer, hlpfile->file_buffer_size, &hlpfile->phrases))
+        hlpfile->hasPhrases40 = TRUE;
 
     if (!HLPFILE_Uncompress_Topic(hlpfile)) return FALSE;
     if (!HLPFILE_ReadFont(hlpfile)) return FALSE;
 
-    old_index = -1;
-    offs = 0;
-    do
-    {
-        BYTE*   end;
-
-        if (hlpfile->version <= 16)
-        {
-            index  = (ref - 0x0C) / hlpfile->dsize;
-            offset = (ref - 0x0C) % hlpfile->dsize;
-        }
-        else
-        {
-            index  = (ref - 0x0C) >> 14;
-            offset = (ref - 0x0C) & 0x3FFF;
-        }
-
-        if (hlpfile->version <= 16 && index != old_index && old_index != -1)
-        {
-            /* we jumped to the next block, adjust pointers */
-            ref -= 12;
-            offset -= 12;
-        }
-
-        WINE_TRACE("ref=%08x => [%u/%u]\n", ref, index, offset);
-
-        if (index >= hlpfile->topic_maplen) {WINE_WARN("maplen\n"); break;}
-        buf = hlpfile->topic_map[index] + offset;
-        if (buf + 0x15 >= hlpfile->topic_end) {WINE_WARN("extra\n"); break;}
-        end = min(buf + GET_UINT(buf, 0), hlpfile->topic_end);
-        if (index != old_index) {offs = 0; old_index = index;}
+    /* The scan below goes through every block, decode them on all CPUs */
+    GetSystemInfo(&si);
+    hlpfile->topic_threads = si.dwNumberOfProcessors;
 
+    HLPCORE_StartWalk(&walk, 0x0C);
+    while ((buf = HLPCORE_NextRecord(&hlpfile->topic, &walk, &end)))
+    {
         switch (buf[0x14])
 	{
 	case HLP_TOPICHDR: /* Topic Header */
             if (hlpfile->version <= 16)
-                topicoffset = ref + index * 12;
+                topicoffset = walk.rec + walk.index * 12;
             else
-                topicoffset = index * 0x8000 + offs;
-            if (!HLPFILE_AddPage(hlpfile, buf, end, ref, topicoffset)) return FALSE;
+                topicoffset = walk.index * 0x8000 + walk.offs;
+            if (!HLPFILE_AddPage(hlpfile, buf, end, walk.rec, topicoffset)) return FALSE;
             break;
 
 	case HLP_DISPLAY30:
 	case HLP_DISPLAY:
 	case HLP_TABLE:
             if (!HLPFILE_SkipParagraph(hlpfile, buf, end, &len)) return FALSE;
-            offs += len;
+            walk.offs += len;
             break;
 
 	default:
             WINE_ERR("buf[0x14] = %x\n", buf[0x14]);
 	}
+    }
 
-        if (hlpfile->version <= 16)
-        {
-            ref += GET_UINT(buf, 0xc);
-            if (GET_UINT(buf, 0xc) == 0)
-                break;
-        }
-        else
-            ref = GET_UINT(buf, 0xc);
-    } while (ref != 0xffffffff);
+    /* Pages are then rendered one at a time */
+    hlpfile->topic_threads = 1;
+
+    if (!HLPFILE_IndexPages(hlpfile)) return FALSE;
 
     HLPFILE_GetKeywords(hlpfile);
     HLPFILE_GetMap(hlpfile);
@@ -2797,6 +2585,7 @@ HLPFILE *HLPFILE_ReadHlpFile(LPCSTR lpszPath)
     hlpfile->wRefCount          = 1;
 
     strcpy(hlpfile->lpszPath, lpszPath);
+    InitializeCriticalSection(&hlpfile->topic_cs);
 
     first_hlpfile = hlpfile;
     if (hlpfile->next) hlpfile->next->prev = hlpfile;
@@ -2806,6 +2595,7 @@ HLPFILE *HLPFILE_ReadHlpFile(LPCSTR lpszPath)
         HLPFILE_FreeHlpFile(hlpfile);
         hlpfile = 0;
     }
+    else FTS_Open(hlpfile);
 
     return hlpfile;
 }
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include "hlpcore.h"
+
 struct tagHelpFile;
 
 typedef struct 
@@ -47,6 +49,7 @@ typedef struct tagHlpFileLink
     unsigned    window;         /* window number for displaying the link (-1 is current) */
     DWORD       cpMin;
     DWORD       cpMax;
+    struct tagMacroCode* code;  /* compiled string of hlp_link_macro (NULL until run) */
     struct tagHlpFileLink* next;
 } HLPFILE_LINK;
 
@@ -62,6 +65,7 @@ typedef struct tagHlpFileHotSpotLink
 typedef struct tagHlpFileMacro
 {
     LPCSTR                      lpszMacro;
+    struct tagMacroCode*        code;           /* compiled lpszMacro (NULL until run) */
     struct tagHlpFileMacro*     next;
 } HLPFILE_MACRO;
 
@@ -84,6 +88,47 @@ typedef struct tagHlpFilePage
     struct tagHlpFileFile*      file;
 } HLPFILE_PAGE;
 
+/* start of a paragraph of a page, to find where a jump into the page lands */
+typedef struct
+{
+    unsigned                    offset;         /* relative offset of the paragraph */
+    unsigned                    char_pos;       /* char_pos after the paragraph */
+} HLPFILE_RTFPAR;
+
+/* generated RTF of a page, for any jump into it */
+typedef struct tagHlpFileRtf
+{
+    HLPFILE_PAGE*               page;
+    unsigned                    font_scale;
+    HLPFILE_RTFPAR*             pars;
+    unsigned                    num_pars;
+    char*                       data;
+    unsigned                    size;
+    struct tagHlpFileRtf*       next;           /* less recently used */
+} HLPFILE_RTF;
+
+#define HLPFILE_RTF_CACHE       (1024 * 1024)
+
+/* RTF of a decoded |bm picture, shared by all the pages showing it */
+typedef struct tagHlpFileGfx
+{
+    unsigned                    index;
+    char*                       data;
+    unsigned                    size;
+    struct tagHlpFileGfx*       next;           /* less recently used */
+} HLPFILE_GFX;
+
+#define HLPFILE_GFX_CACHE       (4 * 1024 * 1024)
+
+typedef struct
+{
+    LONG                        lHash;
+    HLPFILE_PAGE*               page;
+    ULONG                       relative;
+} HLPFILE_HASHENTRY;
+
+#define HLPFILE_HASH_CACHE      256
+
 typedef struct
 {
     LONG                        lMap;
@@ -99,21 +144,28 @@ typedef struct
 
 typedef struct tagHlpFileFile
 {
-    BYTE*                       file_buffer;
+    BYTE*                       file_buffer;    /* read-only view of the file */
     UINT                        file_buffer_size;
     LPSTR                       lpszPath;
     LPSTR                       lpszTitle;
     LPSTR                       lpszCopyright;
     HLPFILE_PAGE*               first_page;
     HLPFILE_PAGE*               last_page;
+    HLPFILE_PAGE**              page_index;     /* sorted by offset */
+    unsigned                    num_pages;
+    HLPFILE_HASHENTRY           hash_cache[HLPFILE_HASH_CACHE]; /* PageByHash results */
+    HLPFILE_RTF*                first_rtf;      /* most recently used first */
+    unsigned                    rtf_cached;     /* bytes of RTF in the list */
+    HLPFILE_GFX*                first_gfx;      /* most recently used first */
+    unsigned                    gfx_cached;     /* bytes of RTF in the list */
     HLPFILE_MACRO*              first_macro;
-    BYTE*                       Context;
+    BYTE*                       Context;        /* subfiles, in file_buffer */
     BYTE*                       kwbtree;
     BYTE*                       kwdata;
     unsigned                    wMapLen;
     HLPFILE_MAP*                Map;
     unsigned                    wTOMapLen;
-    unsigned*                   TOMap;
+    BYTE*                       TOMap;          /* wTOMapLen topic offsets */
     unsigned long               contents_start;
 
     struct tagHlpFileFile*      prev;
@@ -129,13 +181,13 @@ typedef struct tagHlpFileFile
     BOOL                        compressed;
     BOOL                        hasPhrases;   /* file has |Phrases */
     BOOL                        hasPhrases40; /* file has |PhrIndex/|PhrImage */
-    UINT                        num_phrases;
-    unsigned*                   phrases_offsets;
-    char*                       phrases_buffer;
+    HLPCORE_PHRASES             phrases;
+
+    HLPCORE_TOPIC               topic;          /* blocks decompressed on demand */
+    UINT                        topic_threads;  /* decoding blocks ahead on >1 threads */
+    CRITICAL_SECTION            topic_cs;       /* topic blocks, shared with the indexer */
 
-    BYTE**                      topic_map;
-    BYTE*                       topic_end;
-    UINT                        topic_maplen;
+    struct tagFtsIndex*         fts;            /* full text index */
 
     unsigned                    numBmps;
     HBITMAP*                    bmps;
@@ -156,28 +208,6 @@ typedef struct tagHlpFileFile
     int                         rounderr;
 } HLPFILE;
 
-/*
- * Compare function type for HLPFILE_BPTreeSearch function.
- *
- * PARAMS
- *     p       [I] pointer to testing block (key + data)
- *     key     [I] pointer to key value to look for
- *     leaf    [I] whether this function called for index of leaf page
- *     next    [O] pointer to pointer to next block
- */
-typedef int (*HLPFILE_BPTreeCompare)(void *p, const void *key,
-                                     int leaf, void **next);
-
-/*
- * Callback function type for HLPFILE_BPTreeEnum function.
- *
- * PARAMS
- *     p       [I]  pointer to data block
- *     next    [O]  pointer to pointer to next block
- *     cookie  [IO] cookie data
- */
-typedef void (*HLPFILE_BPTreeCallback)(void *p, void **next, void *cookie);
-
 HLPFILE*      HLPFILE_ReadHlpFile(LPCSTR lpszPath);
 HLPFILE_PAGE* HLPFILE_PageByHash(HLPFILE* hlpfile, LONG lHash, ULONG* relative);
 HLPFILE_PAGE* HLPFILE_PageByMap(HLPFILE* hlpfile, LONG lMap, ULONG* relative);
@@ -200,10 +230,28 @@ struct RtfData {
     BOOL        force_color;
     unsigned    relative;       /* offset within page to lookup for */
     unsigned    char_pos_rel;   /* char_pos correspondinf to relative */
+    HLPFILE_RTFPAR* pars;       /* paragraphs generated so far */
+    unsigned    num_pars;
+    unsigned    alloc_pars;
+    HLPFILE_PAGE* page;         /* page being generated */
+    HLPCORE_TOPICWALK walk;     /* next topic record of the page */
+    unsigned    count;
+    BOOL        done;           /* the whole page is in data */
+    BOOL        cached;         /* data belongs to the page cache */
+    BOOL        found_rel;      /* char_pos_rel won't change anymore */
+    unsigned    header_size;    /* bytes of data before the first paragraph */
+    char        char_format[128]; /* character formatting in effect at ptr */
 };
 
 BOOL          HLPFILE_BrowsePage(HLPFILE_PAGE*, struct RtfData* rd,
                                  unsigned font_scale, unsigned relative);
+BOOL          HLPFILE_BrowseMore(struct RtfData* rd);
+void          HLPFILE_EndBrowse(struct RtfData* rd);
+
+/* text is size bytes of NUL separated strings; return FALSE to stop */
+typedef BOOL (*HLPFILE_TextCallback)(HLPFILE_PAGE* page, const char* text, unsigned size, void* cookie);
+
+BOOL          HLPFILE_EnumTopicText(HLPFILE* hlpfile, HLPFILE_TextCallback cb, void* cookie);
 
 #define HLP_DISPLAY30 0x01     /* version 3.0 displayable information */
 #define HLP_TOPICHDR  0x02     /* topic header information */
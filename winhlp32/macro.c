@@ -46,8 +46,61 @@ struct MacroDesc {
 static struct MacroDesc*MACRO_Loaded /* = NULL */;
 static unsigned         MACRO_NumLoaded /* = 0 */;
 
+/* Open addressing tables of index + 1 in the descriptors (0 for a free
+ * slot), hashed on the case folded name and on the alias.
+ */
+#define MACRO_BUILTIN_HASH      256     /* power of 2, twice the builtins and aliases */
+static unsigned         MACRO_BuiltinHash[MACRO_BUILTIN_HASH];
+static unsigned*        MACRO_LoadedHash /* = NULL */;
+static unsigned         MACRO_LoadedHashSize /* = 0 */;
+
 /*******      helper functions     *******/
 
+static unsigned MACRO_HashName(const char* name)
+{
+    unsigned    h = 2166136261u;
+    char        ch;
+
+    for (; (ch = *name); name++)
+    {
+        if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+        h = (h ^ (BYTE)ch) * 16777619u;
+    }
+    return h;
+}
+
+static struct MacroDesc* MACRO_HashFind(struct MacroDesc* descs, const unsigned* hash, unsigned size,
+                                        const char* name)
+{
+    struct MacroDesc*   md;
+    unsigned            i;
+
+    for (i = MACRO_HashName(name) & (size - 1); hash[i]; i = (i + 1) & (size - 1))
+    {
+        md = &descs[hash[i] - 1];
+        if (strcasecmp(md->name, name) == 0 || (md->alias != NULL && strcasecmp(md->alias, name) == 0))
+            return md;
+    }
+    return NULL;
+}
+
+static void MACRO_HashAdd(struct MacroDesc* descs, unsigned* hash, unsigned size,
+                          const char* name, unsigned idx)
+{
+    unsigned    i;
+
+    /* the first declaration wins, as with a linear search */
+    if (MACRO_HashFind(descs, hash, size, name)) return;
+    for (i = MACRO_HashName(name) & (size - 1); hash[i]; i = (i + 1) & (size - 1));
+    hash[i] = idx + 1;
+}
+
+static void MACRO_HashInsert(struct MacroDesc* descs, unsigned* hash, unsigned size, unsigned idx)
+{
+    MACRO_HashAdd(descs, hash, size, descs[idx].name, idx);
+    if (descs[idx].alias) MACRO_HashAdd(descs, hash, size, descs[idx].alias, idx);
+}
+
 static char* StrDup(const char* str)
 {
     char* dst;
@@ -99,6 +152,7 @@ void CALLBACK MACRO_CreateButton(LPCSTR id, LPCSTR name, LPCSTR macro)
 
     strcpy(ptr, macro);
     button->lpszMacro = ptr;
+    button->code = NULL;
 
     button->wParam = WH_FIRST_BUTTON;
     for (b = &win->first_button; *b; b = &(*b)->next)
@@ -258,6 +312,7 @@ static void CALLBACK MACRO_ChangeButtonBinding(LPCSTR id, LPCSTR macro)
 
     strcpy(ptr, macro);
     button->lpszMacro = ptr;
+    button->code = NULL;
 
     *b = button;
 
@@ -808,6 +863,24 @@ static void CALLBACK MACRO_RegisterRoutine(LPCSTR dll_name, LPCSTR proc, LPCSTR
     MACRO_Loaded[MACRO_NumLoaded - 1].arguments = StrDup(args); /* FIXME: never freed */
     MACRO_Loaded[MACRO_NumLoaded - 1].fn        = fn;
     WINE_TRACE("Added %s(%s) at %p\n", debugstr_a(proc), debugstr_a(args), fn);
+
+    /* keep the table at most half full */
+    if (2 * MACRO_NumLoaded > MACRO_LoadedHashSize)
+    {
+        unsigned*   new;
+        unsigned    i, new_size = max(MACRO_LoadedHashSize * 2, 16);
+
+        if ((new = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, new_size * sizeof(unsigned))))
+        {
+            HeapFree(GetProcessHeap(), 0, MACRO_LoadedHash);
+            MACRO_LoadedHash = new;
+            MACRO_LoadedHashSize = new_size;
+            for (i = 0; i < MACRO_NumLoaded - 1; i++)
+                MACRO_HashInsert(MACRO_Loaded, MACRO_LoadedHash, MACRO_LoadedHashSize, i);
+        }
+    }
+    if (MACRO_LoadedHash && MACRO_NumLoaded < MACRO_LoadedHashSize)
+        MACRO_HashInsert(MACRO_Loaded, MACRO_LoadedHash, MACRO_LoadedHashSize, MACRO_NumLoaded - 1);
 }
 
 static void CALLBACK MACRO_RemoveAccelerator(LONG u1, LONG u2)
@@ -1005,29 +1078,33 @@ static struct MacroDesc MACRO_Builtins[] = {
     {NULL,                  NULL, 0, NULL,     NULL}
 };
 
-static int MACRO_DoLookUp(struct MacroDesc* start, const char* name, struct lexret* lr, unsigned len)
+static int MACRO_DoLookUp(struct MacroDesc* start, const unsigned* hash, unsigned size,
+                          const char* name, struct lexret* lr)
 {
-    struct MacroDesc*   md;
+    struct MacroDesc*   md = MACRO_HashFind(start, hash, size, name);
 
-    for (md = start; md->name && len != 0; md++, len--)
-    {
-        if (strcasecmp(md->name, name) == 0 || (md->alias != NULL && strcasecmp(md->alias, name) == 0))
-        {
-            lr->proto = md->arguments;
-            lr->function = md->fn;
-            return md->isBool ? BOOL_FUNCTION : VOID_FUNCTION;
-        }
-    }
-    return EMPTY;
+    if (!md) return EMPTY;
+    lr->proto = md->arguments;
+    lr->function = md->fn;
+    return md->isBool ? BOOL_FUNCTION : VOID_FUNCTION;
 }
 
 int MACRO_Lookup(const char* name, struct lexret* lr)
 {
+    static BOOL init /* = FALSE */;
     int ret;
+    unsigned i;
 
-    if ((ret = MACRO_DoLookUp(MACRO_Builtins, name, lr, -1)) != EMPTY)
+    if (!init)
+    {
+        for (i = 0; MACRO_Builtins[i].name; i++)
+            MACRO_HashInsert(MACRO_Builtins, MACRO_BuiltinHash, MACRO_BUILTIN_HASH, i);
+        init = TRUE;
+    }
+    if ((ret = MACRO_DoLookUp(MACRO_Builtins, MACRO_BuiltinHash, MACRO_BUILTIN_HASH, name, lr)) != EMPTY)
         return ret;
-    if (MACRO_Loaded && (ret = MACRO_DoLookUp(MACRO_Loaded, name, lr, MACRO_NumLoaded)) != EMPTY)
+    if (MACRO_LoadedHash &&
+        (ret = MACRO_DoLookUp(MACRO_Loaded, MACRO_LoadedHash, MACRO_LoadedHashSize, name, lr)) != EMPTY)
         return ret;
     if (!strcmp(name, "hwndApp"))
     {
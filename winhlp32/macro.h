@@ -36,8 +36,12 @@ struct lexret {
 
 extern struct lexret yylval;
 struct tagWinHelp;
+struct tagMacroCode;
 
 BOOL            MACRO_ExecuteMacro(struct tagWinHelp*, LPCSTR);
+BOOL            MACRO_ExecuteCached(struct tagWinHelp*, LPCSTR, struct tagMacroCode**);
+struct tagMacroCode* MACRO_Compile(LPCSTR);
+void            MACRO_FreeCode(struct tagMacroCode*);
 int             MACRO_Lookup(const char* name, struct lexret* lr);
 struct tagWinHelp* MACRO_CurrentWindow(void);
 
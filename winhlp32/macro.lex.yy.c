@@ -501,6 +501,22 @@ char *yytext;
 
 WINE_DEFAULT_DEBUG_CHANNEL(winhelp);
 
+/* A macro is lexed once into tokens, which can then be run several times.
+ * Names are kept as IDENTIFIER and only looked up when run.
+ */
+struct macro_token {
+    int      type;
+    LONG     integer;
+    LPCSTR   string;
+};
+
+struct tagMacroCode {
+    unsigned ref;       /* the owner, plus one per run in progress */
+    unsigned count;
+    struct macro_token tokens[1];
+    /* followed by the strings */
+};
+
 struct lex_data {
     LPCSTR   macroptr;
     LPSTR    strptr;
@@ -508,6 +524,8 @@ struct lex_data {
     unsigned quote_stk_idx;
     LPSTR    cache_string[32];
     int      cache_used;
+    const struct tagMacroCode* code;
+    unsigned pc;
     WINHELP_WINDOW* window;
 };
 static struct lex_data* lex_data = NULL;
@@ -517,8 +535,8 @@ struct lexret  yylval;
 #define YY_INPUT(buf,result,max_size)\
   if ((result = *lex_data->macroptr ? 1 : 0)) buf[0] = *lex_data->macroptr++;
 
-#line 520 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
-#line 521 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
+#line 538 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
+#line 539 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
 
 #define INITIAL 0
 #define quote 1
@@ -734,10 +752,10 @@ YY_DECL
 		}
 
 	{
-#line 58 "macro.lex.l"
+#line 76 "macro.lex.l"
 
 
-#line 740 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
+#line 758 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
 
 	while ( /*CONSTCOND*/1 )		/* loops until end-of-file is reached */
 		{
@@ -792,32 +810,32 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 60 "macro.lex.l"
+#line 78 "macro.lex.l"
 yylval.integer = strtol(yytext, NULL, 10);	return INTEGER;
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 61 "macro.lex.l"
+#line 79 "macro.lex.l"
 yylval.integer = strtol(yytext, NULL, 16);	return INTEGER;
 	YY_BREAK
 case 3:
 YY_RULE_SETUP
-#line 63 "macro.lex.l"
-return MACRO_Lookup(yytext, &yylval);
+#line 81 "macro.lex.l"
+yylval.string = yytext; return IDENTIFIER;
 	YY_BREAK
 case 4:
-#line 66 "macro.lex.l"
+#line 84 "macro.lex.l"
 case 5:
-#line 67 "macro.lex.l"
+#line 85 "macro.lex.l"
 case 6:
-#line 68 "macro.lex.l"
+#line 86 "macro.lex.l"
 case 7:
-#line 69 "macro.lex.l"
+#line 87 "macro.lex.l"
 case 8:
-#line 70 "macro.lex.l"
+#line 88 "macro.lex.l"
 case 9:
 YY_RULE_SETUP
-#line 70 "macro.lex.l"
+#line 88 "macro.lex.l"
 {
     if (lex_data->quote_stk_idx == 0 ||
         (yytext[0] == '\"' && lex_data->quote_stack[lex_data->quote_stk_idx - 1] != '\"') ||
@@ -852,34 +870,34 @@ YY_RULE_SETUP
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 102 "macro.lex.l"
+#line 120 "macro.lex.l"
 *lex_data->strptr++ = yytext[0];
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 103 "macro.lex.l"
+#line 121 "macro.lex.l"
 *lex_data->strptr++ = yytext[1];
 	YY_BREAK
 case YY_STATE_EOF(quote):
-#line 104 "macro.lex.l"
+#line 122 "macro.lex.l"
 return 0;
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 106 "macro.lex.l"
+#line 124 "macro.lex.l"
 
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 107 "macro.lex.l"
+#line 125 "macro.lex.l"
 return yytext[0];
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 108 "macro.lex.l"
+#line 126 "macro.lex.l"
 ECHO;
 	YY_BREAK
-#line 882 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
+#line 900 "D:/GitHub/XPAccApps/winhlp32/macro.lex.yy.c"
 case YY_STATE_EOF(INITIAL):
 	yyterminate();
 
@@ -1848,7 +1866,7 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 108 "macro.lex.l"
+#line 126 "macro.lex.l"
 
 
 #if 0
@@ -1895,6 +1913,26 @@ static const char* ts(int t)
 
 static int MACRO_CallBoolFunc(void *fn, const char* args, void** ret);
 
+/******************************************************************
+ *		MACRO_Token
+ *
+ * Returns the next token of the code being run
+ */
+static int MACRO_Token(void)
+{
+    const struct macro_token*   tok;
+
+    if (lex_data->pc >= lex_data->code->count) return EMPTY;
+    tok = &lex_data->code->tokens[lex_data->pc++];
+    switch (tok->type)
+    {
+    case IDENTIFIER:    return MACRO_Lookup(tok->string, &yylval);
+    case INTEGER:       yylval.integer = tok->integer; return INTEGER;
+    case STRING:        yylval.string = tok->string; return STRING;
+    default:            return tok->type;
+    }
+}
+
 /******************************************************************
  *		MACRO_CheckArgs
  *
@@ -1909,14 +1947,14 @@ static int MACRO_CheckArgs(void* pa[], unsigned max, const char* args)
 
     WINE_TRACE("Checking %s\n", debugstr_a(args));
 
-    if (yylex() != '(') {WINE_WARN("missing (\n");return -1;}
+    if (MACRO_Token() != '(') {WINE_WARN("missing (\n");return -1;}
 
     if (*args)
     {
         len = strlen(args);
         for (;;)
         {
-            t = yylex();
+            t = MACRO_Token();
             WINE_TRACE("Got %s <=> %c\n", debugstr_a(ts(t)), *args);
 
             switch (*args)
@@ -1944,13 +1982,13 @@ static int MACRO_CheckArgs(void* pa[], unsigned max, const char* args)
             }
             idx++;
             if (*++args == '\0') break;
-            t = yylex();
+            t = MACRO_Token();
             if (t == ')') goto CheckArgs_end;
             if (t != ',') {WINE_WARN("missing ,\n");return -1;}
             if (idx >= max) {WINE_FIXME("stack overflow (%d)\n", max);return -1;}
         }
     }
-    if (yylex() != ')') {WINE_WARN("missing )\n");return -1;}
+    if (MACRO_Token() != ')') {WINE_WARN("missing )\n");return -1;}
 
 CheckArgs_end:
     while (len > idx) pa[--len] = NULL;
@@ -2058,11 +2096,22 @@ static int MACRO_CallVoidFunc(void *fn, const char* args)
     return 1;
 }
 
-BOOL MACRO_ExecuteMacro(WINHELP_WINDOW* window, LPCSTR macro)
+/******************************************************************
+ *		MACRO_Compile
+ *
+ * Lexes a macro string into code for MACRO_ExecuteCached
+ */
+struct tagMacroCode* MACRO_Compile(LPCSTR macro)
 {
     struct lex_data     curr_lex_data, *prev_lex_data;
-    BOOL ret = TRUE;
-    int t;
+    struct macro_token* tokens = NULL;
+    struct macro_token* new_tokens;
+    char*               strings = NULL;
+    char*               new_strings;
+    struct tagMacroCode* code = NULL;
+    unsigned            num_tokens = 0, max_tokens = 0, strings_size = 0, max_strings = 0;
+    unsigned            i, len;
+    int                 t;
 
     WINE_TRACE("%s\n", debugstr_a(macro));
 
@@ -2071,9 +2120,92 @@ BOOL MACRO_ExecuteMacro(WINHELP_WINDOW* window, LPCSTR macro)
 
     memset(lex_data, 0, sizeof(*lex_data));
     lex_data->macroptr = macro;
-    lex_data->window = WINHELP_GrabWindow(window);
 
     while ((t = yylex()) != EMPTY)
+    {
+        if (num_tokens == max_tokens)
+        {
+            max_tokens = max(max_tokens * 2, 16);
+            new_tokens = tokens ? HeapReAlloc(GetProcessHeap(), 0, tokens, max_tokens * sizeof(*tokens)) :
+                HeapAlloc(GetProcessHeap(), 0, max_tokens * sizeof(*tokens));
+            if (!new_tokens) goto done;
+            tokens = new_tokens;
+        }
+        tokens[num_tokens].type = t;
+        tokens[num_tokens].integer = yylval.integer;
+        tokens[num_tokens].string = NULL;
+        if (t == STRING || t == IDENTIFIER)
+        {
+            /* strings are stored as offsets until the final block is allocated */
+            len = strlen(yylval.string) + 1;
+            if (strings_size + len > max_strings)
+            {
+                max_strings = max(max_strings * 2, strings_size + len);
+                new_strings = strings ? HeapReAlloc(GetProcessHeap(), 0, strings, max_strings) :
+                    HeapAlloc(GetProcessHeap(), 0, max_strings);
+                if (!new_strings) goto done;
+                strings = new_strings;
+            }
+            memcpy(strings + strings_size, yylval.string, len);
+            tokens[num_tokens].string = (LPCSTR)(ULONG_PTR)strings_size;
+            strings_size += len;
+            if (t == STRING)
+                HeapFree(GetProcessHeap(), 0, lex_data->cache_string[--lex_data->cache_used]);
+        }
+        num_tokens++;
+    }
+
+    code = HeapAlloc(GetProcessHeap(), 0, FIELD_OFFSET(struct tagMacroCode, tokens[num_tokens + 1]) + strings_size);
+    if (!code) goto done;
+    code->ref = 1;
+    code->count = num_tokens;
+    if (num_tokens) memcpy(code->tokens, tokens, num_tokens * sizeof(*tokens));
+    if (strings_size) memcpy(&code->tokens[num_tokens + 1], strings, strings_size);
+    for (i = 0; i < num_tokens; i++)
+    {
+        if (code->tokens[i].type == STRING || code->tokens[i].type == IDENTIFIER)
+            code->tokens[i].string = (LPCSTR)&code->tokens[num_tokens + 1] + (ULONG_PTR)code->tokens[i].string;
+    }
+
+done:
+    /* an unterminated string may leave the scanner in the middle of a quote */
+    BEGIN(INITIAL);
+    YY_FLUSH_BUFFER;
+    for (t = 0; t < lex_data->cache_used; t++)
+        HeapFree(GetProcessHeap(), 0, lex_data->cache_string[t]);
+    HeapFree(GetProcessHeap(), 0, tokens);
+    HeapFree(GetProcessHeap(), 0, strings);
+    lex_data = prev_lex_data;
+
+    return code;
+}
+
+void MACRO_FreeCode(struct tagMacroCode* code)
+{
+    if (code && --code->ref == 0) HeapFree(GetProcessHeap(), 0, code);
+}
+
+/******************************************************************
+ *		MACRO_ExecuteCode
+ *
+ * The code is referenced while it runs, as the macro may well free its
+ * owner (a button or a page replaced by a jump).
+ */
+static BOOL MACRO_ExecuteCode(WINHELP_WINDOW* window, struct tagMacroCode* code)
+{
+    struct lex_data     curr_lex_data, *prev_lex_data;
+    BOOL ret = TRUE;
+    int t;
+
+    prev_lex_data = lex_data;
+    lex_data = &curr_lex_data;
+
+    memset(lex_data, 0, sizeof(*lex_data));
+    lex_data->code = code;
+    lex_data->window = WINHELP_GrabWindow(window);
+    code->ref++;
+
+    while ((t = MACRO_Token()) != EMPTY)
     {
         switch (t)
         {
@@ -2086,27 +2218,50 @@ BOOL MACRO_ExecuteMacro(WINHELP_WINDOW* window, LPCSTR macro)
             break;
         default:
             WINE_WARN("got unexpected type %s\n", debugstr_a(ts(t)));
-            YY_FLUSH_BUFFER;
             ret = FALSE;
             goto done;
         }
-        switch (t = yylex())
+        switch (t = MACRO_Token())
         {
         case EMPTY:     goto done;
         case ';':       break;
-        default:        ret = FALSE; YY_FLUSH_BUFFER; goto done;
+        default:        ret = FALSE; goto done;
         }
     }
 
 done:
-    for (t = 0; t < lex_data->cache_used; t++)
-        HeapFree(GetProcessHeap(), 0, lex_data->cache_string[t]);
     lex_data = prev_lex_data;
+    MACRO_FreeCode(code);
     WINHELP_ReleaseWindow(window);
 
     return ret;
 }
 
+BOOL MACRO_ExecuteMacro(WINHELP_WINDOW* window, LPCSTR macro)
+{
+    struct tagMacroCode* code = MACRO_Compile(macro);
+    BOOL ret;
+
+    if (!code) return FALSE;
+    ret = MACRO_ExecuteCode(window, code);
+    MACRO_FreeCode(code);
+
+    return ret;
+}
+
+/******************************************************************
+ *		MACRO_ExecuteCached
+ *
+ * Same as MACRO_ExecuteMacro, but keeps the compiled macro in *code for
+ * the next runs. *code must be released with MACRO_FreeCode.
+ */
+BOOL MACRO_ExecuteCached(WINHELP_WINDOW* window, LPCSTR macro, struct tagMacroCode** code)
+{
+    if (!*code && !(*code = MACRO_Compile(macro))) return FALSE;
+    WINE_TRACE("%s\n", debugstr_a(macro));
+    return MACRO_ExecuteCode(window, *code);
+}
+
 WINHELP_WINDOW* MACRO_CurrentWindow(void)
 {
     return lex_data ? lex_data->window : Globals.active_win;
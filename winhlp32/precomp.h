@@ -14,6 +14,7 @@
 
 #include "winhelp.h"
 #include "hlpfile.h"
+#include "fts.h"
 #include "macro.h"
 #include "winhelp_res.h"
 
@@ -0,0 +1,490 @@
+/*
+ * Help Viewer - help file dumper and benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Walks a help file the way the viewer opens it, with nothing but hlpcore.c:
+ * lists the internal files and the pages, and with -b times each stage
+ * (open, topic blocks decoded on one then on -j threads, page walk with
+ * the phrases expanded, keyword lookups) over -n runs.
+ *
+ *      hlpdump [-b] [-n iterations] [-j threads] file.hlp...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hlpcore.h"
+
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define HLP_DISPLAY30 0x01     /* version 3.0 displayable information */
+#define HLP_TOPICHDR  0x02     /* topic header information */
+#define HLP_DISPLAY   0x20     /* version 3.1 displayable information */
+#define HLP_TABLE     0x23     /* version 3.1 table */
+
+#define MAX_THREADS   64
+
+typedef struct
+{
+    BYTE*               file;
+    UINT                size;
+    HLPCORE_SYSTEM      sys;
+    HLPCORE_PHRASES     phrases;
+    BOOL                hasPhrases;
+    BOOL                hasPhrases40;
+    HLPCORE_TOPIC       topic;
+} DUMPFILE;
+
+typedef struct
+{
+    DUMPFILE*           df;
+    unsigned            first;
+    unsigned            step;
+    BOOL                ok;
+} DUMPJOB;
+
+/***********************************************************************
+ *
+ *           now
+ *
+ * Returns a monotonic time, in seconds.
+ */
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER       freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / freq.QuadPart;
+#else
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/***********************************************************************
+ *
+ *           ReadWholeFile
+ */
+static BYTE* ReadWholeFile(const char* path, UINT* size)
+{
+    FILE*       f;
+    BYTE*       buf;
+    long        len;
+
+    if (!(f = fopen(path, "rb"))) return NULL;
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET))
+    {
+        fclose(f);
+        return NULL;
+    }
+    buf = malloc(len);
+    if (buf && fread(buf, 1, len, f) != (size_t)len)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *size = len;
+    return buf;
+}
+
+/***********************************************************************
+ *
+ *           DecodeJob
+ *
+ * Decodes the blocks first, first + step, first + 2 * step...
+ */
+#ifdef _WIN32
+static DWORD WINAPI DecodeJob(void* arg)
+#else
+static void* DecodeJob(void* arg)
+#endif
+{
+    DUMPJOB*    job = arg;
+    unsigned    i;
+
+    job->ok = TRUE;
+    for (i = job->first; i < job->df->topic.maplen; i += job->step)
+        if (!HLPCORE_DecodeTopicBlock(&job->df->topic, i)) job->ok = FALSE;
+    return 0;
+}
+
+/***********************************************************************
+ *
+ *           DecodeBlocks
+ *
+ * Decodes all the topic blocks, on threads threads.
+ */
+static BOOL DecodeBlocks(DUMPFILE* df, unsigned threads)
+{
+    DUMPJOB     jobs[MAX_THREADS];
+#ifdef _WIN32
+    HANDLE      handles[MAX_THREADS];
+#else
+    pthread_t   handles[MAX_THREADS];
+#endif
+    unsigned    i, started;
+    BOOL        ret = TRUE;
+
+    if (threads > df->topic.maplen) threads = df->topic.maplen;
+    if (threads <= 1)
+    {
+        jobs[0].df = df;
+        jobs[0].first = 0;
+        jobs[0].step = 1;
+        DecodeJob(&jobs[0]);
+        return jobs[0].ok;
+    }
+
+    for (started = 0; started < threads; started++)
+    {
+        jobs[started].df = df;
+        jobs[started].first = started;
+        jobs[started].step = threads;
+        jobs[started].ok = FALSE;
+#ifdef _WIN32
+        handles[started] = CreateThread(NULL, 0, DecodeJob, &jobs[started], 0, NULL);
+        if (!handles[started]) break;
+#else
+        if (pthread_create(&handles[started], NULL, DecodeJob, &jobs[started])) break;
+#endif
+    }
+    for (i = 0; i < started; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+        if (!jobs[i].ok) ret = FALSE;
+    }
+    return ret && started == threads;
+}
+
+/***********************************************************************
+ *
+ *           CacheBlocks
+ *
+ * Hands the decoded blocks over to the page walk: HLPCORE_TopicBlock
+ * only uses the blocks in the cache.
+ */
+static void CacheBlocks(DUMPFILE* df)
+{
+    unsigned    i;
+
+    for (i = 0; i < df->topic.maplen; i++)
+        if (df->topic.blocks[i].data) HLPCORE_CacheTopicBlock(&df->topic, &df->topic.blocks[i]);
+}
+
+/***********************************************************************
+ *
+ *           OpenHelp
+ *
+ * Same steps as HLPFILE_DoReadHlpFile, up to the topic scan.
+ */
+static BOOL OpenHelp(DUMPFILE* df, BYTE* file, UINT size)
+{
+    BYTE        *buf, *end;
+
+    memset(df, 0, sizeof(*df));
+    df->file = file;
+    if (!HLPCORE_CheckFile(file, size, &df->size)) return FALSE;
+
+    if (!HLPCORE_FindSubFile(file, df->size, "|SYSTEM", &buf, &end)) return FALSE;
+    if (!HLPCORE_ReadSystem(buf, end, &df->sys)) return FALSE;
+
+    if (HLPCORE_LoadPhrases(file, df->size, df->sys.version, &df->phrases))
+        df->hasPhrases = TRUE;
+    else if (HLPCORE_LoadPhrases40(file, df->size, &df->phrases))
+        df->hasPhrases40 = TRUE;
+
+    if (!HLPCORE_OpenTopic(file, df->size, &df->sys, &df->topic)) return FALSE;
+    if (df->hasPhrases || df->hasPhrases40) df->topic.phrases = &df->phrases;
+    df->topic.phrases40 = df->hasPhrases40;
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           CloseHelp
+ */
+static void CloseHelp(DUMPFILE* df)
+{
+    HLPCORE_CloseTopic(&df->topic);
+    HLPCORE_FreePhrases(&df->phrases);
+}
+
+/***********************************************************************
+ *
+ *           RecordText
+ *
+ * HLPCORE_RecordText, in a buffer grown as needed.
+ */
+static LONG RecordText(DUMPFILE* df, const BYTE* buf, const BYTE* end, char** text, LONG* alloc)
+{
+    LONG        size = HLPCORE_RecordTextSize(buf, end);
+
+    if (size < 0) return -1;
+    if (size + 1 > *alloc)
+    {
+        char* new = realloc(*text, size + 1);
+        if (!new) return -1;
+        *text = new;
+        *alloc = size + 1;
+    }
+    return HLPCORE_RecordText(&df->topic, buf, end, *text);
+}
+
+/***********************************************************************
+ *
+ *           WalkPages
+ *
+ * Follows the topic records as HLPFILE_DoReadHlpFile does, printing the
+ * page titles when print is set. Returns the number of pages, and the
+ * amount of paragraph text in text_size.
+ */
+static int WalkPages(DUMPFILE* df, BOOL print, unsigned long* text_size)
+{
+    HLPCORE_TOPICWALK walk;
+    BYTE        *buf, *end;
+    char*       text = NULL;
+    LONG        alloc = 0, len;
+    int         pages = 0;
+
+    *text_size = 0;
+    HLPCORE_StartWalk(&walk, 0x0C);
+    while ((buf = HLPCORE_NextRecord(&df->topic, &walk, &end)))
+    {
+        switch (buf[0x14])
+        {
+        case HLP_TOPICHDR:
+            if ((len = RecordText(df, buf, end, &text, &alloc)) < 0) goto done;
+            if (print) printf("  %08x %s\n", (unsigned)walk.rec, text);
+            pages++;
+            break;
+
+        case HLP_DISPLAY30:
+        case HLP_DISPLAY:
+        case HLP_TABLE:
+            if ((len = RecordText(df, buf, end, &text, &alloc)) < 0) goto done;
+            *text_size += len;
+            break;
+
+        default:
+            fprintf(stderr, "unknown record type %x at %08x\n", buf[0x14], (unsigned)walk.rec);
+            goto done;
+        }
+    }
+done:
+    free(text);
+    return pages;
+}
+
+/* |KWBTREE keywords, collected for the lookups */
+typedef struct
+{
+    char**      names;
+    unsigned    num;
+    unsigned    alloc;
+} KEYWORDS;
+
+static void cb_Keyword(void* p, void** next, void* cookie)
+{
+    KEYWORDS*   kw = cookie;
+    char*       name = p;
+
+    *next = name + strlen(name) + 7;
+    if (kw->num == kw->alloc)
+    {
+        char** new = realloc(kw->names, (kw->alloc = kw->alloc * 2 + 16) * sizeof(char*));
+        if (!new) return;
+        kw->names = new;
+    }
+    kw->names[kw->num++] = name;
+}
+
+static int comp_Keyword(void* p, const void* key, int leaf, void** next)
+{
+    *next = (char*)p + strlen(p) + (leaf ? 7 : 3);
+    return strcmp(p, key);
+}
+
+static void cb_Directory(void* p, void** next, void* cookie)
+{
+    char*       name = p;
+
+    *next = name + strlen(name) + 5;
+    (void)cookie;
+    printf("  %-24s %08x\n", name, GET_UINT(p, strlen(name) + 1));
+}
+
+/***********************************************************************
+ *
+ *           DumpFile
+ */
+static BOOL DumpFile(BYTE* file, UINT size)
+{
+    DUMPFILE            df;
+    unsigned long       text_size;
+    int                 pages;
+
+    if (!OpenHelp(&df, file, size))
+    {
+        CloseHelp(&df);
+        return FALSE;
+    }
+    printf("version %u, flags %04x, %scompressed, %u topic blocks of %u\n",
+           df.sys.version, df.sys.flags, df.sys.compressed ? "" : "not ",
+           df.topic.maplen, df.sys.tbsize);
+    printf("%u phrases%s\n", df.hasPhrases || df.hasPhrases40 ? df.phrases.num : 0, df.hasPhrases40 ? " (Hall)" : "");
+    printf("internal files:\n");
+    HLPCORE_BPTreeEnum(file + GET_UINT(file, 4), cb_Directory, NULL);
+
+    printf("pages:\n");
+    pages = WalkPages(&df, TRUE, &text_size);
+    printf("%d pages, %lu bytes of text\n", pages, text_size);
+    CloseHelp(&df);
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           BenchFile
+ */
+static BOOL BenchFile(BYTE* file, UINT size, unsigned iterations, unsigned threads)
+{
+    DUMPFILE            df;
+    KEYWORDS            kw = {NULL, 0, 0};
+    BYTE                *buf, *end;
+    double              t, t_open = 0, t_serial = 0, t_parallel = 0, t_walk = 0, t_keys = 0;
+    unsigned long       text_size = 0;
+    unsigned            it, i, blocks = 0, found = 0;
+    int                 pages = 0;
+    BOOL                ret = TRUE;
+
+    for (it = 0; it < iterations && ret; it++)
+    {
+        t = now();
+        ret = OpenHelp(&df, file, size);
+        t_open += now() - t;
+        if (!ret)
+        {
+            CloseHelp(&df);
+            break;
+        }
+
+        blocks = df.topic.maplen;
+
+        t = now();
+        ret = DecodeBlocks(&df, 1);
+        t_serial += now() - t;
+        HLPCORE_FlushTopicBlocks(&df.topic);
+
+        t = now();
+        ret = ret && DecodeBlocks(&df, threads);
+        t_parallel += now() - t;
+
+        if (ret)
+        {
+            CacheBlocks(&df);
+            t = now();
+            pages = WalkPages(&df, FALSE, &text_size);
+            t_walk += now() - t;
+        }
+
+        if (ret && HLPCORE_FindSubFile(file, df.size, "|KWBTREE", &buf, &end))
+        {
+            kw.num = 0;
+            HLPCORE_BPTreeEnum(buf, cb_Keyword, &kw);
+            found = 0;
+            t = now();
+            for (i = 0; i < kw.num; i++)
+                if (HLPCORE_BPTreeSearch(buf, kw.names[i], comp_Keyword)) found++;
+            t_keys += now() - t;
+        }
+        CloseHelp(&df);
+    }
+    free(kw.names);
+    if (!ret) return FALSE;
+
+    printf("%u blocks, %d pages, %lu bytes of text, %u/%u keywords found\n",
+           blocks, pages, text_size, found, kw.num);
+    printf("  open         %10.3f ms\n", t_open * 1000 / iterations);
+    printf("  decode x1    %10.3f ms\n", t_serial * 1000 / iterations);
+    printf("  decode x%-4u %10.3f ms\n", threads, t_parallel * 1000 / iterations);
+    printf("  page walk    %10.3f ms (%.1f MB/s of %s text)\n", t_walk * 1000 / iterations,
+           t_walk ? text_size * (double)iterations / t_walk / 1e6 : 0.0,
+           df.hasPhrases ? "phrase compressed" : df.hasPhrases40 ? "Hall compressed" : "plain");
+    printf("  keywords     %10.3f ms\n", t_keys * 1000 / iterations);
+    return TRUE;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: hlpdump [-b] [-n iterations] [-j threads] file.hlp...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    BOOL        bench = FALSE;
+    unsigned    iterations = 10, threads = 4;
+    int         i, ret = 0;
+    BYTE*       file;
+    UINT        size;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (!strcmp(argv[i], "-b")) bench = TRUE;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = atoi(argv[++i]);
+        else usage();
+    }
+    if (i == argc || !iterations) usage();
+    if (!threads) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    for (; i < argc; i++)
+    {
+        printf("%s:\n", argv[i]);
+        if (!(file = ReadWholeFile(argv[i], &size)))
+        {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (!(bench ? BenchFile(file, size, iterations, threads) : DumpFile(file, size)))
+        {
+            fprintf(stderr, "%s: not a valid help file\n", argv[i]);
+            ret = 1;
+        }
+        free(file);
+    }
+    return ret;
+}
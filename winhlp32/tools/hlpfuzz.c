@@ -0,0 +1,221 @@
+/*
+ * Help Viewer - fuzzing harness for hlpcore.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * Feeds any bytes to what reads a help file before a page is shown: the
+ * container (HLPCORE_CheckFile, HLPCORE_FindSubFile), the |SYSTEM header,
+ * the phrase tables and the topic walk, with its LZ77 blocks and phrase
+ * expansion. The input also goes as is to the LZ77 and phrase decoders.
+ *
+ * Built with clang, it's a libFuzzer target. Otherwise it's a program
+ * running the files it's given, and with -m that many random mutations
+ * of each (seeded with -s):
+ *
+ *      hlpfuzz [-m mutations] [-s seed] file...
+ *
+ * Inputs that once crashed it are kept in corpus/.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hlpcore.h"
+
+#define MAX_TEXT      (1024 * 1024)
+
+int LLVMFuzzerTestOneInput(const BYTE* data, size_t size);
+
+/***********************************************************************
+ *
+ *           FuzzDecoders
+ *
+ * Runs the raw input through the LZ77 decoder, and through both phrase
+ * decoders with a small table.
+ */
+static void FuzzDecoders(const BYTE* buf, UINT size)
+{
+    static char         phrase_buffer[] = "the help file" "Windows" "click";
+    HLPCORE_PHRASE      table[] = {{0, 13}, {13, 7}, {20, 5}, {0, 0}};
+    HLPCORE_PHRASES     phrases;
+    char                padded[sizeof(phrase_buffer) + HLPCORE_PHRASE_PAD];
+    BYTE*               out;
+    INT                 len;
+
+    len = HLPCORE_LZ77Size(buf, buf + size);
+    if (len >= 0 && (out = malloc(len ? len : 1)))
+    {
+        HLPCORE_UncompressLZ77(buf, buf + size, out);
+        free(out);
+    }
+
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, phrase_buffer, sizeof(phrase_buffer));
+    phrases.num = 3;
+    phrases.table = table;
+    phrases.buffer = padded;
+    len = size * 2 + 16;
+    if ((out = malloc(len)))
+    {
+        HLPCORE_ExpandPhrases(&phrases, buf, buf + size, out, out + len);
+        HLPCORE_ExpandPhrases40(&phrases, (char*)out, (char*)out + len, buf, buf + size);
+        free(out);
+    }
+}
+
+/***********************************************************************
+ *
+ *           FuzzFile
+ *
+ * Opens the input as HLPFILE_DoReadHlpFile does, and walks all the
+ * topic records.
+ */
+static void FuzzFile(BYTE* file, UINT size)
+{
+    HLPCORE_SYSTEM      sys;
+    HLPCORE_PHRASES     phrases;
+    HLPCORE_TOPIC       topic;
+    HLPCORE_TOPICWALK   walk;
+    BOOL                hasPhrases = FALSE, hasPhrases40 = FALSE;
+    BYTE                *buf, *end;
+    char*               text;
+    LONG                len;
+
+    if (!HLPCORE_CheckFile(file, size, &size)) return;
+    if (!HLPCORE_FindSubFile(file, size, "|SYSTEM", &buf, &end) ||
+        !HLPCORE_ReadSystem(buf, end, &sys))
+        return;
+
+    memset(&phrases, 0, sizeof(phrases));
+    if (HLPCORE_LoadPhrases(file, size, sys.version, &phrases))
+        hasPhrases = TRUE;
+    else if (HLPCORE_LoadPhrases40(file, size, &phrases))
+        hasPhrases40 = TRUE;
+
+    if (HLPCORE_OpenTopic(file, size, &sys, &topic))
+    {
+        if (hasPhrases || hasPhrases40) topic.phrases = &phrases;
+        topic.phrases40 = hasPhrases40;
+        /* small, to go through the LRU list */
+        topic.cache_size = 2 * sys.dsize;
+
+        HLPCORE_StartWalk(&walk, 0x0C);
+        while ((buf = HLPCORE_NextRecord(&topic, &walk, &end)))
+        {
+            len = HLPCORE_RecordTextSize(buf, end);
+            if (len < 0 || len > MAX_TEXT || !(text = malloc(len + 1))) continue;
+            HLPCORE_RecordText(&topic, buf, end, text);
+            free(text);
+        }
+    }
+    HLPCORE_CloseTopic(&topic);
+    HLPCORE_FreePhrases(&phrases);
+}
+
+int LLVMFuzzerTestOneInput(const BYTE* data, size_t size)
+{
+    BYTE*       copy;
+
+    if (size > 64 * 1024 * 1024) return 0;
+    /* exactly size bytes, for the sanitizers to catch any overread */
+    if (!(copy = malloc(size ? size : 1))) return 0;
+    memcpy(copy, data, size);
+    FuzzDecoders(copy, size);
+    FuzzFile(copy, size);
+    free(copy);
+    return 0;
+}
+
+#ifndef __clang__
+
+/***********************************************************************
+ *
+ *           Mutate
+ *
+ * Changes a few bytes of buf, favouring the ones the parsers read as
+ * sizes and offsets.
+ */
+static void Mutate(BYTE* buf, size_t size)
+{
+    static const BYTE   interesting[] = {0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0xFF};
+    unsigned            n = 1 + rand() % 8, i;
+    size_t              pos;
+
+    for (i = 0; i < n; i++)
+    {
+        pos = ((size_t)rand() * RAND_MAX + rand()) % size;
+        switch (rand() % 3)
+        {
+        case 0: buf[pos] = rand(); break;
+        case 1: buf[pos] = interesting[rand() % sizeof(interesting)]; break;
+        case 2: buf[pos] ^= 1 << (rand() % 8); break;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned    mutations = 0, seed = 1, m;
+    int         i;
+    FILE*       f;
+    BYTE        *data, *work;
+    long        size;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc) mutations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atoi(argv[++i]);
+        else i = argc;
+    }
+    if (i >= argc)
+    {
+        fprintf(stderr, "usage: hlpfuzz [-m mutations] [-s seed] file...\n");
+        return 2;
+    }
+    srand(seed);
+
+    for (; i < argc; i++)
+    {
+        if (!(f = fopen(argv[i], "rb"))) {perror(argv[i]); return 1;}
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = malloc(size > 0 ? size : 1);
+        work = malloc(size > 0 ? size : 1);
+        if (!data || !work || (size > 0 && fread(data, 1, size, f) != (size_t)size))
+        {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            return 1;
+        }
+        fclose(f);
+
+        LLVMFuzzerTestOneInput(data, size);
+        for (m = 0; m < mutations && size > 0; m++)
+        {
+            memcpy(work, data, size);
+            Mutate(work, size);
+            LLVMFuzzerTestOneInput(work, size);
+        }
+        printf("%s: %u runs\n", argv[i], mutations + 1);
+        free(data);
+        free(work);
+    }
+    return 0;
+}
+
+#endif
@@ -51,6 +51,9 @@ WINHELP_GLOBALS Globals = {3, NULL, TRUE, NULL, NULL, NULL, NULL, NULL, {{{NULL,
 #define CTL_ID_BUTTON   0x700
 #define CTL_ID_TEXT     0x701
 
+#define WINHELP_STREAM_TIMER    1
+#define WINHELP_STREAM_CHUNK    16384   /* bytes of RTF added to the text at a time */
+
 int ScreenDpi;
 
 /***********************************************************************
@@ -88,56 +91,180 @@ static void WINHELP_InitFonts(HWND hWnd)
     }
 }
 
+/* an RTF document handed to the rich edit, in pieces */
+struct RtfStream
+{
+    const char*         data[4];
+    unsigned            size[4];
+    unsigned            part;
+};
+
 static DWORD CALLBACK WINHELP_RtfStreamIn(DWORD_PTR cookie, BYTE* buff,
                                           LONG cb, LONG* pcb)
 {
-    struct RtfData*     rd = (struct RtfData*)cookie;
+    struct RtfStream*   rs = (struct RtfStream*)cookie;
 
-    if (rd->where >= rd->ptr) return 1;
-    if (rd->where + cb > rd->ptr)
-        cb = rd->ptr - rd->where;
-    memcpy(buff, rd->where, cb);
-    rd->where += cb;
+    while (rs->part < ARRAY_SIZE(rs->data) && !rs->size[rs->part]) rs->part++;
+    if (rs->part == ARRAY_SIZE(rs->data))
+    {
+        *pcb = 0;
+        return 0;
+    }
+    if ((unsigned)cb > rs->size[rs->part])
+        cb = rs->size[rs->part];
+    memcpy(buff, rs->data[rs->part], cb);
+    rs->data[rs->part] += cb;
+    rs->size[rs->part] -= cb;
     *pcb = cb;
     return 0;
 }
 
+static void WINHELP_StreamPieces(HWND hTextWnd, DWORD format, struct RtfStream* rs)
+{
+    EDITSTREAM          es;
+
+    rs->part = 0;
+    es.dwCookie = (DWORD_PTR)rs;
+    es.dwError = 0;
+    es.pfnCallback = WINHELP_RtfStreamIn;
+    SendMessageW(hTextWnd, EM_STREAMIN, format, (LPARAM)&es);
+}
+
+/* Generates the page until at least size bytes of it haven't been streamed yet */
+static BOOL WINHELP_BrowseAhead(struct RtfData* rd, unsigned size)
+{
+    while (!rd->done && (unsigned)(rd->ptr - rd->where) < size)
+    {
+        if (!HLPFILE_BrowseMore(rd)) return FALSE;
+    }
+    return TRUE;
+}
+
+/***********************************************************************
+ *
+ *           WINHELP_StreamMore
+ *
+ * Appends the next paragraphs of the page being streamed to the end of
+ * the text. Returns FALSE once the whole page is in.
+ */
+static BOOL WINHELP_StreamMore(WINHELP_WINDOW* win)
+{
+    struct RtfData*     rd = win->stream;
+    HWND                hTextWnd = GetDlgItem(win->hMainWnd, CTL_ID_TEXT);
+    struct RtfStream    rs;
+    char                format[ARRAY_SIZE(rd->char_format)];
+    GETTEXTLENGTHEX     gtl = {GTL_NUMCHARS, 1200};
+    CHARRANGE           sel, end;
+    POINT               pt;
+    BOOL                more;
+
+    /* the paragraphs go as a document of their own, with the page's font
+     * and color tables, and the character formatting they start with */
+    strcpy(format, rd->char_format);
+    more = WINHELP_BrowseAhead(rd, WINHELP_STREAM_CHUNK) && !rd->done;
+    rs.data[0] = rd->data;
+    rs.size[0] = rd->header_size;
+    rs.data[1] = format;
+    rs.size[1] = strlen(format);
+    rs.data[2] = rd->where;
+    rs.size[2] = rd->ptr - rd->where;
+    rs.data[3] = "}";
+    rs.size[3] = rd->done ? 0 : 1;
+    rd->where = rd->ptr;
+
+    SendMessageW(hTextWnd, WM_SETREDRAW, FALSE, 0);
+    SendMessageW(hTextWnd, EM_EXGETSEL, 0, (LPARAM)&sel);
+    SendMessageW(hTextWnd, EM_GETSCROLLPOS, 0, (LPARAM)&pt);
+    end.cpMin = end.cpMax = SendMessageW(hTextWnd, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0);
+    SendMessageW(hTextWnd, EM_EXSETSEL, 0, (LPARAM)&end);
+    WINHELP_StreamPieces(hTextWnd, SF_RTF | SFF_SELECTION, &rs);
+    SendMessageW(hTextWnd, EM_EXSETSEL, 0, (LPARAM)&sel);
+    SendMessageW(hTextWnd, EM_SETSCROLLPOS, 0, (LPARAM)&pt);
+    SendMessageW(hTextWnd, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(hTextWnd, NULL, FALSE);
+
+    return more;
+}
+
+/***********************************************************************
+ *
+ *           WINHELP_EndStream
+ */
+static void WINHELP_EndStream(WINHELP_WINDOW* win)
+{
+    if (!win->stream) return;
+    KillTimer(win->hMainWnd, WINHELP_STREAM_TIMER);
+    HLPFILE_EndBrowse(win->stream);
+    HeapFree(GetProcessHeap(), 0, win->stream);
+    win->stream = NULL;
+}
+
+/***********************************************************************
+ *
+ *           WINHELP_SetupText
+ *
+ * Shows the page as soon as its first screen (and the place we jump to)
+ * is generated. The rest of a long page is generated and appended a
+ * piece at a time from a timer, popups excepted as they are sized after
+ * their whole text.
+ */
 static void WINHELP_SetupText(HWND hTextWnd, WINHELP_WINDOW* win, ULONG relative)
 {
     static const WCHAR emptyW[1];
+    struct RtfData*     rd = NULL;
+    BOOL                started = FALSE;
+    BOOL                whole;
+
+    WINHELP_EndStream(win);
+    whole = (win->info->win_style & WS_POPUP) && lstrcmpiA(win->info->name, "main");
+
     /* At first clear area - needed by EM_POSFROMCHAR/EM_SETSCROLLPOS */
     SendMessageW(hTextWnd, WM_SETTEXT, 0, (LPARAM)emptyW);
     SendMessageW(hTextWnd, WM_SETREDRAW, FALSE, 0);
     SendMessageW(hTextWnd, EM_SETBKGNDCOLOR, 0, (LPARAM)win->info->sr_color);
     /* set word-wrap to window size (undocumented) */
     SendMessageW(hTextWnd, EM_SETTARGETDEVICE, 0, 0);
-    if (win->page)
+    if (win->page && (rd = HeapAlloc(GetProcessHeap(), 0, sizeof(*rd))))
     {
-        struct RtfData  rd;
-        EDITSTREAM      es;
-        unsigned        cp = 0;
-        POINTL          ptl;
-        POINT           pt;
-
+        struct RtfStream    rs;
+        unsigned            cp = 0;
+        POINTL              ptl;
+        POINT               pt;
 
-        if (HLPFILE_BrowsePage(win->page, &rd, win->font_scale, relative))
+        if ((started = HLPFILE_BrowsePage(win->page, rd, win->font_scale, relative)))
         {
-            rd.where = rd.data;
-            es.dwCookie = (DWORD_PTR)&rd;
-            es.dwError = 0;
-            es.pfnCallback = WINHELP_RtfStreamIn;
+            while (!rd->done &&
+                   (whole || rd->ptr - rd->data < WINHELP_STREAM_CHUNK || !rd->found_rel))
+            {
+                if (!HLPFILE_BrowseMore(rd)) break;
+            }
+
+            rs.data[0] = rd->data;
+            rs.size[0] = rd->ptr - rd->data;
+            rs.data[1] = "}";
+            rs.size[1] = rd->done ? 0 : 1;
+            rs.size[2] = rs.size[3] = 0;
+            rd->where = rd->ptr;
 
-            SendMessageW(hTextWnd, EM_STREAMIN, SF_RTF, (LPARAM)&es);
-            cp = rd.char_pos_rel;
+            /* with more to come, the rich edit mustn't drop the last \par */
+            WINHELP_StreamPieces(hTextWnd, rd->done ? SF_RTF : SF_RTF | SFF_SELECTION, &rs);
+            cp = rd->char_pos_rel;
         }
-        /* FIXME: else leaking potentially the rd.first_link chain */
-        HeapFree(GetProcessHeap(), 0, rd.data);
         SendMessageW(hTextWnd, EM_POSFROMCHAR, (WPARAM)&ptl, cp ? cp - 1 : 0);
         pt.x = 0; pt.y = ptl.y;
         SendMessageW(hTextWnd, EM_SETSCROLLPOS, 0, (LPARAM)&pt);
     }
     SendMessageW(hTextWnd, WM_SETREDRAW, TRUE, 0);
     RedrawWindow(hTextWnd, NULL, NULL, RDW_FRAME|RDW_INVALIDATE);
+
+    if (!rd) return;
+    win->stream = rd;
+    if (!started || rd->done) WINHELP_EndStream(win);
+    else if (whole || !SetTimer(win->hMainWnd, WINHELP_STREAM_TIMER, 0, NULL))
+    {
+        while (WINHELP_StreamMore(win)) /* nothing */;
+        WINHELP_EndStream(win);
+    }
 }
 
 /***********************************************************************
@@ -470,6 +597,7 @@ static void WINHELP_DeleteButtons(WINHELP_WINDOW* win)
     {
         DestroyWindow(b->hWnd);
         bp = b->next;
+        MACRO_FreeCode(b->code);
         HeapFree(GetProcessHeap(), 0, b);
     }
     win->first_button = NULL;
@@ -491,22 +619,6 @@ void WINHELP_DeleteBackSet(WINHELP_WINDOW* win)
     win->back.index = 0;
 }
 
-/******************************************************************
- *             WINHELP_DeletePageLinks
- *
- */
-static void WINHELP_DeletePageLinks(HLPFILE_PAGE* page)
-{
-    HLPFILE_LINK*       curr;
-    HLPFILE_LINK*       next;
-
-    for (curr = page->first_link; curr; curr = next)
-    {
-        next = curr->next;
-        HeapFree(GetProcessHeap(), 0, curr);
-    }
-}
-
 /***********************************************************************
  *
  *           WINHELP_GrabWindow
@@ -564,12 +676,13 @@ static void WINHELP_DeleteWindow(WINHELP_WINDOW* win)
     if (win == Globals.active_popup)
         Globals.active_popup = NULL;
 
+    WINHELP_EndStream(win);
+
     hTextWnd = GetDlgItem(win->hMainWnd, CTL_ID_TEXT);
     SetWindowLongPtrA(hTextWnd, GWLP_WNDPROC, (LONG_PTR)win->origRicheditWndProc);
 
     WINHELP_DeleteButtons(win);
 
-    if (win->page) WINHELP_DeletePageLinks(win->page);
     if (win->hHistoryWnd) DestroyWindow(win->hHistoryWnd);
 
     DeleteObject(win->hBrush);
@@ -624,43 +737,30 @@ static void WINHELP_RememberPage(WINHELP_WINDOW* win, WINHELP_WNDPAGE* wpage)
     wpage->page->file->wRefCount++;
 }
 
-/***********************************************************************
- *
- *           WINHELP_FindLink
- */
-static HLPFILE_LINK* WINHELP_FindLink(WINHELP_WINDOW* win, LPARAM pos)
+/* Looks for the link at character cp, under the mouse at mouse_ptl, in a list of links */
+static HLPFILE_LINK* WINHELP_FindLinkIn(HWND hTextWnd, HLPFILE_LINK* link,
+                                        const POINTL* mouse_ptl, DWORD cp)
 {
-    HLPFILE_LINK*           link;
-    POINTL                  mouse_ptl, char_ptl, char_next_ptl;
-    DWORD                   cp;
-
-    if (!win->page) return NULL;
-
-    mouse_ptl.x = (short)LOWORD(pos);
-    mouse_ptl.y = (short)HIWORD(pos);
-    cp = SendMessageW(GetDlgItem(win->hMainWnd, CTL_ID_TEXT), EM_CHARFROMPOS,
-                      0, (LPARAM)&mouse_ptl);
+    POINTL                  char_ptl, char_next_ptl;
 
-    for (link = win->page->first_link; link; link = link->next)
+    for (; link; link = link->next)
     {
         if (link->cpMin <= cp && cp <= link->cpMax)
         {
             /* check whether we're at end of line */
-            SendMessageW(GetDlgItem(win->hMainWnd, CTL_ID_TEXT), EM_POSFROMCHAR,
-                         (LPARAM)&char_ptl, cp);
-            SendMessageW(GetDlgItem(win->hMainWnd, CTL_ID_TEXT), EM_POSFROMCHAR,
-                         (LPARAM)&char_next_ptl, cp + 1);
+            SendMessageW(hTextWnd, EM_POSFROMCHAR, (LPARAM)&char_ptl, cp);
+            SendMessageW(hTextWnd, EM_POSFROMCHAR, (LPARAM)&char_next_ptl, cp + 1);
             if (link->bHotSpot)
             {
                 HLPFILE_HOTSPOTLINK*    hslink = (HLPFILE_HOTSPOTLINK*)link;
-                if ((mouse_ptl.x < char_ptl.x + hslink->x) ||
-                    (mouse_ptl.x >= char_ptl.x + hslink->x + hslink->width) ||
-                    (mouse_ptl.y < char_ptl.y + hslink->y) ||
-                    (mouse_ptl.y >= char_ptl.y + hslink->y + hslink->height))
+                if ((mouse_ptl->x < char_ptl.x + hslink->x) ||
+                    (mouse_ptl->x >= char_ptl.x + hslink->x + hslink->width) ||
+                    (mouse_ptl->y < char_ptl.y + hslink->y) ||
+                    (mouse_ptl->y >= char_ptl.y + hslink->y + hslink->height))
                     continue;
                 break;
             }
-            if (char_next_ptl.y != char_ptl.y || mouse_ptl.x >= char_next_ptl.x)
+            if (char_next_ptl.y != char_ptl.y || mouse_ptl->x >= char_next_ptl.x)
                 link = NULL;
             break;
         }
@@ -668,6 +768,34 @@ static HLPFILE_LINK* WINHELP_FindLink(WINHELP_WINDOW* win, LPARAM pos)
     return link;
 }
 
+/***********************************************************************
+ *
+ *           WINHELP_FindLink
+ */
+static HLPFILE_LINK* WINHELP_FindLink(WINHELP_WINDOW* win, LPARAM pos)
+{
+    HWND                    hTextWnd = GetDlgItem(win->hMainWnd, CTL_ID_TEXT);
+    GETTEXTLENGTHEX         gtl = {GTL_NUMCHARS, 1200};
+    HLPFILE_LINK*           link;
+    POINTL                  mouse_ptl;
+    DWORD                   cp;
+
+    if (!win->page) return NULL;
+
+    mouse_ptl.x = (short)LOWORD(pos);
+    mouse_ptl.y = (short)HIWORD(pos);
+    cp = SendMessageW(hTextWnd, EM_CHARFROMPOS, 0, (LPARAM)&mouse_ptl);
+
+    link = WINHELP_FindLinkIn(hTextWnd, win->page->first_link, &mouse_ptl, cp);
+    /* the links of a page being streamed only move to the page once it's
+     * done, those of the paragraphs already shown are still in the stream
+     * (along with the ones of paragraphs generated ahead, past the text) */
+    if (!link && win->stream &&
+        cp < (DWORD)SendMessageW(hTextWnd, EM_GETTEXTLENGTHEX, (WPARAM)&gtl, 0))
+        link = WINHELP_FindLinkIn(hTextWnd, win->stream->first_link, &mouse_ptl, cp);
+    return link;
+}
+
 static LRESULT CALLBACK WINHELP_RicheditWndProc(HWND hWnd, UINT msg,
                                                 WPARAM wParam, LPARAM lParam)
 {
@@ -836,10 +964,10 @@ BOOL WINHELP_CreateHelpWindow(WINHELP_WNDPAGE* wpage, int nCmdShow, BOOL remembe
     {
         HLPFILE_MACRO  *macro;
         for (macro = wpage->page->file->first_macro; macro; macro = macro->next)
-            MACRO_ExecuteMacro(win, macro->lpszMacro);
+            MACRO_ExecuteCached(win, macro->lpszMacro, &macro->code);
 
         for (macro = wpage->page->first_macro; macro; macro = macro->next)
-            MACRO_ExecuteMacro(win, macro->lpszMacro);
+            MACRO_ExecuteCached(win, macro->lpszMacro, &macro->code);
     }
     /* See #17681, in some cases, the newly created window is closed by the macros it contains
      * (braindead), so deal with this case
@@ -934,7 +1062,12 @@ static BOOL WINHELP_HandleTextMouse(WINHELP_WINDOW* win, UINT msg, LPARAM lParam
                                            SW_NORMAL);
                 break;
             case hlp_link_macro:
-                MACRO_ExecuteMacro(win, link->string);
+                /* the links of a page being streamed go away if the macro
+                 * leaves the page, so don't run the code kept in the link */
+                if (win->stream)
+                    MACRO_ExecuteMacro(win, link->string);
+                else
+                    MACRO_ExecuteCached(win, link->string, &link->code);
                 break;
             default:
                 WINE_FIXME("Unknown link cookie %d\n", link->cookie);
@@ -1294,14 +1427,60 @@ static INT_PTR CALLBACK WINHELP_IndexDlgProc(HWND hWnd, UINT msg, WPARAM wParam,
  */
 static INT_PTR CALLBACK WINHELP_SearchDlgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
+    static struct index_data* id;
+    FTS_RESULT          results[100];
+    char                buf[256];
+    HLPFILE_PAGE*       page;
+    ULONG               relative;
+    unsigned            i, count;
+    LRESULT             sel;
+
     switch (msg)
     {
     case WM_INITDIALOG:
+        id = (struct index_data*)((PROPSHEETPAGEA*)lParam)->lParam;
         return TRUE;
+    case WM_COMMAND:
+        switch (LOWORD(wParam))
+        {
+        case IDC_SEARCHGO:
+            SendDlgItemMessageW(hWnd, IDC_SEARCHLIST, LB_RESETCONTENT, 0, 0);
+            if (!FTS_IsReady(id->hlpfile))
+            {
+                LoadStringA(Globals.hInstance, STID_FTS_BUILDING, buf, sizeof(buf));
+                sel = SendDlgItemMessageA(hWnd, IDC_SEARCHLIST, LB_ADDSTRING, 0, (LPARAM)buf);
+                SendDlgItemMessageW(hWnd, IDC_SEARCHLIST, LB_SETITEMDATA, sel, 0xFFFFFFFF);
+                break;
+            }
+            GetDlgItemTextA(hWnd, IDC_SEARCHTEXT, buf, sizeof(buf));
+            count = FTS_Query(id->hlpfile, buf, results, sizeof(results) / sizeof(results[0]));
+            for (i = 0; i < count; i++)
+            {
+                if (!(page = HLPFILE_PageByOffset(id->hlpfile, results[i].offset, &relative))) continue;
+                sel = SendDlgItemMessageA(hWnd, IDC_SEARCHLIST, LB_ADDSTRING, 0, (LPARAM)page->lpszTitle);
+                SendDlgItemMessageW(hWnd, IDC_SEARCHLIST, LB_SETITEMDATA, sel, results[i].offset);
+            }
+            break;
+        case IDC_SEARCHLIST:
+            if (HIWORD(wParam) == LBN_DBLCLK)
+                SendMessageW(GetParent(hWnd), PSM_PRESSBUTTON, PSBTN_OK, 0);
+            break;
+        }
+        break;
     case WM_NOTIFY:
 	switch (((NMHDR*)lParam)->code)
 	{
 	case PSN_APPLY:
+            sel = SendDlgItemMessageW(hWnd, IDC_SEARCHLIST, LB_GETCURSEL, 0, 0);
+            if (sel != LB_ERR)
+            {
+                sel = SendDlgItemMessageW(hWnd, IDC_SEARCHLIST, LB_GETITEMDATA, sel, 0);
+                if ((ULONG)sel != 0xFFFFFFFF)
+                {
+                    id->offset = (ULONG)sel;
+                    id->jump = TRUE;
+                }
+            }
             SetWindowLongPtrW(hWnd, DWLP_MSGRESULT, PSNRET_NOERROR);
             return TRUE;
         default:
@@ -1341,6 +1520,12 @@ static LRESULT CALLBACK WINHELP_MainWndProc(HWND hWnd, UINT msg, WPARAM wParam,
         WINHELP_LayoutMainWindow((WINHELP_WINDOW*) GetWindowLongPtrW(hWnd, 0));
         break;
 
+    case WM_TIMER:
+        win = (WINHELP_WINDOW*) GetWindowLongPtrW(hWnd, 0);
+        if (wParam == WINHELP_STREAM_TIMER && win->stream && !WINHELP_StreamMore(win))
+            WINHELP_EndStream(win);
+        break;
+
     case WM_COMMAND:
         win = (WINHELP_WINDOW*) GetWindowLongPtrW(hWnd, 0);
         switch (LOWORD(wParam))
@@ -1403,7 +1588,7 @@ static LRESULT CALLBACK WINHELP_MainWndProc(HWND hWnd, UINT msg, WPARAM wParam,
             for (button = win->first_button; button; button = button->next)
                 if (wParam == button->wParam) break;
             if (button)
-                MACRO_ExecuteMacro(win, button->lpszMacro);
+                MACRO_ExecuteCached(win, button->lpszMacro, &button->code);
             else if (!HIWORD(wParam))
                 MessageBoxW(0, MAKEINTRESOURCEW(STID_NOT_IMPLEMENTED),
                             MAKEINTRESOURCEW(STID_WHERROR), MB_OK);
@@ -37,6 +37,7 @@
 #include <stdarg.h>
 
 #include "hlpfile.h"
+#include "fts.h"
 #include "windef.h"
 #include "winbase.h"
 #include "macro.h"
@@ -49,6 +50,7 @@ typedef struct tagHelpButton
     LPCSTR              lpszID;
     LPCSTR              lpszName;
     LPCSTR              lpszMacro;
+    struct tagMacroCode*code;           /* compiled lpszMacro (NULL until run) */
 
     WPARAM              wParam;
 
@@ -94,6 +96,8 @@ typedef struct tagWinHelp
     WINHELP_PAGESET     back;
     unsigned            font_scale; /* 0 = small, 1 = normal, 2 = large */
 
+    struct RtfData*     stream;     /* rest of the page still to add to the text */
+
     struct tagWinHelp*  next;
 } WINHELP_WINDOW;
 
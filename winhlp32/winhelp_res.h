@@ -48,9 +48,13 @@
 #define STID_FILE_NOT_FOUND_s	0x12E
 #define STID_NO_RICHEDIT        0x12F
 #define STID_PSH_INDEX          0x130
+#define STID_FTS_BUILDING       0x131
 
 #define IDD_INDEX               0x150
 #define IDC_INDEXLIST           0x151
 #define IDD_SEARCH              0x152
+#define IDC_SEARCHTEXT          0x153
+#define IDC_SEARCHGO            0x154
+#define IDC_SEARCHLIST          0x155
 
 #define IDI_WINHELP             0xF00